@@ -0,0 +1,390 @@
+// Microbenchmarks for the hot paths, for `meson test --benchmark`.
+//
+// usage: bench NAME [seconds]    run one benchmark, each case for ~seconds
+//        bench list              name them all
+//
+// Every case prints one line of json on stdout, so runs can be appended to
+// a file and compared:
+//
+//   {"bench":"twrite","case":"styled","iters":57,"ns_per_iter":8771234.0,
+//    "mb_per_s":119.6}
+//
+// mb_per_s is only there for cases which move bytes.
+
+#include <locale.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "nast.c"
+#include "test_term.h"
+#include "writable.h"
+
+static double bench_secs = 0.5;
+
+static double now(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* call fn(arg) once to warm up, then until bench_secs have passed, and print
+   the result; bytes is how many bytes one call handles, or 0 */
+static void run(
+    const char *bench,
+    const char *name,
+    void (*fn)(void *arg),
+    void *arg,
+    size_t bytes
+){
+    fn(arg);
+    uint64_t iters = 0;
+    double t0 = now(), t1;
+    do {
+        fn(arg);
+        iters++;
+    } while((t1 = now()) - t0 < bench_secs);
+    double secs = t1 - t0;
+    printf(
+        "{\"bench\":\"%s\",\"case\":\"%s\",\"iters\":%llu,"
+        "\"ns_per_iter\":%.1f",
+        bench, name, (unsigned long long)iters, secs * 1e9 / iters
+    );
+    if(bytes) printf(",\"mb_per_s\":%.1f", bytes * iters / secs / 1e6);
+    printf("}\n");
+    fflush(stdout);
+}
+
+//// the corpora: the kinds of output a terminal spends its time on
+
+typedef struct {
+    char *buf;
+    size_t len;
+    size_t cap;
+} corpus_t;
+
+static void put(corpus_t *c, const char *fmt, ...){
+    va_list ap;
+    for(;;){
+        va_start(ap, fmt);
+        int n = vsnprintf(c->buf + c->len, c->cap - c->len, fmt, ap);
+        va_end(ap);
+        if(c->len + n < c->cap){
+            c->len += n;
+            return;
+        }
+        c->cap = c->cap ? c->cap * 2 : 65536;
+        c->buf = xrealloc(c->buf, c->cap);
+    }
+}
+
+// the same pseudo-random text every run
+static uint32_t rnd(uint32_t *s){
+    *s = *s * 1103515245 + 12345;
+    return *s >> 16;
+}
+
+static const char *words[] = {
+    "the", "terminal", "parses", "every", "byte", "of", "output", "and",
+    "most", "of", "it", "is", "plain", "text", "src/nast.c:1234:", "warning",
+    "error", "ok", "0x7ffd", "build", "[100%]", "linking", "done",
+};
+#define NWORDS (sizeof(words) / sizeof(*words))
+
+typedef enum { CORPUS_ASCII, CORPUS_STYLED, CORPUS_CJK, CORPUS_CURSOR } kind_e;
+
+static const char *corpus_names[] = { "ascii", "styled", "cjk", "cursor" };
+
+// about size bytes of one kind of output, in whole sequences
+static corpus_t corpus(kind_e kind, size_t size){
+    corpus_t c = {0};
+    uint32_t s = 1;
+    int row = 1;
+    while(c.len < size){
+        int n = 4 + rnd(&s) % 14;
+        switch(kind){
+            case CORPUS_ASCII:
+                // log lines, like make or a test runner
+                for(int i = 0; i < n; i++){
+                    put(&c, "%s ", words[rnd(&s) % NWORDS]);
+                }
+                put(&c, "\r\n");
+                break;
+
+            case CORPUS_STYLED:
+                // every word colored, like ls or a compiler
+                for(int i = 0; i < n; i++){
+                    put(&c, "\x1b[%d;38;5;%dm%s\x1b[0m ",
+                        rnd(&s) % 2, rnd(&s) % 256, words[rnd(&s) % NWORDS]
+                    );
+                }
+                put(&c, "\r\n");
+                break;
+
+            case CORPUS_CJK:
+                // double-width text
+                for(int i = 0; i < 3 * n; i++){
+                    Rune u = 0x4e00 + rnd(&s) % 0x5000;
+                    char buf[UTF_SIZ];
+                    size_t len = utf8encode(u, buf);
+                    put(&c, "%.*s", (int)len, buf);
+                }
+                put(&c, "\r\n");
+                break;
+
+            case CORPUS_CURSOR:
+                // a full-screen program redrawing rows in place, like top
+                put(&c, "\x1b[%d;1H\x1b[K", row);
+                for(int i = 0; i < n; i++){
+                    put(&c, "%s ", words[rnd(&s) % NWORDS]);
+                }
+                row = row % 40 + 1;
+                break;
+        }
+    }
+    return c;
+}
+
+//// twrite: parsing and printing into a headless Term
+
+typedef struct {
+    Term *t;
+    corpus_t c;
+} twrite_arg_t;
+
+static void twrite_fn(void *arg){
+    twrite_arg_t *a = arg;
+    twrite(a->t, a->c.buf, (int)a->c.len, 0);
+}
+
+static void bench_twrite(void){
+    for(kind_e k = CORPUS_ASCII; k <= CORPUS_CURSOR; k++){
+        twrite_arg_t a = { .t = term(120, 40), .c = corpus(k, 1 << 20) };
+        run("twrite", corpus_names[k], twrite_fn, &a, a.c.len);
+        tfree(a.t);
+        free(a.c.buf);
+    }
+}
+
+//// reflow: resizing a Term full of history
+
+typedef struct {
+    Term *t;
+    int cols;
+    bool narrow;
+} reflow_arg_t;
+
+static void reflow_fn(void *arg){
+    // one column either way is still a full reflow of every line
+    reflow_arg_t *a = arg;
+    a->narrow = !a->narrow;
+    tresize(a->t, a->cols - a->narrow, 40);
+}
+
+static void bench_reflow(void){
+    int widths[] = { 40, 80, 200 };
+    // (history is capped at RLINES_LIMIT rows)
+    size_t depths[] = { 100, 1000, RLINES_LIMIT - 1 };
+    corpus_t c = corpus(CORPUS_ASCII, 1 << 20);
+    for(size_t i = 0; i < sizeof(widths) / sizeof(*widths); i++){
+        for(size_t j = 0; j < sizeof(depths) / sizeof(*depths); j++){
+            reflow_arg_t a = { .t = term(widths[i], 40), .cols = widths[i] };
+            // fill the history with whole lines, up to the depth
+            size_t off = 0;
+            while(a.t->main.len < depths[j] && off < c.len){
+                const char *nl = memchr(c.buf + off, '\n', c.len - off);
+                size_t n = nl ? (size_t)(nl - (c.buf + off)) + 1 : c.len - off;
+                twrite(a.t, c.buf + off, (int)n, 0);
+                off += n;
+            }
+            char name[64];
+            snprintf(name, sizeof(name), "%dcols_%zurows",
+                widths[i], depths[j]
+            );
+            run("reflow", name, reflow_fn, &a, 0);
+            tfree(a.t);
+        }
+    }
+    free(c.buf);
+}
+
+//// scroll: tscrollup() and tscrolldown() inside scroll regions
+
+typedef struct {
+    Term *t;
+    int top;
+    int bot;
+    int n;
+    bool down;
+} scroll_arg_t;
+
+static void scroll_fn(void *arg){
+    scroll_arg_t *a = arg;
+    if(a->down) tscrolldown(a->t, a->top, a->bot, a->n, true);
+    else tscrollup(a->t, a->top, a->bot, a->n, true);
+}
+
+static void bench_scroll(void){
+    struct { const char *name; int top; int bot; int n; bool down; } cases[] = {
+        { "up_full_1", 0, 39, 1, false },
+        { "up_partial_1", 5, 34, 1, false },
+        { "down_partial_1", 5, 34, 1, true },
+        { "up_partial_10", 5, 34, 10, false },
+        { "down_partial_10", 5, 34, 10, true },
+    };
+    corpus_t c = corpus(CORPUS_STYLED, 1 << 16);
+    for(size_t i = 0; i < sizeof(cases) / sizeof(*cases); i++){
+        scroll_arg_t a = {
+            .t = term(120, 40),
+            .top = cases[i].top,
+            .bot = cases[i].bot,
+            .n = cases[i].n,
+            .down = cases[i].down,
+        };
+        // something on every row to move around
+        twrite(a.t, c.buf, (int)c.len, 0);
+        run("scroll", cases[i].name, scroll_fn, &a, 0);
+        tfree(a.t);
+    }
+    free(c.buf);
+}
+
+//// render: rasterizing one line with pango
+
+typedef struct {
+    RLine *rline;
+    rctx_t rctx;
+} render_arg_t;
+
+static void render_fn(void *arg){
+    render_arg_t *a = arg;
+    rline_unrender(a->rline);
+    rline_render(a->rline, a->rctx);
+}
+
+static void bench_render(void){
+    for(kind_e k = CORPUS_ASCII; k <= CORPUS_CJK; k++){
+        Term *t;
+        tnew(&t, 120, 2, "monospace", 12, " ", &hooks);
+        tsetsize(t, 120 * t->grid_w, 2 * t->grid_h);
+        // the first line of the corpus, cut to fit the row
+        corpus_t c = corpus(k, 4096);
+        const char *nl = memchr(c.buf, '\r', c.len);
+        twrite(t, c.buf, nl ? (int)(nl - c.buf) : (int)c.len, 0);
+        render_arg_t a = {
+            .rline = get_rline(t->scr, term2abs(t, 0)),
+            .rctx = trctx(t),
+        };
+        run("render", corpus_names[k], render_fn, &a, 0);
+        tfree(t);
+        free(c.buf);
+    }
+}
+
+//// writable: queueing bytes for the tty and draining them
+
+typedef struct {
+    struct writable w;
+    char *chunk;
+    size_t n; // bytes per add
+    size_t total; // bytes per cycle
+} writable_arg_t;
+
+static void writable_fn(void *arg){
+    writable_arg_t *a = arg;
+    for(size_t added = 0; added < a->total; added += a->n){
+        writable_add_bytes(&a->w, a->chunk, a->n);
+    }
+    const char *s;
+    size_t n;
+    while((s = writable_get_string(&a->w, &n)));
+}
+
+static void bench_writable(void){
+    struct { const char *name; size_t n; size_t total; } cases[] = {
+        // keystrokes, which stay in the ring
+        { "keys_16b", 16, 4096 },
+        // a paste, which fits the ring
+        { "paste_4k", 4096, 12288 },
+        // a big paste, which spills into the chunk chain
+        { "paste_64k", 65536, 1 << 20 },
+    };
+    for(size_t i = 0; i < sizeof(cases) / sizeof(*cases); i++){
+        writable_arg_t a = {
+            .chunk = xmalloc(cases[i].n),
+            .n = cases[i].n,
+            .total = cases[i].total,
+        };
+        memset(a.chunk, 'x', cases[i].n);
+        run("writable", cases[i].name, writable_fn, &a, cases[i].total);
+        writable_free(&a.w);
+        free(a.chunk);
+    }
+}
+
+//// export: turning a big selection into text
+
+static size_t exported;
+
+static void export_clipboard_hook(THooks *h, char *buf, size_t len, int clip){
+    (void)h; (void)clip;
+    exported = len;
+    free(buf);
+}
+
+static void export_fn(void *arg){
+    texportselection(arg, 1);
+}
+
+static void bench_export(void){
+    size_t lines[] = { 1000, RLINES_LIMIT - 1 };
+    corpus_t c = corpus(CORPUS_STYLED, 4 << 20);
+    THooks export_hooks = hooks;
+    export_hooks.set_clipboard = export_clipboard_hook;
+    for(size_t i = 0; i < sizeof(lines) / sizeof(*lines); i++){
+        Term *t;
+        tnew(&t, 120, 40, NULL, 0, " ", &export_hooks);
+        size_t off = 0;
+        while(t->main.len < lines[i] && off < c.len){
+            size_t n = MIN((size_t)4096, c.len - off);
+            off += twrite(t, c.buf + off, (int)n, 0);
+        }
+        // everything, from the top of the history to the cursor
+        tselect(t, 0, 0, t->col - 1, t->main.len - 1, 1);
+        texportselection(t, 1);
+        char name[64];
+        snprintf(name, sizeof(name), "%zulines", lines[i]);
+        run("export", name, export_fn, t, exported);
+        tfree(t);
+    }
+    free(c.buf);
+}
+
+static struct {
+    const char *name;
+    void (*fn)(void);
+} benches[] = {
+    { "twrite", bench_twrite },
+    { "reflow", bench_reflow },
+    { "scroll", bench_scroll },
+    { "render", bench_render },
+    { "writable", bench_writable },
+    { "export", bench_export },
+};
+#define NBENCHES (sizeof(benches) / sizeof(*benches))
+
+int main(int argc, char **argv){
+    setlocale(LC_CTYPE, "C.UTF-8");
+    if(argc > 1 && strcmp(argv[1], "list") == 0){
+        for(size_t i = 0; i < NBENCHES; i++) printf("%s\n", benches[i].name);
+        return 0;
+    }
+    if(argc > 2) bench_secs = strtod(argv[2], NULL);
+    for(size_t i = 0; argc > 1 && i < NBENCHES; i++){
+        if(strcmp(argv[1], benches[i].name)) continue;
+        benches[i].fn();
+        return 0;
+    }
+    fprintf(stderr, "usage: bench NAME [seconds]\n       bench list\n");
+    return 1;
+}
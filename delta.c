@@ -0,0 +1,652 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "nast.h"
+#include "delta.h"
+
+/* The wire format: a frame is a run of ops, each an opcode byte and its
+   arguments.  Integers are LEB128 varints (signed ones zigzagged first), so
+   the common small values are one byte. */
+enum {
+    OP_SIZE = 1,     // cols rows: a new, empty grid
+    OP_STYLES_RESET, // forget all interned styles
+    OP_STYLE,        // mode fg.rgb bg.rgb: define the next style index
+    OP_SCROLL,       // top bot n(signed) style rune: move rows top..bot up
+                     // by n, filling the rows scrolled in with that cell
+    OP_SPAN,         // y x n style rune*n: set cells
+    OP_RUN,          // n style rune*n: continue the last span or run
+    OP_CURSOR,       // visible x y style
+    OP_MODES,        // TMODE_* flags
+    OP_TITLE,        // len bytes*len
+    OP_BELL,
+};
+
+// interned styles; a reset (and redefinitions) when the table fills
+#define MAX_STYLES 4096
+#define STYLE_SLOTS (2 * MAX_STYLES)
+
+/* unchanged cells between two changed ones which are cheaper to resend than
+   to start a new span for */
+#define SPAN_GAP 4
+
+struct TDelta {
+    // what the decoder has
+    bool valid;
+    int cols;
+    int rows;
+    Glyph *shadow;
+    uint64_t *shadow_hash;
+    bool cursor_visible;
+    int cursor_x;
+    int cursor_y;
+    enum cursor_style cursor_style;
+    uint32_t modes;
+
+    // the Term's window, this frame
+    Glyph *cur;
+    uint64_t *cur_hash;
+    bool *uniform;
+
+    // style key+1 -> index+1, open addressing
+    uint64_t *style_keys;
+    uint32_t *style_idx;
+    size_t nstyles;
+
+    char *buf;
+    size_t len;
+    size_t cap;
+
+    TDeltaStats stats;
+};
+
+static bool glyph_eq(const Glyph *a, const Glyph *b){
+    return a->u == b->u
+        && a->mode == b->mode
+        && rgb24_eq(a->fg, b->fg)
+        && rgb24_eq(a->bg, b->bg);
+}
+
+static bool row_eq(const Glyph *a, const Glyph *b, int n){
+    for(int x = 0; x < n; x++){
+        if(!glyph_eq(&a[x], &b[x])) return false;
+    }
+    return true;
+}
+
+static uint64_t style_key(const Glyph *g){
+    return (uint64_t)g->mode << 48
+         | (uint64_t)g->fg.r << 40 | (uint64_t)g->fg.g << 32
+         | (uint64_t)g->fg.b << 24 | (uint64_t)g->bg.r << 16
+         | (uint64_t)g->bg.g << 8 | (uint64_t)g->bg.b;
+}
+
+// fnv-1a over the fields, so struct padding never matters
+static uint64_t row_hash(const Glyph *g, int n){
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for(int x = 0; x < n; x++){
+        h = (h ^ g[x].u) * 0x100000001b3ULL;
+        h = (h ^ style_key(&g[x])) * 0x100000001b3ULL;
+    }
+    return h;
+}
+
+static void emit(TDelta *d, const void *s, size_t n){
+    if(d->len + n > d->cap){
+        d->cap = d->cap ? d->cap : 4096;
+        while(d->len + n > d->cap) d->cap *= 2;
+        d->buf = xrealloc(d->buf, d->cap);
+    }
+    memcpy(d->buf + d->len, s, n);
+    d->len += n;
+}
+
+static void emit_byte(TDelta *d, unsigned char c){
+    emit(d, &c, 1);
+}
+
+static void emit_uint(TDelta *d, uint64_t v){
+    unsigned char tmp[10];
+    size_t n = 0;
+    do {
+        tmp[n] = v & 0x7f;
+        v >>= 7;
+        if(v) tmp[n] |= 0x80;
+        n++;
+    } while(v);
+    emit(d, tmp, n);
+}
+
+static void emit_int(TDelta *d, int64_t v){
+    emit_uint(d, ((uint64_t)v << 1) ^ (uint64_t)(v >> 63));
+}
+
+TDelta *tdelta_new(void){
+    TDelta *d = xmalloc(sizeof(*d));
+    *d = (TDelta){0};
+    d->style_keys = xmalloc(STYLE_SLOTS * sizeof(*d->style_keys));
+    d->style_idx = xmalloc(STYLE_SLOTS * sizeof(*d->style_idx));
+    return d;
+}
+
+void tdelta_free(TDelta *d){
+    if(!d) return;
+    free(d->shadow);
+    free(d->shadow_hash);
+    free(d->cur);
+    free(d->cur_hash);
+    free(d->uniform);
+    free(d->style_keys);
+    free(d->style_idx);
+    free(d->buf);
+    free(d);
+}
+
+void tdelta_reset(TDelta *d){
+    d->valid = false;
+}
+
+TDeltaStats tdelta_stats(TDelta *d){
+    return d->stats;
+}
+
+static void styles_reset(TDelta *d){
+    memset(d->style_keys, 0, STYLE_SLOTS * sizeof(*d->style_keys));
+    d->nstyles = 0;
+}
+
+// the index of g's style, defining it first if the decoder doesn't have it
+static uint32_t style_get(TDelta *d, const Glyph *g){
+    uint64_t key = style_key(g) + 1;
+    size_t slot = (key * 0x9e3779b97f4a7c15ULL) >> 51; // STYLE_SLOTS = 2^13
+    while(d->style_keys[slot]){
+        if(d->style_keys[slot] == key) return d->style_idx[slot];
+        slot = (slot + 1) % STYLE_SLOTS;
+    }
+    if(d->nstyles == MAX_STYLES){
+        emit_byte(d, OP_STYLES_RESET);
+        styles_reset(d);
+        return style_get(d, g);
+    }
+    d->style_keys[slot] = key;
+    d->style_idx[slot] = (uint32_t)d->nstyles;
+    emit_byte(d, OP_STYLE);
+    emit_uint(d, g->mode);
+    unsigned char rgb[6] = {
+        g->fg.r, g->fg.g, g->fg.b, g->bg.r, g->bg.g, g->bg.b
+    };
+    emit(d, rgb, sizeof(rgb));
+    d->stats.styles++;
+    return (uint32_t)d->nstyles++;
+}
+
+static void grids_alloc(TDelta *d, int cols, int rows){
+    size_t cells = (size_t)cols * (size_t)rows;
+    d->cols = cols;
+    d->rows = rows;
+    d->shadow = xrealloc(d->shadow, cells * sizeof(Glyph));
+    d->cur = xrealloc(d->cur, cells * sizeof(Glyph));
+    d->shadow_hash = xrealloc(d->shadow_hash, rows * sizeof(uint64_t));
+    d->cur_hash = xrealloc(d->cur_hash, rows * sizeof(uint64_t));
+    d->uniform = xrealloc(d->uniform, rows * sizeof(bool));
+    memset(d->shadow, 0, cells * sizeof(Glyph));
+    uint64_t blank = row_hash(d->shadow, cols);
+    for(int y = 0; y < rows; y++) d->shadow_hash[y] = blank;
+}
+
+// copy the Term's window into cur, padding short rows with empty cells
+static void snapshot(TDelta *d, Term *t){
+    for(int y = 0; y < d->rows; y++){
+        size_t n;
+        const Glyph *src = twindowline(t, y, &n);
+        Glyph *dst = &d->cur[(size_t)y * d->cols];
+        if(n > (size_t)d->cols) n = (size_t)d->cols;
+        memcpy(dst, src, n * sizeof(Glyph));
+        memset(dst + n, 0, (d->cols - n) * sizeof(Glyph));
+        d->cur_hash[y] = row_hash(dst, d->cols);
+        bool uniform = true;
+        for(int x = 1; x < d->cols && uniform; x++){
+            uniform = glyph_eq(&dst[x], &dst[0]);
+        }
+        d->uniform[y] = uniform;
+    }
+}
+
+static bool row_matches(TDelta *d, int cur_y, int shadow_y){
+    return d->cur_hash[cur_y] == d->shadow_hash[shadow_y]
+        && row_eq(
+            &d->cur[(size_t)cur_y * d->cols],
+            &d->shadow[(size_t)shadow_y * d->cols],
+            d->cols
+        );
+}
+
+/* move rows top..bot of the shadow up by n (down if negative), like the
+   decoder will; the vacated rows are filled with copies of fill */
+static void shadow_scroll(TDelta *d, int top, int bot, int n, Glyph fill){
+    size_t w = (size_t)d->cols;
+    int k = abs(n);
+    int keep = bot - top + 1 - k;
+    int dst = n > 0 ? top : top + k;
+    int src = n > 0 ? top + k : top;
+    int vacated = n > 0 ? bot - k + 1 : top;
+    memmove(&d->shadow[dst * w], &d->shadow[src * w], keep * w * sizeof(Glyph));
+    memmove(
+        &d->shadow_hash[dst], &d->shadow_hash[src], keep * sizeof(uint64_t)
+    );
+    for(size_t i = vacated * w; i < (vacated + k) * w; i++){
+        d->shadow[i] = fill;
+    }
+    uint64_t blank = row_hash(&d->shadow[vacated * w], d->cols);
+    for(int y = vacated; y < vacated + k; y++) d->shadow_hash[y] = blank;
+}
+
+// rows of top..bot which would match cur after shadow_scroll()
+static int matches_after(TDelta *d, int top, int bot, int n, Glyph fill){
+    size_t w = (size_t)d->cols;
+    int count = 0;
+    for(int y = top; y <= bot; y++){
+        int from = y + n;
+        if(from < top || from > bot){
+            if(d->uniform[y] && glyph_eq(&d->cur[y * w], &fill)) count++;
+        }else if(row_matches(d, y, from)){
+            count++;
+        }
+    }
+    return count;
+}
+
+/* Find rows which moved, as a scrolling program or a pager would, and scroll
+   the shadow to match.  For each changed row with some content, look for it
+   elsewhere in the shadow, and take the longest run which matches from
+   there, if scrolling that region wins at least a couple of rows. */
+static void find_scrolls(TDelta *d){
+    int nscrolls = 0;
+    for(int y = 0; y < d->rows && nscrolls < TDELTA_MAX_SCROLLS; y++){
+        if(d->uniform[y] || row_matches(d, y, y)) continue;
+        int best_s = -1, best_len = 0;
+        for(int s = 0; s < d->rows; s++){
+            if(s == y || !row_matches(d, y, s)) continue;
+            int len = 1;
+            while(y + len < d->rows && s + len < d->rows
+                    && row_matches(d, y + len, s + len)){
+                len++;
+            }
+            if(len > best_len){
+                best_s = s;
+                best_len = len;
+            }
+        }
+        if(best_s < 0) continue;
+        // the region runs from wherever the rows start to where they end up
+        int n = best_s - y;
+        int top = n > 0 ? y : best_s;
+        int bot = (n > 0 ? best_s : y) + best_len - 1;
+        /* fill the rows scrolled in with what ends the first of them, which
+           is nearly always the blank that they were cleared to */
+        int vacated = n > 0 ? bot - n + 1 : top;
+        Glyph fill = d->cur[(size_t)vacated * d->cols + d->cols - 1];
+        int before = 0;
+        for(int r = top; r <= bot; r++) before += row_matches(d, r, r);
+        if(matches_after(d, top, bot, n, fill) - before < 2) continue;
+
+        uint32_t style = style_get(d, &fill);
+        shadow_scroll(d, top, bot, n, fill);
+        emit_byte(d, OP_SCROLL);
+        emit_uint(d, (uint64_t)top);
+        emit_uint(d, (uint64_t)bot);
+        emit_int(d, n);
+        emit_uint(d, style);
+        emit_uint(d, fill.u);
+        d->stats.scrolls++;
+        nscrolls++;
+        y += best_len - 1;
+    }
+}
+
+// send cells [x0, x1) of row y, as spans of one style each
+static void send_cells(TDelta *d, int y, int x0, int x1){
+    const Glyph *row = &d->cur[(size_t)y * d->cols];
+    bool first = true;
+    int x = x0;
+    while(x < x1){
+        int end = x + 1;
+        uint64_t key = style_key(&row[x]);
+        while(end < x1 && style_key(&row[end]) == key) end++;
+        // a new style must be defined before the op which uses it
+        uint32_t style = style_get(d, &row[x]);
+        if(first){
+            emit_byte(d, OP_SPAN);
+            emit_uint(d, (uint64_t)y);
+            emit_uint(d, (uint64_t)x);
+        }else{
+            emit_byte(d, OP_RUN);
+        }
+        emit_uint(d, (uint64_t)(end - x));
+        emit_uint(d, style);
+        for(int i = x; i < end; i++) emit_uint(d, row[i].u);
+        first = false;
+        x = end;
+    }
+    d->stats.spans++;
+}
+
+static void send_rows(TDelta *d){
+    size_t w = (size_t)d->cols;
+    for(int y = 0; y < d->rows; y++){
+        if(row_matches(d, y, y)) continue;
+        const Glyph *cur = &d->cur[y * w];
+        const Glyph *old = &d->shadow[y * w];
+        int x = 0;
+        while(x < d->cols){
+            if(glyph_eq(&cur[x], &old[x])){
+                x++;
+                continue;
+            }
+            int start = x, end = x + 1;
+            // extend across short gaps of unchanged cells
+            for(int i = end; i < d->cols && i - end < SPAN_GAP; i++){
+                if(!glyph_eq(&cur[i], &old[i])) end = i + 1;
+            }
+            send_cells(d, y, start, end);
+            x = end;
+        }
+        memcpy(&d->shadow[y * w], cur, w * sizeof(Glyph));
+        d->shadow_hash[y] = d->cur_hash[y];
+    }
+}
+
+static const char *finish(TDelta *d, size_t *n){
+    *n = d->len;
+    if(!d->len) return NULL;
+    d->stats.frames++;
+    d->stats.bytes += d->len;
+    return d->buf;
+}
+
+const char *tdelta_encode(TDelta *d, Term *t, size_t *n){
+    d->len = 0;
+    int cols = tcols(t), rows = trows(t);
+    if(!d->valid || cols != d->cols || rows != d->rows){
+        if(!d->valid){
+            emit_byte(d, OP_STYLES_RESET);
+            styles_reset(d);
+            // force the cursor and modes out
+            d->cursor_x = -1;
+            d->modes = ~(uint32_t)0;
+        }
+        emit_byte(d, OP_SIZE);
+        emit_uint(d, (uint64_t)cols);
+        emit_uint(d, (uint64_t)rows);
+        grids_alloc(d, cols, rows);
+        d->valid = true;
+    }
+
+    snapshot(d, t);
+    find_scrolls(d);
+    send_rows(d);
+
+    int x = 0, y = 0;
+    bool visible = tcursorpos(t, &x, &y);
+    enum cursor_style style = tcursorshape(t);
+    if(visible != d->cursor_visible || x != d->cursor_x || y != d->cursor_y
+            || style != d->cursor_style){
+        emit_byte(d, OP_CURSOR);
+        emit_uint(d, visible);
+        emit_uint(d, (uint64_t)x);
+        emit_uint(d, (uint64_t)y);
+        emit_uint(d, style);
+        d->cursor_visible = visible;
+        d->cursor_x = x;
+        d->cursor_y = y;
+        d->cursor_style = style;
+    }
+
+    uint32_t modes = tmodes(t);
+    if(modes != d->modes){
+        emit_byte(d, OP_MODES);
+        emit_uint(d, modes);
+        d->modes = modes;
+    }
+
+    return finish(d, n);
+}
+
+const char *tdelta_title(TDelta *d, const char *title, size_t *n){
+    d->len = 0;
+    size_t len = title ? strlen(title) : 0;
+    emit_byte(d, OP_TITLE);
+    emit_uint(d, len);
+    if(len) emit(d, title, len);
+    return finish(d, n);
+}
+
+const char *tdelta_bell(TDelta *d, size_t *n){
+    d->len = 0;
+    emit_byte(d, OP_BELL);
+    return finish(d, n);
+}
+
+//// decoder
+
+TGrid *tgrid_new(void){
+    TGrid *g = xmalloc(sizeof(*g));
+    *g = (TGrid){0};
+    return g;
+}
+
+void tgrid_free(TGrid *g){
+    if(!g) return;
+    free(g->cells);
+    free(g->dirty);
+    free(g->title);
+    free(g->styles);
+    free(g);
+}
+
+typedef struct {
+    const unsigned char *p;
+    const unsigned char *end;
+    bool bad;
+} reader_t;
+
+static uint64_t read_uint(reader_t *r){
+    uint64_t v = 0;
+    for(int shift = 0; shift < 64; shift += 7){
+        if(r->p == r->end) break;
+        unsigned char c = *r->p++;
+        v |= (uint64_t)(c & 0x7f) << shift;
+        if(!(c & 0x80)) return v;
+    }
+    r->bad = true;
+    return 0;
+}
+
+static int64_t read_int(reader_t *r){
+    uint64_t v = read_uint(r);
+    return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+// a varint which must be below max
+static int read_index(reader_t *r, uint64_t max){
+    uint64_t v = read_uint(r);
+    if(v >= max){
+        r->bad = true;
+        return 0;
+    }
+    return (int)v;
+}
+
+static void grid_scroll(TGrid *g, int top, int bot, int n, Glyph fill){
+    size_t w = (size_t)g->cols;
+    int k = abs(n);
+    int keep = bot - top + 1 - k;
+    int dst = n > 0 ? top : top + k;
+    int src = n > 0 ? top + k : top;
+    int vacated = n > 0 ? bot - k + 1 : top;
+    memmove(&g->cells[dst * w], &g->cells[src * w], keep * w * sizeof(Glyph));
+    memmove(&g->dirty[dst], &g->dirty[src], keep * sizeof(bool));
+    for(size_t i = vacated * w; i < (vacated + k) * w; i++) g->cells[i] = fill;
+    // the vacated rows are whatever the client blitted in; redraw them
+    memset(&g->dirty[vacated], 1, k * sizeof(bool));
+}
+
+// n cells from row y, column x, in the given style
+static void read_cells(TGrid *g, reader_t *r, int y, int *x){
+    int n = read_index(r, (uint64_t)(g->cols - *x) + 1);
+    int style = read_index(r, g->nstyles);
+    if(r->bad) return;
+    Glyph *cell = &g->cells[(size_t)y * g->cols + *x];
+    for(int i = 0; i < n; i++){
+        Glyph s = g->styles[style];
+        s.u = (Rune)read_index(r, 0x110000);
+        cell[i] = s;
+    }
+    *x += n;
+    g->dirty[y] = true;
+}
+
+int tgrid_apply(TGrid *g, const char *buf, size_t n){
+    reader_t r = {
+        (const unsigned char*)buf, (const unsigned char*)buf + n, false
+    };
+    g->resized = false;
+    g->nscrolls = 0;
+    g->title_changed = false;
+    g->bells = 0;
+    if(g->dirty) memset(g->dirty, 0, g->rows * sizeof(bool));
+
+    // where an OP_RUN continues; -1 if there was no span to continue
+    int span_y = -1, span_x = 0;
+
+    while(r.p < r.end && !r.bad){
+        int op = *r.p++;
+        // (styles may be defined between the runs of a span)
+        if(op != OP_RUN && op != OP_STYLE && op != OP_STYLES_RESET){
+            span_y = -1;
+        }
+        switch(op){
+            case OP_SIZE: {
+                // sanity, not policy: more than any screen could show
+                int cols = read_index(&r, TDELTA_MAX_DIM);
+                int rows = read_index(&r, TDELTA_MAX_DIM);
+                if(r.bad) break;
+                size_t cells = (size_t)cols * (size_t)rows;
+                g->cells = xrealloc(
+                    g->cells, (cells ? cells : 1) * sizeof(Glyph)
+                );
+                g->dirty = xrealloc(g->dirty, (rows ? rows : 1) * sizeof(bool));
+                memset(g->cells, 0, cells * sizeof(Glyph));
+                memset(g->dirty, 1, rows * sizeof(bool));
+                g->cols = cols;
+                g->rows = rows;
+                g->resized = true;
+                g->nscrolls = 0;
+                break;
+            }
+
+            case OP_STYLES_RESET:
+                g->nstyles = 0;
+                break;
+
+            case OP_STYLE: {
+                Glyph s = {0};
+                s.mode = (ushort)read_index(&r, 1 << 16);
+                if(r.end - r.p < 6){
+                    r.bad = true;
+                    break;
+                }
+                s.fg = (struct rgb24){r.p[0], r.p[1], r.p[2]};
+                s.bg = (struct rgb24){r.p[3], r.p[4], r.p[5]};
+                r.p += 6;
+                if(g->nstyles == MAX_STYLES){
+                    r.bad = true;
+                    break;
+                }
+                if(g->nstyles == g->cap_styles){
+                    g->cap_styles = g->cap_styles ? g->cap_styles * 2 : 64;
+                    g->styles = xrealloc(
+                        g->styles, g->cap_styles * sizeof(Glyph)
+                    );
+                }
+                g->styles[g->nstyles++] = s;
+                break;
+            }
+
+            case OP_SCROLL: {
+                int top = read_index(&r, (uint64_t)g->rows);
+                int bot = read_index(&r, (uint64_t)g->rows);
+                int64_t k = read_int(&r);
+                int style = read_index(&r, g->nstyles);
+                Glyph fill = g->nstyles ? g->styles[style] : (Glyph){0};
+                fill.u = (Rune)read_index(&r, 0x110000);
+                if(r.bad) break;
+                if(bot < top || k == 0 || llabs(k) > bot - top){
+                    r.bad = true;
+                    break;
+                }
+                grid_scroll(g, top, bot, (int)k, fill);
+                // (the record is dropped past the limit; redraw instead)
+                if(g->nscrolls < TDELTA_MAX_SCROLLS){
+                    g->scrolls[g->nscrolls++] =
+                        (TDeltaScroll){ top, bot, (int)k };
+                }else{
+                    memset(&g->dirty[top], 1, (bot - top + 1) * sizeof(bool));
+                }
+                break;
+            }
+
+            case OP_SPAN:
+                span_y = read_index(&r, (uint64_t)g->rows);
+                span_x = read_index(&r, (uint64_t)g->cols);
+                if(r.bad) break;
+                read_cells(g, &r, span_y, &span_x);
+                break;
+
+            case OP_RUN:
+                if(span_y < 0){
+                    r.bad = true;
+                    break;
+                }
+                read_cells(g, &r, span_y, &span_x);
+                break;
+
+            case OP_CURSOR:
+                g->cursor_visible = read_index(&r, 2);
+                g->cursor_x = read_index(&r, TDELTA_MAX_DIM);
+                g->cursor_y = read_index(&r, TDELTA_MAX_DIM);
+                g->cursor_style = (enum cursor_style)read_index(&r, 256);
+                if(g->cursor_x >= g->cols || g->cursor_y >= g->rows){
+                    // only a hidden cursor may be off the grid
+                    if(g->cursor_visible) r.bad = true;
+                }
+                break;
+
+            case OP_MODES:
+                g->modes = (uint32_t)read_uint(&r);
+                break;
+
+            case OP_TITLE: {
+                size_t len = read_index(&r, 1 << 20);
+                if(r.bad || (size_t)(r.end - r.p) < len){
+                    r.bad = true;
+                    break;
+                }
+                free(g->title);
+                g->title = xmalloc(len + 1);
+                memcpy(g->title, r.p, len);
+                g->title[len] = '\0';
+                r.p += len;
+                g->title_changed = true;
+                break;
+            }
+
+            case OP_BELL:
+                g->bells++;
+                break;
+
+            default:
+                r.bad = true;
+        }
+    }
+    return r.bad ? -1 : 0;
+}
@@ -0,0 +1,93 @@
+// Screen deltas: a compact binary stream of what changed on a Term's window,
+// for renderers in another process or on another machine.
+//
+// TDelta *d = tdelta_new();
+// size_t n;
+// const char *frame = tdelta_encode(d, term, &n);  // n == 0: no change
+// send(frame, n);
+//
+// TGrid *g = tgrid_new();
+// if(tgrid_apply(g, frame, n)) ...  // malformed; start over
+// // g->cells, g->cursor_*, etc are now what the Term showed
+//
+// The encoder keeps a copy of what the decoder has, so the damage since the
+// last frame is found by comparing against that, with nothing tracked in the
+// Term.  Rows which moved are sent as scrolls, which a client can blit;
+// changed cells go out as spans of runes, each span naming a style (the
+// attributes and colors) which was interned the first time it was used.
+// Cursor and mode changes ride along, and titles and bells are frames of
+// their own.
+//
+// Each frame stands alone only in its framing: they must be applied in order,
+// and the caller delimits them (like with a length header).  After a
+// tgrid_apply() failure, or to start a new decoder, tdelta_reset() makes the
+// next frame a full one.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// (after nast.h, or something which includes it, like loop.h)
+
+// scrolls per frame, at most
+#define TDELTA_MAX_SCROLLS 4
+// the biggest window a frame can describe, in either direction
+#define TDELTA_MAX_DIM (1 << 14)
+
+typedef struct TDelta TDelta;
+
+typedef struct {
+    uint64_t frames;
+    uint64_t bytes;
+    uint64_t scrolls;
+    uint64_t spans;
+    uint64_t styles; // style definitions sent
+} TDeltaStats;
+
+TDelta *tdelta_new(void);
+void tdelta_free(TDelta *d);
+// forget what the decoder has; the next frame resends everything
+void tdelta_reset(TDelta *d);
+/* the frame which brings the decoder up to date with the Term's window, or
+   NULL with *n == 0 if nothing changed; valid until the next call */
+const char *tdelta_encode(TDelta *d, Term *t, size_t *n);
+// frames for events which aren't part of the grid
+const char *tdelta_title(TDelta *d, const char *title, size_t *n);
+const char *tdelta_bell(TDelta *d, size_t *n);
+TDeltaStats tdelta_stats(TDelta *d);
+
+typedef struct {
+    int top;
+    int bot; // inclusive
+    int n; // rows moved up (or down, if negative)
+} TDeltaScroll;
+
+typedef struct {
+    int cols;
+    int rows;
+    Glyph *cells; // rows * cols, row-major; unset cells are all zeroes
+    bool cursor_visible;
+    int cursor_x;
+    int cursor_y;
+    enum cursor_style cursor_style;
+    uint32_t modes; // TMODE_* flags
+    char *title; // NULL until one is set
+
+    // what the last tgrid_apply() did, for redrawing just that
+    bool resized; // everything changed
+    TDeltaScroll scrolls[TDELTA_MAX_SCROLLS]; // applied first, in order
+    int nscrolls;
+    bool *dirty; // rows with new cells, after the scrolls
+    bool title_changed;
+    int bells;
+
+    // interned styles
+    Glyph *styles; // (only the mode, fg and bg are used)
+    size_t nstyles;
+    size_t cap_styles;
+} TGrid;
+
+TGrid *tgrid_new(void);
+void tgrid_free(TGrid *g);
+// returns 0, or -1 if the frame is malformed
+int tgrid_apply(TGrid *g, const char *buf, size_t n);
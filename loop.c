@@ -0,0 +1,734 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "loop.h"
+#include "uring.h"
+#include "writable.h"
+
+// how many epoll events to handle per loop_run()
+#define LOOP_EVENTS 256
+
+// io_uring sizing: reads land in URING_BUFS shared buffers of URING_BUF_SIZE
+#define URING_ENTRIES 4096
+#define URING_BUFS 1024
+#define URING_BUF_SIZE 16384
+// iovecs per io_uring write
+#define URING_IOV 64
+
+/* io_uring user_data is the lterm pointer with the operation in the low
+   bits (malloc alignment leaves them free) */
+#define UOP_READ 1
+#define UOP_WRITE 2
+#define UOP_CANCEL 3
+#define UOP_MASK 7
+
+// what each epoll event points at
+typedef enum {
+    SRC_PTY,
+    SRC_PIDFD,
+    SRC_SIGNAL,
+    SRC_WATCH,
+    SRC_URING,
+} src_type_e;
+
+typedef struct {
+    src_type_e type;
+    void *ptr;
+} src_t;
+
+struct lterm {
+    // hooks pointer, must be the first element
+    THooks hooks;
+    loop_t *loop;
+    Term *term;
+    pid_t pid;
+    int ptyfd;
+    int pidfd; // -1 when the loop uses its signalfd instead
+    src_t pty_src;
+    src_t pid_src;
+    struct writable writable;
+    bool want_out; // is EPOLLOUT registered?
+    bool hup; // the pty is no longer watched
+    bool dirty; // damage is due
+    bool reaped; // the child is gone, but io may still be in flight
+    int status;
+    bool dead; // finished, waiting to be freed
+
+    // io_uring only: operations in flight
+    int inflight;
+    bool reading;
+    bool writing;
+    struct iovec wiov[URING_IOV];
+    int nwiov;
+
+    const lterm_cbs_t *cbs;
+    void *data;
+    // every live lterm, for reaping with the signalfd
+    lterm_t *prev;
+    lterm_t *next;
+    // the dirty list, or the list of dead lterms
+    lterm_t *next_dirty;
+    lterm_t *next_dead;
+};
+
+struct lwatch {
+    loop_t *loop;
+    int fd;
+    src_t src;
+    lwatch_fn fn;
+    void *data;
+    bool dead;
+    lwatch_t *next_dead;
+};
+
+struct loop {
+    int epfd;
+    // only without pidfds
+    int sigfd;
+    src_t sig_src;
+    sigset_t oldmask;
+
+    lterm_t *terms;
+    size_t count;
+    lterm_t *dirty;
+    // freed at the end of loop_run(), since events may still point at them
+    lterm_t *dead_terms;
+    lwatch_t *dead_watches;
+
+    // with io_uring, ptys are read and written through the ring, and epoll
+    // only tells us when the ring has completions
+    bool use_uring;
+    uring_t uring;
+    src_t uring_src;
+
+    loop_stats_t stats;
+};
+
+static int pidfd_open(pid_t pid){
+#ifdef SYS_pidfd_open
+    return (int)syscall(SYS_pidfd_open, pid, 0);
+#else
+    (void)pid;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+static void ep_ctl(loop_t *loop, int op, int fd, uint32_t events, src_t *src){
+    struct epoll_event ev = { .events = events, .data.ptr = src };
+    loop->stats.syscalls++;
+    if(epoll_ctl(loop->epfd, op, fd, &ev) < 0){
+        die("epoll_ctl: %s\n", strerror(errno));
+    }
+}
+
+static loop_t *loop_new_ex(bool want_uring){
+    loop_t *loop = xmalloc(sizeof(*loop));
+    *loop = (loop_t){ .sigfd = -1 };
+
+    loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if(loop->epfd < 0) die("epoll_create1: %s\n", strerror(errno));
+
+    if(want_uring){
+        int ret = uring_init(
+            &loop->uring, URING_ENTRIES, URING_BUFS, URING_BUF_SIZE
+        );
+        // no io_uring (old kernel, seccomp, etc) means plain epoll
+        if(ret == 0){
+            loop->use_uring = true;
+            loop->uring_src = (src_t){ SRC_URING, loop };
+            ep_ctl(
+                loop, EPOLL_CTL_ADD, loop->uring.fd, EPOLLIN, &loop->uring_src
+            );
+        }
+    }
+
+    // can we have pidfds?  if not, fall back to a signalfd
+    int fd = pidfd_open(getpid());
+    if(fd >= 0){
+        close(fd);
+        return loop;
+    }
+
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    if(sigprocmask(SIG_BLOCK, &mask, &loop->oldmask) < 0){
+        die("sigprocmask: %s\n", strerror(errno));
+    }
+    loop->sigfd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if(loop->sigfd < 0) die("signalfd: %s\n", strerror(errno));
+    loop->sig_src = (src_t){ SRC_SIGNAL, loop };
+    ep_ctl(loop, EPOLL_CTL_ADD, loop->sigfd, EPOLLIN, &loop->sig_src);
+
+    return loop;
+}
+
+loop_t *loop_new(void){
+    return loop_new_ex(false);
+}
+
+loop_t *loop_new_uring(void){
+    return loop_new_ex(true);
+}
+
+bool loop_is_uring(loop_t *loop){
+    return loop->use_uring;
+}
+
+loop_stats_t loop_stats(loop_t *loop){
+    loop_stats_t stats = loop->stats;
+    stats.syscalls += loop->uring.enters;
+    return stats;
+}
+
+static void lterm_free(lterm_t *lt){
+    tfree(lt->term);
+    writable_free(&lt->writable);
+    free(lt);
+}
+
+static void free_dead(loop_t *loop){
+    while(loop->dead_terms){
+        lterm_t *lt = loop->dead_terms;
+        loop->dead_terms = lt->next_dead;
+        lterm_free(lt);
+    }
+    while(loop->dead_watches){
+        lwatch_t *w = loop->dead_watches;
+        loop->dead_watches = w->next_dead;
+        free(w);
+    }
+}
+
+void loop_free(loop_t *loop){
+    for(lterm_t *lt = loop->terms; lt; lt = lt->next){
+        close(lt->ptyfd);
+        if(lt->pidfd >= 0) close(lt->pidfd);
+        if(lt->reaped) continue;
+        kill(lt->pid, SIGHUP);
+        while(waitpid(lt->pid, NULL, 0) < 0 && errno == EINTR){}
+    }
+    // this cancels anything in flight, so the lterms can go
+    if(loop->use_uring) uring_exit(&loop->uring);
+    while(loop->terms){
+        lterm_t *lt = loop->terms;
+        loop->terms = lt->next;
+        lterm_free(lt);
+    }
+    free_dead(loop);
+    if(loop->sigfd >= 0){
+        close(loop->sigfd);
+        sigprocmask(SIG_SETMASK, &loop->oldmask, NULL);
+    }
+    close(loop->epfd);
+    free(loop);
+}
+
+size_t loop_count(loop_t *loop){
+    return loop->count;
+}
+
+//////// terminals
+
+static void set_want_out(lterm_t *lt, bool want){
+    if(lt->hup || lt->want_out == want) return;
+    lt->want_out = want;
+    uint32_t events = EPOLLIN | (want ? EPOLLOUT : 0);
+    ep_ctl(lt->loop, EPOLL_CTL_MOD, lt->ptyfd, events, &lt->pty_src);
+}
+
+static struct io_uring_sqe *get_sqe(loop_t *loop){
+    struct io_uring_sqe *sqe = uring_sqe(&loop->uring);
+    if(!sqe) die("io_uring submission queue is stuck\n");
+    return sqe;
+}
+
+static void uring_read(lterm_t *lt){
+    uring_t *u = &lt->loop->uring;
+    struct io_uring_sqe *sqe = get_sqe(lt->loop);
+    if(u->read_multishot){
+        // one sqe keeps reading into provided buffers until it fails
+        sqe->opcode = URING_OP_READ_MULTISHOT;
+    }else{
+        sqe->opcode = IORING_OP_READ;
+        sqe->len = (uint32_t)u->buf_size;
+    }
+    sqe->fd = lt->ptyfd;
+    sqe->off = (uint64_t)-1;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BGID;
+    sqe->user_data = (uintptr_t)lt | UOP_READ;
+    lt->reading = true;
+    lt->inflight++;
+}
+
+// at most one write in flight, covering everything queued at the time
+static void uring_write(lterm_t *lt){
+    if(lt->writing || !writable_nonempty(&lt->writable)) return;
+    lt->nwiov = writable_iov(&lt->writable, lt->wiov, URING_IOV);
+    struct io_uring_sqe *sqe = get_sqe(lt->loop);
+    sqe->opcode = IORING_OP_WRITEV;
+    sqe->fd = lt->ptyfd;
+    sqe->off = (uint64_t)-1;
+    sqe->addr = (uintptr_t)lt->wiov;
+    sqe->len = (uint32_t)lt->nwiov;
+    sqe->user_data = (uintptr_t)lt | UOP_WRITE;
+    lt->writing = true;
+    lt->inflight++;
+}
+
+static void uring_cancel(lterm_t *lt, int op){
+    struct io_uring_sqe *sqe = get_sqe(lt->loop);
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = (uintptr_t)lt | op;
+    sqe->user_data = (uintptr_t)lt | UOP_CANCEL;
+    lt->inflight++;
+}
+
+static void lterm_flush(lterm_t *lt){
+    if(lt->loop->use_uring){
+        // submitted at the end of this loop_run(), with everything else
+        uring_write(lt);
+        return;
+    }
+    lt->loop->stats.syscalls++;
+    ssize_t ret = writable_writev(&lt->writable, lt->ptyfd);
+    if(ret > 0) lt->loop->stats.bytes_written += (size_t)ret;
+    if(ret < 0 && errno != EAGAIN && errno != EINTR){
+        // the pty is going away; nobody will read this anyway
+        writable_free(&lt->writable);
+        lt->writable = (struct writable){0};
+    }
+    set_want_out(lt, writable_nonempty(&lt->writable));
+}
+
+void lterm_write(lterm_t *lt, const char *buf, size_t len){
+    if(lt->reaped) return;
+    if(t_isset_crlf(lt->term)){
+        writable_add_crlf(&lt->writable, buf, len);
+    }else{
+        writable_add_bytes(&lt->writable, buf, len);
+    }
+    lterm_flush(lt);
+}
+
+static void ttywrite_hook(THooks *hooks, const char *buf, size_t len){
+    lterm_write((lterm_t*)hooks, buf, len);
+}
+
+static void ttyresize_hook(THooks *hooks, int row, int col){
+    lterm_t *lt = (lterm_t*)hooks;
+    struct winsize w = { .ws_row = row, .ws_col = col };
+    if(ioctl(lt->ptyfd, TIOCSWINSZ, &w) < 0){
+        fprintf(stderr, "Couldn't set window size: %s\n", strerror(errno));
+    }
+}
+
+static void ttyhangup_hook(THooks *hooks){
+    lterm_hangup((lterm_t*)hooks);
+}
+
+static void bell_hook(THooks *hooks){
+    lterm_t *lt = (lterm_t*)hooks;
+    if(lt->cbs->bell) lt->cbs->bell(lt, lt->data);
+}
+
+static void sendbreak_hook(THooks *hooks){
+    lterm_t *lt = (lterm_t*)hooks;
+    if(tcsendbreak(lt->ptyfd, 0)){
+        perror("Error sending break");
+    }
+}
+
+static void set_title_hook(THooks *hooks, const char *title){
+    lterm_t *lt = (lterm_t*)hooks;
+    if(lt->cbs->set_title) lt->cbs->set_title(lt, title, lt->data);
+}
+
+static void set_clipboard_hook(
+    THooks *hooks, char *buf, size_t len, int clipboard
+){
+    // there is no clipboard without a display
+    (void)hooks;
+    (void)len;
+    (void)clipboard;
+    free(buf);
+}
+
+static void offer_clipboard_hook(THooks *hooks, int clipboard){
+    // nobody will ever ask, so don't make text for it either
+    tclipboarddrop(((lterm_t*)hooks)->term, clipboard);
+}
+
+lterm_t *loop_spawn(
+    loop_t *loop,
+    int col,
+    int row,
+    char **cmd,
+    const lterm_cbs_t *cbs,
+    void *data
+){
+    lterm_t *lt = xmalloc(sizeof(*lt));
+    *lt = (lterm_t){
+        .hooks = {
+            .ttywrite = ttywrite_hook,
+            .ttyresize = ttyresize_hook,
+            .ttyhangup = ttyhangup_hook,
+            .bell = bell_hook,
+            .sendbreak = sendbreak_hook,
+            .set_title = set_title_hook,
+            .set_clipboard = set_clipboard_hook,
+            .offer_clipboard = offer_clipboard_hook,
+        },
+        .loop = loop,
+        .pidfd = -1,
+        .cbs = cbs,
+        .data = data,
+    };
+    lt->pty_src = (src_t){ SRC_PTY, lt };
+    lt->pid_src = (src_t){ SRC_PIDFD, lt };
+
+    char *delims = " `-=~!@#$%^&*()_+[]\\{}|;':\",./<>?";
+    tnew(&lt->term, col, row, NULL, 0, delims, &lt->hooks);
+
+    lt->ptyfd = ttynew(lt->term, &lt->pid, cmd);
+    // later children must not inherit this pty
+    if(fcntl(lt->ptyfd, F_SETFD, FD_CLOEXEC) < 0
+            || fcntl(lt->ptyfd, F_SETFL, O_NONBLOCK) < 0){
+        die("fcntl: %s\n", strerror(errno));
+    }
+    ttyresize_hook(&lt->hooks, row, col);
+    if(loop->use_uring){
+        uring_read(lt);
+    }else{
+        ep_ctl(loop, EPOLL_CTL_ADD, lt->ptyfd, EPOLLIN, &lt->pty_src);
+    }
+
+    if(loop->sigfd < 0){
+        lt->pidfd = pidfd_open(lt->pid);
+        if(lt->pidfd < 0) die("pidfd_open: %s\n", strerror(errno));
+        fcntl(lt->pidfd, F_SETFD, FD_CLOEXEC);
+        ep_ctl(loop, EPOLL_CTL_ADD, lt->pidfd, EPOLLIN, &lt->pid_src);
+    }
+
+    lt->next = loop->terms;
+    if(loop->terms) loop->terms->prev = lt;
+    loop->terms = lt;
+    loop->count++;
+
+    return lt;
+}
+
+static void mark_dirty(lterm_t *lt){
+    if(lt->dirty) return;
+    lt->dirty = true;
+    lt->next_dirty = lt->loop->dirty;
+    lt->loop->dirty = lt;
+}
+
+Term *lterm_term(lterm_t *lt){
+    return lt->term;
+}
+
+void lterm_queued(lterm_t *lt, size_t *queued, size_t *max){
+    *queued = writable_len(&lt->writable);
+    *max = lt->writable.stats.max_len;
+}
+
+pid_t lterm_pid(lterm_t *lt){
+    return lt->pid;
+}
+
+void *lterm_data(lterm_t *lt){
+    return lt->data;
+}
+
+bool lterm_keyev(lterm_t *lt, key_ev_t ev){
+    if(lt->reaped) return false;
+    // (a key can scroll the window, too)
+    if(!tkeyev(lt->term, ev)) return false;
+    mark_dirty(lt);
+    return true;
+}
+
+void lterm_resize(lterm_t *lt, int col, int row){
+    if(lt->reaped) return;
+    tresize(lt->term, col, row);
+    ttyresize_hook(&lt->hooks, row, col);
+    mark_dirty(lt);
+}
+
+void lterm_hangup(lterm_t *lt){
+    if(lt->reaped) return;
+    kill(lt->pid, SIGHUP);
+}
+
+static void stop_pty(lterm_t *lt){
+    if(lt->hup) return;
+    if(!lt->loop->use_uring){
+        ep_ctl(lt->loop, EPOLL_CTL_DEL, lt->ptyfd, 0, NULL);
+    }
+    lt->hup = true;
+}
+
+static size_t lterm_read(lterm_t *lt){
+    lt->loop->stats.syscalls++;
+    size_t n = ttyread(lt->term);
+    lt->loop->stats.bytes_read += n;
+    return n;
+}
+
+// parse the last of the child's output, report, and clean up
+static void lterm_finish(lterm_t *lt){
+    loop_t *loop = lt->loop;
+
+    if(!lt->hup){
+        while(lterm_read(lt)) mark_dirty(lt);
+        stop_pty(lt);
+    }
+    if(lt->dirty && lt->cbs->damage) lt->cbs->damage(lt, lt->data);
+    lt->dirty = false;
+
+    if(lt->cbs->exited) lt->cbs->exited(lt, lt->status, lt->data);
+    lt->dead = true;
+
+    close(lt->ptyfd);
+    if(lt->pidfd >= 0) close(lt->pidfd);
+
+    if(lt->prev) lt->prev->next = lt->next;
+    else loop->terms = lt->next;
+    if(lt->next) lt->next->prev = lt->prev;
+    loop->count--;
+
+    lt->next_dead = loop->dead_terms;
+    loop->dead_terms = lt;
+}
+
+// the child is gone, but the lterm can't go until its io is finished
+static void lterm_reaped(lterm_t *lt, int status){
+    lt->reaped = true;
+    lt->status = status;
+    if(lt->pidfd >= 0){
+        // it would stay readable forever
+        ep_ctl(lt->loop, EPOLL_CTL_DEL, lt->pidfd, 0, NULL);
+    }
+    if(!lt->inflight){
+        lterm_finish(lt);
+        return;
+    }
+    // whatever is still unread is read synchronously by lterm_finish()
+    if(lt->reading) uring_cancel(lt, UOP_READ);
+    if(lt->writing) uring_cancel(lt, UOP_WRITE);
+}
+
+static void try_reap(lterm_t *lt){
+    if(lt->reaped) return;
+    int status;
+    pid_t ret = waitpid(lt->pid, &status, WNOHANG);
+    if(ret == lt->pid) lterm_reaped(lt, status);
+}
+
+static void handle_pty(lterm_t *lt, uint32_t events){
+    if(lt->dead) return;
+    if(events & EPOLLOUT) lterm_flush(lt);
+    if(events & EPOLLIN){
+        /* one read per event: with many busy terminals, each gets a turn
+           per loop_run(), and the level-triggered epoll brings us back */
+        if(lterm_read(lt)) mark_dirty(lt);
+    }else if(events & (EPOLLHUP | EPOLLERR)){
+        // drained and hung up; the child's exit will finish the job
+        stop_pty(lt);
+    }
+}
+
+static void handle_signal(loop_t *loop){
+    struct signalfd_siginfo si;
+    while(read(loop->sigfd, &si, sizeof(si)) == sizeof(si)){}
+    // SIGCHLDs coalesce, so check every child
+    lterm_t *next;
+    for(lterm_t *lt = loop->terms; lt; lt = next){
+        next = lt->next;
+        try_reap(lt);
+    }
+}
+
+static void handle_cqe(loop_t *loop, struct io_uring_cqe *cqe){
+    uring_t *u = &loop->uring;
+    lterm_t *lt = (lterm_t*)(uintptr_t)(cqe->user_data & ~(uint64_t)UOP_MASK);
+    int op = (int)(cqe->user_data & UOP_MASK);
+    int res = cqe->res;
+
+    switch(op){
+        case UOP_READ:
+            if(cqe->flags & IORING_CQE_F_BUFFER){
+                unsigned bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+                if(res > 0 && !lt->dead){
+                    // parse straight out of the ring's buffer
+                    ttyfeed(lt->term, uring_buf(u, bid), (size_t)res);
+                    loop->stats.bytes_read += (size_t)res;
+                    mark_dirty(lt);
+                }
+                uring_buf_return(u, bid);
+            }
+            // a multishot read keeps going
+            if(cqe->flags & IORING_CQE_F_MORE) return;
+            lt->reading = false;
+            lt->inflight--;
+            if(res > 0 || res == -ENOBUFS){
+                // a oneshot read finished, or we ran out of buffers
+                if(!lt->reaped) uring_read(lt);
+            }else if(res != -ECANCELED){
+                // EIO: the child side of the pty is closed
+                lt->hup = true;
+            }
+            break;
+
+        case UOP_WRITE:
+            lt->writing = false;
+            lt->inflight--;
+            if(res >= 0){
+                writable_wrote(&lt->writable, (size_t)res, lt->nwiov);
+                loop->stats.bytes_written += (size_t)res;
+            }else if(res != -EAGAIN && res != -EINTR){
+                // the pty is going away; nobody will read this anyway
+                writable_free(&lt->writable);
+                lt->writable = (struct writable){0};
+            }
+            if(!lt->reaped) uring_write(lt);
+            break;
+
+        case UOP_CANCEL:
+            lt->inflight--;
+            break;
+    }
+
+    if(lt->reaped && !lt->inflight && !lt->dead) lterm_finish(lt);
+}
+
+static int handle_uring(loop_t *loop){
+    int n = 0;
+    struct io_uring_cqe *cqe;
+    while((cqe = uring_peek(&loop->uring))){
+        // copy it out, since handling it may queue sqes and submit
+        struct io_uring_cqe c = *cqe;
+        uring_seen(&loop->uring);
+        handle_cqe(loop, &c);
+        n++;
+    }
+    return n;
+}
+
+//////// extra fds
+
+lwatch_t *loop_watch(
+    loop_t *loop, int fd, uint32_t events, lwatch_fn fn, void *data
+){
+    lwatch_t *w = xmalloc(sizeof(*w));
+    *w = (lwatch_t){ .loop = loop, .fd = fd, .fn = fn, .data = data };
+    w->src = (src_t){ SRC_WATCH, w };
+    ep_ctl(loop, EPOLL_CTL_ADD, fd, events, &w->src);
+    return w;
+}
+
+void lwatch_set(lwatch_t *w, uint32_t events){
+    ep_ctl(w->loop, EPOLL_CTL_MOD, w->fd, events, &w->src);
+}
+
+void lwatch_free(lwatch_t *w){
+    ep_ctl(w->loop, EPOLL_CTL_DEL, w->fd, 0, NULL);
+    w->dead = true;
+    w->next_dead = w->loop->dead_watches;
+    w->loop->dead_watches = w;
+}
+
+//////// the loop
+
+static int64_t now_ms(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+int loop_run(loop_t *loop, int timeout_ms){
+    // writes queued between loop_run()s
+    if(loop->use_uring && uring_submit(&loop->uring)){
+        die("io_uring_enter: %s\n", strerror(errno));
+    }
+
+    // completions posted while submitting need no wait
+    if(loop->use_uring && uring_peek(&loop->uring)) timeout_ms = 0;
+
+    struct epoll_event evs[LOOP_EVENTS];
+    int n;
+    int64_t deadline = timeout_ms > 0 ? now_ms() + timeout_ms : 0;
+    while(true){
+        loop->stats.syscalls++;
+        n = epoll_wait(loop->epfd, evs, LOOP_EVENTS, timeout_ms);
+        if(n >= 0) break;
+        if(errno != EINTR) return -1;
+        if(!loop->use_uring) return 0;
+        /* io_uring's task work interrupts epoll_wait() whenever it runs,
+           whether or not it posted anything, so only stop if it did */
+        if(uring_peek(&loop->uring)){
+            n = 0;
+            break;
+        }
+        if(timeout_ms > 0){
+            timeout_ms = (int)(deadline - now_ms());
+            if(timeout_ms < 0) timeout_ms = 0;
+        }
+    }
+
+    for(int i = 0; i < n; i++){
+        src_t *src = evs[i].data.ptr;
+        uint32_t events = evs[i].events;
+        switch(src->type){
+            case SRC_PTY: handle_pty(src->ptr, events); break;
+
+            case SRC_PIDFD: try_reap(src->ptr); break;
+
+            case SRC_SIGNAL: handle_signal(loop); break;
+
+            case SRC_WATCH: {
+                lwatch_t *w = src->ptr;
+                if(!w->dead) w->fn(w->fd, events, w->data);
+            } break;
+
+            case SRC_URING: break;
+        }
+    }
+
+    // the ring's fd only says there might be completions; just check
+    if(loop->use_uring) n += handle_uring(loop);
+
+    // new reads, writes and cancels all go out in one io_uring_enter()
+    if(loop->use_uring && uring_submit(&loop->uring)){
+        die("io_uring_enter: %s\n", strerror(errno));
+    }
+
+    // report damage once per batch, not once per read
+    while(loop->dirty){
+        lterm_t *lt = loop->dirty;
+        loop->dirty = lt->next_dirty;
+        if(!lt->dirty) continue;
+        lt->dirty = false;
+        if(lt->cbs->damage) lt->cbs->damage(lt, lt->data);
+    }
+
+    free_dead(loop);
+    return n;
+}
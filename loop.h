@@ -0,0 +1,95 @@
+// A headless event loop for libnast, with no GLib, for servers and tests.
+//
+// loop_t *loop = loop_new();
+// lterm_t *lt = loop_spawn(loop, 80, 24, NULL, &cbs, data);
+// while(loop_count(loop)) loop_run(loop, -1);
+// loop_free(loop);
+//
+// The loop owns each terminal's pty, child process and write queue.  Child
+// exits are noticed through a pidfd per child, or where the kernel is too
+// old for those, through a signalfd for SIGCHLD (which loop_new() blocks).
+// Other fds, like a listening socket, can be watched with loop_watch().
+//
+// loop_new_uring() moves the pty reads and writes onto io_uring: multishot
+// reads into a shared set of provided buffers, parsed in place, and writev()s
+// batched into one io_uring_enter() per loop_run().
+//
+// Nothing here is thread-safe; use one loop per thread.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "nast.h"
+
+typedef struct loop loop_t;
+typedef struct lterm lterm_t;
+typedef struct lwatch lwatch_t;
+
+typedef struct {
+    // output was parsed; called at most once per loop_run()
+    void (*damage)(lterm_t *lt, void *data);
+    // the child was reaped; lt is freed once this returns
+    void (*exited)(lterm_t *lt, int status, void *data);
+    // optional
+    void (*bell)(lterm_t *lt, void *data);
+    void (*set_title)(lterm_t *lt, const char *title, void *data);
+} lterm_cbs_t;
+
+loop_t *loop_new(void);
+/* the same, but with pty reads and writes done through io_uring, which
+   saves syscalls with many busy ptys; falls back to epoll if io_uring is
+   unavailable */
+loop_t *loop_new_uring(void);
+bool loop_is_uring(loop_t *loop);
+// hangs up on and reaps any remaining children, without calling callbacks
+void loop_free(loop_t *loop);
+
+// cmd == NULL runs the user's shell; cbs must outlive the lterm
+lterm_t *loop_spawn(
+    loop_t *loop,
+    int col,
+    int row,
+    char **cmd,
+    const lterm_cbs_t *cbs,
+    void *data
+);
+// how many terminals are still running
+size_t loop_count(loop_t *loop);
+
+typedef struct {
+    uint64_t syscalls; // in the io paths, including io_uring_enter()
+    uint64_t bytes_read;
+    uint64_t bytes_written;
+} loop_stats_t;
+
+loop_stats_t loop_stats(loop_t *loop);
+
+Term *lterm_term(lterm_t *lt);
+// bytes waiting to go to the pty, and the most there have been at once
+void lterm_queued(lterm_t *lt, size_t *queued, size_t *max);
+pid_t lterm_pid(lterm_t *lt);
+void *lterm_data(lterm_t *lt);
+/* queue bytes for the pty, and write what it will take right away (or with
+   io_uring, at the end of the current or next loop_run()) */
+void lterm_write(lterm_t *lt, const char *buf, size_t len);
+// send a key through tkeyev(); returns true if the Term changed
+bool lterm_keyev(lterm_t *lt, key_ev_t ev);
+// resize both the Term and the pty
+void lterm_resize(lterm_t *lt, int col, int row);
+// SIGHUP the child; the lterm lives on until the child is reaped
+void lterm_hangup(lterm_t *lt);
+
+// events are EPOLLIN, EPOLLOUT, etc
+typedef void (*lwatch_fn)(int fd, uint32_t events, void *data);
+lwatch_t *loop_watch(
+    loop_t *loop, int fd, uint32_t events, lwatch_fn fn, void *data
+);
+void lwatch_set(lwatch_t *w, uint32_t events);
+// safe to call from any callback; does not close the fd
+void lwatch_free(lwatch_t *w);
+
+/* wait up to timeout_ms (-1 means forever) and handle whatever is ready;
+   returns the number of events handled, or -1 with errno set */
+int loop_run(loop_t *loop, int timeout_ms);
@@ -3,22 +3,32 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <pthread.h>
 #include <pwd.h>
+#include <regex.h>
 #include <signal.h>
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/select.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <termios.h>
+#include <time.h>
 #include <unistd.h>
 #define __USE_XOPEN
 #include <wchar.h>
+#include <wctype.h>
+#ifdef __SSE2__
+#include <immintrin.h>
+#endif
 
 #include "nast.h"
+#include "pool.h"
 #include "strs.h"
 #include "keymap.h"
 
@@ -85,6 +95,24 @@ char *vtiden2 = "\033[>41;372;0c";
 // actually there is one less line than this...
 #define RLINES_LIMIT 10000
 
+// pages above and below the window which are kept (or pre-) rendered
+#define PRERENDER_PAGES 1
+
+// ttyread buffer size, which doubles whenever a read fills it
+#define TTYREAD_MIN 16384
+#define TTYREAD_MAX (1 << 20)
+
+// fewer dirty lines than this are rendered serially, on the calling thread
+#define RENDER_PARALLEL_MIN 8
+
+// render workers, created the first time a frame has many dirty lines
+typedef struct {
+    pool_t *pool;
+    bool failed;
+    // one pango context per worker, since each thread has its own fontmap
+    PangoContext **pctx;
+} rpool_t;
+
 enum term_mode {
     MODE_WRAP        = 1 << 0,
     MODE_INSERT      = 1 << 1,
@@ -102,6 +130,7 @@ enum term_mode {
     MODE_KBDLOCK     = 1 << 12,
     MODE_HIDE        = 1 << 13,
     MODE_8BIT        = 1 << 15,
+    // the blink phase: when set, blinking things are hidden
     MODE_BLINK       = 1 << 16,
     MODE_FBLINK      = 1 << 17,
     MODE_NUMLOCK     = 1 << 18,
@@ -147,16 +176,30 @@ typedef struct {
     char state;
 } TCursor;
 
+struct spill;
+
 typedef struct {
     RLine **rlines;
     // ring buffer semantics
     size_t cap;       // cap = item length of the physical buffer
     size_t start;     // the oldest line in memory
-    size_t len;       // number of lines in memory
+    size_t len;       // number of lines, counting those spilled to disk
+    /* lines which fell out of the ring into the spill file (see tspill());
+       they keep the lowest absolute indices */
+    struct spill *spill;
+    size_t spilled;
+    // lines which fell off the top of the ring, ever
+    uint64_t dropped;
     uint64_t line_id; // current line UID
     bool new_line_id_on_write; // should the next write set the line id?
     // how many unrendered lines are below the viewing window
     size_t window_off;
+    // fraction of a line beyond window_off, for pixel-granular scrolling
+    double window_frac;
+    /* absolute range of lines which may hold rendered surfaces: the window
+       plus PRERENDER_PAGES of lookahead in each direction */
+    size_t warm_lo;
+    size_t warm_hi;
 } Screen;
 
 typedef enum {
@@ -168,6 +211,65 @@ typedef enum {
     MOUSE_ALL    = MOUSE_BUTTON | MOUSE_MOTION | MOUSE_X10 | MOUSE_MANY,
 } mouse_mode_e;
 
+// a logical line's runes, gathered up for searching
+typedef struct {
+    size_t first; // absolute index of its first rline
+    size_t nlines;
+    Rune *u;
+    uint32_t *cell; // where each rune came from, counting from first's cell 0
+    size_t n;
+    size_t cap;
+    // the runes in utf8, for regexes, and where each one starts
+    char *s;
+    size_t *boff; // n + 1 entries
+    size_t scap;
+} sline_t;
+
+typedef struct {
+    bool active;
+    Screen *scr;
+    int flags;
+    char *pattern;
+    Rune *runes; // a literal pattern, folded with TSEARCH_ICASE
+    size_t nrunes;
+    regex_t re;
+    bool have_re;
+    // where the search started, until the lines move under it
+    bool have_origin;
+    size_t oy;
+    long ox;
+    bool found;
+    TMatch m; // absolute
+    sline_t line;
+    // a worker in tfindall() reads lines through its own reader
+    struct sreader *rd;
+} tsearch_t;
+
+/* CSI Escape sequence structs */
+/* ESC '[' [[ [<priv>] <arg> [;]] [<submode>] <mode> ] */
+/* note that <priv> can be '?' or '>' */
+// see https://invisible-island.net/xterm/ctlseqs/ctlseqs.html
+typedef struct {
+    char buf[ESC_BUF_SIZ]; /* raw string */
+    size_t len;            /* raw string length */
+    char priv;
+    int arg[ESC_ARG_SIZ];
+    int narg;              /* nb of args */
+    char submode;
+    char mode;
+} CSIEscape;
+
+/* STR Escape sequence structs */
+/* ESC type [[ [<priv>] <arg> [;]] <mode>] ESC '\' */
+typedef struct {
+    char type;             /* ESC type ... */
+    char *buf;             /* allocated raw string */
+    size_t siz;            /* allocation size */
+    size_t len;            /* raw string length */
+    char *args[STR_ARG_SIZ];
+    int narg;              /* nb of args */
+} STREscape;
+
 /* Internal representation of the screen */
 struct Term {
     int row;      /* nb row */
@@ -194,6 +296,11 @@ struct Term {
     size_t last_press_x;
     size_t last_press_y;
     int last_press_type; // 0=none, 1=click, 2=doubleclick, 3=tripleclick
+    /* the cell the selection was last dragged to, so motion within a cell
+       doesn't redo the selection; forgotten whenever the selection is */
+    size_t drag_x;
+    size_t drag_y;
+    bool drag_known;
     /* selection: modified dynamically while mouse is pressed, or modified by
        shift+click.  Reflects the snapped values, not the raw mouse values. */
     size_t sel_xb;
@@ -203,6 +310,11 @@ struct Term {
     // does the selection end with an EOL
     bool sel_eol;
     int sel_type; // 0=none, 1=click, 2=doubleclick, 3=tripleclick
+    // bumped whenever the selection changes or goes away
+    uint64_t sel_gen;
+    // selections offered to the primary (0) and clipboard (1), lazily
+    bool offered[2];
+    uint64_t offer_gen[2];
 
     // focus mode
     bool want_focus;
@@ -241,53 +353,55 @@ struct Term {
     int icharset; /* selected charset for sequence */
     int *tabs;
     enum cursor_style cursor_style;
+    // a one-glyph rline, holding the rendered block cursor
+    RLine *cursor_rline;
+    // did the last trender() draw anything that blinks?
+    bool blinking;
+
+    rpool_t rpool;
 
     // buffer for ttyread
     int cmdfd;
-    char ttyreadbuf[BUFSIZ];
-    size_t ttyreadbuflen;
+    /* bytes are read in at rhead and parsed in place from rtail; the only
+       bytes left between reads are an incomplete utf8 sequence */
+    char *rbuf;
+    size_t rcap;
+    size_t rtail;
+    size_t rhead;
+
+    TStats stats;
 
     // buffer for tcursor
     TCursor saved[2];
-};
 
-/* CSI Escape sequence structs */
-/* ESC '[' [[ [<priv>] <arg> [;]] [<submode>] <mode> ] */
-/* note that <priv> can be '?' or '>' */
-// see https://invisible-island.net/xterm/ctlseqs/ctlseqs.html
-typedef struct {
-    char buf[ESC_BUF_SIZ]; /* raw string */
-    size_t len;            /* raw string length */
-    char priv;
-    int arg[ESC_ARG_SIZ];
-    int narg;              /* nb of args */
-    char submode;
-    char mode;
-} CSIEscape;
+    // escape sequences being parsed
+    CSIEscape csiescseq;
+    STREscape strescseq;
+    // where MODE_PRINT output goes, or -1
+    int iofd;
 
-/* STR Escape sequence structs */
-/* ESC type [[ [<priv>] <arg> [;]] <mode>] ESC '\' */
-typedef struct {
-    char type;             /* ESC type ... */
-    char *buf;             /* allocated raw string */
-    size_t siz;            /* allocation size */
-    size_t len;            /* raw string length */
-    char *args[STR_ARG_SIZ];
-    int narg;              /* nb of args */
-} STREscape;
+    // the snapshot restored from, which packed lines still point into
+    char *snap;
+    size_t snap_len;
+
+    tsearch_t search;
+    /* bumped whenever absolute rows stop meaning what they did (a clear, a
+       reflow), which is what TMatches are checked against */
+    uint64_t epoch;
+};
 
-static void execsh(char **);
+static void execsh(char **, char **);
 // static void ttywriteraw(t, const char *, size_t);
 
-static void csidump(FILE *f);
+static void csidump(Term *t, FILE *f);
 static void csihandle(Term *t);
-static void csiparse(void);
-static void csireset(void);
+static void csiparse(Term *t);
+static void csireset(Term *t);
 static int eschandle(Term *t, uchar);
-static void strdump(void);
+static void strdump(Term *t);
 static void strhandle(Term *t);
-static void strparse(void);
-static void strreset(void);
+static void strparse(Term *t);
+static void strreset(Term *t);
 
 static void tprinter(Term *t, char *, size_t);
 static void tdumpsel(Term *t);
@@ -324,21 +438,42 @@ static struct rgb24 tdefcolor(Term *t, int *, int *, int, struct rgb24);
 static void tdeftran(Term *t, char);
 static void tstrsequence(Term *t, uchar);
 static void tscrollregion(Term *t, int top, int bot);
+static void rpool_free(rpool_t *rp);
+static pool_t *rpool_start(rpool_t *rp);
 
 static ssize_t xwrite(int, const char *, size_t);
 
-/* Globals */
-static CSIEscape csiescseq;
-static STREscape strescseq;
-static int iofd = 1;
-
-// get the physical index from an offset (a logical index)
+// get the physical index from an offset (a logical index) of an in-ring line
 static inline size_t rlines_idx(Screen *scr, size_t idx){
-    return (scr->start + idx) % (scr->cap + 1);
+    return (scr->start + idx - scr->spilled) % (scr->cap + 1);
+}
+
+static void rline_unpack(RLine *rline);
+static RLine *spill_line(struct spill *sp, size_t idx);
+static RLine *spill_peek(struct spill *sp, size_t idx);
+static void spill_unrender(struct spill *sp);
+static void spill_clear(struct spill *sp);
+static void spill_free(struct spill **spp);
+static void spill_resize(struct spill *sp, int col);
+static void scr_spill(Screen *scr, RLine *rline);
+static void scr_unspill(Term *t, Screen *scr);
+static void tsearch_free(tsearch_t *s);
+static void tsearch_lose(Term *t);
+static void tsearch_shift(Term *t, Screen *scr);
+static bool t_get_match_span(Term *t, size_t y_abs, int *first, int *last);
+static RLine *sreader_peek(struct sreader *rd, size_t y);
+static RLine *sreader_line(struct sreader *rd, size_t y);
+
+// a line as it's stored, which might still be packed
+static inline RLine *scr_line(Screen *scr, size_t idx){
+    if(idx < scr->spilled) return spill_line(scr->spill, idx);
+    return scr->rlines[rlines_idx(scr, idx)];
 }
 
 static inline RLine *get_rline(Screen *scr, size_t idx){
-    return scr->rlines[rlines_idx(scr, idx)];
+    RLine *rline = scr_line(scr, idx);
+    if(rline->packed) rline_unpack(rline);
+    return rline;
 }
 
 static inline void set_rline(Screen *scr, size_t idx, RLine *rline){
@@ -347,7 +482,7 @@ static inline void set_rline(Screen *scr, size_t idx, RLine *rline){
 
 // convert absolute index to a view index, or what is currently in window
 static inline size_t abs2window(Term *t, size_t idx){
-    return t->scr->len - t->row - t->scr->window_off + idx;
+    return idx - (t->scr->len - t->row - t->scr->window_off);
 }
 
 static inline size_t scrwin2abs(Term *t, Screen *scr, size_t idx){
@@ -600,10 +735,22 @@ die(const char *errstr, ...)
     exit(1);
 }
 
-void
-execsh(char **cmd)
-{
-    char *sh;
+extern char **environ;
+
+static char *env_entry(const char *name, const char *value){
+    size_t n = strlen(name), m = strlen(value);
+    char *s = xmalloc(n + m + 2);
+    memcpy(s, name, n);
+    s[n] = '=';
+    memcpy(s + n + 1, value, m + 1);
+    return s;
+}
+
+/* Work out what the child runs, and its environment, before fork(): other
+   threads (a parser thread, a render pool) may hold locks which getpwuid()
+   or setenv() would wait on forever in the child.  *sh is set when the
+   command is a shell of our choosing; free the result with free_env(). */
+static char **shell_env(char ***cmd, char **sh){
     const struct passwd *pw;
 
     errno = 0;
@@ -614,30 +761,54 @@ execsh(char **cmd)
             die("who are you?\n");
     }
 
-    char *cmdbuf[2] = {NULL, NULL};
-    if(cmd){
+    *sh = NULL;
+    if(*cmd){
         // noop
-    }else if((sh = getenv("SHELL"))){
-        cmdbuf[0] = sh;
-        cmd = cmdbuf;
+    }else if(getenv("SHELL")){
+        *sh = xstrdup(getenv("SHELL"));
     }else if(pw->pw_shell[0]){
-        cmdbuf[0] = pw->pw_shell;
-        cmd = cmdbuf;
+        *sh = xstrdup(pw->pw_shell);
     }else{
         // fallback to /bin/sh
-        cmdbuf[0] = "/bin/sh";
-        cmd = cmdbuf;
+        *sh = xstrdup("/bin/sh");
+    }
+
+    // (an explicit command leaves SHELL alone)
+    const char *drop[] = {
+        "COLUMNS", "LINES", "TERMCAP", "LOGNAME", "USER", "HOME", "TERM",
+        "SHELL",
+    };
+    size_t ndrop = LEN(drop) - !*sh;
+    size_t n = 0;
+    while(environ[n]) n++;
+    char **env = xmalloc((n + 6) * sizeof(*env));
+    size_t k = 0;
+    for(size_t i = 0; i < n; i++){
+        bool keep = true;
+        for(size_t j = 0; j < ndrop && keep; j++){
+            size_t l = strlen(drop[j]);
+            keep = strncmp(environ[i], drop[j], l) || environ[i][l] != '=';
+        }
+        if(keep) env[k++] = xstrdup(environ[i]);
     }
+    env[k++] = env_entry("LOGNAME", pw->pw_name);
+    env[k++] = env_entry("USER", pw->pw_name);
+    if(*sh) env[k++] = env_entry("SHELL", *sh);
+    env[k++] = env_entry("HOME", pw->pw_dir);
+    env[k++] = env_entry("TERM", termname);
+    env[k] = NULL;
+    return env;
+}
 
-    unsetenv("COLUMNS");
-    unsetenv("LINES");
-    unsetenv("TERMCAP");
-    setenv("LOGNAME", pw->pw_name, 1);
-    setenv("USER", pw->pw_name, 1);
-    setenv("SHELL", sh, 1);
-    setenv("HOME", pw->pw_dir, 1);
-    setenv("TERM", termname, 1);
+static void free_env(char **env){
+    for(size_t i = 0; env[i]; i++) free(env[i]);
+    free(env);
+}
 
+// (in the child, so only async-signal-safe calls)
+void
+execsh(char **cmd, char **env)
+{
     signal(SIGCHLD, SIG_DFL);
     signal(SIGHUP, SIG_DFL);
     signal(SIGINT, SIG_DFL);
@@ -645,7 +816,7 @@ execsh(char **cmd)
     signal(SIGTERM, SIG_DFL);
     signal(SIGALRM, SIG_DFL);
 
-    // execvp("/bin/sh", (char*[]){"/bin/sh", NULL});
+    environ = env;
     execvp(cmd[0], cmd);
     _exit(1);
 }
@@ -671,13 +842,22 @@ ttynew(Term *t, pid_t *pid, char **cmd)
         die("tcsetattr() failed: %s\n", strerror(errno));
     }
 
+    char *sh;
+    char **env = shell_env(&cmd, &sh);
+    char *shcmd[2] = { sh, NULL };
+    if(!cmd) cmd = shcmd;
+
     switch (*pid = fork()) {
     case -1:
         die("fork failed: %s\n", strerror(errno));
         break;
     case 0:
         (void)die;
-        close(iofd);
+        close(t->iofd);
+        // an event loop may have blocked signals (like SIGCHLD for signalfd)
+        sigset_t none;
+        sigemptyset(&none);
+        sigprocmask(SIG_SETMASK, &none, NULL);
         setsid(); /* create a new process group */
         dup2(s, 0);
         dup2(s, 1);
@@ -690,7 +870,7 @@ ttynew(Term *t, pid_t *pid, char **cmd)
         if (pledge("stdio getpw proc exec", NULL) == -1)
             die("pledge\n");
 #endif
-        execsh(cmd);
+        execsh(cmd, env);
         break;
     default:
 #ifdef __OpenBSD__
@@ -701,46 +881,186 @@ ttynew(Term *t, pid_t *pid, char **cmd)
         t->cmdfd = m;
         break;
     }
+    free_env(env);
+    free(sh);
     return t->cmdfd;
 }
 
 size_t
 ttyread(Term *t)
 {
-    /* append read bytes to unprocessed bytes */
-    ssize_t ret = read(
-        t->cmdfd,
-        t->ttyreadbuf+t->ttyreadbuflen,
-        LEN(t->ttyreadbuf)-t->ttyreadbuflen
-    );
-    if(ret < 0) die("couldn't read from tty: %s\n", strerror(errno));
-    t->ttyreadbuflen += ret;
+    /* when the space after an incomplete utf8 char gets too small for a good
+       read, wrap around by copying its (at most UTF_SIZ-1) bytes to the front */
+    if(t->rcap - t->rhead < t->rcap / 4){
+        size_t carry = t->rhead - t->rtail;
+        memcpy(t->rbuf, t->rbuf + t->rtail, carry);
+        t->rtail = 0;
+        t->rhead = carry;
+    }
+
+    size_t space = t->rcap - t->rhead;
+    ssize_t ret = read(t->cmdfd, t->rbuf + t->rhead, space);
+    if(ret < 0){
+        if(errno == EAGAIN || errno == EINTR) return 0;
+        // linux says EIO once the child side of the pty is all closed
+        if(errno == EIO) return 0;
+        die("couldn't read from tty: %s\n", strerror(errno));
+    }
+    t->stats.read_calls++;
+    t->stats.read_bytes += ret;
+    t->rhead += ret;
 
-    size_t written = twrite(t, t->ttyreadbuf, t->ttyreadbuflen, 0);
-    t->ttyreadbuflen -= written;
-    /* keep any uncomplete utf8 char for the next call */
-    if (t->ttyreadbuflen > 0)
-        memmove(t->ttyreadbuf, t->ttyreadbuf + written, t->ttyreadbuflen);
+    t->rtail += twrite(t, t->rbuf + t->rtail, t->rhead - t->rtail, 0);
+    // usually everything was consumed, so the next read starts at the front
+    if(t->rtail == t->rhead){
+        t->rtail = 0;
+        t->rhead = 0;
+    }
+
+    // a full read means the application is outpacing us, so read more at once
+    if((size_t)ret == space && t->rcap < TTYREAD_MAX){
+        t->rcap *= 2;
+        t->rbuf = xrealloc(t->rbuf, t->rcap);
+        t->stats.read_grows++;
+    }
 
     return ret;
 }
 
-// set the window offset, and unrender any lines that are no longer showing
-static void tsetwindowoff(Term *t, Screen *scr, size_t window_off){
-    if(scr->window_off == window_off) return;
+void ttyfeed(Term *t, const char *buf, size_t n){
+    t->stats.read_calls++;
+    t->stats.read_bytes += n;
+
+    size_t carry = t->rhead - t->rtail;
+    if(!carry){
+        // the usual case: parse straight out of the caller's buffer
+        size_t used = twrite(t, buf, n, 0);
+        buf += used;
+        n -= used;
+        if(!n) return;
+        // keep the incomplete utf8 sequence for next time
+        memcpy(t->rbuf, buf, n);
+        t->rtail = 0;
+        t->rhead = n;
+        return;
+    }
 
-    size_t oldmin = scrwin2abs(t, scr, 0);
-    size_t oldmax = scrwin2abs(t, scr, t->row);
+    // finish the carried sequence first, by parsing from our own buffer
+    if(carry + n > t->rcap){
+        t->rcap = carry + n;
+        t->rbuf = xrealloc(t->rbuf, t->rcap);
+    }
+    memmove(t->rbuf, t->rbuf + t->rtail, carry);
+    memcpy(t->rbuf + carry, buf, n);
+    t->rtail = twrite(t, t->rbuf, carry + n, 0);
+    t->rhead = carry + n;
+    if(t->rtail == t->rhead){
+        t->rtail = 0;
+        t->rhead = 0;
+    }
+}
 
-    scr->window_off = window_off;
+TStats tstats(Term *t){
+    TStats stats = t->stats;
+    stats.read_cap = t->rcap;
+    return stats;
+}
+
+static void stat_line(FILE *f, const char *name, uint64_t v){
+    if(v) fprintf(f, "%s %llu\n", name, (unsigned long long)v);
+}
+
+void tstatsprint(const TStats *stats, FILE *f){
+    stat_line(f, "read_bytes", stats->read_bytes);
+    stat_line(f, "read_calls", stats->read_calls);
+    if(stats->read_calls){
+        fprintf(f, "read_bytes_per_call %.1f\n",
+            (double)stats->read_bytes / stats->read_calls
+        );
+    }
+    stat_line(f, "read_grows", stats->read_grows);
+    stat_line(f, "read_cap", stats->read_cap);
+    stat_line(f, "parsed_bytes", stats->parsed_bytes);
+    stat_line(f, "printed", stats->printed);
+    stat_line(f, "controls", stats->controls);
+    char name[32];
+    for(int i = 0; i < 64; i++){
+        snprintf(name, sizeof(name), "csi_%c", 0x40 + i);
+        stat_line(f, name, stats->csi[i]);
+    }
+    for(int i = 0; i < TSTATS_OSC; i++){
+        snprintf(name, sizeof(name), "osc_%d", i);
+        stat_line(f, name, stats->osc[i]);
+    }
+    stat_line(f, "osc_other", stats->osc[TSTATS_OSC]);
+    stat_line(f, "dcs", stats->dcs);
+    stat_line(f, "lines_scrolled", stats->lines_scrolled);
+    stat_line(f, "rlines_new", stats->rlines_new);
+    stat_line(f, "rlines_dropped", stats->rlines_dropped);
+    stat_line(f, "reflows", stats->reflows);
+    stat_line(f, "reflow_us", stats->reflow_us);
+    stat_line(f, "lines_rendered", stats->draw.rendered);
+    stat_line(f, "surface_hits", stats->draw.hits);
+    stat_line(f, "surface_misses", stats->draw.misses);
+}
+
+// monotonic microseconds, for timing reflows
+static uint64_t now_us(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+// calculate the warm range for the current window
+static void twarmrange(Term *t, Screen *scr, size_t *lo, size_t *hi){
+    if(scr->len < t->row + scr->window_off){
+        // only possible mid-resize
+        *lo = 0;
+        *hi = scr->len;
+        return;
+    }
+    size_t wlo = scrwin2abs(t, scr, 0);
+    size_t whi = scrwin2abs(t, scr, t->row);
+    size_t ahead = (size_t)t->row * PRERENDER_PAGES;
+    *lo = wlo > ahead ? wlo - ahead : 0;
+    *hi = MIN(whi + ahead, scr->len);
+}
 
-    size_t newmin = scrwin2abs(t, scr, 0);
-    size_t newmax = scrwin2abs(t, scr, t->row);
+// update the warm range, and unrender any lines that fell out of it
+static void tsetwarm(Term *t, Screen *scr){
+    size_t lo, hi;
+    twarmrange(t, scr, &lo, &hi);
+    if(lo == scr->warm_lo && hi == scr->warm_hi) return;
 
-    for(size_t i = oldmin; i < oldmax; i++){
-        if(i >= newmin && i < newmax) continue;
-        rline_unrender(get_rline(scr, i));
+    for(size_t i = scr->warm_lo; i < scr->warm_hi && i < scr->len; i++){
+        if(i >= lo && i < hi) continue;
+        // (a spilled line which isn't in memory has nothing rendered)
+        RLine *rline = i < scr->spilled ? spill_peek(scr->spill, i)
+                                        : get_rline(scr, i);
+        if(rline) rline_unrender(rline);
     }
+
+    scr->warm_lo = lo;
+    scr->warm_hi = hi;
+}
+
+// set the window offset, and unrender any lines that are no longer needed
+static void tsetwindowoff(Term *t, Screen *scr, size_t window_off){
+    // whole-line moves snap away any partial line
+    scr->window_frac = 0;
+    if(scr->window_off == window_off) return;
+    scr->window_off = window_off;
+    tsetwarm(t, scr);
+}
+
+/* how many pixels the window is shifted down by, revealing part of the line
+   above it */
+static int tscrolldy(Term *t){
+    Screen *scr = t->scr;
+    if(!scr->window_frac) return 0;
+    // nothing above the window to reveal
+    if(scr->len < t->row + scr->window_off + 1) return 0;
+    return (int)(scr->window_frac * t->grid_h + 0.5);
 }
 
 // returns if line y is the end of a line group
@@ -763,37 +1083,109 @@ ttailspace(Term *t, size_t y)
     return 0;
 }
 
-void
-texportselection(Term *t, int clipboard)
-{
-    if(!t->sel_type) return;
-
-    // allocate a big enough buffer for all utf8 characters plus newlines
-    char *buf = xmalloc(UTF_SIZ * (t->col + 1) * (t->sel_ye - t->sel_yb + 1));
-    size_t len = 0;
-    // decode all runes into bytes
-    size_t y = t->sel_yb;
-    size_t x = t->sel_xb;
-    RLine *rline = get_rline(t->scr, t->sel_yb);
-    size_t line_id = rline->line_id;
-    for(; y <= t->sel_ye; y++){
-        rline = get_rline(t->scr, y);
+/* encode the selection's text into buf, picking up where c left off, until
+   buf is too full for another rune; returns the bytes written */
+static size_t tselencode(Term *t, TSelCursor *c, char *buf, size_t len){
+    size_t n = 0;
+    if(!c->started){
+        c->y = t->sel_yb;
+        c->x = t->sel_xb;
+        c->line_id = get_rline(t->scr, t->sel_yb)->line_id;
+        c->started = true;
+    }
+    for(; c->y <= t->sel_ye; c->y++){
+        RLine *rline = get_rline(t->scr, c->y);
         // detect line transitions
-        if(line_id != rline->line_id){
-            buf[len++] = '\n';
-            line_id = rline->line_id;
+        if(c->line_id != rline->line_id){
+            if(n == len) return n;
+            buf[n++] = '\n';
+            c->line_id = rline->line_id;
         }
         // copy each rune
-        size_t xlimit = ttailspace(t, y);
-        if(y == t->sel_ye && xlimit > t->sel_xe) xlimit = t->sel_xe + 1;
-        for(; x < xlimit; x++){
-            len += utf8encode(rline->glyphs[x].u, buf + len);
+        size_t xlimit = ttailspace(t, c->y);
+        if(c->y == t->sel_ye && xlimit > t->sel_xe) xlimit = t->sel_xe + 1;
+        for(; c->x < xlimit; c->x++){
+            if(len - n < UTF_SIZ) return n;
+            n += utf8encode(rline->glyphs[c->x].u, buf + n);
         }
-        x = 0;
+        c->x = 0;
     }
     // detect EOL selection
-    if(t->sel_eol) buf[len++] = '\n';
-    t->hooks->set_clipboard(t->hooks, buf, len, clipboard);
+    if(t->sel_eol && !c->ended){
+        if(n == len) return n;
+        buf[n++] = '\n';
+    }
+    c->ended = true;
+    return n;
+}
+
+// the whole selection's text, in a buffer as big as it needs
+static char *tseltext(Term *t, size_t *len){
+    TSelCursor c = {0};
+    size_t cap = 4096;
+    char *buf = xmalloc(cap);
+    *len = 0;
+    while(true){
+        if(cap - *len < cap / 2){
+            cap *= 2;
+            buf = xrealloc(buf, cap);
+        }
+        size_t n = tselencode(t, &c, buf + *len, cap - *len);
+        if(!n) return buf;
+        *len += n;
+    }
+}
+
+/* The selection is about to change or go away, and any offers of it with
+   it.  A copy to the clipboard was asked for, so it outlives the selection,
+   as text made now. */
+static void tselbreak(Term *t){
+    for(int i = 0; i < 2; i++){
+        if(!t->offered[i]) continue;
+        t->offered[i] = false;
+        if(i == 1 && t->sel_type && t->offer_gen[1] == t->sel_gen){
+            size_t len;
+            char *buf = tseltext(t, &len);
+            t->hooks->set_clipboard(t->hooks, buf, len, 1);
+        }else if(t->hooks->drop_clipboard){
+            t->hooks->drop_clipboard(t->hooks, i);
+        }
+    }
+}
+
+// (before anything under the selection changes)
+static void tselclear(Term *t){
+    tselbreak(t);
+    t->sel_type = 0;
+    t->sel_gen++;
+    t->drag_known = false;
+}
+
+void
+texportselection(Term *t, int clipboard)
+{
+    if(!t->sel_type) return;
+    if(!t->hooks->offer_clipboard){
+        size_t len;
+        char *buf = tseltext(t, &len);
+        t->hooks->set_clipboard(t->hooks, buf, len, clipboard);
+        return;
+    }
+    t->offered[clipboard] = true;
+    t->offer_gen[clipboard] = t->sel_gen;
+    t->hooks->offer_clipboard(t->hooks, clipboard);
+}
+
+ssize_t tclipboardread(
+    Term *t, int clipboard, TSelCursor *c, char *buf, size_t len
+){
+    if(!t->sel_type || !t->offered[clipboard]) return -1;
+    if(t->offer_gen[clipboard] != t->sel_gen) return -1;
+    return (ssize_t)tselencode(t, c, buf, len);
+}
+
+void tclipboarddrop(Term *t, int clipboard){
+    t->offered[clipboard] = false;
 }
 
 // returns true if the event should cause a rerender
@@ -1040,12 +1432,14 @@ tselect(Term *t, size_t xb, size_t yb, size_t xe, size_t ye, int type)
     }
     if(tgroupend(t, ye) && xe >= ttailspace(t, ye)) eol = true;
 
+    tselbreak(t);
     t->sel_xb = xb;
     t->sel_yb = yb;
     t->sel_xe = xe;
     t->sel_ye = ye;
     t->sel_eol = eol;
     t->sel_type = type;
+    t->sel_gen++;
 }
 
 // returns true if the event should cause a rerender
@@ -1058,9 +1452,11 @@ tmouseev(Term *t, mouse_ev_t ev)
         int tempx = (double)ev.x / t->grid_w;
         LIMIT(tempx, 0, t->col-1);
         x = tempx;
-        int tempy = (double)ev.y / t->grid_h;
-        LIMIT(tempy, 0, t->row-1);
-        y = window2abs(t, tempy);
+        // the partial line above the window is row -1
+        int dy = tscrolldy(t);
+        int tempy = (double)(ev.y - dy + t->grid_h) / t->grid_h - 1;
+        LIMIT(tempy, dy ? -1 : 0, t->row-1);
+        y = tempy < 0 ? window2abs(t, 0) - 1 : window2abs(t, tempy);
     }else{
         x = ev.x;
         y = ev.y;
@@ -1072,13 +1468,14 @@ tmouseev(Term *t, mouse_ev_t ev)
             t->pressed = true;
             t->last_press_x = x;
             t->last_press_y = y;
+            t->drag_known = false;
             int type = mouse_register_press(t->press_history, ev.ms);
             t->last_press_type = type;
             switch(type){
                 case 1:
                     // clear existing selection
                     if(t->sel_type){
-                        t->sel_type = 0;
+                        tselclear(t);
                         return true;
                     }
                     return true;
@@ -1108,7 +1505,12 @@ tmouseev(Term *t, mouse_ev_t ev)
     }
     if(ev.type == MOUSE_EV_MOTION){
         if(!t->pressed) return false;
+        // only a new cell can change the selection
+        if(t->drag_known && x == t->drag_x && y == t->drag_y) return false;
         tselect(t, t->last_press_x, t->last_press_y, x, y, t->last_press_type);
+        t->drag_x = x;
+        t->drag_y = y;
+        t->drag_known = true;
         return true;
     }
     if(ev.type == MOUSE_EV_SCROLL){
@@ -1124,14 +1526,49 @@ tfocusev(Term *t, bool focused)
 {
     if(t->focused == focused) return false;
     t->focused = focused;
-    // we'll always rerender the cursor
-    rline_unrender(get_rline(t->scr, t->c.y));
+    // the cursor is an overlay, so there is nothing to unrender
+    // (and an unfocused terminal doesn't blink)
+    if(!focused) t->mode &= ~MODE_BLINK;
     if(t->want_focus){
         t->hooks->ttywrite(t->hooks, focused ? "\x1b[I" : "\x1b[O", 3);
     }
     return true;
 }
 
+static bool
+tcursorblinks(Term *t)
+{
+    switch(t->cursor_style){
+        case CURSOR_BLOCK_BLINK:
+        case CURSOR_UNDRLN_BLINK:
+        case CURSOR_BAR_BLINK:
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool
+tblinking(Term *t)
+{
+    return t->blinking;
+}
+
+bool
+tblink(Term *t)
+{
+    t->mode ^= MODE_BLINK;
+    return t->blinking;
+}
+
+bool
+tblinkreset(Term *t)
+{
+    if(!IS_SET(t, MODE_BLINK)) return false;
+    t->mode &= ~MODE_BLINK;
+    return t->blinking;
+}
+
 bool
 t_isset_bracketpaste(Term *t)
 {
@@ -1207,12 +1644,14 @@ treset(Term *t)
     for (i = 0; i < 2; i++) {
         tmoveto(t, 0, 0, true);
         tcursor(t, CURSOR_SAVE);
+        scr_unspill(t, t->scr);
         tclearregion_abs(t, 0, 0, t->col-1, t->scr->len - 1);
+        tsearch_lose(t);
         tswapscreen(t);
     }
 }
 
-int getfont(
+static int measurefont(
     char *font_name,
     int font_size,
     PangoFontDescription **desc_out,
@@ -1303,6 +1742,60 @@ fail:
     return -1;
 }
 
+/* Measured fonts, shared by every Term in the process (and across threads;
+   tsetfont() runs on render.c's parser thread).  Entries are never freed;
+   there is one per font and size ever used. */
+typedef struct fontcache {
+    struct fontcache *next;
+    char *name;
+    int size;
+    PangoFontDescription *desc;
+    double grid_w;
+    double grid_h;
+} fontcache_t;
+
+static fontcache_t *fontcache;
+static pthread_mutex_t fontcache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// like measurefont(), but each font is only measured once; *desc_out is a copy
+static int getfont(
+    char *font_name,
+    int font_size,
+    PangoFontDescription **desc_out,
+    double *grid_w_out,
+    double *grid_h_out
+){
+    pthread_mutex_lock(&fontcache_lock);
+    fontcache_t *fc;
+    for(fc = fontcache; fc; fc = fc->next){
+        if(fc->size == font_size && strcmp(fc->name, font_name) == 0) break;
+    }
+    if(!fc){
+        PangoFontDescription *desc;
+        double grid_w, grid_h;
+        int ret = measurefont(font_name, font_size, &desc, &grid_w, &grid_h);
+        if(ret < 0){
+            pthread_mutex_unlock(&fontcache_lock);
+            return -1;
+        }
+        fc = xmalloc(sizeof(*fc));
+        *fc = (fontcache_t){
+            .next = fontcache,
+            .name = xstrdup(font_name),
+            .size = font_size,
+            .desc = desc,
+            .grid_w = grid_w,
+            .grid_h = grid_h,
+        };
+        fontcache = fc;
+    }
+    *desc_out = pango_font_description_copy(fc->desc);
+    *grid_w_out = fc->grid_w;
+    *grid_h_out = fc->grid_h;
+    pthread_mutex_unlock(&fontcache_lock);
+    return 0;
+}
+
 void
 tnew(
     Term **tout,
@@ -1327,10 +1820,18 @@ tnew(
         .delims = runedelims,
         .ndelims = ndelims,
         .hooks = hooks,
+        .rbuf = xmalloc(TTYREAD_MIN),
+        .rcap = TTYREAD_MIN,
+        .iofd = 1,
     };
 
-    int ret = getfont(font_name, font_size, &t->desc, &t->grid_w, &t->grid_h);
-    if(ret < 0) die("invalid font\n");
+    // a headless Term has no font, and must never be rendered
+    if(font_name){
+        int ret = getfont(
+            font_name, font_size, &t->desc, &t->grid_w, &t->grid_h
+        );
+        if(ret < 0) die("invalid font\n");
+    }
 
     // allocate history (primary screen, lots of scrollback)
     t->main.cap = RLINES_LIMIT - 1;
@@ -1372,76 +1873,1654 @@ tnew(
     *tout = t;
 }
 
-void tfree(Term *t){
-    for(size_t i = 0; i < t->main.len; i++){
-        RLine *rline = get_rline(&t->main, i);
-        rline_free(&rline);
+static void scr_free(Screen *scr){
+    // (not get_rline(), which would unpack lines just to free them)
+    for(size_t i = scr->spilled; i < scr->len; i++){
+        rline_free(&scr->rlines[rlines_idx(scr, i)]);
     }
-    free(t->main.rlines);
+    free(scr->rlines);
+    scr->rlines = NULL;
+    // the spill file goes with it
+    spill_free(&scr->spill);
+    scr->spilled = 0;
+}
 
-    for(size_t i = 0; i < t->alt.len; i++){
-        RLine *rline = get_rline(&t->alt, i);
-        rline_free(&rline);
-    }
-    free(t->alt.rlines);
+void tfree(Term *t){
+    scr_free(&t->main);
+    scr_free(&t->alt);
+    if(t->snap) munmap(t->snap, t->snap_len);
+    tsearch_free(&t->search);
+
+    rline_free(&t->cursor_rline);
 
+    rpool_free(&t->rpool);
+
+    free(t->rbuf);
+    free(t->strescseq.buf);
     free(t->tabs);
     free(t->delims);
-    pango_font_description_free(t->desc);
+    if(t->desc) pango_font_description_free(t->desc);
     free(t);
 }
 
-int trows(Term *t){
-    return t->row;
-}
+//// search
 
-int tsetfont(Term *t, char *font_name, int font_size){
-    PangoFontDescription *desc;
-    double grid_w, grid_h;
-    int ret = getfont(font_name, font_size, &desc, &grid_w, &grid_h);
-    if(ret < 0) return -1;
+/* A search gathers each logical line's runes into one array, without the
+   second cells of wide characters, and folded to lowercase for a literal
+   which ignores case.  A literal is found by scanning for its first rune, a
+   vector at a time where there are vector instructions, and comparing the
+   rest wherever it turns up; a regex runs over the line's utf8.  Matches
+   are kept in absolute rows, like the selection. */
 
-    /* always unrender, in case new font has same dimensions as the old, in
-       which case the auto-rerender logic in trender() wouldn't be triggered */
-    tunrender(t);
+size_t tscrollback(Term *t){
+    return t->scr->len;
+}
 
-    pango_font_description_free(t->desc);
-    t->desc = desc;
-    t->font_size = font_size;
-    t->grid_w = grid_w;
-    t->grid_h = grid_h;
-    return 0;
+// the first index at or after i where u[i] == c, or SIZE_MAX
+static size_t scan_rune(const Rune *u, size_t i, size_t n, Rune c){
+#ifdef __AVX2__
+    __m256i c8 = _mm256_set1_epi32((int)c);
+    for(; i + 8 <= n; i += 8){
+        __m256i v = _mm256_loadu_si256((const __m256i*)(u + i));
+        unsigned mask = _mm256_movemask_epi8(_mm256_cmpeq_epi32(v, c8));
+        if(mask) return i + __builtin_ctz(mask) / 4;
+    }
+#endif
+#ifdef __SSE2__
+    __m128i c4 = _mm_set1_epi32((int)c);
+    for(; i + 4 <= n; i += 4){
+        __m128i v = _mm_loadu_si128((const __m128i*)(u + i));
+        unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi32(v, c4));
+        if(mask) return i + __builtin_ctz(mask) / 4;
+    }
+#endif
+    for(; i < n; i++) if(u[i] == c) return i;
+    return SIZE_MAX;
 }
 
-void
-tswapscreen(Term *t)
-{
-    if(t->mode & MODE_ALTSCREEN){
-        // switch to main
-        t->scr = &t->main;
-    }else{
-        // switch to alt
-        t->scr = &t->alt;
+// the last index before i where u[i] == c, or SIZE_MAX
+static size_t scan_rune_back(const Rune *u, size_t i, Rune c){
+#ifdef __SSE2__
+    __m128i c4 = _mm_set1_epi32((int)c);
+    for(; i >= 4; i -= 4){
+        __m128i v = _mm_loadu_si128((const __m128i*)(u + i - 4));
+        unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi32(v, c4));
+        if(mask) return i - 4 + (31 - __builtin_clz(mask)) / 4;
     }
-    t->mode ^= MODE_ALTSCREEN;
-    // break selection
-    t->sel_type = 0;
+#endif
+    while(i--) if(u[i] == c) return i;
+    return SIZE_MAX;
 }
 
-void
-tnewline(Term *t, int first_col, bool break_line_id)
-{
-    t->c.state &= ~CURSOR_WRAPNEXT;
-    if(first_col) t->c.x = 0;
+/* a double-width rune's second cell is a dummy, or just left alone as it is
+   now; either way it isn't part of the text */
+static bool rune_wide(Rune u){
+    return u >= 0x1100 && wcwidth(u) == 2;
+}
 
-    uint64_t line_id;
-    if(break_line_id){
-        line_id = new_line_id(t->scr);
-    }else{
-        line_id = get_cursor_rline(t)->line_id;
+// a line for its line_id and size, which might still be packed
+static RLine *search_peek(tsearch_t *s, size_t y){
+    return s->rd ? sreader_peek(s->rd, y) : scr_line(s->scr, y);
+}
+
+// a line with its glyphs
+static RLine *search_line(tsearch_t *s, size_t y){
+    return s->rd ? sreader_line(s->rd, y) : get_rline(s->scr, y);
+}
+
+// the first rline of the logical line which y is a part of
+static size_t group_first(tsearch_t *s, size_t y){
+    uint64_t id = search_peek(s, y)->line_id;
+    if(!id) return y;
+    while(y > 0 && search_peek(s, y - 1)->line_id == id) y--;
+    return y;
+}
+
+static void sline_gather(tsearch_t *s, size_t first, int col){
+    sline_t *l = &s->line;
+    Screen *scr = s->scr;
+    bool fold = (s->flags & (TSEARCH_ICASE | TSEARCH_REGEX)) == TSEARCH_ICASE;
+    l->first = first;
+    l->n = 0;
+    uint64_t id = search_peek(s, first)->line_id;
+    size_t y = first;
+    size_t end = 0;
+    do {
+        RLine *rline = search_line(s, y);
+        if(l->n + rline->n_glyphs > l->cap){
+            l->cap = MAX(l->n + rline->n_glyphs, l->cap * 2);
+            l->u = xrealloc(l->u, l->cap * sizeof(*l->u));
+            l->cell = xrealloc(l->cell, l->cap * sizeof(*l->cell));
+        }
+        uint32_t base = (uint32_t)((y - first) * col);
+        for(size_t x = 0; x < rline->n_glyphs; x++){
+            Glyph g = rline->glyphs[x];
+            if(g.mode & ATTR_WDUMMY) continue;
+            l->u[l->n] = fold ? (Rune)towlower(g.u) : g.u;
+            l->cell[l->n++] = base + x;
+            if(rune_wide(g.u)) x++;
+        }
+        // what's past the end of the line isn't part of it
+        end = base + rline->maxwritten;
+        y++;
+    } while(id && y < scr->len && search_peek(s, y)->line_id == id);
+    l->nlines = y - first;
+    while(l->n && l->cell[l->n - 1] >= end) l->n--;
+
+    if(!(s->flags & TSEARCH_REGEX)) return;
+    size_t need = l->n * UTF_SIZ + 1;
+    if(need > l->scap){
+        l->scap = need;
+        l->s = xrealloc(l->s, l->scap);
+    }
+    l->boff = xrealloc(l->boff, (l->n + 1) * sizeof(*l->boff));
+    size_t len = 0;
+    for(size_t i = 0; i < l->n; i++){
+        l->boff[i] = len;
+        len += utf8encode(l->u[i], l->s + len);
+    }
+    l->boff[l->n] = len;
+    l->s[len] = '\0';
+}
+
+// the rune which byte off is in
+static size_t sline_rune_at(sline_t *l, size_t off){
+    size_t lo = 0, hi = l->n + 1;
+    while(hi - lo > 1){
+        size_t mid = lo + (hi - lo) / 2;
+        if(l->boff[mid] <= off) lo = mid;
+        else hi = mid;
+    }
+    return lo;
+}
+
+// the first regex match in l starting at or after rune i
+static bool sline_regexec(tsearch_t *s, size_t i, size_t *b, size_t *e){
+    sline_t *l = &s->line;
+    while(i <= l->n){
+        regmatch_t pm;
+        const char *p = l->s + l->boff[i];
+        if(regexec(&s->re, p, 1, &pm, i ? REG_NOTBOL : 0)) return false;
+        *b = sline_rune_at(l, l->boff[i] + pm.rm_so);
+        *e = sline_rune_at(l, l->boff[i] + pm.rm_eo);
+        if(l->boff[*e] < l->boff[i] + pm.rm_eo) (*e)++;
+        if(*e > *b) return true;
+        // an empty match highlights nothing; look past it
+        i = *b + 1;
     }
+    return false;
+}
 
-    /* if we are not in the scroll region, or if we not at the very bottom of
+/* the nearest match in the gathered line starting at or after rune i, or
+   with backward, before rune i; [b, e) are runes */
+static bool sline_find(
+    tsearch_t *s, size_t i, bool backward, size_t *b, size_t *e
+){
+    sline_t *l = &s->line;
+    if(s->flags & TSEARCH_REGEX){
+        if(!backward) return sline_regexec(s, i, b, e);
+        /* the last one which starts before i, of those a forward scan of the
+           line would find */
+        bool found = false;
+        size_t mb, me;
+        for(
+            size_t j = 0;
+            j < i && sline_regexec(s, j, &mb, &me);
+            j = MAX(me, mb + 1)
+        ){
+            if(mb >= i) break;
+            *b = mb;
+            *e = me;
+            found = true;
+        }
+        return found;
+    }
+
+    size_t m = s->nrunes;
+    if(!m || l->n < m) return false;
+    size_t size = m * sizeof(*s->runes);
+    if(!backward){
+        while(i + m <= l->n){
+            i = scan_rune(l->u, i, l->n - m + 1, s->runes[0]);
+            if(i == SIZE_MAX) return false;
+            if(!memcmp(l->u + i, s->runes, size)) break;
+            i++;
+        }
+        if(i + m > l->n) return false;
+    }else{
+        i = MIN(i, l->n - m + 1);
+        while(true){
+            i = scan_rune_back(l->u, i, s->runes[0]);
+            if(i == SIZE_MAX) return false;
+            if(!memcmp(l->u + i, s->runes, size)) break;
+        }
+    }
+    *b = i;
+    *e = i + m;
+    return true;
+}
+
+// the cells of runes [b, e) of the gathered line
+static TMatch sline_match(sline_t *l, int col, size_t b, size_t e){
+    uint32_t cb = l->cell[b], ce = l->cell[e - 1];
+    TMatch m = {
+        .yb = l->first + cb / col,
+        .xb = cb % col,
+        .ye = l->first + ce / col,
+        .xe = ce % col,
+    };
+    // take in the other half of a wide character
+    if(rune_wide(l->u[e - 1]) && m.xe + 1 < col) m.xe++;
+    return m;
+}
+
+/* the nearest match which starts after (y, x), or before it with backward;
+   x may be -1 or col */
+static bool tsearch_scan(
+    Term *t, tsearch_t *s, size_t y, long x, bool backward, TMatch *m
+){
+    Screen *scr = s->scr;
+    sline_t *l = &s->line;
+    if(y >= scr->len) return false;
+    size_t first = group_first(s, y);
+    // the cell relative to the line, which a match must start past
+    long c = (long)(y - first) * t->col + x;
+    while(true){
+        sline_gather(s, first, t->col);
+        // the first rune past c, or with backward, the first one not before c
+        size_t i = 0;
+        while(i < l->n && (long)l->cell[i] < c + !backward) i++;
+        size_t b, e;
+        if(sline_find(s, i, backward, &b, &e)){
+            *m = sline_match(l, t->col, b, e);
+            return true;
+        }
+        if(!backward){
+            first += l->nlines;
+            if(first >= scr->len) return false;
+            c = -1;
+        }else{
+            if(!first) return false;
+            first = group_first(s, first - 1);
+            c = LONG_MAX;
+        }
+    }
+}
+
+static void tsearch_free(tsearch_t *s){
+    free(s->pattern);
+    free(s->runes);
+    if(s->have_re) regfree(&s->re);
+    free(s->line.u);
+    free(s->line.cell);
+    free(s->line.s);
+    free(s->line.boff);
+    *s = (tsearch_t){0};
+}
+
+static int tsearch_compile(tsearch_t *s, const char *pattern, int flags){
+    free(s->pattern);
+    s->pattern = xstrdup((char*)pattern);
+    s->flags = flags;
+    if(s->have_re) regfree(&s->re);
+    s->have_re = false;
+    s->nrunes = 0;
+    if(flags & TSEARCH_REGEX){
+        int cflags = REG_EXTENDED | (flags & TSEARCH_ICASE ? REG_ICASE : 0);
+        if(regcomp(&s->re, pattern, cflags)) return -1;
+        s->have_re = true;
+        return 0;
+    }
+    size_t len = strlen(pattern);
+    s->runes = xrealloc(s->runes, (len + 1) * sizeof(*s->runes));
+    s->nrunes = utf8decodestr(pattern, len, s->runes, len + 1);
+    if(flags & TSEARCH_ICASE){
+        for(size_t i = 0; i < s->nrunes; i++){
+            s->runes[i] = (Rune)towlower(s->runes[i]);
+        }
+    }
+    return 0;
+}
+
+int tfind(Term *t, const char *pattern, int flags, size_t y, int x, TMatch *m){
+    tsearch_t s = { .scr = t->scr };
+    int ret = -1;
+    if(tsearch_compile(&s, pattern, flags) == 0){
+        ret = tsearch_scan(t, &s, y, x, flags & TSEARCH_BACKWARD, m);
+    }
+    tsearch_free(&s);
+    return ret;
+}
+
+// forget where the search was, after the lines it pointed at moved
+static void tsearch_lose(Term *t){
+    t->search.found = false;
+    t->search.have_origin = false;
+    t->epoch++;
+}
+
+// lines dropped off the top of the ring: absolute rows all go down by one
+static void tsearch_shift(Term *t, Screen *scr){
+    tsearch_t *s = &t->search;
+    if(!s->active || s->scr != scr) return;
+    if(s->oy) s->oy--;
+    else s->have_origin = false;
+    if(s->found && !s->m.yb) s->found = false;
+    if(s->found){
+        s->m.yb--;
+        s->m.ye--;
+    }
+}
+
+// scroll the window to show the match, if it isn't showing
+static void tsearch_show(Term *t){
+    tsearch_t *s = &t->search;
+    Screen *scr = s->scr;
+    size_t top = scrwin2abs(t, scr, 0);
+    if(s->m.yb >= top && s->m.ye < top + t->row && !scr->window_frac) return;
+    // put it in the middle
+    long want = (long)s->m.yb - t->row / 2;
+    LIMIT(want, 0, (long)(scr->len - t->row));
+    tsetwindowoff(t, scr, scr->len - t->row - (size_t)want);
+}
+
+static int tsearch_from(Term *t, size_t y, long x, bool backward){
+    tsearch_t *s = &t->search;
+    TMatch m;
+    if(!tsearch_scan(t, s, y, x, backward, &m)) return 0;
+    s->found = true;
+    s->m = m;
+    tsearch_show(t);
+    return 1;
+}
+
+int tsearch(Term *t, const char *pattern, int flags){
+    tsearch_t *s = &t->search;
+    bool backward = flags & TSEARCH_BACKWARD;
+    if(!s->active || s->scr != t->scr){
+        tsearch_free(s);
+        s->active = true;
+        s->scr = t->scr;
+    }
+    // a literal which only grew can't match anywhere before the last match
+    bool narrow = s->found
+        && s->have_origin
+        && flags == s->flags
+        && !(flags & TSEARCH_REGEX)
+        && strncmp(pattern, s->pattern, strlen(s->pattern)) == 0;
+    if(!s->have_origin || (s->flags ^ flags) & TSEARCH_BACKWARD){
+        // from just past the edge of the window, on the side it starts from
+        s->oy = scrwin2abs(t, s->scr, backward ? t->row - 1 : 0);
+        s->ox = backward ? t->col : -1;
+        s->have_origin = true;
+    }
+    s->found = false;
+    if(tsearch_compile(s, pattern, flags)) return -1;
+    if(!*pattern) return 0;
+    if(narrow){
+        // the last match itself might still be one
+        return tsearch_from(
+            t, s->m.yb, s->m.xb + (backward ? 1 : -1), backward
+        );
+    }
+    return tsearch_from(t, s->oy, s->ox, backward);
+}
+
+int tsearchnext(Term *t, bool reverse){
+    tsearch_t *s = &t->search;
+    if(!s->active || s->scr != t->scr || !s->pattern || !*s->pattern){
+        return 0;
+    }
+    if(s->flags & TSEARCH_REGEX && !s->have_re) return -1;
+    bool backward = !(s->flags & TSEARCH_BACKWARD) != !reverse;
+    if(!s->found){
+        if(!s->have_origin){
+            // start over from the window
+            char *pattern = xstrdup(s->pattern);
+            int ret = tsearch(t, pattern, s->flags);
+            free(pattern);
+            return ret;
+        }
+        return tsearch_from(t, s->oy, s->ox, backward);
+    }
+    /* start just past this match's first cell; if there's no next match,
+       this one stays */
+    TMatch m;
+    if(!tsearch_scan(t, s, s->m.yb, s->m.xb, backward, &m)) return 0;
+    s->m = m;
+    tsearch_show(t);
+    return 1;
+}
+
+bool tsearchmatch(Term *t, TMatch *m){
+    tsearch_t *s = &t->search;
+    if(!s->active || !s->found || s->scr != t->scr) return false;
+    *m = s->m;
+    return true;
+}
+
+void tsearchend(Term *t){
+    tsearch_free(&t->search);
+}
+
+bool tsearchgoto(Term *t, const TMatch *m){
+    tsearch_t *s = &t->search;
+    if(!s->active || s->scr != t->scr || m->ye >= s->scr->len) return false;
+    s->found = true;
+    s->m = *m;
+    tsearch_show(t);
+    return true;
+}
+
+// the columns of the current match on a given line, like t_get_sel_span()
+static bool t_get_match_span(Term *t, size_t y_abs, int *first, int *last){
+    TMatch m;
+    if(!tsearchmatch(t, &m) || y_abs < m.yb || y_abs > m.ye) return false;
+    *first = y_abs == m.yb ? m.xb : 0;
+    *last = y_abs == m.ye ? m.xe : t->col - 1;
+    return true;
+}
+
+//// snapshots
+
+/* The format, all integers as LEB128 varints (zigzagged where signed):
+
+     "nastsnap" version
+     the Term: size, modes, charsets, tabs, cursor and saved cursors
+     per screen (main, then alt):
+         cap len line_id new_line_id_on_write window_off
+         an index entry per line: n_glyphs maxwritten line_id-delta nbytes
+         each line's glyphs, nbytes apiece
+
+   A line's glyphs are runs, each a header (count << 3 | repeat << 2 | style)
+   and then count runes, or one rune for all count cells if repeat is set.
+   style is SNAP_STYLE_SAME (as the last run), SNAP_STYLE_BLANK (all zeroes,
+   as cleared lines have) or SNAP_STYLE_NEW (a mode and rgb fg and bg next).
+
+   The index comes first so that trestore() can lay out every line without
+   reading any glyphs; it is written by a first pass over the lines, which
+   only measures their encoding. */
+
+#define SNAP_MAGIC "nastsnap"
+#define SNAP_VERSION 1
+// sanity limits, for refusing corrupt snapshots
+#define SNAP_MAX_DIM (1 << 14)
+#define SNAP_MAX_LINES (1 << 28)
+// repeats at least this long are encoded as one rune
+#define SNAP_REPEAT_MIN 4
+
+enum {
+    SNAP_STYLE_SAME = 0,
+    SNAP_STYLE_BLANK = 1,
+    SNAP_STYLE_NEW = 2,
+};
+
+typedef struct {
+    int fd;
+    bool failed;
+    int err;
+    char *buf;
+    size_t len;
+    size_t cap;
+} snapw_t;
+
+static void snapw_flush(snapw_t *w){
+    if(!w->failed && w->fd >= 0 && w->len){
+        if(xwrite(w->fd, w->buf, w->len) < 0){
+            w->failed = true;
+            w->err = errno;
+        }
+    }
+    w->len = 0;
+}
+
+static void snapw_put(snapw_t *w, const void *p, size_t n){
+    if(w->len + n > w->cap){
+        // a file writer flushes; a scratch writer (fd < 0) grows
+        if(w->fd >= 0) snapw_flush(w);
+        if(w->len + n > w->cap){
+            while(w->len + n > w->cap) w->cap = w->cap ? w->cap * 2 : 4096;
+            w->buf = xrealloc(w->buf, w->cap);
+        }
+    }
+    memcpy(w->buf + w->len, p, n);
+    w->len += n;
+}
+
+static void snapw_uint(snapw_t *w, uint64_t v){
+    unsigned char tmp[10];
+    size_t n = 0;
+    do {
+        tmp[n] = v & 0x7f;
+        v >>= 7;
+        if(v) tmp[n] |= 0x80;
+        n++;
+    } while(v);
+    snapw_put(w, tmp, n);
+}
+
+static void snapw_int(snapw_t *w, int64_t v){
+    snapw_uint(w, ((uint64_t)v << 1) ^ (uint64_t)(v >> 63));
+}
+
+static bool snap_style_eq(Glyph a, Glyph b){
+    return a.mode == b.mode && rgb24_eq(a.fg, b.fg) && rgb24_eq(a.bg, b.bg);
+}
+
+static void snapw_glyph(snapw_t *w, Glyph g){
+    snapw_uint(w, g.mode);
+    unsigned char rgb[6] = {g.fg.r, g.fg.g, g.fg.b, g.bg.r, g.bg.g, g.bg.b};
+    snapw_put(w, rgb, sizeof(rgb));
+}
+
+static void snap_encode_line(snapw_t *w, const Glyph *g, size_t n){
+    Glyph prev = {0};
+    for(size_t i = 0, j; i < n; i = j){
+        // one style
+        for(j = i + 1; j < n && snap_style_eq(g[j], g[i]); j++);
+        int style = snap_style_eq(g[i], prev) ? SNAP_STYLE_SAME
+                  : snap_style_eq(g[i], (Glyph){0}) ? SNAP_STYLE_BLANK
+                  : SNAP_STYLE_NEW;
+        // literal runs, broken up by repeats
+        for(size_t k = i; k < j; ){
+            size_t lit = k, rep = k;
+            for(; lit < j; lit = rep){
+                for(rep = lit + 1; rep < j && g[rep].u == g[lit].u; rep++);
+                if(rep - lit >= SNAP_REPEAT_MIN) break;
+            }
+            size_t count = lit - k;
+            bool repeat = !count;
+            if(repeat) count = rep - lit;
+            snapw_uint(w, (uint64_t)count << 3 | repeat << 2 | style);
+            if(style == SNAP_STYLE_NEW) snapw_glyph(w, g[i]);
+            style = SNAP_STYLE_SAME;
+            if(repeat){
+                snapw_uint(w, g[k].u);
+            }else{
+                for(size_t x = k; x < lit; x++) snapw_uint(w, g[x].u);
+            }
+            k += count;
+        }
+        prev = g[i];
+    }
+}
+
+static void snapw_cursor(snapw_t *w, TCursor *c){
+    snapw_glyph(w, c->attr);
+    snapw_uint(w, c->attr.u);
+    snapw_uint(w, (uint64_t)c->x);
+    snapw_uint(w, (uint64_t)c->y);
+    snapw_uint(w, (uint64_t)c->state);
+}
+
+// a line's index entry, given the size of its glyphs
+static void snapw_index(
+    snapw_t *w, RLine *rline, size_t nbytes, uint64_t *line_id
+){
+    snapw_uint(w, rline->n_glyphs);
+    snapw_uint(w, rline->maxwritten);
+    snapw_int(w, (int64_t)(rline->line_id - *line_id));
+    snapw_uint(w, nbytes);
+    *line_id = rline->line_id;
+}
+
+// packed lines are written out as they were read in
+static void snapw_data(snapw_t *w, RLine *rline){
+    if(rline->packed){
+        snapw_put(w, rline->packed, rline->packed_len);
+    }else{
+        snap_encode_line(w, rline->glyphs, rline->n_glyphs);
+    }
+}
+
+static void snapw_screen(snapw_t *w, snapw_t *scratch, Screen *scr){
+    // spilled lines are restored into the ring, which grows to fit them
+    snapw_uint(w, MAX(scr->cap, scr->len));
+    snapw_uint(w, scr->len);
+    snapw_uint(w, scr->line_id);
+    snapw_uint(w, scr->new_line_id_on_write);
+    snapw_uint(w, scr->window_off);
+
+    // (the index is written first, so each line is encoded just to measure)
+    uint64_t line_id = 0;
+    for(size_t i = 0; i < scr->len; i++){
+        RLine *rline = scr_line(scr, i);
+        scratch->len = 0;
+        snapw_data(scratch, rline);
+        snapw_index(w, rline, scratch->len, &line_id);
+    }
+    for(size_t i = 0; i < scr->len && !w->failed; i++){
+        snapw_data(w, scr_line(scr, i));
+    }
+}
+
+int tsnapshot(Term *t, int fd){
+    snapw_t w = { .fd = fd, .buf = xmalloc(65536), .cap = 65536 };
+    snapw_t scratch = { .fd = -1 };
+
+    snapw_put(&w, SNAP_MAGIC, strlen(SNAP_MAGIC));
+    snapw_uint(&w, SNAP_VERSION);
+    snapw_uint(&w, (uint64_t)t->col);
+    snapw_uint(&w, (uint64_t)t->row);
+    snapw_uint(&w, (uint32_t)t->mode);
+    snapw_uint(&w, t->appkeypad);
+    snapw_uint(&w, t->appcursor);
+    snapw_uint(&w, (uint64_t)t->modify_other);
+    snapw_uint(&w, t->mouse);
+    snapw_uint(&w, t->want_focus);
+    snapw_uint(&w, t->cursor_style);
+    snapw_uint(&w, (uint64_t)t->top);
+    snapw_uint(&w, (uint64_t)t->bot);
+    snapw_uint(&w, (uint64_t)t->charset);
+    snapw_uint(&w, (uint64_t)t->icharset);
+    for(int i = 0; i < 4; i++) snapw_uint(&w, (unsigned char)t->trantbl[i]);
+    for(int x = 0; x < t->col; x++) snapw_uint(&w, t->tabs[x] != 0);
+    snapw_uint(&w, t->scr == &t->alt);
+    snapw_cursor(&w, &t->c);
+    snapw_cursor(&w, &t->saved[0]);
+    snapw_cursor(&w, &t->saved[1]);
+    snapw_screen(&w, &scratch, &t->main);
+    snapw_screen(&w, &scratch, &t->alt);
+    snapw_flush(&w);
+
+    free(w.buf);
+    free(scratch.buf);
+    if(w.failed){
+        errno = w.err;
+        return -1;
+    }
+    return 0;
+}
+
+typedef struct {
+    const unsigned char *p;
+    const unsigned char *end;
+    bool bad;
+} snapr_t;
+
+static uint64_t snapr_uint(snapr_t *r){
+    uint64_t v = 0;
+    for(int shift = 0; shift < 64; shift += 7){
+        if(r->p == r->end) break;
+        unsigned char c = *r->p++;
+        v |= (uint64_t)(c & 0x7f) << shift;
+        if(!(c & 0x80)) return v;
+    }
+    r->bad = true;
+    return 0;
+}
+
+static int64_t snapr_int(snapr_t *r){
+    uint64_t v = snapr_uint(r);
+    return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+// a varint which must be at most max
+static uint64_t snapr_max(snapr_t *r, uint64_t max){
+    uint64_t v = snapr_uint(r);
+    if(v > max) r->bad = true;
+    return r->bad ? 0 : v;
+}
+
+static Glyph snapr_glyph(snapr_t *r){
+    Glyph g = { .mode = (ushort)snapr_max(r, USHRT_MAX) };
+    if(r->end - r->p < 6){
+        r->bad = true;
+        return g;
+    }
+    g.fg = (struct rgb24){r->p[0], r->p[1], r->p[2]};
+    g.bg = (struct rgb24){r->p[3], r->p[4], r->p[5]};
+    r->p += 6;
+    return g;
+}
+
+static TCursor snapr_cursor(snapr_t *r, int col, int row){
+    TCursor c = { .attr = snapr_glyph(r) };
+    c.attr.u = (Rune)snapr_max(r, 0x10FFFF);
+    c.x = (int)snapr_max(r, (uint64_t)col - 1);
+    c.y = (int)snapr_max(r, (uint64_t)row - 1);
+    c.state = (char)snapr_max(r, CURSOR_WRAPNEXT | CURSOR_ORIGIN);
+    return c;
+}
+
+// decode a packed line's n glyphs into g
+static void glyphs_unpack(const char *packed, size_t len, Glyph *g, size_t n){
+    snapr_t r = {
+        (const unsigned char*)packed,
+        (const unsigned char*)packed + len,
+        false,
+    };
+    size_t x = 0;
+    Glyph style = {0};
+    while(x < n && !r.bad){
+        uint64_t h = snapr_uint(&r);
+        uint64_t count = h >> 3;
+        switch(h & 3){
+            case SNAP_STYLE_SAME: break;
+            case SNAP_STYLE_BLANK: style = (Glyph){0}; break;
+            case SNAP_STYLE_NEW: style = snapr_glyph(&r); break;
+            default: r.bad = true;
+        }
+        if(r.bad || !count){
+            r.bad = true;
+            break;
+        }
+        if(h & 4){
+            style.u = (Rune)snapr_max(&r, 0x10FFFF);
+            for(uint64_t i = 0; i < count && x < n; i++) g[x++] = style;
+        }else{
+            for(uint64_t i = 0; i < count && x < n; i++){
+                style.u = (Rune)snapr_max(&r, 0x10FFFF);
+                g[x++] = style;
+            }
+        }
+    }
+    /* the index was checked at restore time, but not the glyphs; a corrupt
+       line comes out blank from where it went wrong (and one encoded wider
+       than it is now, as spilled lines can be, is cut off) */
+    for(; x < n; x++) g[x] = (Glyph){ .u = ' ' };
+}
+
+static void rline_unpack(RLine *rline){
+    Glyph *g = xmalloc(rline->n_glyphs * sizeof(*g));
+    glyphs_unpack(rline->packed, rline->packed_len, g, rline->n_glyphs);
+    rline->packed = NULL;
+    rline->glyphs = g;
+}
+
+// read a line's index entry; its glyphs are found later
+static void snapr_index(snapr_t *r, RLine *rline, uint64_t *line_id){
+    rline->n_glyphs = snapr_max(r, SNAP_MAX_DIM);
+    rline->maxwritten = snapr_max(r, rline->n_glyphs);
+    *line_id += (uint64_t)snapr_int(r);
+    rline->line_id = *line_id;
+    rline->packed_len = (uint32_t)snapr_max(r, UINT32_MAX);
+}
+
+static void rline_set_packed(RLine *rline, const char *p){
+    rline->packed = p;
+    // an empty line has no runs, but it still has to be unpacked
+    if(!rline->packed_len && rline->n_glyphs) rline->packed = "";
+    else if(!rline->n_glyphs) rline->packed = NULL;
+}
+
+// lay out a screen's lines from the index, without reading their glyphs
+static bool snapr_screen(snapr_t *r, Screen *scr, int col, int row){
+    *scr = (Screen){0};
+    scr->cap = snapr_max(r, SNAP_MAX_LINES);
+    scr->len = snapr_max(r, scr->cap);
+    scr->line_id = snapr_uint(r);
+    scr->new_line_id_on_write = snapr_max(r, 1);
+    if(r->bad || scr->len < (size_t)row) return false;
+    /* check the sizes against the file before allocating for them: every
+       line's index takes at least a byte, and a Term never keeps more than
+       RLINES_LIMIT lines of room beyond what it has */
+    if(scr->len > (size_t)(r->end - r->p)) return false;
+    if(scr->cap > scr->len + RLINES_LIMIT) return false;
+    scr->window_off = snapr_max(r, scr->len - row);
+    if(r->bad) return false;
+
+    size_t nbytes = (scr->cap + 1) * sizeof(*scr->rlines);
+    scr->rlines = xmalloc(nbytes);
+    memset(scr->rlines, 0, nbytes);
+    uint64_t line_id = 0;
+    // offsets relative to the glyphs, which start after the index
+    size_t *offs = xmalloc((scr->len ? scr->len : 1) * sizeof(*offs));
+    size_t off = 0;
+    for(size_t i = 0; i < scr->len && !r->bad; i++){
+        RLine *rline = xmalloc(sizeof(*rline));
+        *rline = (RLine){0};
+        scr->rlines[i] = rline;
+        snapr_index(r, rline, &line_id);
+        // every line in a screen is as wide as the Term
+        if(rline->n_glyphs != (size_t)col) r->bad = true;
+        offs[i] = off;
+        off += rline->packed_len;
+    }
+    if(!r->bad && (size_t)(r->end - r->p) < off) r->bad = true;
+    if(r->bad){
+        free(offs);
+        scr->len = 0;
+        for(size_t i = 0; i < scr->cap + 1; i++) rline_free(&scr->rlines[i]);
+        free(scr->rlines);
+        scr->rlines = NULL;
+        return false;
+    }
+    for(size_t i = 0; i < scr->len; i++){
+        rline_set_packed(scr->rlines[i], (const char*)r->p + offs[i]);
+    }
+    free(offs);
+    r->p += off;
+    return true;
+}
+
+int trestore(Term *t, const char *path){
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if(fd < 0) return -1;
+    struct stat st;
+    if(fstat(fd, &st) < 0){
+        int err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+    size_t len = (size_t)st.st_size;
+    char *map = len ? mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0) : NULL;
+    int err = errno;
+    close(fd);
+    if(map == MAP_FAILED){
+        errno = err;
+        return -1;
+    }
+
+    snapr_t r = {
+        (const unsigned char*)map, (const unsigned char*)map + len, false
+    };
+    size_t magic = strlen(SNAP_MAGIC);
+    if(len < magic || memcmp(map, SNAP_MAGIC, magic) != 0) goto bad;
+    r.p += magic;
+    if(snapr_uint(&r) != SNAP_VERSION) goto bad;
+
+    // read everything into locals; the Term is untouched until it all checks
+    int col = (int)snapr_max(&r, SNAP_MAX_DIM);
+    int row = (int)snapr_max(&r, SNAP_MAX_DIM);
+    if(r.bad || col < 1 || row < 1) goto bad;
+    int mode = (int)snapr_max(&r, INT_MAX);
+    bool appkeypad = snapr_max(&r, 1);
+    bool appcursor = snapr_max(&r, 1);
+    int modify_other = (int)snapr_max(&r, 2);
+    mouse_mode_e mouse = (mouse_mode_e)snapr_max(&r, MOUSE_ALL | MOUSE_SGR);
+    bool want_focus = snapr_max(&r, 1);
+    enum cursor_style cursor_style = snapr_max(&r, CURSOR_BAR_SOLID);
+    int top = (int)snapr_max(&r, (uint64_t)row - 1);
+    int bot = (int)snapr_max(&r, (uint64_t)row - 1);
+    int charset = (int)snapr_max(&r, 3);
+    int icharset = (int)snapr_max(&r, 3);
+    char trantbl[4];
+    for(int i = 0; i < 4; i++) trantbl[i] = (char)snapr_max(&r, CHAR_MAX);
+    if(r.bad || top > bot) goto bad;
+    int *tabs = xmalloc(col * sizeof(*tabs));
+    for(int x = 0; x < col; x++) tabs[x] = (int)snapr_max(&r, 1);
+    bool alt = snapr_max(&r, 1);
+    TCursor c = snapr_cursor(&r, col, row);
+    TCursor saved0 = snapr_cursor(&r, col, row);
+    TCursor saved1 = snapr_cursor(&r, col, row);
+    Screen main_scr, alt_scr;
+    if(r.bad || !snapr_screen(&r, &main_scr, col, row)){
+        free(tabs);
+        goto bad;
+    }
+    if(!snapr_screen(&r, &alt_scr, col, row)){
+        scr_free(&main_scr);
+        free(tabs);
+        goto bad;
+    }
+
+    // the selection goes with the lines it was on
+    tselclear(t);
+    // out with the old, except a spill file, which the new lines can use
+    struct spill *sp = t->main.spill;
+    t->main.spill = NULL;
+    if(sp){
+        spill_clear(sp);
+        spill_resize(sp, col);
+    }
+    scr_free(&t->main);
+    scr_free(&t->alt);
+    if(t->snap) munmap(t->snap, t->snap_len);
+    free(t->tabs);
+    t->snap = map;
+    t->snap_len = len;
+
+    t->main = main_scr;
+    t->main.spill = sp;
+    t->alt = alt_scr;
+    t->scr = alt ? &t->alt : &t->main;
+    t->col = col;
+    t->row = row;
+    t->mode = mode;
+    t->appkeypad = appkeypad;
+    t->appcursor = appcursor;
+    t->modify_other = modify_other;
+    t->mouse = mouse;
+    t->want_focus = want_focus;
+    t->cursor_style = cursor_style;
+    t->top = top;
+    t->bot = bot;
+    t->charset = charset;
+    t->icharset = icharset;
+    memcpy(t->trantbl, trantbl, sizeof(trantbl));
+    t->tabs = tabs;
+    t->c = c;
+    t->saved[0] = saved0;
+    t->saved[1] = saved1;
+    t->ocx = c.x;
+    t->ocy = c.y;
+
+    // nothing in flight survives: not a search, nor a half-parsed sequence
+    tsearch_lose(t);
+    t->pressed = false;
+    t->last_press_type = 0;
+    t->esc = 0;
+    csireset(t);
+    strreset(t);
+    t->rtail = t->rhead = 0;
+    return 0;
+
+bad:
+    if(map) munmap(map, len);
+    errno = EINVAL;
+    return -1;
+}
+
+//// spilled scrollback
+
+/* With tspill(), lines which fall out of the main screen's ring are kept in
+   a temporary file instead of being freed.  They keep their absolute indices
+   (scr->len counts them, and scr->spilled says how many there are), so
+   everything which reads lines by index reaches them through get_rline().
+
+   Lines are gathered into blocks of SPILL_BLOCK_LINES, each encoded like a
+   snapshot screen (a count, an index, then the glyphs), and appended to the
+   file.  The file is mapped in segments, read-only, and the lines of a block
+   are laid out over the mapping when one of them is wanted, to be unpacked
+   one at a time like restored lines.  A few blocks are kept laid out, so the
+   pointers get_rline() returns stay valid while a handful of other blocks
+   are read.
+
+   Spilled lines are read-only, and they are not reflowed: after a resize
+   they come back cut off or padded to the new width. */
+
+#define SPILL_BLOCK_LINES 256
+#define SPILL_SEGMENT (16 << 20)
+#define SPILL_CACHE 32
+
+typedef struct {
+    size_t first; // absolute index of the first line
+    uint32_t n;
+    uint32_t seg;
+    size_t off; // within the segment
+    size_t len; // 0 if it couldn't be written, and its lines are lost
+} spill_block_t;
+
+typedef struct {
+    size_t off; // in the file, page-aligned
+    size_t size;
+    size_t used;
+    char *map; // NULL until a block in it is read
+} spill_seg_t;
+
+typedef struct {
+    size_t block; // SIZE_MAX when empty
+    uint64_t used; // for evicting the least recently used
+    RLine **lines;
+} spill_cached_t;
+
+struct spill {
+    int fd;
+    int col; // the width lines are read back at
+    spill_block_t *blocks;
+    size_t nblocks;
+    size_t cap_blocks;
+    spill_seg_t *segs;
+    size_t nsegs;
+    size_t end; // where the next segment starts
+    size_t flushed; // lines in blocks; the rest are pending
+    RLine *pending[SPILL_BLOCK_LINES];
+    size_t npending;
+    spill_cached_t cache[SPILL_CACHE];
+    uint64_t clock;
+    snapw_t w;
+    snapw_t scratch;
+    bool warned;
+};
+
+static void spill_uncache(spill_cached_t *c, size_t n){
+    if(c->block == SIZE_MAX) return;
+    for(size_t i = 0; i < n; i++) rline_free(&c->lines[i]);
+    free(c->lines);
+    c->lines = NULL;
+    c->block = SIZE_MAX;
+}
+
+// forget every spilled line
+static void spill_clear(struct spill *sp){
+    for(size_t i = 0; i < SPILL_CACHE; i++){
+        spill_cached_t *c = &sp->cache[i];
+        if(c->block != SIZE_MAX) spill_uncache(c, sp->blocks[c->block].n);
+    }
+    for(size_t i = 0; i < sp->npending; i++) rline_free(&sp->pending[i]);
+    for(size_t i = 0; i < sp->nsegs; i++){
+        if(sp->segs[i].map) munmap(sp->segs[i].map, sp->segs[i].size);
+    }
+    free(sp->segs);
+    sp->segs = NULL;
+    sp->nsegs = 0;
+    sp->nblocks = 0;
+    sp->npending = 0;
+    sp->flushed = 0;
+    sp->end = 0;
+    if(ftruncate(sp->fd, 0) < 0){ /* the space is reused anyway */ }
+}
+
+static void spill_free(struct spill **spp){
+    struct spill *sp = *spp;
+    if(!sp) return;
+    spill_clear(sp);
+    close(sp->fd);
+    free(sp->blocks);
+    free(sp->w.buf);
+    free(sp->scratch.buf);
+    free(sp);
+    *spp = NULL;
+}
+
+// append a block to the file, returning where it went or -1
+static int spill_write(
+    struct spill *sp, const char *buf, size_t len, spill_block_t *blk
+){
+    spill_seg_t *seg = sp->nsegs ? &sp->segs[sp->nsegs - 1] : NULL;
+    if(!seg || seg->used + len > seg->size){
+        size_t page = (size_t)sysconf(_SC_PAGESIZE);
+        sp->segs = xrealloc(sp->segs, (sp->nsegs + 1) * sizeof(*sp->segs));
+        seg = &sp->segs[sp->nsegs++];
+        *seg = (spill_seg_t){
+            .off = sp->end,
+            // a block bigger than a segment gets one to itself
+            .size = MAX(SPILL_SEGMENT, (len + page - 1) / page * page),
+        };
+        sp->end += seg->size;
+    }
+    for(size_t done = 0; done < len; ){
+        ssize_t n = pwrite(
+            sp->fd, buf + done, len - done, (off_t)(seg->off + seg->used + done)
+        );
+        if(n < 0 && errno == EINTR) continue;
+        if(n <= 0) return -1;
+        done += (size_t)n;
+    }
+    blk->seg = sp->nsegs - 1;
+    blk->off = seg->used;
+    blk->len = len;
+    seg->used += len;
+    return 0;
+}
+
+// write out the pending lines as a block
+static void spill_flush(struct spill *sp){
+    if(!sp->npending) return;
+    // a block is small enough to encode the glyphs first, then the index
+    snapw_t *w = &sp->w, *data = &sp->scratch;
+    size_t ends[SPILL_BLOCK_LINES];
+    data->len = 0;
+    for(size_t i = 0; i < sp->npending; i++){
+        snapw_data(data, sp->pending[i]);
+        ends[i] = data->len;
+    }
+    w->len = 0;
+    snapw_uint(w, sp->npending);
+    uint64_t line_id = 0;
+    for(size_t i = 0; i < sp->npending; i++){
+        size_t nbytes = ends[i] - (i ? ends[i - 1] : 0);
+        snapw_index(w, sp->pending[i], nbytes, &line_id);
+    }
+    snapw_put(w, data->buf, data->len);
+
+    spill_block_t blk = { .first = sp->flushed, .n = (uint32_t)sp->npending };
+    if(spill_write(sp, w->buf, w->len, &blk) < 0){
+        if(!sp->warned){
+            fprintf(stderr, "spill: %s, losing scrollback\n", strerror(errno));
+            sp->warned = true;
+        }
+        blk.len = 0;
+    }
+    if(sp->nblocks == sp->cap_blocks){
+        sp->cap_blocks = sp->cap_blocks ? sp->cap_blocks * 2 : 64;
+        sp->blocks = xrealloc(
+            sp->blocks, sp->cap_blocks * sizeof(*sp->blocks)
+        );
+    }
+    sp->blocks[sp->nblocks++] = blk;
+
+    for(size_t i = 0; i < sp->npending; i++) rline_free(&sp->pending[i]);
+    sp->flushed += sp->npending;
+    sp->npending = 0;
+    // small blocks don't need big buffers kept around
+    if(w->cap > 1 << 20){
+        free(w->buf);
+        free(data->buf);
+        *w = (snapw_t){ .fd = -1 };
+        *data = (snapw_t){ .fd = -1 };
+    }
+}
+
+// map a segment, if it isn't already; false if it can't be
+static bool spill_map(struct spill *sp, spill_seg_t *seg){
+    if(seg->map) return true;
+    char *map = mmap(
+        NULL, seg->size, PROT_READ, MAP_SHARED, sp->fd, (off_t)seg->off
+    );
+    if(map == MAP_FAILED) return false;
+    seg->map = map;
+    return true;
+}
+
+/* lay out a block's lines over its (already mapped) segment, as packed
+   lines; false if the block is lost */
+static bool spill_layout(struct spill *sp, size_t b, RLine *lines){
+    spill_block_t *blk = &sp->blocks[b];
+    spill_seg_t *seg = &sp->segs[blk->seg];
+    snapr_t r = { NULL, NULL, !blk->len || !seg->map };
+    if(!r.bad){
+        r.p = (const unsigned char*)seg->map + blk->off;
+        r.end = r.p + blk->len;
+        if(snapr_uint(&r) != blk->n) r.bad = true;
+    }
+    uint64_t line_id = 0;
+    size_t off = 0;
+    for(size_t i = 0; i < blk->n && !r.bad; i++){
+        lines[i] = (RLine){0};
+        snapr_index(&r, &lines[i], &line_id);
+        off += lines[i].packed_len;
+    }
+    if(!r.bad && (size_t)(r.end - r.p) < off) r.bad = true;
+    if(r.bad) return false;
+
+    for(size_t i = 0; i < blk->n; i++){
+        lines[i].n_glyphs = sp->col;
+        lines[i].maxwritten = MIN(lines[i].maxwritten, (size_t)sp->col);
+        rline_set_packed(&lines[i], (const char*)r.p);
+        r.p += lines[i].packed_len;
+    }
+    return true;
+}
+
+// lay out a block's lines over its mapping
+static void spill_load(struct spill *sp, spill_cached_t *c, size_t b){
+    spill_block_t *blk = &sp->blocks[b];
+    RLine *lines = xmalloc(blk->n * sizeof(*lines));
+    bool ok = spill_map(sp, &sp->segs[blk->seg]) && spill_layout(sp, b, lines);
+    c->lines = xmalloc(blk->n * sizeof(*c->lines));
+    for(size_t i = 0; i < blk->n; i++){
+        if(!ok){
+            // lost: blank lines, which belong to no line group
+            c->lines[i] = rline_new(sp->col, 0);
+            continue;
+        }
+        c->lines[i] = xmalloc(sizeof(RLine));
+        *c->lines[i] = lines[i];
+    }
+    free(lines);
+    c->block = b;
+}
+
+// the block which a flushed line is in
+static size_t spill_block_of(struct spill *sp, size_t idx){
+    size_t lo = 0, hi = sp->nblocks;
+    while(hi - lo > 1){
+        size_t mid = lo + (hi - lo) / 2;
+        if(sp->blocks[mid].first <= idx) lo = mid;
+        else hi = mid;
+    }
+    return lo;
+}
+
+static RLine *spill_find(struct spill *sp, size_t idx, bool load){
+    if(idx >= sp->flushed) return sp->pending[idx - sp->flushed];
+    size_t lo = spill_block_of(sp, idx);
+    // an empty slot, or else the least recently used one
+    spill_cached_t *victim = NULL;
+    for(size_t i = 0; i < SPILL_CACHE; i++){
+        spill_cached_t *c = &sp->cache[i];
+        if(c->block == lo){
+            c->used = ++sp->clock;
+            return c->lines[idx - sp->blocks[lo].first];
+        }
+        if(!victim || (victim->block != SIZE_MAX
+                && (c->block == SIZE_MAX || c->used < victim->used))){
+            victim = c;
+        }
+    }
+    if(!load) return NULL;
+    if(victim->block != SIZE_MAX){
+        spill_uncache(victim, sp->blocks[victim->block].n);
+    }
+    spill_load(sp, victim, lo);
+    victim->used = ++sp->clock;
+    return victim->lines[idx - sp->blocks[lo].first];
+}
+
+static RLine *spill_line(struct spill *sp, size_t idx){
+    return spill_find(sp, idx, true);
+}
+
+// a spilled line, only if it's in memory already
+static RLine *spill_peek(struct spill *sp, size_t idx){
+    return spill_find(sp, idx, false);
+}
+
+// unrender the spilled lines in memory, without reading any others back
+static void spill_unrender(struct spill *sp){
+    for(size_t i = 0; i < SPILL_CACHE; i++){
+        spill_cached_t *c = &sp->cache[i];
+        if(c->block == SIZE_MAX) continue;
+        for(size_t j = 0; j < sp->blocks[c->block].n; j++){
+            if(!c->lines[j]->packed) rline_unrender(c->lines[j]);
+        }
+    }
+    for(size_t i = 0; i < sp->npending; i++){
+        rline_unrender(sp->pending[i]);
+    }
+}
+
+// take the oldest line of a full ring
+static void scr_spill(Screen *scr, RLine *rline){
+    struct spill *sp = scr->spill;
+    rline_unrender(rline);
+    sp->pending[sp->npending++] = rline;
+    scr->spilled++;
+    if(sp->npending == SPILL_BLOCK_LINES) spill_flush(sp);
+}
+
+// before a resize: lines read back from now on have the new width
+static void spill_resize(struct spill *sp, int col){
+    // the pending lines are written at the width they have
+    spill_flush(sp);
+    for(size_t i = 0; i < SPILL_CACHE; i++){
+        spill_cached_t *c = &sp->cache[i];
+        if(c->block != SIZE_MAX) spill_uncache(c, sp->blocks[c->block].n);
+    }
+    sp->col = col;
+}
+
+// drop a screen's spilled lines, like when the scrollback is cleared
+static void scr_unspill(Term *t, Screen *scr){
+    if(!scr->spilled) return;
+    tselclear(t);
+    size_t n = scr->spilled;
+    spill_clear(scr->spill);
+    scr->spilled = 0;
+    scr->len -= n;
+    scr->warm_lo = scr->warm_lo > n ? scr->warm_lo - n : 0;
+    scr->warm_hi = scr->warm_hi > n ? scr->warm_hi - n : 0;
+    if(scr->window_off > scr->len - t->row){
+        scr->window_off = scr->len - t->row;
+    }
+    t->last_press_x = 0;
+    t->last_press_y = 0;
+    tsearch_lose(t);
+}
+
+int tspill(Term *t, const char *dir){
+    if(t->main.spill) return 0;
+    if(!dir) dir = getenv("TMPDIR");
+    if(!dir || !*dir) dir = "/tmp";
+    size_t n = strlen(dir) + 32;
+    char *path = xmalloc(n);
+    snprintf(path, n, "%s/nast-scrollback-XXXXXX", dir);
+    int fd = mkstemp(path);
+    if(fd < 0){
+        free(path);
+        return -1;
+    }
+    // nothing else needs the name, and now it can't outlive us
+    unlink(path);
+    free(path);
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+    struct spill *sp = xmalloc(sizeof(*sp));
+    *sp = (struct spill){
+        .fd = fd,
+        .col = t->col,
+        .w = { .fd = -1 },
+        .scratch = { .fd = -1 },
+    };
+    for(size_t i = 0; i < SPILL_CACHE; i++){
+        sp->cache[i] = (spill_cached_t){ .block = SIZE_MAX };
+    }
+    t->main.spill = sp;
+    return 0;
+}
+
+size_t tspilled(Term *t){
+    return t->main.spilled;
+}
+
+//// finding every match
+
+/* tfindall() cuts the scrollback into chunks of rows and searches them on
+   the Term's worker pool.  The calling thread, which owns the Term, works
+   in pool_run() until every chunk is done, so nothing is appended or
+   dropped under the workers.  Each chunk takes the logical lines which
+   start in it, so a line wrapped over a boundary is searched once.
+
+   tmatchesupdate() searches on the calling thread, from ms->scanned on, and
+   at most FINDALL_STEP rows at a time: lines appended since the last time,
+   the window, whose lines can still change under a list, and for a list
+   from tfindallstart(), the next slice of the scrollback. */
+
+#define FINDALL_CHUNK 4096
+// fewer rows than this are searched on the calling thread alone
+#define FINDALL_PARALLEL_MIN (4 * FINDALL_CHUNK)
+// rows searched by one tmatchesupdate(), at most
+#define FINDALL_STEP (4 * FINDALL_CHUNK)
+
+/* get_rline() unpacks lines and loads spill blocks into the shared cache;
+   workers read through one of these instead, which changes nothing else */
+struct sreader {
+    Screen *scr;
+    size_t block; // the spill block laid out in lines, or SIZE_MAX
+    RLine lines[SPILL_BLOCK_LINES];
+    RLine line; // the last line unpacked by sreader_line()
+    Glyph *glyphs;
+    size_t cap;
+};
+
+static RLine *sreader_peek(struct sreader *rd, size_t y){
+    Screen *scr = rd->scr;
+    if(y >= scr->spilled) return scr->rlines[rlines_idx(scr, y)];
+    struct spill *sp = scr->spill;
+    if(y >= sp->flushed) return sp->pending[y - sp->flushed];
+    size_t b = spill_block_of(sp, y);
+    if(rd->block != b){
+        if(!spill_layout(sp, b, rd->lines)){
+            // lost lines have nothing to find in them
+            memset(rd->lines, 0, sp->blocks[b].n * sizeof(*rd->lines));
+        }
+        rd->block = b;
+    }
+    return &rd->lines[y - sp->blocks[b].first];
+}
+
+static RLine *sreader_line(struct sreader *rd, size_t y){
+    RLine *rline = sreader_peek(rd, y);
+    if(!rline->packed) return rline;
+    if(rline->n_glyphs > rd->cap){
+        rd->cap = rline->n_glyphs;
+        rd->glyphs = xrealloc(rd->glyphs, rd->cap * sizeof(*rd->glyphs));
+    }
+    glyphs_unpack(rline->packed, rline->packed_len, rd->glyphs, rline->n_glyphs);
+    rd->line = *rline;
+    rd->line.packed = NULL;
+    rd->line.glyphs = rd->glyphs;
+    return &rd->line;
+}
+
+typedef struct {
+    tsearch_t s;
+    struct sreader rd;
+} findall_worker_t;
+
+typedef struct {
+    TMatch *m;
+    size_t n;
+    size_t cap;
+} findall_chunk_t;
+
+typedef struct {
+    int col;
+    findall_worker_t *workers;
+    findall_chunk_t *chunks;
+} findall_job_t;
+
+/* add every match in the logical lines which start in [y, end) to c, and
+   return where the line after them starts */
+static size_t findall_rows(
+    tsearch_t *s, int col, size_t y, size_t end, findall_chunk_t *c
+){
+    sline_t *l = &s->line;
+    for(; y < end; y += l->nlines){
+        sline_gather(s, y, col);
+        size_t b, e;
+        // every match, stepping like tsearchnext() would
+        for(size_t j = 0; sline_find(s, j, false, &b, &e); j = b + 1){
+            if(c->n == c->cap){
+                c->cap = c->cap ? c->cap * 2 : 16;
+                c->m = xrealloc(c->m, c->cap * sizeof(*c->m));
+            }
+            c->m[c->n++] = sline_match(l, col, b, e);
+        }
+    }
+    return y;
+}
+
+static void findall_chunk_fn(void *arg, size_t i, int worker){
+    findall_job_t *job = arg;
+    tsearch_t *s = &job->workers[worker].s;
+    size_t y = i * FINDALL_CHUNK;
+    size_t end = MIN(y + FINDALL_CHUNK, s->scr->len);
+    // the rest of a line which started in the chunk before is not ours
+    uint64_t id = y ? search_peek(s, y - 1)->line_id : 0;
+    while(id && y < end && search_peek(s, y)->line_id == id) y++;
+    findall_rows(s, job->col, y, end, &job->chunks[i]);
+}
+
+// where the lines which are still in the window (and so may change) start
+static size_t findall_settled(Term *t, Screen *scr){
+    if(scr->len <= (size_t)t->row) return 0;
+    tsearch_t s = { .scr = scr };
+    return group_first(&s, scr->len - t->row);
+}
+
+int tfindallstart(Term *t, const char *pattern, int flags, TMatches *ms){
+    Screen *scr = t->scr;
+    flags &= ~TSEARCH_BACKWARD;
+    *ms = (TMatches){
+        .pattern = xstrdup((char*)pattern),
+        .flags = flags,
+        .epoch = t->epoch,
+        .dropped = scr->dropped,
+        .alt = scr == &t->alt,
+    };
+    tsearch_t s = {0};
+    int ret = tsearch_compile(&s, pattern, flags);
+    tsearch_free(&s);
+    if(ret){
+        // (nothing to keep up to date)
+        free(ms->pattern);
+        ms->pattern = NULL;
+    }
+    return ret;
+}
+
+int tfindall(Term *t, const char *pattern, int flags, TMatches *ms){
+    Screen *scr = t->scr;
+    tfindallstart(t, pattern, flags, ms);
+    flags &= ~TSEARCH_BACKWARD;
+
+    pool_t *pool = NULL;
+    if(scr->len >= FINDALL_PARALLEL_MIN) pool = rpool_start(&t->rpool);
+    int nworkers = pool ? pool_size(pool) : 1;
+    findall_worker_t *workers = xmalloc(nworkers * sizeof(*workers));
+    int ret = 0;
+    for(int i = 0; i < nworkers; i++){
+        findall_worker_t *w = &workers[i];
+        w->s = (tsearch_t){ .scr = scr, .rd = &w->rd };
+        w->rd = (struct sreader){ .scr = scr, .block = SIZE_MAX };
+        // each worker has its own regex, since regexec() locks one
+        if(tsearch_compile(&w->s, pattern, flags)) ret = -1;
+    }
+    // workers read the spill file through mappings made here
+    if(scr->spill){
+        for(size_t i = 0; i < scr->spill->nsegs; i++){
+            spill_map(scr->spill, &scr->spill->segs[i]);
+        }
+    }
+
+    size_t nchunks = (scr->len + FINDALL_CHUNK - 1) / FINDALL_CHUNK;
+    findall_chunk_t *chunks = xmalloc(nchunks * sizeof(*chunks));
+    memset(chunks, 0, nchunks * sizeof(*chunks));
+    findall_job_t job = { t->col, workers, chunks };
+    if(ret == 0 && pool){
+        pool_run(pool, nchunks, findall_chunk_fn, &job);
+    }else if(ret == 0){
+        for(size_t i = 0; i < nchunks; i++) findall_chunk_fn(&job, i, 0);
+    }
+
+    // the chunks are in order, and so is each one's list
+    for(size_t i = 0; i < nchunks; i++) ms->n += chunks[i].n;
+    ms->m = ms->n ? xmalloc(ms->n * sizeof(*ms->m)) : NULL;
+    size_t n = 0;
+    for(size_t i = 0; i < nchunks; i++){
+        if(chunks[i].n){
+            memcpy(ms->m + n, chunks[i].m, chunks[i].n * sizeof(*ms->m));
+        }
+        n += chunks[i].n;
+        free(chunks[i].m);
+    }
+    free(chunks);
+    ms->cap = ms->n;
+    ms->scanned = ret ? 0 : scr->len;
+    ms->settled = findall_settled(t, scr);
+    for(int i = 0; i < nworkers; i++){
+        tsearch_free(&workers[i].s);
+        free(workers[i].rd.glyphs);
+    }
+    free(workers);
+    return ret;
+}
+
+bool tmatchesupdate(Term *t, TMatches *ms){
+    Screen *scr = ms->alt ? &t->alt : &t->main;
+    if(ms->epoch != t->epoch){
+        tmatchesfree(ms);
+        return false;
+    }
+    uint64_t gone = scr->dropped - ms->dropped;
+    if(gone){
+        size_t keep = 0;
+        for(size_t i = 0; i < ms->n; i++){
+            if(ms->m[i].yb < gone) continue;
+            ms->m[i].yb -= gone;
+            ms->m[i].ye -= gone;
+            ms->m[keep++] = ms->m[i];
+        }
+        ms->n = keep;
+        ms->scanned = ms->scanned > gone ? ms->scanned - gone : 0;
+        ms->settled = ms->settled > gone ? ms->settled - gone : 0;
+        ms->dropped = scr->dropped;
+    }
+    if(!ms->pattern || !scr->len) return true;
+
+    // what was found in the window then may not be there any more
+    if(ms->scanned > ms->settled){
+        while(ms->n && ms->m[ms->n - 1].yb >= ms->settled) ms->n--;
+        ms->scanned = ms->settled;
+    }
+    ms->settled = findall_settled(t, scr);
+    tsearch_t s = { .scr = scr };
+    size_t end = MIN(scr->len, ms->scanned + FINDALL_STEP);
+    if(tsearch_compile(&s, ms->pattern, ms->flags) == 0){
+        findall_chunk_t c = { ms->m, ms->n, ms->cap };
+        ms->scanned = findall_rows(&s, t->col, ms->scanned, end, &c);
+        ms->m = c.m;
+        ms->n = c.n;
+        ms->cap = c.cap;
+    }
+    tsearch_free(&s);
+    return true;
+}
+
+void tmatchesfree(TMatches *ms){
+    free(ms->m);
+    free(ms->pattern);
+    ms->m = NULL;
+    ms->pattern = NULL;
+    ms->n = 0;
+    ms->cap = 0;
+    ms->scanned = 0;
+}
+
+int trows(Term *t){
+    return t->row;
+}
+
+int tcols(Term *t){
+    return t->col;
+}
+
+const Glyph *tline(Term *t, int y, size_t *n){
+    RLine *rline = get_rline(t->scr, term2abs(t, y));
+    *n = rline->n_glyphs;
+    return rline->glyphs;
+}
+
+const Glyph *twindowline(Term *t, int y, size_t *n){
+    RLine *rline = get_rline(t->scr, window2abs(t, y));
+    *n = rline->n_glyphs;
+    return rline->glyphs;
+}
+
+bool tcursorpos(Term *t, int *x, int *y){
+    if(t->mode & MODE_HIDE) return false;
+    size_t y_win = abs2window(t, term2abs(t, t->c.y));
+    if(y_win >= (size_t)t->row) return false;
+    *x = t->c.x;
+    *y = (int)y_win;
+    return true;
+}
+
+enum cursor_style tcursorshape(Term *t){
+    return t->cursor_style;
+}
+
+uint32_t tmodes(Term *t){
+    return (t->appcursor ? TMODE_APPCURSOR : 0)
+         | (t->appkeypad ? TMODE_APPKEYPAD : 0)
+         | (t->mode & MODE_BRCKTPASTE ? TMODE_BRACKETPASTE : 0)
+         | (t->mode & MODE_ALTSCREEN ? TMODE_ALTSCREEN : 0)
+         | (t->mode & MODE_REVERSE ? TMODE_REVERSE : 0)
+         | (t->mouse & MOUSE_ALL ? TMODE_MOUSE : 0)
+         | (t->want_focus ? TMODE_FOCUS : 0);
+}
+
+int tsetfont(Term *t, char *font_name, int font_size){
+    PangoFontDescription *desc;
+    double grid_w, grid_h;
+    int ret = getfont(font_name, font_size, &desc, &grid_w, &grid_h);
+    if(ret < 0) return -1;
+
+    /* always unrender, in case new font has same dimensions as the old, in
+       which case the auto-rerender logic in trender() wouldn't be triggered */
+    tunrender(t);
+
+    pango_font_description_free(t->desc);
+    t->desc = desc;
+    t->font_size = font_size;
+    t->grid_w = grid_w;
+    t->grid_h = grid_h;
+    return 0;
+}
+
+void
+tswapscreen(Term *t)
+{
+    // break selection
+    tselclear(t);
+    if(t->mode & MODE_ALTSCREEN){
+        // switch to main
+        t->scr = &t->main;
+    }else{
+        // switch to alt
+        t->scr = &t->alt;
+    }
+    t->mode ^= MODE_ALTSCREEN;
+}
+
+void
+tnewline(Term *t, int first_col, bool break_line_id)
+{
+    t->c.state &= ~CURSOR_WRAPNEXT;
+    if(first_col) t->c.x = 0;
+
+    uint64_t line_id;
+    if(break_line_id){
+        line_id = new_line_id(t->scr);
+    }else{
+        line_id = get_cursor_rline(t)->line_id;
+    }
+
+    /* if we are not in the scroll region, or if we not at the very bottom of
        the scroll region, we just move downwards and call it a day */
     if(t->c.y != t->bot){
         // move down if we can
@@ -1467,6 +3546,7 @@ tnewline(Term *t, int first_col, bool break_line_id)
 
     // add a new line to the bottom of the screen
     scr_new_rline(t->scr, t, line_id, t->col);
+    t->stats.lines_scrolled++;
 
     // if scroll region doen't reach the bottom, rotate the new line into place
     if(t->bot + 1 != t->row){
@@ -1487,38 +3567,38 @@ tnewline(Term *t, int first_col, bool break_line_id)
 
 // see https://vt100.net/docs/vt510-rm/chapter4.html, chapter 4.3.3
 void
-csiparse(void)
+csiparse(Term *t)
 {
-    char *p = csiescseq.buf, *np;
+    char *p = t->csiescseq.buf, *np;
     long int v;
 
-    csiescseq.narg = 0;
+    t->csiescseq.narg = 0;
     if (*p == '?' || *p == '>') {
-        csiescseq.priv = *p;
+        t->csiescseq.priv = *p;
         p++;
     }
 
-    csiescseq.buf[csiescseq.len] = '\0';
-    while (p < csiescseq.buf+csiescseq.len) {
+    t->csiescseq.buf[t->csiescseq.len] = '\0';
+    while (p < t->csiescseq.buf+t->csiescseq.len) {
         np = NULL;
         v = strtol(p, &np, 10);
         if (np == p)
             v = 0;
         if (v == LONG_MAX || v == LONG_MIN)
             v = -1;
-        csiescseq.arg[csiescseq.narg++] = v;
+        t->csiescseq.arg[t->csiescseq.narg++] = v;
         p = np;
-        if (*p != ';' || csiescseq.narg == ESC_ARG_SIZ)
+        if (*p != ';' || t->csiescseq.narg == ESC_ARG_SIZ)
             break;
         p++;
     }
     // detect when there is a submode
-    if(p - csiescseq.buf + 1 < csiescseq.len){
-        csiescseq.submode = *p++;
-        csiescseq.mode = *p;
+    if(p - t->csiescseq.buf + 1 < t->csiescseq.len){
+        t->csiescseq.submode = *p++;
+        t->csiescseq.mode = *p;
     }else{
-        csiescseq.submode = '\0';
-        csiescseq.mode = *p;
+        t->csiescseq.submode = '\0';
+        t->csiescseq.mode = *p;
     }
 }
 
@@ -1633,6 +3713,15 @@ tclearregion_abs(Term *t, int x1, int y1, int x2, int y2)
     if (y1 > y2)
         temp = y1, y1 = y2, y2 = temp;
 
+    // any overlap breaks the selection, before it's cleared
+    if(t->sel_type){
+        // is selection before cleared region?
+        bool before = t->sel_ye < y1 || (t->sel_ye == y1 && t->sel_xe < x1);
+        // is selection after cleared region?
+        bool after = t->sel_yb > y2 || (t->sel_yb == y2 && t->sel_xb > x2);
+        if(!before && !after) tselclear(t);
+    }
+
     for (y = y1; y <= y2; y++) {
         RLine *rline = get_rline(t->scr, y);
         rline_unrender(rline);
@@ -1654,13 +3743,6 @@ tclearregion_abs(Term *t, int x1, int y1, int x2, int y2)
             rline->maxwritten = x1;
         }
     }
-
-    // is selection before cleared region?
-    if(t->sel_ye < y1 || (t->sel_ye == y1 && t->sel_xe < x1)) return;
-    // is selection after cleared region?
-    if(t->sel_ye < y1 || (t->sel_ye == y1 && t->sel_xe < x1)) return;
-    // any overlap breaks the selection
-    t->sel_type = 0;
 }
 
 void
@@ -1674,6 +3756,15 @@ tclearregion_term(Term *t, int x1, int y1, int x2, int y2)
     tclearregion_abs(t, x1, term2abs(t, y1), x2, term2abs(t, y2));
 }
 
+static void temit_break_selection(Term *t, int x, size_t y, bool insert){
+    if(!t->sel_type) return;
+    if(y < t->sel_yb) return;
+    if(y == t->sel_yb && x < t->sel_xb && !insert) return;
+    if(y > t->sel_ye) return;
+    if(y == t->sel_ye && x > t->sel_xe) return;
+    tselclear(t);
+}
+
 void
 tdeletechar(Term *t, int n)
 {
@@ -1686,6 +3777,9 @@ tdeletechar(Term *t, int n)
     size = t->col - src;
     RLine *rline = get_rline(t->scr, term2abs(t, t->c.y));
 
+    // break selection if it is on or after cursor
+    temit_break_selection(t, t->c.x, term2abs(t, t->c.y), true);
+
     Glyph *glyphs = rline->glyphs;
 
     // use memmove to overwrite the deleted characters
@@ -1707,15 +3801,6 @@ tdeletechar(Term *t, int n)
     tclearregion_term(t, t->col-n, t->c.y, t->col-1, t->c.y);
 }
 
-static void temit_break_selection(Term *t, int x, size_t y, bool insert){
-    if(!t->sel_type) return;
-    if(y < t->sel_yb) return;
-    if(y == t->sel_yb && x < t->sel_xb && !insert) return;
-    if(y > t->sel_ye) return;
-    if(y == t->sel_ye && x > t->sel_xe) return;
-    t->sel_type = 0;
-}
-
 void
 tinsertblank(Term *t, int n)
 {
@@ -1729,6 +3814,9 @@ tinsertblank(Term *t, int n)
     // will this break the line_id? (will there be dropped characters?)
     bool breaks_line_id = len + n > t->col;
 
+    // break selection, identical to temit's selection breaking
+    temit_break_selection(t, x, term2abs(t, t->c.y), true);
+
     if(shift){
         void *src = &rline->glyphs[x];
         void *dst = &rline->glyphs[x + n];
@@ -1754,28 +3842,50 @@ tinsertblank(Term *t, int n)
             .bg = t->c.attr.bg,
         };
     }
-
-    // break selection, identical to temit's selection breaking
-    temit_break_selection(t, x, term2abs(t, t->c.y), true);
 }
 
 // replace the line_ids of the contiguous group at y with a new line_id
 // dir can be +1 or -1, depending on which direction to look for matches
 void mod_line_group(Term *t, size_t idx, int dir){
     // valid idx?
-    if(idx >= t->scr->len) return;
+    if(idx >= t->scr->len || idx < t->scr->spilled) return;
     uint64_t old = get_rline(t->scr, idx)->line_id;
     // valid line group?
     if(old == 0) return;
     uint64_t line_id = new_line_id(t->scr);
     // loop tracks i with a 1-offset, to avoid underflow in dir=-1 case
-    for(size_t i = idx+1; i > 0 && i < t->scr->len + 1; i += dir){
+    // (and spilled lines are read-only, so groups are cut off at the ring)
+    for(size_t i = idx+1; i > t->scr->spilled && i < t->scr->len + 1; i += dir){
         RLine *rline = get_rline(t->scr, i-1);
         if(rline->line_id != old) break;
         rline->line_id = line_id;
     }
 }
 
+/* the selection, for a scroll of rows top to bot by n (upwards, or down if
+   negative); done before the scroll, so a break sees what was selected */
+static void tscrollsel(Term *t, int top, int bot, int n){
+    if(!t->sel_type) return; // no selection
+    size_t topabs = term2abs(t, top);
+    size_t botabs = term2abs(t, bot);
+    size_t selb_movable = t->sel_yb >= topabs && t->sel_yb <= botabs;
+    size_t sele_movable = t->sel_ye >= topabs && t->sel_ye <= botabs;
+    if(selb_movable != sele_movable){
+        // selection is partly inside, partly outside the margins; break it
+        tselclear(t);
+        return;
+    }
+    if(!selb_movable) return;  // selection not in margins at all
+    if(n > 0 ? t->sel_yb < topabs + n : t->sel_ye + -n > botabs){
+        // selection is inside the margins, but would be broken by the move
+        tselclear(t);
+        return;
+    }
+    // selection can be moved!
+    t->sel_yb -= n;
+    t->sel_ye -= n;
+}
+
 // scroll lines upwards in a specified window, cursor stays in place
 /*
    Example: t->row = 8, top = 1, bot = 6, n = 2
@@ -1797,6 +3907,9 @@ void tscrollup(Term *t, int top, int bot, int n, bool break_line_id){
     if(top >= bot) return;
     LIMIT(n, 0, bot - top);
     if(!n) return;
+    t->stats.lines_scrolled += n;
+    // step 0: move the selection with its lines, or break it first
+    tscrollsel(t, top, bot, n);
     // step 1: wipe n lines clean
     for(int i = top; i < top + n; i++){
         rline_clear(get_rline(t->scr, term2abs(t, i)));
@@ -1823,26 +3936,6 @@ void tscrollup(Term *t, int top, int bot, int n, bool break_line_id){
     // step 3: modify the new top line group's line_id, moving downwards
     mod_line_group(t, term2abs(t, top), +1);
     if(break_line_id) t->scr->new_line_id_on_write = true;
-    // step 4: modify the selection accordingly
-    if(!t->sel_type) return; // no selection
-    size_t topabs = term2abs(t, top);
-    size_t botabs = term2abs(t, bot);
-    size_t selb_movable = t->sel_yb >= topabs && t->sel_yb <= botabs;
-    size_t sele_movable = t->sel_ye >= topabs && t->sel_ye <= botabs;
-    if(selb_movable != sele_movable){
-        // selection is partly inside, partly outside the margins; break it
-        t->sel_type = 0;
-        return;
-    }
-    if(!selb_movable) return;  // selection not in margins at all
-    if(t->sel_yb < topabs + n){
-        // selection is inside the margins, but would be broken by the move
-        t->sel_type = 0;
-        return;
-    }
-    // selection can be moved!
-    t->sel_yb -= n;
-    t->sel_ye -= n;
 }
 
 // scroll lines downwards in a specified window, cursor stays in place
@@ -1866,6 +3959,9 @@ void tscrolldown(Term *t, int top, int bot, int n, bool break_line_id){
     if(top >= bot) return;
     LIMIT(n, 0, bot - top);
     if(!n) return;
+    t->stats.lines_scrolled += n;
+    // step 0: move the selection with its lines, or break it first
+    tscrollsel(t, top, bot, -n);
     // step 1: wipe n lines clean
     for(int i = bot + 1 - n; i < bot + 1; i++){
         rline_clear(get_rline(t->scr, term2abs(t, i)));
@@ -1892,26 +3988,6 @@ void tscrolldown(Term *t, int top, int bot, int n, bool break_line_id){
     // step 3: modify the new bottom line group's line_id, moving upwards
     mod_line_group(t, term2abs(t, bot + 1 - n), -1);
     if(break_line_id) t->scr->new_line_id_on_write = true;
-    // step 4: modify the selection accordingly
-    if(!t->sel_type) return; // no selection
-    size_t topabs = term2abs(t, top);
-    size_t botabs = term2abs(t, bot);
-    size_t selb_movable = t->sel_yb >= topabs && t->sel_yb <= botabs;
-    size_t sele_movable = t->sel_ye >= topabs && t->sel_ye <= botabs;
-    if(selb_movable != sele_movable){
-        // selection is partly inside, partly outside the margins; break it
-        t->sel_type = 0;
-        return;
-    }
-    if(!selb_movable) return;  // selection not in margins at all
-    if(t->sel_ye + n > botabs){
-        // selection is inside the margins, but would be broken by the move
-        t->sel_type = 0;
-        return;
-    }
-    // selection can be moved!
-    t->sel_yb += n;
-    t->sel_ye += n;
 }
 
 struct rgb24
@@ -2055,7 +4131,7 @@ tsetattr(Term *t, int *attr, int l)
                 fprintf(
                     stderr, "erresc(default): gfx attr %d unknown: ", attr[i]
                 );
-                csidump(stderr);
+                csidump(t, stderr);
             }
             break;
         }
@@ -2273,31 +4349,31 @@ void
 csihandle(Term *t)
 {
     // printf("csihandle(): ");
-    // csidump(stdout);
+    // csidump(t, stdout);
     char buf[40];
     int len;
     int lvl;
 
-    switch (csiescseq.mode) {
+    switch (t->csiescseq.mode) {
     case '@': /* ICH -- Insert <n> blank char */
-        if(csiescseq.priv || csiescseq.submode) goto unknown;
-        DEFAULT(csiescseq.arg[0], 1);
-        tinsertblank(t, csiescseq.arg[0]);
+        if(t->csiescseq.priv || t->csiescseq.submode) goto unknown;
+        DEFAULT(t->csiescseq.arg[0], 1);
+        tinsertblank(t, t->csiescseq.arg[0]);
         break;
     case 'A': /* CUU -- Cursor <n> Up */
-        if(csiescseq.priv || csiescseq.submode) goto unknown;
-        DEFAULT(csiescseq.arg[0], 1);
-        tmoveto(t, t->c.x, t->c.y-csiescseq.arg[0], true);
+        if(t->csiescseq.priv || t->csiescseq.submode) goto unknown;
+        DEFAULT(t->csiescseq.arg[0], 1);
+        tmoveto(t, t->c.x, t->c.y-t->csiescseq.arg[0], true);
         break;
     case 'B': /* CUD -- Cursor <n> Down */
     case 'e': /* VPR --Cursor <n> Down */
-        if(csiescseq.priv || csiescseq.submode) goto unknown;
-        DEFAULT(csiescseq.arg[0], 1);
-        tmoveto(t, t->c.x, t->c.y+csiescseq.arg[0], true);
+        if(t->csiescseq.priv || t->csiescseq.submode) goto unknown;
+        DEFAULT(t->csiescseq.arg[0], 1);
+        tmoveto(t, t->c.x, t->c.y+t->csiescseq.arg[0], true);
         break;
     case 'i': /* MC -- Media Copy */
-        if(csiescseq.priv || csiescseq.submode) goto unknown;
-        switch (csiescseq.arg[0]) {
+        if(t->csiescseq.priv || t->csiescseq.submode) goto unknown;
+        switch (t->csiescseq.arg[0]) {
         case 0:
             tdump(t);
             break;
@@ -2316,15 +4392,15 @@ csihandle(Term *t)
         }
         break;
     case 'c': /* DA -- Device Attributes */
-        if(csiescseq.submode) goto unknown;
-        if(csiescseq.priv == '>'){
+        if(t->csiescseq.submode) goto unknown;
+        if(t->csiescseq.priv == '>'){
             // secondary device attributes
             t->hooks->ttywrite(t->hooks, vtiden2, strlen(vtiden2));
             break;
         }
-        if(csiescseq.priv) goto unknown;
-        if(csiescseq.narg == 0
-            || (csiescseq.narg == 0 && csiescseq.arg[0] == 0)
+        if(t->csiescseq.priv) goto unknown;
+        if(t->csiescseq.narg == 0
+            || (t->csiescseq.narg == 0 && t->csiescseq.arg[0] == 0)
         ){
             t->hooks->ttywrite(t->hooks, vtiden, strlen(vtiden));
             break;
@@ -2332,28 +4408,28 @@ csihandle(Term *t)
         goto unknown;
     case 'C': /* CUF -- Cursor <n> Forward */
     case 'a': /* HPR -- Cursor <n> Forward */
-        if(csiescseq.priv || csiescseq.submode) goto unknown;
-        DEFAULT(csiescseq.arg[0], 1);
-        tmoveto(t, t->c.x+csiescseq.arg[0], t->c.y, false);
+        if(t->csiescseq.priv || t->csiescseq.submode) goto unknown;
+        DEFAULT(t->csiescseq.arg[0], 1);
+        tmoveto(t, t->c.x+t->csiescseq.arg[0], t->c.y, false);
         break;
     case 'D': /* CUB -- Cursor <n> Backward */
-        if(csiescseq.priv || csiescseq.submode) goto unknown;
-        DEFAULT(csiescseq.arg[0], 1);
-        tmoveto(t, t->c.x-csiescseq.arg[0], t->c.y, false);
+        if(t->csiescseq.priv || t->csiescseq.submode) goto unknown;
+        DEFAULT(t->csiescseq.arg[0], 1);
+        tmoveto(t, t->c.x-t->csiescseq.arg[0], t->c.y, false);
         break;
     case 'E': /* CNL -- Cursor <n> Down and first col */
-        if(csiescseq.priv || csiescseq.submode) goto unknown;
-        DEFAULT(csiescseq.arg[0], 1);
-        tmoveto(t, 0, t->c.y+csiescseq.arg[0], true);
+        if(t->csiescseq.priv || t->csiescseq.submode) goto unknown;
+        DEFAULT(t->csiescseq.arg[0], 1);
+        tmoveto(t, 0, t->c.y+t->csiescseq.arg[0], true);
         break;
     case 'F': /* CPL -- Cursor <n> Up and first col */
-        if(csiescseq.priv || csiescseq.submode) goto unknown;
-        DEFAULT(csiescseq.arg[0], 1);
-        tmoveto(t, 0, t->c.y-csiescseq.arg[0], true);
+        if(t->csiescseq.priv || t->csiescseq.submode) goto unknown;
+        DEFAULT(t->csiescseq.arg[0], 1);
+        tmoveto(t, 0, t->c.y-t->csiescseq.arg[0], true);
         break;
     case 'g': /* TBC -- Tabulation clear */
-        if(csiescseq.priv || csiescseq.submode) goto unknown;
-        switch (csiescseq.arg[0]) {
+        if(t->csiescseq.priv || t->csiescseq.submode) goto unknown;
+        switch (t->csiescseq.arg[0]) {
         case 0: /* clear current tab stop */
             t->tabs[t->c.x] = 0;
             break;
@@ -2366,25 +4442,25 @@ csihandle(Term *t)
         break;
     case 'G': /* CHA -- Move to <col> */
     case '`': /* HPA */
-        if(csiescseq.priv || csiescseq.submode) goto unknown;
-        DEFAULT(csiescseq.arg[0], 1);
-        tmoveto(t, csiescseq.arg[0]-1, t->c.y, false);
+        if(t->csiescseq.priv || t->csiescseq.submode) goto unknown;
+        DEFAULT(t->csiescseq.arg[0], 1);
+        tmoveto(t, t->csiescseq.arg[0]-1, t->c.y, false);
         break;
     case 'H': /* CUP -- Move to <row> <col> */
     case 'f': /* HVP */
-        if(csiescseq.priv || csiescseq.submode) goto unknown;
-        DEFAULT(csiescseq.arg[0], 1);
-        DEFAULT(csiescseq.arg[1], 1);
-        tmoveto_origin(t, csiescseq.arg[1]-1, csiescseq.arg[0]-1, true);
+        if(t->csiescseq.priv || t->csiescseq.submode) goto unknown;
+        DEFAULT(t->csiescseq.arg[0], 1);
+        DEFAULT(t->csiescseq.arg[1], 1);
+        tmoveto_origin(t, t->csiescseq.arg[1]-1, t->csiescseq.arg[0]-1, true);
         break;
     case 'I': /* CHT -- Cursor Forward Tabulation <n> tab stops */
-        if(csiescseq.priv || csiescseq.submode) goto unknown;
-        DEFAULT(csiescseq.arg[0], 1);
-        tputtab(t, csiescseq.arg[0]);
+        if(t->csiescseq.priv || t->csiescseq.submode) goto unknown;
+        DEFAULT(t->csiescseq.arg[0], 1);
+        tputtab(t, t->csiescseq.arg[0]);
         break;
     case 'J': /* ED -- Clear screen */
-        if(csiescseq.priv || csiescseq.submode) goto unknown;
-        switch (csiescseq.arg[0]) {
+        if(t->csiescseq.priv || t->csiescseq.submode) goto unknown;
+        switch (t->csiescseq.arg[0]) {
         case 0: /* below */
             tclearregion_term(t, t->c.x, t->c.y, t->col-1, t->c.y);
             if (t->c.y < t->row-1) {
@@ -2402,14 +4478,17 @@ csihandle(Term *t)
             break;
         case 3: /* xterm extension: clear screen and scrollback buffer */
             tclearregion_term(t, 0, 0, t->col-1, t->row-1);
+            scr_unspill(t, t->scr);
+            if(t->scr->len > t->row) tselclear(t);
             // delete from beginning of ring buffer
             while(t->scr->len > t->row){
                 rline_free(&t->scr->rlines[t->scr->start]);
+                t->stats.rlines_dropped++;
                 t->scr->start = rlines_idx(t->scr, 1);
                 t->scr->len--;
-                // reset scroll and selection
+                // reset scroll and search (the selection is gone already)
                 tsetwindowoff(t, t->scr, 0);
-                t->sel_type = 0;
+                tsearch_lose(t);
                 t->last_press_x = 0;
                 t->last_press_x = 0;
             }
@@ -2419,8 +4498,8 @@ csihandle(Term *t)
         }
         break;
     case 'K': /* EL -- Clear line */
-        if(csiescseq.priv || csiescseq.submode) goto unknown;
-        switch (csiescseq.arg[0]) {
+        if(t->csiescseq.priv || t->csiescseq.submode) goto unknown;
+        switch (t->csiescseq.arg[0]) {
         case 0: /* right */
             tclearregion_term(t, t->c.x, t->c.y, t->col-1, t->c.y);
             break;
@@ -2433,89 +4512,89 @@ csihandle(Term *t)
         }
         break;
     case 'S': /* SU -- Scroll <n> line up */
-        if(csiescseq.priv || csiescseq.submode) goto unknown;
-        DEFAULT(csiescseq.arg[0], 1);
-        tscrollup(t, t->top, t->bot, csiescseq.arg[0], true);
+        if(t->csiescseq.priv || t->csiescseq.submode) goto unknown;
+        DEFAULT(t->csiescseq.arg[0], 1);
+        tscrollup(t, t->top, t->bot, t->csiescseq.arg[0], true);
         break;
     case 'T': /* SD -- Scroll <n> line down */
-        if(csiescseq.priv || csiescseq.submode) goto unknown;
-        DEFAULT(csiescseq.arg[0], 1);
-        tscrolldown(t, t->top, t->bot, csiescseq.arg[0], true);
+        if(t->csiescseq.priv || t->csiescseq.submode) goto unknown;
+        DEFAULT(t->csiescseq.arg[0], 1);
+        tscrolldown(t, t->top, t->bot, t->csiescseq.arg[0], true);
         break;
     case 'L': /* IL -- Insert <n> blank lines */
-        if(csiescseq.priv || csiescseq.submode) goto unknown;
-        DEFAULT(csiescseq.arg[0], 1);
+        if(t->csiescseq.priv || t->csiescseq.submode) goto unknown;
+        DEFAULT(t->csiescseq.arg[0], 1);
         // insert blank lines is just scrolling down from cursor to the bottom
         /* no need to break line id because we're going to be pointing at a
            newly reset line */
-        tscrolldown(t, t->c.y, t->bot, csiescseq.arg[0], false);
+        tscrolldown(t, t->c.y, t->bot, t->csiescseq.arg[0], false);
         break;
     case 'l': /* RM -- Reset Mode */
-        if(csiescseq.priv && csiescseq.priv != '?') goto unknown;
-        if(csiescseq.submode) goto unknown;
-        tsetmode(t, csiescseq.priv, 0, csiescseq.arg, csiescseq.narg);
+        if(t->csiescseq.priv && t->csiescseq.priv != '?') goto unknown;
+        if(t->csiescseq.submode) goto unknown;
+        tsetmode(t, t->csiescseq.priv, 0, t->csiescseq.arg, t->csiescseq.narg);
         break;
     case 'M': /* DL -- Delete <n> lines */
-        if(csiescseq.priv || csiescseq.submode) goto unknown;
-        DEFAULT(csiescseq.arg[0], 1);
+        if(t->csiescseq.priv || t->csiescseq.submode) goto unknown;
+        DEFAULT(t->csiescseq.arg[0], 1);
         // delete lines is just scrolling up from cursor to the bottom
         /* no need to break line id because we're going to be pointing at a
            line which just got mod_line_group()'d */
-        tscrollup(t, t->c.y, t->bot, csiescseq.arg[0], false);
+        tscrollup(t, t->c.y, t->bot, t->csiescseq.arg[0], false);
         break;
     case 'X': /* ECH -- Erase <n> char */
-        if(csiescseq.priv || csiescseq.submode) goto unknown;
-        DEFAULT(csiescseq.arg[0], 1);
+        if(t->csiescseq.priv || t->csiescseq.submode) goto unknown;
+        DEFAULT(t->csiescseq.arg[0], 1);
         tclearregion_term(
-            t, t->c.x, t->c.y, t->c.x + csiescseq.arg[0] - 1, t->c.y
+            t, t->c.x, t->c.y, t->c.x + t->csiescseq.arg[0] - 1, t->c.y
         );
         break;
     case 'P': /* DCH -- Delete <n> char */
-        if(csiescseq.priv || csiescseq.submode) goto unknown;
-        DEFAULT(csiescseq.arg[0], 1);
-        tdeletechar(t, csiescseq.arg[0]);
+        if(t->csiescseq.priv || t->csiescseq.submode) goto unknown;
+        DEFAULT(t->csiescseq.arg[0], 1);
+        tdeletechar(t, t->csiescseq.arg[0]);
         break;
     case 'Z': /* CBT -- Cursor Backward Tabulation <n> tab stops */
-        if(csiescseq.priv || csiescseq.submode) goto unknown;
-        DEFAULT(csiescseq.arg[0], 1);
-        tputtab(t, -csiescseq.arg[0]);
+        if(t->csiescseq.priv || t->csiescseq.submode) goto unknown;
+        DEFAULT(t->csiescseq.arg[0], 1);
+        tputtab(t, -t->csiescseq.arg[0]);
         break;
     case 'd': /* VPA -- Move to <row> */
-        if(csiescseq.priv || csiescseq.submode) goto unknown;
-        DEFAULT(csiescseq.arg[0], 1);
-        tmoveto_origin(t, t->c.x, csiescseq.arg[0]-1, true);
+        if(t->csiescseq.priv || t->csiescseq.submode) goto unknown;
+        DEFAULT(t->csiescseq.arg[0], 1);
+        tmoveto_origin(t, t->c.x, t->csiescseq.arg[0]-1, true);
         break;
     case 'h': /* SM -- Set terminal mode */
-        if(csiescseq.priv && csiescseq.priv != '?') goto unknown;
-        if(csiescseq.submode) goto unknown;
-        tsetmode(t, csiescseq.priv, 1, csiescseq.arg, csiescseq.narg);
+        if(t->csiescseq.priv && t->csiescseq.priv != '?') goto unknown;
+        if(t->csiescseq.submode) goto unknown;
+        tsetmode(t, t->csiescseq.priv, 1, t->csiescseq.arg, t->csiescseq.narg);
         break;
     case 'm':
-        if(csiescseq.submode) goto unknown;
-        if(csiescseq.priv == '>'){
+        if(t->csiescseq.submode) goto unknown;
+        if(t->csiescseq.priv == '>'){
             // XTMODKEYS -- set/reset key modifier options
-            switch(csiescseq.arg[0]){
+            switch(t->csiescseq.arg[0]){
                 case 0: // modifyKeyboard
                 case 1: // modifyCursorKeys
                 case 2: // modifyFunctionKeys
                     goto unknown;
                 case 4: // modifyOtherKeys
-                    lvl = csiescseq.arg[1];
+                    lvl = t->csiescseq.arg[1];
                     if(lvl < 0 || lvl > 2) goto unknown;
                     t->modify_other = lvl;
                     break;
                 default:
                     goto unknown;
             }
-        }else if(csiescseq.priv == '?'){
+        }else if(t->csiescseq.priv == '?'){
             // Query key modifier options (XTQMODKEYS)
-            switch(csiescseq.arg[0]){
+            switch(t->csiescseq.arg[0]){
                 case 0: // modifyKeyboard
                 case 1: // modifyCursorKeys
                 case 2: // modifyFunctionKeys
                     goto unknown;
                 case 4: // modifyOtherKeys
-                    lvl = csiescseq.arg[1];
+                    lvl = t->csiescseq.arg[1];
                     if(lvl < 0 || lvl > 2) goto unknown;
                     lvl = t->modify_other;
                     break;
@@ -2523,43 +4602,43 @@ csihandle(Term *t)
                     goto unknown;
             }
             len = snprintf(
-                buf, sizeof(buf), "\x1b[>%d;%dm", csiescseq.arg[0], lvl
+                buf, sizeof(buf), "\x1b[>%d;%dm", t->csiescseq.arg[0], lvl
             );
             t->hooks->ttywrite(t->hooks, buf, len);
-        }else if(!csiescseq.priv){
+        }else if(!t->csiescseq.priv){
             // SGR -- Terminal attribute (color)
-            if(csiescseq.priv || csiescseq.submode) goto unknown;
-            tsetattr(t, csiescseq.arg, csiescseq.narg);
+            if(t->csiescseq.priv || t->csiescseq.submode) goto unknown;
+            tsetattr(t, t->csiescseq.arg, t->csiescseq.narg);
         }else{
             goto unknown;
         }
         break;
     case 'n': /* DSR – Device Status Report (cursor position) */
-        if(csiescseq.priv || csiescseq.submode) goto unknown;
-        if (csiescseq.arg[0] == 6) {
+        if(t->csiescseq.priv || t->csiescseq.submode) goto unknown;
+        if (t->csiescseq.arg[0] == 6) {
             len = snprintf(buf, sizeof(buf),"\033[%i;%iR", t->c.y+1, t->c.x+1);
             t->hooks->ttywrite(t->hooks, buf, len);
         }
         break;
     case 'r': /* DECSTBM -- Set Scrolling Region */
-        if(csiescseq.priv || csiescseq.submode) goto unknown;
-        DEFAULT(csiescseq.arg[0], 1);
-        DEFAULT(csiescseq.arg[1], t->row);
-        tscrollregion(t, csiescseq.arg[0]-1, csiescseq.arg[1]-1);
+        if(t->csiescseq.priv || t->csiescseq.submode) goto unknown;
+        DEFAULT(t->csiescseq.arg[0], 1);
+        DEFAULT(t->csiescseq.arg[1], t->row);
+        tscrollregion(t, t->csiescseq.arg[0]-1, t->csiescseq.arg[1]-1);
         tmoveto_origin(t, 0, 0, true);
         break;
     case 's': /* DECSC -- Save cursor position (ANSI.SYS) */
-        if(csiescseq.priv || csiescseq.submode) goto unknown;
+        if(t->csiescseq.priv || t->csiescseq.submode) goto unknown;
         tcursor(t, CURSOR_SAVE);
         break;
     case 'u': /* DECRC -- Restore cursor position (ANSI.SYS) */
-        if(csiescseq.priv || csiescseq.submode) goto unknown;
+        if(t->csiescseq.priv || t->csiescseq.submode) goto unknown;
         tcursor(t, CURSOR_LOAD);
         break;
     case 't': /* Window manipulation (XTWINOPS) */
-        if(csiescseq.priv || csiescseq.submode) goto unknown;
-        if(csiescseq.narg < 1) goto unknown;
-        switch(csiescseq.arg[0]){
+        if(t->csiescseq.priv || t->csiescseq.submode) goto unknown;
+        if(t->csiescseq.narg < 1) goto unknown;
+        switch(t->csiescseq.arg[0]){
             case 1: // de-iconify window
             case 2: // iconify window
             case 3: // (x, y) ->  Move window to [x, y]
@@ -2614,8 +4693,8 @@ csihandle(Term *t)
                 break;
 
             default:
-                if(csiescseq.arg[0] >= 24){
-                    // DECSLPP: resize to nrows=csiescseq.arg[0]
+                if(t->csiescseq.arg[0] >= 24){
+                    // DECSLPP: resize to nrows=t->csiescseq.arg[0]
                     // xterm adapts this by resizing its window
                 }else{
                     goto unknown;
@@ -2623,11 +4702,11 @@ csihandle(Term *t)
         }
         break;
     case 'q':
-        if(csiescseq.priv) goto unknown;
-        switch (csiescseq.submode) {
+        if(t->csiescseq.priv) goto unknown;
+        switch (t->csiescseq.submode) {
         case ' ':
             // DECSCUSR: Set Cursor Style:
-            if(tcursorstyle(t, csiescseq.arg[0]))
+            if(tcursorstyle(t, t->csiescseq.arg[0]))
                 goto unknown;
             break;
         default:
@@ -2635,15 +4714,15 @@ csihandle(Term *t)
         }
         break;
     case 'p':
-        if(csiescseq.submode != '$') goto unknown;
+        if(t->csiescseq.submode != '$') goto unknown;
         // DECRQM: request ansi mode / request dec private mode
-        lvl = tgetmode(t, csiescseq.priv, csiescseq.arg[0]);
+        lvl = tgetmode(t, t->csiescseq.priv, t->csiescseq.arg[0]);
         len = snprintf(
             buf,
             sizeof(buf),
             "\x1b[%s%d;%d$y",
-            csiescseq.priv?"?":"",
-            csiescseq.arg[0],
+            t->csiescseq.priv?"?":"",
+            t->csiescseq.arg[0],
             lvl
         );
         t->hooks->ttywrite(t->hooks, buf, len);
@@ -2652,21 +4731,21 @@ csihandle(Term *t)
     default:
     unknown:
         fprintf(stderr, "erresc: unknown csi ");
-        csidump(stderr);
+        csidump(t, stderr);
         /* die(""); */
         break;
     }
 }
 
 void
-csidump(FILE *f)
+csidump(Term *t, FILE *f)
 {
     size_t i;
     uint c;
 
     fprintf(f, "ESC[");
-    for (i = 0; i < csiescseq.len; i++) {
-        c = csiescseq.buf[i] & 0xff;
+    for (i = 0; i < t->csiescseq.len; i++) {
+        c = t->csiescseq.buf[i] & 0xff;
         if (isprint(c)) {
             putc(c, f);
         } else if (c == '\n') {
@@ -2683,9 +4762,9 @@ csidump(FILE *f)
 }
 
 void
-csireset(void)
+csireset(Term *t)
 {
-    memset(&csiescseq, 0, sizeof(csiescseq));
+    memset(&t->csiescseq, 0, sizeof(t->csiescseq));
 }
 
 const char*
@@ -2877,7 +4956,7 @@ dcshandle(Term *t, STREscape strescseq)
     }
 
     fprintf(stderr, "erresc: unknown DCS: ");
-    strdump();
+    strdump(t);
 }
 
 void
@@ -2887,22 +4966,27 @@ strhandle(Term *t)
     int narg, par;
 
     t->esc &= ~(ESC_STR_END|ESC_STR);
-    strparse();
-    par = (narg = strescseq.narg) ? atoi(strescseq.args[0]) : 0;
+    strparse(t);
+    par = (narg = t->strescseq.narg) ? atoi(t->strescseq.args[0]) : 0;
 
-    switch (strescseq.type) {
+    if (t->strescseq.type == ']')
+        t->stats.osc[BETWEEN(par, 0, TSTATS_OSC - 1) ? par : TSTATS_OSC]++;
+    else if (t->strescseq.type == 'P')
+        t->stats.dcs++;
+
+    switch (t->strescseq.type) {
     case ']': /* OSC -- Operating System Command */
         switch (par) {
         case 0:
         case 1:
         case 2:
             if (narg > 1)
-                t->hooks->set_title(t->hooks, strescseq.args[1]);
+                t->hooks->set_title(t->hooks, t->strescseq.args[1]);
             return;
         case 52:
             if (narg > 2) {
                 size_t len;
-                buf = base64dec(strescseq.args[2], &len);
+                buf = base64dec(t->strescseq.args[2], &len);
                 if (buf) {
                     die("OSC set clipboard command\n");
                 } else {
@@ -2915,10 +4999,10 @@ strhandle(Term *t)
 //         case 4: /* color set */
 //             if (narg < 3)
 //                 break;
-//             p = strescseq.args[2];
+//             p = t->strescseq.args[2];
 //             /* FALLTHROUGH */
 //         case 104: /* color reset, here p = NULL */
-//             j = (narg > 1) ? atoi(strescseq.args[1]) : -1;
+//             j = (narg > 1) ? atoi(t->strescseq.args[1]) : -1;
 //             if (xsetcolorname(j, p)) {
 //                 if (par == 104 && narg <= 1)
 //                     return; /* color reset without parameter */
@@ -2935,10 +5019,10 @@ strhandle(Term *t)
 //         }
 //         break;
     case 'k': /* old title set compatibility */
-        t->hooks->set_title(t->hooks, strescseq.args[0]);
+        t->hooks->set_title(t->hooks, t->strescseq.args[0]);
         return;
     case 'P': /* DCS -- Device Control String */
-        dcshandle(t, strescseq);
+        dcshandle(t, t->strescseq);
         return;
     case '_': /* APC -- Application Program Command */
     case '^': /* PM -- Privacy Message */
@@ -2946,24 +5030,24 @@ strhandle(Term *t)
     }
 
     fprintf(stderr, "erresc: unknown str ");
-    strdump();
+    strdump(t);
 }
 
 // see https://vt100.net/docs/vt510-rm/chapter4.html, section 4.3.4
 void
-strparse(void)
+strparse(Term *t)
 {
     int c;
-    char *p = strescseq.buf;
+    char *p = t->strescseq.buf;
 
-    strescseq.narg = 0;
-    strescseq.buf[strescseq.len] = '\0';
+    t->strescseq.narg = 0;
+    t->strescseq.buf[t->strescseq.len] = '\0';
 
     if (*p == '\0')
         return;
 
-    while (strescseq.narg < STR_ARG_SIZ) {
-        strescseq.args[strescseq.narg++] = p;
+    while (t->strescseq.narg < STR_ARG_SIZ) {
+        t->strescseq.args[t->strescseq.narg++] = p;
         while ((c = *p) != ';' && c != '\0')
             ++p;
         if (c == '\0')
@@ -2973,14 +5057,14 @@ strparse(void)
 }
 
 void
-strdump(void)
+strdump(Term *t)
 {
     size_t i;
     uint c;
 
-    fprintf(stderr, "ESC%c", strescseq.type);
-    for (i = 0; i < strescseq.len; i++) {
-        c = strescseq.buf[i] & 0xff;
+    fprintf(stderr, "ESC%c", t->strescseq.type);
+    for (i = 0; i < t->strescseq.len; i++) {
+        c = t->strescseq.buf[i] & 0xff;
         if (c == '\0') {
             putc('\n', stderr);
             return;
@@ -3000,10 +5084,10 @@ strdump(void)
 }
 
 void
-strreset(void)
+strreset(Term *t)
 {
-    strescseq = (STREscape){
-        .buf = xrealloc(strescseq.buf, STR_BUF_SIZ),
+    t->strescseq = (STREscape){
+        .buf = xrealloc(t->strescseq.buf, STR_BUF_SIZ),
         .siz = STR_BUF_SIZ,
     };
 }
@@ -3011,10 +5095,10 @@ strreset(void)
 void
 tprinter(Term *t, char *s, size_t len)
 {
-    if (iofd != -1 && xwrite(iofd, s, len) < 0) {
+    if (t->iofd != -1 && xwrite(t->iofd, s, len) < 0) {
         perror("Error writing to output file");
-        close(iofd);
-        iofd = -1;
+        close(t->iofd);
+        t->iofd = -1;
     }
 }
 
@@ -3126,7 +5210,7 @@ tdectest(Term *t, char c)
 void
 tstrsequence(Term *t, uchar c)
 {
-    strreset();
+    strreset(t);
 
     switch (c) {
     case 0x90:   /* DCS -- Device Control String */
@@ -3149,7 +5233,7 @@ tstrsequence(Term *t, uchar c)
         c = ']';
         break;
     }
-    strescseq.type = c;
+    t->strescseq.type = c;
     t->esc |= ESC_STR;
 }
 
@@ -3182,7 +5266,7 @@ tcontrolcode(Term *t, uchar ascii)
         }
         break;
     case '\033': /* ESC */
-        csireset();
+        csireset(t);
         t->esc &= ~(ESC_CSI|ESC_ALTCHARSET|ESC_TEST);
         t->esc |= ESC_START;
         return;
@@ -3193,7 +5277,7 @@ tcontrolcode(Term *t, uchar ascii)
     case '\032': /* SUB */
         tsetchar(t, '?', &t->c.attr, t->c.x, t->c.y);
     case '\030': /* CAN */
-        csireset();
+        csireset(t);
         break;
     case '\005': /* ENQ (IGNORED) */
     case '\000': /* NUL (IGNORED) */
@@ -3382,7 +5466,7 @@ tputc(Term *t, Rune u)
             return;
         }
 
-        if (strescseq.len+len >= strescseq.siz) {
+        if (t->strescseq.len+len >= t->strescseq.siz) {
             /*
              * Here is a bug in terminals. If the user never sends
              * some code to stop the str or esc command, then st
@@ -3396,14 +5480,14 @@ tputc(Term *t, Rune u)
              * t->esc = 0;
              * strhandle();
              */
-            if (strescseq.siz > (SIZE_MAX - UTF_SIZ) / 2)
+            if (t->strescseq.siz > (SIZE_MAX - UTF_SIZ) / 2)
                 return;
-            strescseq.siz *= 2;
-            strescseq.buf = xrealloc(strescseq.buf, strescseq.siz);
+            t->strescseq.siz *= 2;
+            t->strescseq.buf = xrealloc(t->strescseq.buf, t->strescseq.siz);
         }
 
-        memmove(&strescseq.buf[strescseq.len], c, len);
-        strescseq.len += len;
+        memmove(&t->strescseq.buf[t->strescseq.len], c, len);
+        t->strescseq.len += len;
         return;
     }
 
@@ -3412,17 +5496,20 @@ check_control_code:
        because they can be embedded inside a control sequence, and
        they must not cause conflicts with sequences. */
     if (control) {
+        t->stats.controls++;
         tcontrolcode(t, u);
         // control codes are not shown ever
         return;
     }
     if (t->esc & ESC_START) {
         if (t->esc & ESC_CSI) {
-            csiescseq.buf[csiescseq.len++] = u;
+            t->csiescseq.buf[t->csiescseq.len++] = u;
             if (BETWEEN(u, 0x40, 0x7E)
-                    || csiescseq.len >= sizeof(csiescseq.buf)-1) {
+                    || t->csiescseq.len >= sizeof(t->csiescseq.buf)-1) {
+                if (BETWEEN(u, 0x40, 0x7E))
+                    t->stats.csi[u - 0x40]++;
                 t->esc = 0;
-                csiparse();
+                csiparse(t);
                 csihandle(t);
             }
             return;
@@ -3447,6 +5534,7 @@ check_control_code:
     // }
 
     u = acsc(u, t->trantbl[t->charset]);
+    t->stats.printed++;
     temit(t, u, width);
 }
 
@@ -3470,13 +5558,13 @@ temit(Term *t, Rune u, int width)
     // TODO: handle double-width characters
 
     if(IS_SET(t, MODE_INSERT)){
-        rline_insert_glyph(rline, t->c.x, g);
         // break selection if it is on or after cursor
         temit_break_selection(t, t->c.x, term2abs(t, t->c.y), true);
+        rline_insert_glyph(rline, t->c.x, g);
     }else{
-        rline_set_glyph(rline, t->c.x, g);
         // break selection if it is on cursor
         temit_break_selection(t, t->c.x, term2abs(t, t->c.y), false);
+        rline_set_glyph(rline, t->c.x, g);
     }
 
     // {
@@ -3541,6 +5629,7 @@ twrite(Term *t, const char *buf, int buflen, int show_ctrl)
         }
         tputc(t, u);
     }
+    t->stats.parsed_bytes += n;
     return n;
 }
 
@@ -3702,7 +5791,10 @@ static Screen reflow(
         .cap = new_cap,
         .line_id = old.line_id,
         .start = 0,
-        .len = 0,
+        // spilled lines stay where they are, and the ring refills after them
+        .len = old.spilled,
+        .spill = old.spill,
+        .spilled = old.spilled,
     };
     size_t nbytes = (new.cap + 1) * sizeof(*new.rlines);
     new.rlines = xmalloc(nbytes);
@@ -3733,17 +5825,18 @@ static Screen reflow(
 
     // printf("COPY:\n");
     // copy each old rline into a new rline
-    for(size_t i = 0; i < old.len; i++){
+    for(size_t i = 0; i < old.len - old.spilled; i++){
         // get the next old rline ("o"ld)
         size_t idx = (old.start + i) % (old.cap + 1);
         RLine *o = old.rlines[idx];
+        if(o->packed) rline_unpack(o);
         // ignore id=0 lines, which are the initial empty lines
         if(!o->line_id){
             goto cu_rline;
         }
         // does this old_line have a different line_id than what we last saw?
         if(!n || old_line_id != o->line_id){
-            if(new.len == new.cap){
+            if(new.len == new.cap && !new.spill){
                 // cursor reflow: decrement the stored y_abs values
                 for(size_t i = 0; i < ncrs; i++){
                     cursor_reflow_decrement_y(crs[i]);
@@ -3760,7 +5853,7 @@ static Screen reflow(
             Glyph g = o->glyphs[j];
             // do we need a new rline?
             if(glyph_idx >= col){
-                if(new.len == new.cap){
+                if(new.len == new.cap && !new.spill){
                     // cursor reflow: decrement the stored y_abs values
                     for(size_t i = 0; i < ncrs; i++){
                         cursor_reflow_decrement_y(crs[i]);
@@ -3816,7 +5909,7 @@ static Screen reflow(
     free(old.rlines);
 
     // make sure we have at least enough rlines to fill the screen
-    while(new.len < row){
+    while(new.len - new.spilled < row){
         scr_new_rline(&new, NULL, 0, col);
     }
 
@@ -3835,7 +5928,8 @@ tresize(Term *t, int col, int row)
     int old_col = t->col;
 
     // TODO: reflow selection, don't break it
-    t->sel_type = 0;
+    tselclear(t);
+    tsearch_lose(t);
     t->pressed = false;
 
     tunrender(t);
@@ -3855,7 +5949,10 @@ tresize(Term *t, int col, int row)
         t->c, get_rline(&t->alt, term2abs(t, t->saved[1].y))
     );
 
+    uint64_t reflow_start = now_us();
+
     // reflow main screen first
+    if(t->main.spill) spill_resize(t->main.spill, col);
     {
         cursor_reflow_t *crs[] = {&cr_saved_main, NULL};
         size_t ncrs = 1;
@@ -3891,6 +5988,9 @@ tresize(Term *t, int col, int row)
         );
     }
 
+    t->stats.reflows++;
+    t->stats.reflow_us += now_us() - reflow_start;
+
     /* TODO: Deal with window_off at some point.
         - if window_off == 0, let it stay zero
         - otherwise try to keep the top line as the top line */
@@ -3958,11 +6058,24 @@ bool twindowmv(Term *t, int n){
         // cannot make t->row + window_off exceed scr->len
         (int)(t->scr->len - t->row - t->scr->window_off)
     );
-    if(!n) return false;
+    if(!n && !t->scr->window_frac) return false;
     tsetwindowoff(t, t->scr, t->scr->window_off + n);
     return true;
 }
 
+bool twindowscroll(Term *t, double n){
+    Screen *scr = t->scr;
+    size_t old_off = scr->window_off;
+    int old_dy = tscrolldy(t);
+    double pos = scr->window_off + scr->window_frac + n;
+    LIMIT(pos, 0, (double)(scr->len - t->row));
+    size_t off = (size_t)pos;
+    tsetwindowoff(t, scr, off);
+    scr->window_frac = pos - off;
+    // sub-pixel changes don't need a redraw
+    return off != old_off || tscrolldy(t) != old_dy;
+}
+
 //////
 
 // copy a WxH sub rectangle of the source image to x,y in the destination image
@@ -4031,12 +6144,24 @@ decr_y_with_x(size_t *y, size_t *x)
 // create a new rline in the ring buffer, discarding the oldest one as needed.
 RLine *scr_new_rline(Screen *scr, Term *t, uint64_t line_id, size_t cols){
     // is ring buffer full?
-    if(scr->len == scr->cap){
+    if(scr->len - scr->spilled == scr->cap && scr->spill){
+        // the oldest rline goes to disk, keeping its absolute index
+        scr_spill(scr, scr->rlines[scr->start]);
+        scr->rlines[scr->start] = NULL;
+        scr->start = (scr->start + 1) % (scr->cap + 1);
+    }else if(scr->len == scr->cap){
+        // a selection losing its first line has to be read out first
+        if(t && scr == t->scr && t->sel_type && !t->sel_yb) tselbreak(t);
         // free oldest rline
         rline_free(&scr->rlines[scr->start]);
+        if(t) t->stats.rlines_dropped++;
         // forget the oldest history element (start of the ring buffer)
         scr->start = rlines_idx(scr, 1);
         scr->len--;
+        scr->dropped++;
+        // the warm range is in absolute coordinates too
+        if(scr->warm_lo) scr->warm_lo--;
+        if(scr->warm_hi) scr->warm_hi--;
         if(t){
             // update all stored absoulte y coordinates
             decr_y_with_x(&t->last_press_y, &t->last_press_x);
@@ -4044,46 +6169,45 @@ RLine *scr_new_rline(Screen *scr, Term *t, uint64_t line_id, size_t cols){
             // if sel_ye would go negative, drop the whole selection
             size_t canary = 1;
             decr_y_with_x(&t->sel_ye, &canary);
-            if(!canary) t->sel_type = 0;
+            if(!canary){
+                t->sel_type = 0;
+                t->sel_gen++;
+                t->drag_known = false;
+            }
+            if(t->drag_known){
+                canary = 1;
+                decr_y_with_x(&t->drag_y, &canary);
+                t->drag_known = canary;
+            }
+            tsearch_shift(t, scr);
         }
     }
     // extend the buffer
     RLine *out = rline_new(cols, line_id);
+    if(t) t->stats.rlines_new++;
     scr->rlines[rlines_idx(scr, scr->len++)] = out;
 
     return out;
 
 }
 
-static fmt_overrides_t t_get_fmt_override(Term *t, int y_abs){
-    int cursor = INT_MIN;
-    if(term2abs(t, t->c.y) == y_abs){
-        cursor = t->c.x;
-        if(!t->focused){
-            cursor = -cursor - 1;
-        }
+/* Get the columns of the selection on a given line.  Returns false if the line
+   is not selected.  last is INT_MAX when the selection includes the EOL. */
+static bool t_get_sel_span(Term *t, size_t y_abs, int *first, int *last){
+    if(!t->sel_type || y_abs < t->sel_yb || y_abs > t->sel_ye) return false;
+    if(y_abs == t->sel_yb){
+        // this is the first line of the selection
+        *first = t->sel_xb;
+    }else{
+        *first = 0;
     }
-    int sel_first = -1;
-    int sel_last = -1;
-    if(t->sel_type && y_abs >= t->sel_yb && y_abs <= t->sel_ye){
-        if(y_abs == t->sel_yb){
-            // this is the first line of the selection
-            sel_first = t->sel_xb;
-        }else{
-            sel_first = 0;
-        }
-        if(y_abs < t->sel_ye || t->sel_eol){
-            sel_last = INT_MAX;
-        }else{
-            // final line of selection, and EOL is not selected
-            sel_last = t->sel_xe;
-        }
+    if(y_abs < t->sel_ye || t->sel_eol){
+        *last = INT_MAX;
+    }else{
+        // final line of selection, and EOL is not selected
+        *last = t->sel_xe;
     }
-    return (fmt_overrides_t){cursor, sel_first, sel_last};
-}
-
-static bool ovr_eq(fmt_overrides_t a, fmt_overrides_t b){
-    return memcmp(&a, &b, sizeof(a)) == 0;
+    return *first <= *last;
 }
 
 void swap_rgb(struct rgb24 *a, struct rgb24 *b){
@@ -4092,24 +6216,13 @@ void swap_rgb(struct rgb24 *a, struct rgb24 *b){
     *b = temp;
 }
 
-static Glyph calc_fmt(fmt_overrides_t ovr, Glyph g, size_t x){
+static Glyph calc_fmt(Glyph g){
     if(g.mode & ATTR_REVERSE){
         // handle reverse video here
         swap_rgb(&g.fg, &g.bg);
         // ok, it's handled now
         g.mode &= ~ATTR_REVERSE;
     }
-    if(ovr.sel_first > -1 && ovr.sel_last > -1){
-        // selection reverses its bg/fg
-        if(x >= (size_t)ovr.sel_first && x <= (size_t)ovr.sel_last){
-            swap_rgb(&g.fg, &g.bg);
-        }
-    }
-    if(ovr.cursor != INT_MIN && x == (size_t)ovr.cursor){
-        // white fg, bright red bg
-        g.fg = rgb24_from_index(7);
-        g.bg = rgb24_from_index(9);
-    }
     return g;
 }
 
@@ -4207,36 +6320,39 @@ double rline_subrender(
 }
 
 
-void rline_render(RLine *rline, rctx_t rctx, fmt_overrides_t ovr){
+/* pctx may be a pango context belonging to the calling thread, or NULL for a
+   fresh one */
+static void rline_render_ctx(RLine *rline, rctx_t rctx, PangoContext *pctx){
     // handle caching
-    if(rline->srfc){
-        if(ovr_eq(ovr, rline->last_ovr)){
-            // cached surface still valid
-            return;
-        }
-        // otherwise destroy it and rerender
-        rline_unrender(rline);
-    }
-    rline->last_ovr = ovr;
+    if(rline->srfc) return;
 
     rline->srfc = cairo_image_surface_create(
         CAIRO_FORMAT_RGB24, rctx.render_w, rctx.grid_h);
 
     // create cairo context and layout
     cairo_t *cr = cairo_create(rline->srfc);
-    PangoLayout *layout = pango_cairo_create_layout(cr);
+    PangoLayout *layout;
+    if(pctx){
+        pango_cairo_update_context(cr, pctx);
+        layout = pango_layout_new(pctx);
+    }else{
+        layout = pango_cairo_create_layout(cr);
+    }
 
     // set font
     pango_layout_set_font_description(layout, rctx.desc);
 
     double x = 0;
 
+    rline->blink = rline->glyphs[0].mode & ATTR_BLINK;
+
     // break up the text into multiple chunks of common font settings
-    Glyph fmt = calc_fmt(ovr, rline->glyphs[0], 0);
+    Glyph fmt = calc_fmt(rline->glyphs[0]);
     size_t start = 0;
     size_t i;
     for(i = 1; i < rline->n_glyphs; i++){
-        Glyph next_fmt = calc_fmt(ovr, rline->glyphs[i], i);
+        rline->blink |= !!(rline->glyphs[i].mode & ATTR_BLINK);
+        Glyph next_fmt = calc_fmt(rline->glyphs[i]);
         if(!format_eq(fmt, next_fmt)){
             // found a different format, i-1 was the end of the render box
             x = rline_subrender(rline, rctx, cr, layout, x, start, i, fmt);
@@ -4248,31 +6364,14 @@ void rline_render(RLine *rline, rctx_t rctx, fmt_overrides_t ovr){
     // render the final chunk
     rline_subrender(rline, rctx, cr, layout, x, start, rline->n_glyphs, fmt);
 
-    // if screen is not focused, draw a box instead of a cursor
-    if(ovr.cursor != INT_MIN && ovr.cursor < 0){
-        // pick cursor color
-        cairo_set_source_rgb(cr, rgb24_from_index(9).r/255., 0, 0);
-        // pick a line width
-        double line_width = rctx.font_size / 10.;
-        if(line_width < 1.0) line_width = 1.0;
-        cairo_set_line_width(cr, line_width);
-        // nudge coordinates to make outside of stroke match cursor dimensions
-        double d = line_width / 2;
-        double dd = line_width;
-        int cursor = -(ovr.cursor + 1);
-        cairo_rectangle(cr,
-            cursor * rctx.grid_w + d, // x
-            d,                        // y
-            rctx.grid_w - dd,         // width
-            rctx.grid_h - dd          // height
-        );
-        cairo_stroke(cr);
-    }
-
     g_object_unref(layout);
     cairo_destroy(cr);
 }
 
+void rline_render(RLine *rline, rctx_t rctx){
+    rline_render_ctx(rline, rctx, NULL);
+}
+
 void rline_unrender(RLine *rline){
     if(!rline->srfc) return;
     cairo_surface_destroy(rline->srfc);
@@ -4329,16 +6428,338 @@ void rline_set_glyph(RLine *rline, size_t idx, Glyph g){
     rline_unrender(rline);
 }
 
-// delete any rendered artifacts but leave the text alone
-void tunrender(Term *t){
-    for(size_t i = 0; i < t->main.len; i++){
-        rline_unrender(get_rline(&t->main, i));
+/* blink overlay: in the hidden phase, cover blinking cells with their own
+   background color rather than rerendering the line without them */
+static void tdraw_blink_mask(
+    RLine *rline, rctx_t rctx, cairo_t *cr, size_t line_offset
+){
+    double y = rctx.grid_h * line_offset;
+    size_t i = 0;
+    while(i < rline->n_glyphs){
+        if(!(rline->glyphs[i].mode & ATTR_BLINK)){
+            i++;
+            continue;
+        }
+        // cover one run of matching background color
+        struct rgb24 bg = calc_fmt(rline->glyphs[i]).bg;
+        size_t start = i++;
+        while(
+            i < rline->n_glyphs
+            && (rline->glyphs[i].mode & ATTR_BLINK)
+            && rgb24_eq(calc_fmt(rline->glyphs[i]).bg, bg)
+        ) i++;
+        cairo_set_source_rgb(cr, bg.r / 255., bg.g / 255., bg.b / 255.);
+        cairo_rectangle(
+            cr, rctx.grid_w * start, y, rctx.grid_w * (i - start), rctx.grid_h
+        );
+        cairo_fill(cr);
+    }
+}
+
+/* selection overlay: invert the colors of the selected cells by drawing white
+   with the DIFFERENCE operator, which reads only the composited pixels */
+// add the rectangle for one line's span of the selection
+static void sel_rect(rctx_t rctx, cairo_t *cr, int first, int last, double y){
+    double x1 = first * rctx.grid_w;
+    double x2 = rctx.render_w;
+    if(last != INT_MAX) x2 = MIN(x2, (last + 1) * rctx.grid_w);
+    cairo_rectangle(cr, x1, y, x2 - x1, rctx.grid_h);
+}
+
+// (above is how many lines above the window are also showing)
+static void tdraw_selection(Term *t, rctx_t rctx, cairo_t *cr, size_t above){
+    if(!t->sel_type) return;
+    cairo_save(cr);
+    cairo_set_operator(cr, CAIRO_OPERATOR_DIFFERENCE);
+    cairo_set_source_rgb(cr, 1, 1, 1);
+    size_t top = window2abs(t, 0) - above;
+    for(size_t i = 0; i < t->row + above; i++){
+        int first, last;
+        if(!t_get_sel_span(t, top + i, &first, &last)) continue;
+        sel_rect(rctx, cr, first, last, rctx.grid_h * ((double)i - above));
+    }
+    cairo_fill(cr);
+    cairo_restore(cr);
+}
+
+/* search overlay: the current match is tinted, over the selection, so it
+   stands out wherever the window lands */
+static void match_begin(cairo_t *cr){
+    cairo_save(cr);
+    struct rgb24 rgb = rgb24_from_index(11);
+    cairo_set_source_rgba(cr, rgb.r / 255., rgb.g / 255., rgb.b / 255., 0.45);
+}
+
+static void match_end(cairo_t *cr){
+    cairo_fill(cr);
+    cairo_restore(cr);
+}
+
+static void tdraw_match(Term *t, rctx_t rctx, cairo_t *cr, size_t above){
+    TMatch m;
+    if(!tsearchmatch(t, &m)) return;
+    match_begin(cr);
+    size_t top = window2abs(t, 0) - above;
+    for(size_t i = 0; i < t->row + above; i++){
+        int first, last;
+        if(!t_get_match_span(t, top + i, &first, &last)) continue;
+        sel_rect(rctx, cr, first, last, rctx.grid_h * ((double)i - above));
+    }
+    match_end(cr);
+}
+
+/* draw a cursor of some style at some pixel position; g is the glyph under the
+   cursor, and *crlp caches the rendered block cursor */
+static void draw_cursor(
+    rctx_t rctx,
+    cairo_t *cr,
+    RLine **crlp,
+    double x,
+    double y,
+    Glyph g,
+    enum cursor_style style,
+    bool focused
+){
+    // pick a line width
+    double line_width = rctx.font_size / 10.;
+    if(line_width < 1.0) line_width = 1.0;
+
+    // cursor color is bright red
+    struct rgb24 rgb = rgb24_from_index(9);
+
+    cairo_save(cr);
+    cairo_set_source_rgb(cr, rgb.r / 255., rgb.g / 255., rgb.b / 255.);
+
+    // if screen is not focused, draw a box instead of a cursor
+    if(!focused){
+        cairo_set_line_width(cr, line_width);
+        // nudge coordinates to make outside of stroke match cursor dimensions
+        double d = line_width / 2;
+        double dd = line_width;
+        cairo_rectangle(cr, x + d, y + d, rctx.grid_w - dd, rctx.grid_h - dd);
+        cairo_stroke(cr);
+        cairo_restore(cr);
+        return;
+    }
+
+    switch(style){
+        case CURSOR_UNDRLN_BLINK:
+        case CURSOR_UNDRLN_SOLID:
+            cairo_rectangle(
+                cr, x, y + rctx.grid_h - line_width, rctx.grid_w, line_width
+            );
+            cairo_fill(cr);
+            break;
+
+        case CURSOR_BAR_BLINK:
+        case CURSOR_BAR_SOLID:
+            cairo_rectangle(cr, x, y, line_width, rctx.grid_h);
+            cairo_fill(cr);
+            break;
+
+        // the initial cursor_style of 0 is a solid block
+        default: {
+            // block cursor: white fg, bright red bg
+            g.mode &= ~ATTR_REVERSE;
+            g.fg = rgb24_from_index(7);
+            g.bg = rgb;
+            if(!*crlp) *crlp = rline_new(1, 0);
+            RLine *crl = *crlp;
+            if(crl->glyphs[0].u != g.u || !format_eq(crl->glyphs[0], g)){
+                rline_set_glyph(crl, 0, g);
+            }
+            rctx_t cctx = rctx;
+            cctx.render_w = rctx.grid_w;
+            rline_render(crl, cctx);
+            copy_rectangle(cr, crl->srfc, x, y, rctx.grid_w, rctx.grid_h);
+        } break;
+    }
+    cairo_restore(cr);
+}
+
+/* cursor overlay: the block cursor needs its glyph redrawn in the cursor
+   colors, which is cached in a one-glyph rline; the other shapes are just
+   rectangles drawn over the line surface */
+static void tdraw_cursor(Term *t, rctx_t rctx, cairo_t *cr){
+    size_t y_abs = term2abs(t, t->c.y);
+    size_t y_win = abs2window(t, y_abs);
+    // is the cursor scrolled out of the window?
+    if(y_win >= (size_t)t->row) return;
+
+    if(t->focused && tcursorblinks(t)){
+        t->blinking = true;
+        // is the cursor in the hidden phase of its blink?
+        if(IS_SET(t, MODE_BLINK)) return;
+    }
+
+    Glyph g = get_cursor_rline(t)->glyphs[t->c.x];
+    draw_cursor(
+        rctx,
+        cr,
+        &t->cursor_rline,
+        t->c.x * rctx.grid_w,
+        y_win * rctx.grid_h,
+        g,
+        t->cursor_style,
+        t->focused
+    );
+}
+
+// make a render context
+static rctx_t trctx(Term *t){
+    return (rctx_t){
+        .grid_w = t->grid_w,
+        .grid_h = t->grid_h,
+        .render_w = t->render_w,
+        .font_size = t->font_size,
+        .desc = t->desc,
+    };
+}
+
+bool tprerender(Term *t, int max_lines){
+    // nothing to match until the first trender()
+    if(!t->render_w) return false;
+
+    Screen *scr = t->scr;
+    tsetwarm(t, scr);
+    size_t wlo = scrwin2abs(t, scr, 0);
+    size_t whi = scrwin2abs(t, scr, t->row);
+    rctx_t rctx = trctx(t);
+    int n = 0;
+
+    // work outwards from the window, alternating above and below
+    for(size_t d = 1; ; d++){
+        bool above = d <= wlo && wlo - d >= scr->warm_lo;
+        bool below = whi - 1 + d < scr->warm_hi;
+        if(!above && !below) return false;
+        RLine *rlines[2] = {
+            above ? get_rline(scr, wlo - d) : NULL,
+            below ? get_rline(scr, whi - 1 + d) : NULL,
+        };
+        for(size_t i = 0; i < 2; i++){
+            if(!rlines[i] || rlines[i]->srfc) continue;
+            if(n == max_lines) return true;
+            rline_render(rlines[i], rctx);
+            t->stats.draw.rendered++;
+            n++;
+        }
+    }
+}
+
+// the workers, started the first time they're wanted; NULL if they can't be
+static pool_t *rpool_start(rpool_t *rp){
+    if(rp->pool || rp->failed) return rp->pool;
+    rp->pool = pool_new(0);
+    if(!rp->pool){
+        // don't try again every frame
+        rp->failed = true;
+        return NULL;
+    }
+    size_t npctx = pool_size(rp->pool);
+    rp->pctx = xmalloc(npctx * sizeof(*rp->pctx));
+    memset(rp->pctx, 0, npctx * sizeof(*rp->pctx));
+    return rp->pool;
+}
+
+typedef struct {
+    RLine **rlines;
+    rctx_t rctx;
+    PangoContext **pctx;
+} render_job_t;
+
+static void render_job_fn(void *arg, size_t i, int worker){
+    render_job_t *job = arg;
+    // pango's default fontmap is per-thread, so each worker needs a context
+    if(!job->pctx[worker]){
+        PangoFontMap *fontmap = pango_cairo_font_map_get_default();
+        job->pctx[worker] = pango_font_map_create_context(fontmap);
+    }
+    rline_render_ctx(job->rlines[i], job->rctx, job->pctx[worker]);
+}
+
+/* Rasterize the dirty lines among n lines.  Every line has its own surface,
+   so when there are enough of them they are split across the worker pool,
+   leaving only compositing to the calling thread. */
+static void render_lines(
+    rpool_t *rp, rctx_t rctx, RLine **rlines, size_t n, TDrawStats *ds
+){
+    RLine **dirty = xmalloc(n * sizeof(*dirty));
+    size_t ndirty = 0;
+    for(size_t i = 0; i < n; i++){
+        if(!rlines[i]->srfc) dirty[ndirty++] = rlines[i];
+    }
+    ds->rendered += ndirty;
+    ds->misses += ndirty;
+    ds->hits += n - ndirty;
+
+    if(ndirty >= RENDER_PARALLEL_MIN && rpool_start(rp)){
+        render_job_t job = { .rlines = dirty, .rctx = rctx, .pctx = rp->pctx };
+        pool_run(rp->pool, ndirty, render_job_fn, &job);
+    }else{
+        for(size_t i = 0; i < ndirty; i++){
+            rline_render(dirty[i], rctx);
+        }
+    }
+
+    free(dirty);
+}
+
+static void rpool_free(rpool_t *rp){
+    if(!rp->pool) return;
+    for(int i = 0; i < pool_size(rp->pool); i++){
+        if(rp->pctx[i]) g_object_unref(rp->pctx[i]);
+    }
+    free(rp->pctx);
+    pool_free(rp->pool);
+    *rp = (rpool_t){0};
+}
+
+static void trender_lines(Term *t, rctx_t rctx, size_t y_abs, size_t n){
+    RLine **rlines = xmalloc(n * sizeof(*rlines));
+    for(size_t i = 0; i < n; i++){
+        rlines[i] = get_rline(t->scr, y_abs + i);
+    }
+    render_lines(&t->rpool, rctx, rlines, n, &t->stats.draw);
+    free(rlines);
+}
+
+void tsetsize(Term *t, double w, double h){
+    if(
+        w == t->render_w && h == t->render_h
+        && t->render_grid_w == t->grid_w
+        && t->render_grid_h == t->grid_h
+    ) return;
+    // delete old rendering
+    tunrender(t);
+    t->render_w = w;
+    t->render_h = h;
+    t->render_grid_w = t->grid_w;
+    t->render_grid_h = t->grid_h;
+    // resize the teriminal?
+    int col = t->render_w / t->grid_w;
+    int row = t->render_h / t->grid_h;
+    if(col != t->col || row != t->row){
+        // printf("resize due to render(%f, %f)\n", w, h);
+        tresize(t, col, row);
     }
-    for(size_t i = 0; i < t->alt.len; i++){
-        rline_unrender(get_rline(&t->alt, i));
+}
+
+static void scr_unrender(Screen *scr){
+    if(scr->spilled) spill_unrender(scr->spill);
+    for(size_t i = scr->spilled; i < scr->len; i++){
+        // a packed line was never rendered, and needn't be unpacked now
+        RLine *rline = scr->rlines[rlines_idx(scr, i)];
+        if(!rline->packed) rline_unrender(rline);
     }
 }
 
+// delete any rendered artifacts but leave the text alone
+void tunrender(Term *t){
+    if(t->cursor_rline) rline_unrender(t->cursor_rline);
+    scr_unrender(&t->main);
+    scr_unrender(&t->alt);
+}
+
 void trender(
     Term *t,
     cairo_t *cr,
@@ -4351,54 +6772,344 @@ void trender(
 ){
     // TODO: only rerender the dirty parts
     (void)x1; (void)y1; (void)x2; (void)y2;
+    tsetsize(t, w, h);
+    // draw the slice at the bottom
+    double ybot = t->grid_h * t->row;
+    if(ybot < h){
+        cairo_move_to(cr, 0, ybot);
+        struct rgb24 rgb = defaultbg;
+        cairo_set_source_rgb(cr, rgb.r / 255., rgb.g / 255., rgb.b / 255.);
+        cairo_rectangle(cr, 0, ybot, w, h - ybot);
+        cairo_fill(cr);
+    }
+
+    // output may have moved the window, drop surfaces that are now too far
+    tsetwarm(t, t->scr);
+
+    rctx_t rctx = trctx(t);
+
+    /* a smooth scroll shifts everything down by dy pixels, and the line above
+       the window peeks in at the top */
+    int dy = tscrolldy(t);
+    size_t above = dy ? 1 : 0;
+    size_t top = window2abs(t, 0) - above;
+
+    cairo_save(cr);
+    if(dy){
+        // the bottom slice might be showing through now
+        cairo_rectangle(cr, 0, 0, w, MIN(ybot, h));
+        cairo_clip(cr);
+    }
+    cairo_translate(cr, 0, dy - rctx.grid_h * (double)above);
+
+    // render any lines that aren't cached already
+    trender_lines(t, rctx, top, t->row + above);
+
+    t->blinking = false;
+    for(size_t i = 0; i < t->row + above; i++){
+        RLine *rline = get_rline(t->scr, top + i);
+        // draw this line onto the cairo surface
+        rline_draw(rline, rctx, cr, i);
+        // hide blinking cells, if they're in the hidden phase
+        if(rline->blink){
+            t->blinking = true;
+            if(IS_SET(t, MODE_BLINK)) tdraw_blink_mask(rline, rctx, cr, i);
+        }
+    }
+
+    // overlays go on top of the unmodified line surfaces
+    cairo_translate(cr, 0, rctx.grid_h * (double)above);
+    tdraw_selection(t, rctx, cr, above);
+    tdraw_match(t, rctx, cr, above);
+    tdraw_cursor(t, rctx, cr);
+    cairo_restore(cr);
+}
+
+/* Detached frames: a copy of everything trender() would draw, so the thread
+   that owns the Term can hand frames to another thread for drawing. */
+
+struct TFrame {
+    rctx_t rctx; // rctx.desc is owned by the frame
+    int row;
+    int dy;
+    // copies of the lines to draw, starting with the partial line, if any
+    RLine **rlines;
+    size_t nlines;
+    size_t cap;
+    // the selected span of each line, or sel_first = -1
+    int *sel_first;
+    int *sel_last;
+    // and the search match's, or match_first = -1
+    int *match_first;
+    int *match_last;
+    // cursor_line = -1 when the cursor is out of the window
+    int cursor_line;
+    int cursor_col;
+    Glyph cursor_glyph;
+    enum cursor_style cursor_style;
+    bool cursor_blinks;
+    bool focused;
+};
+
+struct TFrameCache {
+    rctx_t rctx; // rctx.desc is owned by the cache
+    // lines from the last frame, with their surfaces
+    RLine **rlines;
+    size_t nlines;
+    RLine *cursor_rline;
+    rpool_t rpool;
+    TDrawStats stats;
+};
+
+TFrame *tframe_new(void){
+    TFrame *f = xmalloc(sizeof(*f));
+    *f = (TFrame){ .cursor_line = -1 };
+    return f;
+}
+
+void tframe_free(TFrame *f){
+    if(!f) return;
+    for(size_t i = 0; i < f->cap; i++){
+        rline_free(&f->rlines[i]);
+    }
+    free(f->rlines);
+    free(f->sel_first);
+    free(f->sel_last);
+    free(f->match_first);
+    free(f->match_last);
+    if(f->rctx.desc) pango_font_description_free(f->rctx.desc);
+    free(f);
+}
+
+void tframe_capture(Term *t, TFrame *f){
+    rctx_t rctx = trctx(t);
+    if(f->rctx.desc && pango_font_description_equal(f->rctx.desc, t->desc)){
+        rctx.desc = f->rctx.desc;
+    }else{
+        if(f->rctx.desc) pango_font_description_free(f->rctx.desc);
+        rctx.desc = pango_font_description_copy(t->desc);
+    }
+    f->rctx = rctx;
+    f->row = t->row;
+    f->dy = tscrolldy(t);
+
+    size_t above = f->dy ? 1 : 0;
+    size_t n = t->row + above;
+    if(n > f->cap){
+        f->rlines = xrealloc(f->rlines, n * sizeof(*f->rlines));
+        f->sel_first = xrealloc(f->sel_first, n * sizeof(*f->sel_first));
+        f->sel_last = xrealloc(f->sel_last, n * sizeof(*f->sel_last));
+        f->match_first = xrealloc(f->match_first, n * sizeof(*f->match_first));
+        f->match_last = xrealloc(f->match_last, n * sizeof(*f->match_last));
+        for(size_t i = f->cap; i < n; i++) f->rlines[i] = NULL;
+        f->cap = n;
+    }
+    f->nlines = n;
+
+    size_t top = window2abs(t, 0) - above;
+    for(size_t i = 0; i < n; i++){
+        RLine *src = get_rline(t->scr, top + i);
+        if(f->rlines[i] && f->rlines[i]->n_glyphs != src->n_glyphs){
+            rline_free(&f->rlines[i]);
+        }
+        if(!f->rlines[i]) f->rlines[i] = rline_new(src->n_glyphs, 0);
+        RLine *dst = f->rlines[i];
+        memcpy(dst->glyphs, src->glyphs, src->n_glyphs * sizeof(*dst->glyphs));
+        dst->line_id = src->line_id;
+        dst->maxwritten = src->maxwritten;
+
+        int first, last;
+        if(t->sel_type && t_get_sel_span(t, top + i, &first, &last)){
+            f->sel_first[i] = first;
+            f->sel_last[i] = last;
+        }else{
+            f->sel_first[i] = -1;
+        }
+        if(t_get_match_span(t, top + i, &first, &last)){
+            f->match_first[i] = first;
+            f->match_last[i] = last;
+        }else{
+            f->match_first[i] = -1;
+        }
+    }
+
+    f->cursor_line = -1;
+    size_t y_win = abs2window(t, term2abs(t, t->c.y));
+    if(y_win < (size_t)t->row){
+        f->cursor_line = y_win + above;
+        f->cursor_col = t->c.x;
+        f->cursor_glyph = get_cursor_rline(t)->glyphs[t->c.x];
+    }
+    f->cursor_style = t->cursor_style;
+    f->cursor_blinks = tcursorblinks(t);
+    f->focused = t->focused;
+}
+
+TFrameCache *tframecache_new(void){
+    TFrameCache *c = xmalloc(sizeof(*c));
+    *c = (TFrameCache){0};
+    return c;
+}
+
+TDrawStats tframecache_stats(TFrameCache *c){
+    return c->stats;
+}
+
+void tframecache_free(TFrameCache *c){
+    if(!c) return;
+    for(size_t i = 0; i < c->nlines; i++){
+        rline_free(&c->rlines[i]);
+    }
+    free(c->rlines);
+    rline_free(&c->cursor_rline);
+    if(c->rctx.desc) pango_font_description_free(c->rctx.desc);
+    rpool_free(&c->rpool);
+    free(c);
+}
+
+static bool rline_same(RLine *a, RLine *b){
+    if(!a || a->line_id != b->line_id || a->n_glyphs != b->n_glyphs){
+        return false;
+    }
+    return !memcmp(a->glyphs, b->glyphs, a->n_glyphs * sizeof(*a->glyphs));
+}
+
+// build the cache's lines for a new frame, keeping any unchanged surfaces
+static void tframecache_update(TFrameCache *c, TFrame *f){
+    RLine **rlines = xmalloc(f->nlines * sizeof(*rlines));
+    // lines tend to move together, so try the last line's offset first
+    ptrdiff_t shift = 0;
+    for(size_t i = 0; i < f->nlines; i++){
+        RLine *src = f->rlines[i];
+        ptrdiff_t j = (ptrdiff_t)i + shift;
+        bool hit = j >= 0 && (size_t)j < c->nlines
+                && rline_same(c->rlines[j], src);
+        for(j = hit ? j : 0; !hit && (size_t)j < c->nlines; j++){
+            hit = rline_same(c->rlines[j], src);
+            if(hit) break;
+        }
+        if(hit){
+            shift = j - (ptrdiff_t)i;
+            rlines[i] = c->rlines[j];
+            c->rlines[j] = NULL;
+            continue;
+        }
+        RLine *dst = rline_new(src->n_glyphs, src->line_id);
+        memcpy(dst->glyphs, src->glyphs, src->n_glyphs * sizeof(*dst->glyphs));
+        dst->maxwritten = src->maxwritten;
+        rlines[i] = dst;
+    }
+    for(size_t i = 0; i < c->nlines; i++){
+        rline_free(&c->rlines[i]);
+    }
+    free(c->rlines);
+    c->rlines = rlines;
+    c->nlines = f->nlines;
+}
+
+bool tframe_render(
+    TFrameCache *c,
+    TFrame *f,
+    cairo_t *cr,
+    double w,
+    double h,
+    bool blink_hidden
+){
+    if(!f){
+        // nothing to show yet
+        struct rgb24 rgb = defaultbg;
+        cairo_set_source_rgb(cr, rgb.r / 255., rgb.g / 255., rgb.b / 255.);
+        cairo_rectangle(cr, 0, 0, w, h);
+        cairo_fill(cr);
+        return false;
+    }
+
+    // a new font or width invalidates every cached surface
     if(
-        w != t->render_w || h != t->render_h
-        || t->render_grid_w != t->grid_w
-        || t->render_grid_h != t->grid_h
+        !c->rctx.desc
+        || c->rctx.grid_w != f->rctx.grid_w
+        || c->rctx.grid_h != f->rctx.grid_h
+        || c->rctx.render_w != f->rctx.render_w
+        || c->rctx.font_size != f->rctx.font_size
+        || !pango_font_description_equal(c->rctx.desc, f->rctx.desc)
     ){
-        // delete old rendering
-        tunrender(t);
-        t->render_w = w;
-        t->render_h = h;
-        t->render_grid_w = t->grid_w;
-        t->render_grid_h = t->grid_h;
-        // resize the teriminal?
-        int col = t->render_w / t->grid_w;
-        int row = t->render_h / t->grid_h;
-        if(col != t->col || row != t->row){
-            // printf("resize due to render(%f, %f)\n", w, h);
-            tresize(t, col, row);
+        for(size_t i = 0; i < c->nlines; i++){
+            rline_unrender(c->rlines[i]);
         }
+        if(c->cursor_rline) rline_unrender(c->cursor_rline);
+        if(c->rctx.desc) pango_font_description_free(c->rctx.desc);
+        c->rctx = f->rctx;
+        c->rctx.desc = pango_font_description_copy(f->rctx.desc);
     }
+    rctx_t rctx = c->rctx;
+
+    tframecache_update(c, f);
+    render_lines(&c->rpool, rctx, c->rlines, c->nlines, &c->stats);
+
     // draw the slice at the bottom
-    double ybot = t->grid_h * t->row;
+    double ybot = rctx.grid_h * f->row;
     if(ybot < h){
-        cairo_move_to(cr, 0, ybot);
         struct rgb24 rgb = defaultbg;
         cairo_set_source_rgb(cr, rgb.r / 255., rgb.g / 255., rgb.b / 255.);
         cairo_rectangle(cr, 0, ybot, w, h - ybot);
         cairo_fill(cr);
     }
 
-    // make a render context
-    rctx_t rctx = {
-        .grid_w = t->grid_w,
-        .grid_h = t->grid_h,
-        .render_w = t->render_w,
-        .font_size = t->font_size,
-        .desc = t->desc,
-    };
+    cairo_save(cr);
+    if(f->dy){
+        cairo_rectangle(cr, 0, 0, w, MIN(ybot, h));
+        cairo_clip(cr);
+        cairo_translate(cr, 0, f->dy - rctx.grid_h);
+    }
 
-    for(size_t i = 0; i < t->row; i++){
-        size_t y_abs = window2abs(t, i);
-        RLine *rline = get_rline(t->scr, y_abs);
-        // capture any format overrides
-        fmt_overrides_t ovr = t_get_fmt_override(t, y_abs);
-        // render this line
-        rline_render(rline, rctx, ovr);
-        // draw this line onto the cairo surface
+    bool blinking = false;
+    for(size_t i = 0; i < c->nlines; i++){
+        RLine *rline = c->rlines[i];
         rline_draw(rline, rctx, cr, i);
+        if(rline->blink){
+            blinking = true;
+            if(blink_hidden) tdraw_blink_mask(rline, rctx, cr, i);
+        }
+    }
+
+    cairo_save(cr);
+    cairo_set_operator(cr, CAIRO_OPERATOR_DIFFERENCE);
+    cairo_set_source_rgb(cr, 1, 1, 1);
+    for(size_t i = 0; i < f->nlines; i++){
+        if(f->sel_first[i] < 0) continue;
+        sel_rect(rctx, cr, f->sel_first[i], f->sel_last[i], rctx.grid_h * i);
+    }
+    cairo_fill(cr);
+    cairo_restore(cr);
+
+    match_begin(cr);
+    for(size_t i = 0; i < f->nlines; i++){
+        if(f->match_first[i] < 0) continue;
+        sel_rect(
+            rctx, cr, f->match_first[i], f->match_last[i], rctx.grid_h * i
+        );
+    }
+    match_end(cr);
+
+    if(f->cursor_line >= 0){
+        bool blinks = f->focused && f->cursor_blinks;
+        blinking |= blinks;
+        if(!(blinks && blink_hidden)){
+            draw_cursor(
+                rctx,
+                cr,
+                &c->cursor_rline,
+                f->cursor_col * rctx.grid_w,
+                f->cursor_line * rctx.grid_h,
+                f->cursor_glyph,
+                f->cursor_style,
+                f->focused
+            );
+        }
     }
+
+    cairo_restore(cr);
+    return blinking;
 }
 
 // get the 24-bit color value from an ansi color index
@@ -3,6 +3,7 @@
 #include <stdint.h>
 #include <sys/types.h>
 #include <stdbool.h>
+#include <stdio.h>
 
 #include <cairo.h>
 #include <pango/pangocairo.h>
@@ -93,25 +94,23 @@ typedef struct {
 
 // typedef Glyph* Line;
 
-// format overrides alter how an rline renders without altering the content
-typedef struct {
-    // negative index - 1 for 'present but not focused'
-    // INT_MIN for 'not present'
-    int cursor;
-    int sel_first;
-    int sel_last;
-} fmt_overrides_t;
-
-// render line, one line of rendered text
+/* render line, one line of rendered text.  The cached surface only ever
+   reflects the glyphs; the cursor and selection are composited on top of it
+   at draw time, so moving them never invalidates the surface. */
 typedef struct {
     cairo_surface_t *srfc;
-    fmt_overrides_t last_ovr;
     Glyph *glyphs;
     size_t n_glyphs;
     // consecutive physical lines of matching line_id form a logical line.
     uint64_t line_id;
     // gline length is based on furthest nondefault char
     uint64_t maxwritten;
+    // does any glyph have ATTR_BLINK?  (only valid while srfc is rendered)
+    bool blink;
+    /* a restored line whose glyphs are still encoded in the snapshot; they
+       are decoded (and this is cleared) the first time the line is used */
+    const char *packed;
+    uint32_t packed_len;
 } RLine;
 
 struct THooks;
@@ -131,6 +130,14 @@ struct THooks {
     // clipboard=0 -> primary
     // clipboard=1 -> clipboard
     void (*set_clipboard)(THooks*, char *buf, size_t len, int clipboard);
+    /* optional: the selection is offered to a clipboard, without its text,
+       which is read with tclipboardread() only if someone asks for it.
+       Without this hook, selections are encoded up front and handed to
+       set_clipboard(). */
+    void (*offer_clipboard)(THooks*, int clipboard);
+    /* optional, with offer_clipboard: the Term took an offer back by itself
+       (its selection went away), so whoever answers for it can let go */
+    void (*drop_clipboard)(THooks*, int clipboard);
 };
 
 typedef union {
@@ -153,7 +160,7 @@ void tnew(
     Term **tout,
     int col,
     int row,
-    char *font_name,
+    char *font_name, // NULL for a headless Term, which can't be rendered
     int font_size,
     char *delims,
     THooks *hooks
@@ -161,21 +168,210 @@ void tnew(
 // child process must already be gone
 void tfree(Term *t);
 int trows(Term *t);
+int tcols(Term *t);
+// the glyphs of row y of the terminal (ignoring any scrolled-back window)
+const Glyph *tline(Term *t, int y, size_t *n);
+// the glyphs of row y of the window, which may be scrolled back into history
+const Glyph *twindowline(Term *t, int y, size_t *n);
+/* the cursor's position in the window; false if it is hidden or scrolled out
+   of view */
+bool tcursorpos(Term *t, int *x, int *y);
+enum cursor_style tcursorshape(Term *t);
+
+// the modes which matter to a renderer or input encoder outside of libnast
+enum tmode_flags {
+    TMODE_APPCURSOR    = 1 << 0,
+    TMODE_APPKEYPAD    = 1 << 1,
+    TMODE_BRACKETPASTE = 1 << 2,
+    TMODE_ALTSCREEN    = 1 << 3,
+    TMODE_REVERSE      = 1 << 4,
+    TMODE_MOUSE        = 1 << 5, // any kind of mouse reporting
+    TMODE_FOCUS        = 1 << 6, // focus in/out reporting
+};
+uint32_t tmodes(Term *t);
 int tsetfont(Term *t, char *font_name, int font_size);
 void tresize(Term *t, int, int);
+/* Write everything the Term shows and remembers to fd: both screens with all
+   their scrollback, the cursor and saved cursors, modes, tabs and charsets.
+   It is streamed out in one pass with little memory, so fd may be a pipe.
+   Returns 0, or -1 with errno set. */
+int tsnapshot(Term *t, int fd);
+/* Replace the Term's state (and size) with a snapshot's; resize the tty to
+   match after.  The file is mapped rather than read, and each line is only
+   decoded when something first looks at it, so a huge scrollback restores
+   in about the time it takes to index it.  The file must not be truncated
+   or rewritten while the Term lives; write new snapshots elsewhere and
+   rename() them over it.  Returns 0, or -1 with errno set (EINVAL for a
+   snapshot which is corrupt or from an unknown version). */
+int trestore(Term *t, const char *path);
+/* Keep all of the main screen's scrollback: lines which would fall off the
+   end of the in-memory history are written to an unlinked temporary file in
+   dir (NULL for $TMPDIR or /tmp) instead, and read back when scrolled to,
+   selected, or searched.  The file goes away with the Term.  Spilled lines
+   are not reflowed by a resize.  Returns 0, or -1 with errno set. */
+int tspill(Term *t, const char *dir);
+// how many lines of the scrollback are on disk
+size_t tspilled(Term *t);
 // returns true if a mv occured
 bool twindowmv(Term *t, int n);
+/* move the window by a fractional number of lines, for smooth scrolling;
+   returns true if the view changed by at least a pixel */
+bool twindowscroll(Term *t, double n);
 void ttyhangup(pid_t);
 int ttynew(Term *t, pid_t *pid, char **cmd);
+/* read what's available on the tty and parse it; returns bytes read, which
+   is 0 if nothing was ready or the tty was hung up */
 size_t ttyread(Term *t);
+// parse bytes which the caller read from the tty some other way
+void ttyfeed(Term *t, const char *buf, size_t n);
+
+// counters for drawing, which a TFrameCache keeps too
+typedef struct {
+    uint64_t rendered; // lines rasterized, including ahead of time
+    uint64_t hits; // visible lines drawn from a cached surface
+    uint64_t misses; // and those which had to be rasterized first
+} TDrawStats;
+
+// OSC numbers from this one up are counted together
+#define TSTATS_OSC 128
+
+/* counters, for judging how well the io, parsing and drawing are doing;
+   each is a plain increment where the work happens, so they are always on */
+typedef struct {
+    uint64_t read_bytes;
+    uint64_t read_calls; // read_bytes / read_calls is the bytes per syscall
+    uint64_t read_grows; // times the read buffer doubled under a flood
+    size_t read_cap; // current read buffer size
+    // parsing
+    uint64_t parsed_bytes;
+    uint64_t printed; // characters put on the grid
+    uint64_t controls; // C0 and C1 control codes
+    uint64_t csi[64]; // CSI sequences, by final byte: csi['m' - 0x40]
+    uint64_t osc[TSTATS_OSC + 1]; // OSC sequences, by number
+    uint64_t dcs; // DCS sequences
+    // the screen
+    uint64_t lines_scrolled;
+    uint64_t rlines_new;
+    uint64_t rlines_dropped; // freed off the top of the history
+    uint64_t reflows;
+    uint64_t reflow_us;
+    TDrawStats draw;
+} TStats;
+
+TStats tstats(Term *t);
+// write every nonzero counter as a line of "name value"
+void tstatsprint(const TStats *stats, FILE *f);
 
 void texportselection(Term *t, int clipboard);
 
+// how far a tclipboardread() has got; zero it to start
+typedef struct {
+    size_t y;
+    size_t x;
+    uint64_t line_id;
+    bool started;
+    bool ended;
+} TSelCursor;
+
+/* Read the text of an offered selection a chunk at a time, into buf (at
+   least 4 bytes).  Returns the bytes read, 0 at the end, or -1 if the
+   offer is gone: the selection changed or broke since, which an explicit
+   copy to the clipboard (1) survives by being handed to set_clipboard() as
+   it breaks. */
+ssize_t tclipboardread(
+    Term *t, int clipboard, TSelCursor *c, char *buf, size_t len
+);
+// the backend doesn't hold an offer anymore (another program took over)
+void tclipboarddrop(Term *t, int clipboard);
+
+/* Searching the scrollback of the screen which is showing.  Each logical
+   line (a line which wrapped, however many rows it takes) is searched as one
+   line, so a match may span rows, but never lines.  Positions are absolute:
+   row 0 is the oldest line kept, and the bottom of the terminal is row
+   tscrollback() - 1. */
+enum tsearch_flags {
+    TSEARCH_REGEX    = 1 << 0, // a POSIX extended regex, not literal text
+    TSEARCH_ICASE    = 1 << 1,
+    TSEARCH_BACKWARD = 1 << 2, // towards older lines
+};
+
+// the first and last cells of a match
+typedef struct {
+    size_t yb;
+    int xb;
+    size_t ye;
+    int xe;
+} TMatch;
+
+// rows in the scrollback, including the terminal's own
+size_t tscrollback(Term *t);
+/* Find the first match of a utf8 pattern which starts after (y, x), or
+   before it with TSEARCH_BACKWARD; x may be -1 or tcols() to take in all of
+   row y.  Returns 1 if found, 0 if not, or -1 if a regex doesn't compile. */
+int tfind(Term *t, const char *pattern, int flags, size_t y, int x, TMatch *m);
+/* Incremental search, for a search box.  tsearch() sets the pattern and
+   moves the window to the nearest match from where the search started (the
+   edge of the window it starts from), which is highlighted until
+   tsearchend().  A literal which only grew carries on from the last match
+   rather than starting over, since nothing before it could match now.
+   tsearchnext() goes on to the next match, or back the other way.  Both
+   return 1 if there is a match, 0 if not, or -1 for a bad regex. */
+int tsearch(Term *t, const char *pattern, int flags);
+int tsearchnext(Term *t, bool reverse);
+bool tsearchmatch(Term *t, TMatch *m);
+// make m the current match of the open search, and show it
+bool tsearchgoto(Term *t, const TMatch *m);
+void tsearchend(Term *t);
+
+// every match in the scrollback, oldest first
+typedef struct {
+    TMatch *m;
+    size_t n;
+    // rows searched, from the top; all of them once it reaches tscrollback()
+    size_t scanned;
+    // (the rest is for tmatchesupdate())
+    size_t settled; // rows before this had left the window when searched
+    size_t cap;
+    char *pattern;
+    int flags;
+    uint64_t epoch;
+    uint64_t dropped;
+    bool alt;
+} TMatches;
+
+/* Find every match at once, for counting them or jumping to the oldest.  A
+   big scrollback is split at line boundaries over a pool of threads, which
+   only read the Term while the caller waits, so the thread which owns the
+   Term is held up for the whole search (a second or so for a million
+   lines).  tfindallstart() makes the same list without waiting: it only
+   checks the pattern, and each tmatchesupdate() then searches the next
+   slice of rows.  TSEARCH_BACKWARD is ignored.  Both return 0, or -1 for a
+   bad regex; free the list with tmatchesfree(). */
+int tfindall(Term *t, const char *pattern, int flags, TMatches *ms);
+int tfindallstart(Term *t, const char *pattern, int flags, TMatches *ms);
+/* Keep a list in step with the Term: positions move with lines dropped off
+   the top, rows appended since and the window (which may have changed) are
+   searched again, and a list from tfindallstart() gets on with its search.
+   Returns false, with the list emptied, if the positions no longer mean
+   anything, like after a clear or a resize. */
+bool tmatchesupdate(Term *t, TMatches *ms);
+void tmatchesfree(TMatches *ms);
+
 // returns true if the event should cause a rerender
 bool tkeyev(Term *t, key_ev_t ev);
 bool tmouseev(Term *t, mouse_ev_t ev);
 bool tfocusev(Term *t, bool focused);
 
+/* Blinking is driven by a timer in the backend, and only ever changes what is
+   composited over the cached line surfaces, so it never causes rerendering.
+   tblinking() returns true if anything drawn by the last trender() blinks, so
+   the backend can stop its timer when nothing does. */
+bool tblinking(Term *t);
+// toggle the blink phase; returns true if the event should cause a rerender
+bool tblink(Term *t);
+// return to the visible phase; returns true if it should cause a rerender
+bool tblinkreset(Term *t);
+
 /* in bracket paste mode, the renderer should wrap pasted content in:
 
         \x1b[200~ ... \x1b[201~
@@ -247,7 +443,39 @@ void trender(
     double x2,
     double y2
 );
+/* set the size of the drawing area, resizing the terminal to fit; trender()
+   calls this itself, but a Term which is drawn with TFrames needs it too */
+void tsetsize(Term *t, double w, double h);
 void rline_unrender(RLine *rline);
+/* Render up to max_lines of the lines just outside of the window, so that
+   scrolling through history finds them already rendered.  Returns true if
+   there are more lines left to prerender.  Meant to be called when idle. */
+bool tprerender(Term *t, int max_lines);
+
+/* Detached frames, for when the Term lives on a different thread than the one
+   which draws.  The Term's thread fills a TFrame with tframe_capture(), which
+   copies the visible lines, selection and cursor, then hands it over.  The
+   drawing thread draws it with tframe_render(), which keeps rendered lines in
+   a TFrameCache and reuses any whose glyphs did not change.  tframe_render()
+   returns true if anything drawn blinks; the blink phase belongs to the
+   drawing thread in this mode. */
+typedef struct TFrame TFrame;
+typedef struct TFrameCache TFrameCache;
+TFrame *tframe_new(void);
+void tframe_free(TFrame *f);
+void tframe_capture(Term *t, TFrame *f);
+TFrameCache *tframecache_new(void);
+void tframecache_free(TFrameCache *c);
+TDrawStats tframecache_stats(TFrameCache *c);
+// f may be NULL, to draw an empty terminal before the first frame arrives
+bool tframe_render(
+    TFrameCache *c,
+    TFrame *f,
+    cairo_t *cr,
+    double w,
+    double h,
+    bool blink_hidden
+);
 
 /*
 
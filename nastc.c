@@ -0,0 +1,56 @@
+// nastc: ask a running `nast --server` for a new window.
+//
+// usage: nastc [cmd [args...]]
+//
+// The request is the client's cwd and then the command, each string
+// NUL-terminated, ended by shutting down our write side.  The reply is one
+// byte: zero once the window is open, nonzero if it couldn't be.  Without a
+// command, the window runs the user's shell.
+
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "sock.h"
+
+int main(int argc, char **argv){
+    char path[108];
+    if(sock_path(path, sizeof(path), "nast")){
+        fprintf(stderr, "socket path: %s\n", strerror(errno));
+        return 1;
+    }
+    int fd = sock_connect(path);
+    if(fd < 0){
+        fprintf(stderr,
+            "no nast server at %s (%s); start one with `nast --server`\n",
+            path, strerror(errno)
+        );
+        return 1;
+    }
+
+    char cwd[PATH_MAX];
+    if(!getcwd(cwd, sizeof(cwd))) strcpy(cwd, "/");
+    int ret = sock_write_all(fd, cwd, strlen(cwd) + 1);
+    for(int i = 1; !ret && i < argc; i++){
+        ret = sock_write_all(fd, argv[i], strlen(argv[i]) + 1);
+    }
+    if(ret || shutdown(fd, SHUT_WR)){
+        fprintf(stderr, "sending request: %s\n", strerror(errno));
+        return 1;
+    }
+
+    unsigned char status;
+    if(sock_read_all(fd, &status, 1)){
+        fprintf(stderr, "reading reply: %s\n", strerror(errno));
+        return 1;
+    }
+    if(status){
+        fprintf(stderr, "the nast server couldn't open a window\n");
+        return 1;
+    }
+    close(fd);
+    return 0;
+}
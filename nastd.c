@@ -0,0 +1,1111 @@
+// nastd: detachable terminal sessions, kept headless in a server process.
+//
+// usage: nastd new [--spill] [cmd...]   start a session and attach to it
+//        nastd attach [id]              attach to a session (default: newest)
+//        nastd ls                       list sessions
+//        nastd stats [id]               print a session's counters (see TStats)
+//        nastd server                   run the server in the foreground
+//
+// --spill keeps all of a session's scrollback, on disk (see tspill()); it is
+// off by default, since the file grows for as long as the session runs.
+//
+// The server owns each session's pty, child, Term, scrollback and reflow,
+// so attaching never replays output.  An attaching client is sent only what
+// is in the Term's window, then deltas (see delta.h) of what changes after
+// that, with moved rows as scrolls which the client's terminal does itself;
+// scrolling back (shift+pgup) moves the server's window, and the rows it
+// uncovers go out as more changes.  The client turns the keys it reads back
+// into key events, so tkeyev() runs server-side against the session's own
+// modes.  ctrl+] detaches.
+//
+// new and attach start a server if there isn't one running.
+//
+// Messages in both directions are a msg_hdr_t and then len bytes; this is a
+// local socket, so everything is in native byte order.  It lives in a
+// directory only we can get into (see sock_path()), and the server also
+// refuses peers which aren't running as us.  Window sizes are capped at
+// TDELTA_MAX_DIM, which is as big as a delta can describe.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "loop.h"
+#include "delta.h"
+#include "sock.h"
+#include "writable.h"
+
+typedef struct {
+    uint32_t type;
+    uint32_t len;
+} msg_hdr_t;
+
+// client to server
+enum {
+    C_NEW = 1, // u16 cols, u16 rows, u16 NEW_* flags, cwd\0, then cmd args\0...
+    C_ATTACH, // u32 id (0: newest), u16 cols, u16 rows
+    C_LIST,
+    C_KEY, // key_ev_t
+    C_TEXT, // bytes for the pty, for what isn't a key (non-ascii text)
+    C_RESIZE, // u16 cols, u16 rows
+    C_STATS, // u32 id (0: newest)
+};
+
+// C_NEW flags
+enum {
+    NEW_SPILL = 1,
+};
+
+// server to client
+enum {
+    S_ATTACHED = 64, // u32 id, rgb24 defaultfg, rgb24 defaultbg
+    S_FRAME, // a tdelta frame: the screen, title and bells
+    S_LIST, // text, one session per line
+    S_ERROR, // text
+    S_EXIT, // i32 wait status
+    S_STATS, // text, one "name value" counter per line
+};
+
+// messages bigger than this are a broken peer
+#define MSG_MAX (1 << 24)
+// stop sending a client updates while it has this much unread
+#define CLIENT_HIGH_WATER (1 << 20)
+// how long new and attach wait for a server they started
+#define SERVER_START_MS 2000
+
+static void put(struct writable *w, const void *p, size_t n){
+    writable_add_bytes(w, p, n);
+}
+
+static void put_u16(struct writable *w, uint16_t v){ put(w, &v, 2); }
+static void put_u32(struct writable *w, uint32_t v){ put(w, &v, 4); }
+
+static void put_msg(struct writable *w, uint32_t type, const void *p, size_t n){
+    msg_hdr_t hdr = { type, (uint32_t)n };
+    put(w, &hdr, sizeof(hdr));
+    if(n) put(w, p, n);
+}
+
+// reads from a message's payload, failing (once) past the end
+typedef struct {
+    const char *p;
+    size_t n;
+    bool ok;
+} reader_t;
+
+static bool get(reader_t *r, void *out, size_t n){
+    if(!r->ok || r->n < n){
+        r->ok = false;
+        memset(out, 0, n);
+        return false;
+    }
+    memcpy(out, r->p, n);
+    r->p += n;
+    r->n -= n;
+    return true;
+}
+
+static uint16_t get_u16(reader_t *r){ uint16_t v; get(r, &v, 2); return v; }
+static uint32_t get_u32(reader_t *r){ uint32_t v; get(r, &v, 4); return v; }
+
+/* u16 cols, u16 rows, as big as a client can draw at most; anything more is
+   only a way to make us allocate gigabytes */
+static void get_size(reader_t *r, int *cols, int *rows){
+    int c = get_u16(r);
+    int rw = get_u16(r);
+    *cols = MIN(c, TDELTA_MAX_DIM);
+    *rows = MIN(rw, TDELTA_MAX_DIM);
+}
+
+/* pull complete messages out of an input buffer; returns the payload of the
+   next one, or NULL if it isn't all here yet */
+typedef struct {
+    char *buf;
+    size_t len;
+    size_t cap;
+    size_t off; // start of the next message
+} inbuf_t;
+
+static const char *inbuf_next(inbuf_t *in, msg_hdr_t *hdr, bool *bad){
+    size_t avail = in->len - in->off;
+    if(avail < sizeof(*hdr)) return NULL;
+    memcpy(hdr, in->buf + in->off, sizeof(*hdr));
+    if(hdr->len > MSG_MAX){
+        *bad = true;
+        return NULL;
+    }
+    if(avail - sizeof(*hdr) < hdr->len) return NULL;
+    const char *payload = in->buf + in->off + sizeof(*hdr);
+    in->off += sizeof(*hdr) + hdr->len;
+    return payload;
+}
+
+// read what's available; returns like read(2)
+static ssize_t inbuf_read(inbuf_t *in, int fd){
+    // drop consumed messages before making room
+    if(in->off){
+        memmove(in->buf, in->buf + in->off, in->len - in->off);
+        in->len -= in->off;
+        in->off = 0;
+    }
+    if(in->cap - in->len < 4096){
+        in->cap = in->cap ? in->cap * 2 : 8192;
+        in->buf = xrealloc(in->buf, in->cap);
+    }
+    ssize_t n = read(fd, in->buf + in->len, in->cap - in->len);
+    if(n > 0) in->len += (size_t)n;
+    return n;
+}
+
+//////// server
+
+typedef struct session session_t;
+typedef struct client client_t;
+
+struct session {
+    uint32_t id;
+    lterm_t *lt;
+    char *name; // the command line, for `nastd ls`
+    char *title;
+    client_t *clients;
+    session_t *next;
+};
+
+struct client {
+    int fd;
+    lwatch_t *w;
+    session_t *s; // NULL until attached
+    client_t *snext; // in s->clients
+    client_t *next;
+    inbuf_t in;
+    struct writable out;
+    bool closing; // close once out is flushed
+    bool broken; // close as soon as possible
+
+    TDelta *delta; // what the client was last sent
+};
+
+static loop_t *loop;
+static session_t *sessions;
+static client_t *clients;
+static uint32_t next_id = 1;
+
+/* write what the socket will take; clients are only ever closed from
+   client_io(), which this wakes (with EPOLLOUT) when it's time */
+static void client_flush(client_t *c){
+    if(!c->broken && writable_nonempty(&c->out)){
+        ssize_t ret = writable_writev(&c->out, c->fd);
+        if(ret < 0 && errno != EAGAIN && errno != EINTR) c->broken = true;
+    }
+    bool out = writable_nonempty(&c->out) || c->closing || c->broken;
+    lwatch_set(c->w, EPOLLIN | (out ? EPOLLOUT : 0));
+}
+
+static void send_frame(client_t *c, const char *frame, size_t n){
+    if(n) put_msg(&c->out, S_FRAME, frame, n);
+    client_flush(c);
+}
+
+// send whatever changed since the last frame
+static void client_update(client_t *c){
+    size_t n;
+    const char *frame = tdelta_encode(c->delta, lterm_term(c->s->lt), &n);
+    send_frame(c, frame, n);
+}
+
+static void damage_cb(lterm_t *lt, void *data){
+    (void)lt;
+    session_t *s = data;
+    for(client_t *c = s->clients, *next; c; c = next){
+        next = c->snext;
+        // a slow client catches up in one frame once it drains
+        if(writable_len(&c->out) < CLIENT_HIGH_WATER) client_update(c);
+    }
+}
+
+static void bell_cb(lterm_t *lt, void *data){
+    (void)lt;
+    session_t *s = data;
+    for(client_t *c = s->clients, *next; c; c = next){
+        next = c->snext;
+        size_t n;
+        const char *frame = tdelta_bell(c->delta, &n);
+        send_frame(c, frame, n);
+    }
+}
+
+static void set_title_cb(lterm_t *lt, const char *title, void *data){
+    (void)lt;
+    session_t *s = data;
+    free(s->title);
+    s->title = xstrdup((char*)title);
+    for(client_t *c = s->clients, *next; c; c = next){
+        next = c->snext;
+        size_t n;
+        const char *frame = tdelta_title(c->delta, title, &n);
+        send_frame(c, frame, n);
+    }
+}
+
+static void detach(client_t *c){
+    session_t *s = c->s;
+    if(!s) return;
+    for(client_t **p = &s->clients; *p; p = &(*p)->snext){
+        if(*p != c) continue;
+        *p = c->snext;
+        break;
+    }
+    c->s = NULL;
+    tdelta_free(c->delta);
+    c->delta = NULL;
+}
+
+static void exited_cb(lterm_t *lt, int status, void *data){
+    (void)lt;
+    session_t *s = data;
+    while(s->clients){
+        client_t *c = s->clients;
+        detach(c);
+        int32_t st = status;
+        put_msg(&c->out, S_EXIT, &st, sizeof(st));
+        c->closing = true;
+        client_flush(c);
+    }
+    for(session_t **p = &sessions; *p; p = &(*p)->next){
+        if(*p != s) continue;
+        *p = s->next;
+        break;
+    }
+    free(s->name);
+    free(s->title);
+    free(s);
+}
+
+static const lterm_cbs_t cbs = {
+    .damage = damage_cb,
+    .exited = exited_cb,
+    .bell = bell_cb,
+    .set_title = set_title_cb,
+};
+
+static void client_close(client_t *c){
+    detach(c);
+    for(client_t **p = &clients; *p; p = &(*p)->next){
+        if(*p != c) continue;
+        *p = c->next;
+        break;
+    }
+    lwatch_free(c->w);
+    close(c->fd);
+    free(c->in.buf);
+    writable_free(&c->out);
+    free(c);
+}
+
+static void send_error(client_t *c, const char *msg){
+    put_msg(&c->out, S_ERROR, msg, strlen(msg));
+    c->closing = true;
+    client_flush(c);
+}
+
+static void attach(client_t *c, session_t *s, int cols, int rows){
+    detach(c);
+    c->s = s;
+    c->delta = tdelta_new();
+    c->snext = s->clients;
+    s->clients = c;
+
+    // the newest client's size wins
+    Term *t = lterm_term(s->lt);
+    if(cols > 0 && rows > 0 && (cols != tcols(t) || rows != trows(t))){
+        lterm_resize(s->lt, cols, rows);
+    }
+
+    char buf[10];
+    memcpy(buf, &s->id, 4);
+    memcpy(buf + 4, &defaultfg, 3);
+    memcpy(buf + 7, &defaultbg, 3);
+    put_msg(&c->out, S_ATTACHED, buf, sizeof(buf));
+    if(s->title){
+        size_t n;
+        const char *frame = tdelta_title(c->delta, s->title, &n);
+        put_msg(&c->out, S_FRAME, frame, n);
+    }
+    // the first frame is the whole window
+    client_update(c);
+}
+
+static void handle_new(client_t *c, reader_t *r){
+    int cols, rows;
+    get_size(r, &cols, &rows);
+    uint16_t flags = get_u16(r);
+    if(!r->ok || !r->n || r->p[r->n-1] != '\0' || cols < 1 || rows < 1){
+        send_error(c, "bad request");
+        return;
+    }
+
+    // cwd\0arg\0arg\0...
+    size_t nstrs = 0;
+    for(size_t i = 0; i < r->n; i++) nstrs += r->p[i] == '\0';
+    char *strs = xmalloc(r->n);
+    memcpy(strs, r->p, r->n);
+    char **argv = xmalloc((nstrs + 1) * sizeof(*argv));
+    char *p = strs;
+    for(size_t i = 0; i < nstrs; i++){
+        argv[i] = p;
+        p += strlen(p) + 1;
+    }
+    argv[nstrs] = NULL;
+
+    session_t *s = xmalloc(sizeof(*s));
+    *s = (session_t){ .id = next_id++ };
+
+    // a name for `nastd ls`
+    size_t namelen = 0;
+    for(size_t i = 1; i < nstrs; i++) namelen += strlen(argv[i]) + 1;
+    s->name = xmalloc(namelen + 8);
+    s->name[0] = '\0';
+    for(size_t i = 1; i < nstrs; i++){
+        if(i > 1) strcat(s->name, " ");
+        strcat(s->name, argv[i]);
+    }
+    if(nstrs < 2) strcpy(s->name, "(shell)");
+
+    // the child starts in the client's cwd
+    int here = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(chdir(argv[0])){
+        fprintf(stderr, "chdir(%s): %s\n", argv[0], strerror(errno));
+    }
+    s->lt = loop_spawn(loop, cols, rows, nstrs > 1 ? argv + 1 : NULL, &cbs, s);
+    if(here >= 0){
+        if(fchdir(here)) perror("fchdir");
+        close(here);
+    }
+    free(argv);
+    free(strs);
+    /* sessions live long, but a spill file grows without limit, so keeping
+       all of the scrollback is only for those which ask */
+    if(flags & NEW_SPILL && tspill(lterm_term(s->lt), NULL)) perror("tspill");
+
+    s->next = sessions;
+    sessions = s;
+    attach(c, s, cols, rows);
+}
+
+static void handle_attach(client_t *c, reader_t *r){
+    uint32_t id = get_u32(r);
+    int cols, rows;
+    get_size(r, &cols, &rows);
+    if(!r->ok){
+        send_error(c, "bad request");
+        return;
+    }
+    // sessions is newest-first
+    session_t *s;
+    for(s = sessions; s && id && s->id != id; s = s->next);
+    if(!s){
+        send_error(c, id ? "no such session" : "no sessions");
+        return;
+    }
+    attach(c, s, cols, rows);
+}
+
+static void handle_list(client_t *c){
+    struct writable text = {0};
+    for(session_t *s = sessions; s; s = s->next){
+        size_t n = 0;
+        for(client_t *a = s->clients; a; a = a->snext) n++;
+        Term *t = lterm_term(s->lt);
+        char buf[256];
+        int len = snprintf(buf, sizeof(buf),
+            "%u: %dx%d, %zu attached: %.100s%s%.100s%s\n",
+            s->id, tcols(t), trows(t), n, s->name,
+            s->title ? " [" : "", s->title ? s->title : "",
+            s->title ? "]" : ""
+        );
+        put(&text, buf, MIN((size_t)len, sizeof(buf) - 1));
+    }
+    // flatten it into one message
+    size_t len = writable_len(&text);
+    char *buf = xmalloc(len + 1);
+    const char *s;
+    size_t n, off = 0;
+    while((s = writable_get_string(&text, &n))){
+        memcpy(buf + off, s, n);
+        off += n;
+    }
+    put_msg(&c->out, S_LIST, buf, len);
+    free(buf);
+    writable_free(&text);
+    c->closing = true;
+    client_flush(c);
+}
+
+static void handle_stats(client_t *c, reader_t *r){
+    uint32_t id = get_u32(r);
+    if(!r->ok){
+        send_error(c, "bad request");
+        return;
+    }
+    session_t *s;
+    for(s = sessions; s && id && s->id != id; s = s->next);
+    if(!s){
+        send_error(c, id ? "no such session" : "no sessions");
+        return;
+    }
+    char *buf;
+    size_t len;
+    FILE *f = open_memstream(&buf, &len);
+    if(!f){
+        send_error(c, strerror(errno));
+        return;
+    }
+    TStats ts = tstats(lterm_term(s->lt));
+    size_t queued, max;
+    lterm_queued(s->lt, &queued, &max);
+    loop_stats_t ls = loop_stats(loop);
+    fprintf(f,
+        "session %u\n"
+        "write_queued %zu\n"
+        "write_queued_max %zu\n"
+        "loop_syscalls %llu\n",
+        s->id, queued, max, (unsigned long long)ls.syscalls
+    );
+    tstatsprint(&ts, f);
+    fclose(f);
+    put_msg(&c->out, S_STATS, buf, len);
+    free(buf);
+    c->closing = true;
+    client_flush(c);
+}
+
+static void handle_msg(client_t *c, uint32_t type, reader_t *r){
+    if(
+        !c->s && type != C_NEW && type != C_ATTACH && type != C_LIST
+        && type != C_STATS
+    ){
+        send_error(c, "not attached");
+        return;
+    }
+    switch(type){
+        case C_NEW: handle_new(c, r); break;
+        case C_ATTACH: handle_attach(c, r); break;
+        case C_LIST: handle_list(c); break;
+        case C_STATS: handle_stats(c, r); break;
+
+        case C_KEY: {
+            key_ev_t ev;
+            if(!get(r, &ev, sizeof(ev))) break;
+            // mask keys outside of the keymap
+            if(ev.key < 0 || ev.key > 0xff) break;
+            lterm_keyev(c->s->lt, ev);
+        } break;
+
+        case C_TEXT:
+            lterm_write(c->s->lt, r->p, r->n);
+            break;
+
+        case C_RESIZE: {
+            int cols, rows;
+            get_size(r, &cols, &rows);
+            if(r->ok && cols > 0 && rows > 0){
+                lterm_resize(c->s->lt, cols, rows);
+            }
+        } break;
+
+        default:
+            send_error(c, "unknown message");
+            break;
+    }
+}
+
+static void client_io(int fd, uint32_t events, void *data){
+    client_t *c = data;
+
+    if(events & EPOLLOUT){
+        bool behind = writable_len(&c->out) >= CLIENT_HIGH_WATER;
+        client_flush(c);
+        if(behind && c->s && writable_len(&c->out) < CLIENT_HIGH_WATER){
+            client_update(c);
+        }
+    }
+
+    bool readable = events & (EPOLLIN | EPOLLHUP | EPOLLERR);
+    if(readable && !c->closing && !c->broken){
+        ssize_t n = inbuf_read(&c->in, fd);
+        if(n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)){
+            c->broken = true;
+        }else{
+            msg_hdr_t hdr;
+            bool bad = false;
+            const char *payload;
+            while(!c->closing && (payload = inbuf_next(&c->in, &hdr, &bad))){
+                reader_t r = { payload, hdr.len, true };
+                handle_msg(c, hdr.type, &r);
+            }
+            if(bad) send_error(c, "message too long");
+        }
+    }
+
+    if(c->broken || (c->closing && !writable_nonempty(&c->out))){
+        client_close(c);
+    }
+}
+
+// serve a connected (nonblocking, close-on-exec) socket
+static client_t *client_add(int cfd){
+    client_t *c = xmalloc(sizeof(*c));
+    *c = (client_t){ .fd = cfd };
+    c->w = loop_watch(loop, cfd, EPOLLIN, client_io, c);
+    c->next = clients;
+    clients = c;
+    return c;
+}
+
+static void listen_io(int fd, uint32_t events, void *data){
+    (void)events;
+    (void)data;
+    int cfd = accept(fd, NULL, NULL);
+    if(cfd < 0){
+        if(errno != EAGAIN && errno != EINTR) perror("accept");
+        return;
+    }
+    // sessions run as us, so only we may use them
+    if(sock_peer_ok(cfd)){
+        close(cfd);
+        return;
+    }
+    // (children must not inherit it)
+    if(fcntl(cfd, F_SETFD, FD_CLOEXEC) || fcntl(cfd, F_SETFL, O_NONBLOCK)){
+        close(cfd);
+        return;
+    }
+    client_add(cfd);
+}
+
+static int server_main(void){
+    char path[108];
+    if(sock_path(path, sizeof(path), "nastd")){
+        fprintf(stderr, "socket path: %s\n", strerror(errno));
+        return 1;
+    }
+    int lfd = sock_listen(path);
+    if(lfd < 0){
+        fprintf(stderr, "couldn't listen on %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+    if(fcntl(lfd, F_SETFL, O_NONBLOCK)) die("fcntl: %s\n", strerror(errno));
+    // a vanished client must not kill the server
+    signal(SIGPIPE, SIG_IGN);
+
+    loop = loop_new();
+    loop_watch(loop, lfd, EPOLLIN, listen_io, NULL);
+    while(true){
+        if(loop_run(loop, -1) < 0) die("loop_run: %s\n", strerror(errno));
+    }
+}
+
+//////// client
+
+static struct termios saved_tio;
+static volatile sig_atomic_t got_winch;
+
+static void on_winch(int sig){
+    (void)sig;
+    got_winch = 1;
+}
+
+static void winsize(int *cols, int *rows){
+    struct winsize ws;
+    if(ioctl(0, TIOCGWINSZ, &ws) || !ws.ws_col || !ws.ws_row){
+        ws.ws_col = 80;
+        ws.ws_row = 24;
+    }
+    *cols = ws.ws_col;
+    *rows = ws.ws_row;
+}
+
+// connect, starting a server first if there isn't one
+static int connect_server(bool start){
+    char path[108];
+    if(sock_path(path, sizeof(path), "nastd")) return -1;
+    int fd = sock_connect(path);
+    // (a server of somebody else's won't make way for ours)
+    if(fd >= 0 || !start || errno == EACCES) return fd;
+
+    pid_t pid = fork();
+    if(pid < 0) return -1;
+    if(pid == 0){
+        // double fork, so the server isn't our child
+        if(fork()) _exit(0);
+        setsid();
+        if(chdir("/")){}
+        int null = open("/dev/null", O_RDWR);
+        dup2(null, 0);
+        dup2(null, 1);
+        dup2(null, 2);
+        execl("/proc/self/exe", "nastd", "server", (char*)NULL);
+        _exit(127);
+    }
+    waitpid(pid, NULL, 0);
+
+    for(int ms = 0; ms < SERVER_START_MS; ms += 10){
+        fd = sock_connect(path);
+        if(fd >= 0) return fd;
+        usleep(10000);
+    }
+    return -1;
+}
+
+typedef struct {
+    int fd;
+    struct writable tx; // to the server
+    struct writable scr; // to our terminal
+    struct rgb24 fg;
+    struct rgb24 bg;
+    TGrid *grid;
+    int cursor_style; // as last drawn; 0 for none yet
+} attached_t;
+
+static void sgr(struct writable *w, Glyph g, attached_t *a){
+    char buf[128];
+    int n = snprintf(buf, sizeof(buf), "\x1b[0%s%s%s%s%s%s%s%s",
+        g.mode & ATTR_BOLD ? ";1" : "",
+        g.mode & ATTR_FAINT ? ";2" : "",
+        g.mode & ATTR_ITALIC ? ";3" : "",
+        g.mode & ATTR_UNDERLINE ? ";4" : "",
+        g.mode & ATTR_BLINK ? ";5" : "",
+        g.mode & ATTR_REVERSE ? ";7" : "",
+        g.mode & ATTR_INVISIBLE ? ";8" : "",
+        g.mode & ATTR_STRUCK ? ";9" : ""
+    );
+    put(w, buf, n);
+    // the server's default colors become ours
+    if(!rgb24_eq(g.fg, a->fg)){
+        n = snprintf(buf, sizeof(buf), ";38;2;%d;%d;%d", g.fg.r, g.fg.g, g.fg.b);
+        put(w, buf, n);
+    }
+    if(!rgb24_eq(g.bg, a->bg)){
+        n = snprintf(buf, sizeof(buf), ";48;2;%d;%d;%d", g.bg.r, g.bg.g, g.bg.b);
+        put(w, buf, n);
+    }
+    put(w, "m", 1);
+}
+
+static bool blank(Glyph g, attached_t *a){
+    return (g.u == ' ' || g.u == 0) && !(g.mode & ~ATTR_WRAP)
+        && rgb24_eq(g.bg, a->bg);
+}
+
+static void draw_row(attached_t *a, int y){
+    TGrid *grid = a->grid;
+    const Glyph *row = &grid->cells[(size_t)y * grid->cols];
+    char buf[32];
+    int n = snprintf(buf, sizeof(buf), "\x1b[%d;1H", y + 1);
+    put(&a->scr, buf, n);
+    // trailing blanks are erased rather than drawn
+    int end = grid->cols;
+    while(end && blank(row[end-1], a)) end--;
+    for(int x = 0; x < end; x++){
+        Glyph g = row[x];
+        if(!x || g.mode != row[x-1].mode || !rgb24_eq(g.fg, row[x-1].fg)
+                || !rgb24_eq(g.bg, row[x-1].bg)){
+            sgr(&a->scr, g, a);
+        }
+        // the right half of a wide character was drawn with the left
+        if(g.mode & ATTR_WDUMMY) continue;
+        char utf[4];
+        size_t len = g.u ? utf8encode(g.u, utf) : 0;
+        if(len) put(&a->scr, utf, len);
+        else put(&a->scr, " ", 1);
+    }
+    put(&a->scr, "\x1b[0m", 4);
+    // (erasing from the last column would eat the character there)
+    if(end < grid->cols) put(&a->scr, "\x1b[K", 3);
+}
+
+// bring our terminal up to date with a frame
+static bool draw_frame(attached_t *a, reader_t *r){
+    TGrid *g = a->grid;
+    if(tgrid_apply(g, r->p, r->n)) return false;
+    char buf[64];
+    int n;
+
+    if(g->resized) put(&a->scr, "\x1b[0m\x1b[2J", 8);
+    // let our terminal move the rows which scrolled; only new ones are drawn
+    for(int i = 0; i < g->nscrolls; i++){
+        TDeltaScroll sc = g->scrolls[i];
+        n = snprintf(
+            buf, sizeof(buf), "\x1b[0m\x1b[%d;%dr\x1b[%d%c",
+            sc.top + 1, sc.bot + 1, abs(sc.n), sc.n > 0 ? 'S' : 'T'
+        );
+        put(&a->scr, buf, n);
+    }
+    if(g->nscrolls) put(&a->scr, "\x1b[r", 3);
+    for(int y = 0; y < g->rows; y++){
+        if(g->dirty[y]) draw_row(a, y);
+    }
+
+    if(g->title_changed){
+        put(&a->scr, "\x1b]2;", 4);
+        put(&a->scr, g->title, strlen(g->title));
+        put(&a->scr, "\a", 1);
+    }
+    for(int i = 0; i < g->bells; i++) put(&a->scr, "\a", 1);
+
+    if((int)g->cursor_style != a->cursor_style){
+        a->cursor_style = g->cursor_style;
+        n = snprintf(buf, sizeof(buf), "\x1b[%d q", a->cursor_style);
+        put(&a->scr, buf, n);
+    }
+    n = snprintf(
+        buf, sizeof(buf), "\x1b[%d;%dH", g->cursor_y + 1, g->cursor_x + 1
+    );
+    put(&a->scr, buf, n);
+    put(&a->scr, g->cursor_visible ? "\x1b[?25h" : "\x1b[?25l", 6);
+    return true;
+}
+
+// returns 0 to keep going, or 1 + an exit code to stop
+static int handle_server_msg(attached_t *a, uint32_t type, reader_t *r){
+    switch(type){
+        case S_ATTACHED:
+            get_u32(r);
+            get(r, &a->fg, 3);
+            get(r, &a->bg, 3);
+            break;
+
+        case S_FRAME:
+            if(!draw_frame(a, r)) return 1 + 1;
+            break;
+
+        case S_ERROR:
+            fprintf(stderr, "nastd: %.*s\n", (int)r->n, r->p);
+            return 1 + 1;
+
+        case S_EXIT:
+            return 1 + 0;
+    }
+    return 0;
+}
+
+static void send_key(attached_t *a, int key, unsigned int mods){
+    key_ev_t ev = { key, mods };
+    put_msg(&a->tx, C_KEY, &ev, sizeof(ev));
+}
+
+// xterm's modifier parameter: 1 + shift(1) + alt(2) + ctrl(4) + meta(8)
+static unsigned int csi_mods(int m){
+    if(m < 2) return 0;
+    m--;
+    return (m & 1 ? SHIFT_MASK : 0) | (m & 2 ? ALT_MASK : 0)
+         | (m & 4 ? CTRL_MASK : 0) | (m & 8 ? META_MASK : 0);
+}
+
+static int csi_tilde_key(int p){
+    switch(p){
+        case 1: case 7: return NAST_KEY_HOME;
+        case 2: return NAST_KEY_INSERT;
+        case 3: return NAST_KEY_DELETE;
+        case 4: case 8: return NAST_KEY_END;
+        case 5: return NAST_KEY_PGUP;
+        case 6: return NAST_KEY_PGDN;
+    }
+    if(p >= 11 && p <= 15) return NAST_KEY_F1 + p - 11;
+    if(p >= 17 && p <= 21) return NAST_KEY_F6 + p - 17;
+    if(p >= 23 && p <= 24) return NAST_KEY_F11 + p - 23;
+    return 0;
+}
+
+static int csi_final_key(char c){
+    switch(c){
+        case 'A': return NAST_KEY_UP;
+        case 'B': return NAST_KEY_DN;
+        case 'C': return NAST_KEY_RIGHT;
+        case 'D': return NAST_KEY_LEFT;
+        case 'H': return NAST_KEY_HOME;
+        case 'F': return NAST_KEY_END;
+        case 'P': return NAST_KEY_F1;
+        case 'Q': return NAST_KEY_F2;
+        case 'R': return NAST_KEY_F3;
+        case 'S': return NAST_KEY_F4;
+        case 'Z': return NAST_KEY_TAB; // with shift
+    }
+    return 0;
+}
+
+/* Turn what our terminal sent back into key events, so the server's Term
+   encodes them for its own modes.  Non-ascii text goes through as-is.
+   Returns false on ctrl+], which detaches. */
+static bool translate_input(attached_t *a, const char *buf, size_t n){
+    for(size_t i = 0; i < n; ){
+        unsigned char c = buf[i];
+        if(c == 0x1d) return false;
+
+        if(c >= 0x80){
+            size_t j = i;
+            while(j < n && (unsigned char)buf[j] >= 0x80) j++;
+            put_msg(&a->tx, C_TEXT, buf + i, j - i);
+            i = j;
+            continue;
+        }
+
+        if(c == 0x1b && i + 1 < n && (buf[i+1] == '[' || buf[i+1] == 'O')){
+            // CSI or SS3: parameters, then a final byte
+            size_t j = i + 2;
+            int p[2] = {0, 0};
+            int np = 0;
+            while(j < n && ((buf[j] >= '0' && buf[j] <= '9') || buf[j] == ';')){
+                if(buf[j] == ';'){
+                    if(np < 1) np++;
+                }else{
+                    p[np] = p[np] * 10 + (buf[j] - '0');
+                }
+                j++;
+            }
+            // older xterms send a modified SS3 key as ESC O <mods> <final>
+            if(buf[i+1] == 'O' && !np){
+                p[1] = p[0];
+                p[0] = 0;
+            }
+            if(j < n){
+                char fin = buf[j];
+                int key = fin == '~' ? csi_tilde_key(p[0]) : csi_final_key(fin);
+                unsigned int mods = csi_mods(p[1]);
+                if(fin == 'Z') mods |= SHIFT_MASK;
+                if(key){
+                    send_key(a, key, mods);
+                }else{
+                    // something we don't know; pass it along untouched
+                    put_msg(&a->tx, C_TEXT, buf + i, j + 1 - i);
+                }
+                i = j + 1;
+                continue;
+            }
+            // a truncated sequence; send it as text
+            put_msg(&a->tx, C_TEXT, buf + i, n - i);
+            break;
+        }
+
+        unsigned int mods = 0;
+        if(c == 0x1b){
+            if(i + 1 == n){
+                send_key(a, NAST_KEY_ESC, 0);
+                break;
+            }
+            // escape prefixes alt
+            mods = ALT_MASK;
+            c = buf[++i];
+            if(c >= 0x80) continue;
+        }
+        i++;
+
+        if(c == '\r') send_key(a, NAST_KEY_ENTER, mods);
+        else if(c == '\t') send_key(a, NAST_KEY_TAB, mods);
+        else if(c == 0x7f) send_key(a, NAST_KEY_BKSP, mods);
+        else if(c == 0x1b) send_key(a, NAST_KEY_ESC, mods);
+        else if(c == 0) send_key(a, ' ', mods | CTRL_MASK);
+        else if(c < 0x1b) send_key(a, 'a' + c - 1, mods | CTRL_MASK);
+        else if(c < 0x20) send_key(a, '@' + c, mods | CTRL_MASK);
+        else send_key(a, c, mods);
+    }
+    return true;
+}
+
+static void restore_tty(void){
+    const char *s = "\x1b[0m\x1b[?25h\x1b[0 q\x1b[?1049l";
+    if(write(1, s, strlen(s)) < 0){}
+    tcsetattr(0, TCSAFLUSH, &saved_tio);
+}
+
+static int client_main(int fd, uint32_t type, struct writable *req){
+    attached_t a = {
+        .fd = fd, .fg = defaultfg, .bg = defaultbg, .grid = tgrid_new()
+    };
+
+    // send the request as one message
+    size_t len = writable_len(req);
+    msg_hdr_t hdr = { type, (uint32_t)len };
+    put(&a.tx, &hdr, sizeof(hdr));
+    const char *s;
+    size_t n;
+    while((s = writable_get_string(req, &n))) put(&a.tx, s, n);
+
+    bool tty = isatty(0);
+    if(tty){
+        tcgetattr(0, &saved_tio);
+        struct termios raw = saved_tio;
+        cfmakeraw(&raw);
+        tcsetattr(0, TCSAFLUSH, &raw);
+        put(&a.scr, "\x1b[?1049h", 8);
+    }
+    struct sigaction sa = { .sa_handler = on_winch };
+    sigaction(SIGWINCH, &sa, NULL);
+
+    inbuf_t in = {0};
+    int ret = -1;
+    bool eof = false;
+    while(ret < 0){
+        while(writable_nonempty(&a.scr)) writable_writev(&a.scr, 1);
+
+        if(got_winch){
+            got_winch = 0;
+            int cols, rows;
+            winsize(&cols, &rows);
+            char buf[4];
+            memcpy(buf, &(uint16_t){cols}, 2);
+            memcpy(buf + 2, &(uint16_t){rows}, 2);
+            put_msg(&a.tx, C_RESIZE, buf, 4);
+        }
+
+        struct pollfd pfds[2] = {
+            { .fd = eof ? -1 : 0, .events = POLLIN },
+            { .fd = fd, .events = POLLIN },
+        };
+        if(writable_nonempty(&a.tx)) pfds[1].events |= POLLOUT;
+        if(poll(pfds, 2, -1) < 0){
+            if(errno == EINTR) continue;
+            ret = 1;
+            break;
+        }
+
+        if(pfds[0].revents){
+            char buf[4096];
+            ssize_t k = read(0, buf, sizeof(buf));
+            if(k <= 0){
+                eof = true;
+            }else if(!translate_input(&a, buf, (size_t)k)){
+                ret = 0;
+                break;
+            }
+        }
+
+        if(pfds[1].revents & POLLOUT) writable_writev(&a.tx, fd);
+
+        if(pfds[1].revents & (POLLIN | POLLHUP | POLLERR)){
+            ssize_t k = inbuf_read(&in, fd);
+            if(k == 0 || (k < 0 && errno != EAGAIN && errno != EINTR)){
+                ret = 0;
+                break;
+            }
+            bool bad = false;
+            const char *payload;
+            while(ret < 0 && (payload = inbuf_next(&in, &hdr, &bad))){
+                reader_t r = { payload, hdr.len, true };
+                int x = handle_server_msg(&a, hdr.type, &r);
+                if(x) ret = x - 1;
+            }
+            if(bad) ret = 1;
+        }
+    }
+
+    while(writable_nonempty(&a.scr) && writable_writev(&a.scr, 1) > 0);
+    if(tty) restore_tty();
+    free(in.buf);
+    writable_free(&a.tx);
+    writable_free(&a.scr);
+    tgrid_free(a.grid);
+    close(fd);
+    return ret;
+}
+
+// send one request and print the text that comes back
+static int query_main(int fd, uint32_t type, struct writable *req, uint32_t ok){
+    msg_hdr_t hdr = { type, (uint32_t)writable_len(req) };
+    if(sock_write_all(fd, &hdr, sizeof(hdr))) return 1;
+    const char *s;
+    size_t n;
+    while((s = writable_get_string(req, &n))){
+        if(sock_write_all(fd, s, n)) return 1;
+    }
+    if(sock_read_all(fd, &hdr, sizeof(hdr)) || hdr.len > MSG_MAX) return 1;
+    char *buf = xmalloc(hdr.len + 1);
+    if(sock_read_all(fd, buf, hdr.len)) return 1;
+    fwrite(buf, 1, hdr.len, hdr.type == ok ? stdout : stderr);
+    if(hdr.type != ok && hdr.len && buf[hdr.len - 1] != '\n'){
+        fputc('\n', stderr);
+    }
+    free(buf);
+    close(fd);
+    return hdr.type != ok;
+}
+
+static int usage(void){
+    fprintf(stderr,
+        "usage: nastd new [--spill] [cmd [args...]]\n"
+        "       nastd attach [id]\n"
+        "       nastd ls\n"
+        "       nastd stats [id]\n"
+        "       nastd server\n"
+    );
+    return 1;
+}
+
+int main(int argc, char **argv){
+    if(argc < 2) return usage();
+    const char *verb = argv[1];
+
+    if(strcmp(verb, "server") == 0) return server_main();
+
+    bool is_new = strcmp(verb, "new") == 0;
+    bool is_attach = strcmp(verb, "attach") == 0;
+    bool is_ls = strcmp(verb, "ls") == 0;
+    bool is_stats = strcmp(verb, "stats") == 0;
+    if(!is_new && !is_attach && !is_ls && !is_stats) return usage();
+
+    int fd = connect_server(is_new || is_attach);
+    if(fd < 0){
+        fprintf(stderr, "nastd: no server: %s\n", strerror(errno));
+        return 1;
+    }
+    struct writable req = {0};
+    int ret;
+    if(is_ls || is_stats){
+        if(is_stats){
+            put_u32(&req, argc > 2 ? (uint32_t)strtoul(argv[2], NULL, 10) : 0);
+        }
+        ret = is_ls ? query_main(fd, C_LIST, &req, S_LIST)
+                    : query_main(fd, C_STATS, &req, S_STATS);
+        writable_free(&req);
+        return ret;
+    }
+
+    int cols, rows;
+    winsize(&cols, &rows);
+    uint32_t type;
+    if(is_new){
+        type = C_NEW;
+        int arg = 2;
+        uint16_t flags = 0;
+        if(arg < argc && strcmp(argv[arg], "--spill") == 0){
+            flags |= NEW_SPILL;
+            arg++;
+        }
+        put_u16(&req, (uint16_t)cols);
+        put_u16(&req, (uint16_t)rows);
+        put_u16(&req, flags);
+        char cwd[PATH_MAX];
+        if(!getcwd(cwd, sizeof(cwd))) strcpy(cwd, "/");
+        put(&req, cwd, strlen(cwd) + 1);
+        for(; arg < argc; arg++) put(&req, argv[arg], strlen(argv[arg]) + 1);
+    }else{
+        type = C_ATTACH;
+        put_u32(&req, argc > 2 ? (uint32_t)strtoul(argv[2], NULL, 10) : 0);
+        put_u16(&req, (uint16_t)cols);
+        put_u16(&req, (uint16_t)rows);
+    }
+    ret = client_main(fd, type, &req);
+    writable_free(&req);
+    return ret;
+}
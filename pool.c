@@ -0,0 +1,157 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "pool.h"
+
+struct pool {
+    pthread_mutex_t mutex;
+    pthread_cond_t start; // a new job was posted, or we are quitting
+    pthread_cond_t done;  // the last busy worker finished the job
+    pthread_t *threads;
+    int nthreads;
+    bool quit;
+
+    // the current job
+    uint64_t job;
+    pool_fn fn;
+    void *arg;
+    size_t n;
+    size_t next; // next unclaimed item, claimed atomically
+    int busy;    // background workers still on the current job
+};
+
+typedef struct {
+    pool_t *pool;
+    int worker;
+} pool_thread_arg_t;
+
+// claim and run items until there are none left
+static void pool_work(pool_t *pool, pool_fn fn, void *arg, size_t n, int w){
+    while(true){
+        size_t i = __atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED);
+        if(i >= n) return;
+        fn(arg, i, w);
+    }
+}
+
+static void *pool_thread(void *data){
+    pool_thread_arg_t *targ = data;
+    pool_t *pool = targ->pool;
+    int worker = targ->worker;
+    free(targ);
+
+    uint64_t seen = 0;
+    pthread_mutex_lock(&pool->mutex);
+    while(true){
+        while(!pool->quit && pool->job == seen){
+            pthread_cond_wait(&pool->start, &pool->mutex);
+        }
+        if(pool->quit) break;
+        seen = pool->job;
+        pool_fn fn = pool->fn;
+        void *arg = pool->arg;
+        size_t n = pool->n;
+        pthread_mutex_unlock(&pool->mutex);
+
+        pool_work(pool, fn, arg, n, worker);
+
+        pthread_mutex_lock(&pool->mutex);
+        if(--pool->busy == 0) pthread_cond_signal(&pool->done);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+    return NULL;
+}
+
+pool_t *pool_new(int nthreads){
+    if(nthreads <= 0){
+        long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+        nthreads = ncpu > 0 ? (int)ncpu : 1;
+    }
+
+    pool_t *pool = malloc(sizeof(*pool));
+    if(!pool){
+        perror("malloc");
+        return NULL;
+    }
+    *pool = (pool_t){0};
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+
+    // the calling thread is worker 0, so we only spawn the others
+    pool->threads = malloc(sizeof(*pool->threads) * nthreads);
+    if(!pool->threads){
+        perror("malloc");
+        pool_free(pool);
+        return NULL;
+    }
+    for(int i = 1; i < nthreads; i++){
+        pool_thread_arg_t *targ = malloc(sizeof(*targ));
+        if(!targ){
+            perror("malloc");
+            pool_free(pool);
+            return NULL;
+        }
+        *targ = (pool_thread_arg_t){ .pool = pool, .worker = i };
+        int ret = pthread_create(&pool->threads[i-1], NULL, pool_thread, targ);
+        if(ret){
+            fprintf(stderr, "pthread_create: %s\n", strerror(ret));
+            free(targ);
+            pool_free(pool);
+            return NULL;
+        }
+        pool->nthreads++;
+    }
+    return pool;
+}
+
+void pool_free(pool_t *pool){
+    if(!pool) return;
+    pthread_mutex_lock(&pool->mutex);
+    pool->quit = true;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->mutex);
+    for(int i = 0; i < pool->nthreads; i++){
+        pthread_join(pool->threads[i], NULL);
+    }
+    free(pool->threads);
+    pthread_cond_destroy(&pool->done);
+    pthread_cond_destroy(&pool->start);
+    pthread_mutex_destroy(&pool->mutex);
+    free(pool);
+}
+
+int pool_size(pool_t *pool){
+    return pool->nthreads + 1;
+}
+
+void pool_run(pool_t *pool, size_t n, pool_fn fn, void *arg){
+    if(!n) return;
+    // not worth waking anybody up
+    if(n == 1 || !pool->nthreads){
+        for(size_t i = 0; i < n; i++) fn(arg, i, 0);
+        return;
+    }
+
+    pthread_mutex_lock(&pool->mutex);
+    pool->fn = fn;
+    pool->arg = arg;
+    pool->n = n;
+    pool->next = 0;
+    pool->busy = pool->nthreads;
+    pool->job++;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->mutex);
+
+    pool_work(pool, fn, arg, n, 0);
+
+    // wait for the background workers to finish their last items
+    pthread_mutex_lock(&pool->mutex);
+    while(pool->busy) pthread_cond_wait(&pool->done, &pool->mutex);
+    pthread_mutex_unlock(&pool->mutex);
+}
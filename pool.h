@@ -0,0 +1,24 @@
+// A fixed pool of worker threads for data-parallel jobs.
+//
+// pool_t *pool = pool_new(0);
+// pool_run(pool, n, fn, arg);  // calls fn(arg, i, worker) for i in [0, n)
+// pool_free(pool);
+//
+// pool_run() blocks until every item is done, and the calling thread works
+// on items too, as worker 0.  Each worker is always the same thread, so
+// callers may keep per-thread state in an array of pool_size() elements.
+
+#include <stddef.h>
+
+typedef struct pool pool_t;
+
+typedef void (*pool_fn)(void *arg, size_t i, int worker);
+
+// nthreads <= 0 means one per online cpu; returns NULL on failure
+pool_t *pool_new(int nthreads);
+void pool_free(pool_t *pool);
+
+// the number of workers, including the calling thread
+int pool_size(pool_t *pool);
+
+void pool_run(pool_t *pool, size_t n, pool_fn fn, void *arg);
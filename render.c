@@ -1,54 +1,283 @@
 #include <stdbool.h>
+#include <math.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
 #include <cairo.h>
 #include <gtk/gtk.h>
 #include <cairo-xlib.h>
+#include <sys/eventfd.h>
 #include <sys/ioctl.h>
+#include <sys/socket.h>
 #include <sys/wait.h>
 #include <termios.h>
 #include <fcntl.h>
 
 #include "nast.h"
+#include "sock.h"
 #include "writable.h"
 #include "strs.h"
 
 #include "keymap.h"
+#include "trace.h"
+
+// how long each phase of a blink lasts
+#define BLINK_MS 500
+// stop blinking after this much time without input, so idle means idle
+#define BLINK_IDLE_MS 10000
+// how many lines to prerender per idle callback
+#define PRERENDER_BATCH 4
+// kinetic scrolling decays by 1/e every this many seconds
+#define KINETIC_TAU 0.325
+// kinetic scrolling stops below this many lines per second
+#define KINETIC_MIN 1.0
+// commands which can be queued to the parser thread at once
+#define CMDQ_LEN 1024
+// while output streams in, the parser thread publishes frames this often
+#define PUBLISH_MS 8
+// marks the middle frame as newer than the one being drawn
+#define FRAME_FRESH 4
+/* reading the tty yields to the main loop after this long, and runs below
+   input events and redraws, so a flood can't make keystrokes wait on it */
+#define READ_SLICE_US 8000
+#define READ_PRIORITY G_PRIORITY_DEFAULT_IDLE
+
+// how often the latency overlay redraws while it is up
+#define TRACE_REFRESH_MS 250
+
+typedef enum {
+    CMD_KEY,
+    CMD_MOUSE,
+    CMD_FOCUS,
+    CMD_SIZE,
+    CMD_ZOOM,
+    CMD_SCROLL,
+    CMD_PASTE,
+    CMD_EXPORT,
+    CMD_SEARCH,
+    CMD_SEARCH_NEXT,
+    CMD_SEARCH_END,
+    CMD_CLIPBOARD_READ,
+    CMD_CLIPBOARD_DROP,
+    CMD_STATS,
+    CMD_QUIT,
+} cmd_type_e;
+
+/* gtk wants the text of an offered selection, now: the gtk thread waits
+   while the parser thread reads it out of the Term */
+typedef struct {
+    int clipboard;
+    char *text; // NULL if the offer is gone
+    size_t len;
+    bool done;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} clipread_t;
+
+// something the gtk thread wants done to the Term
+typedef struct {
+    cmd_type_e type;
+    gint64 us; // when a CMD_KEY was pressed
+    int flags; // for CMD_SEARCH, alongside its text
+    union {
+        key_ev_t key;
+        mouse_ev_t mouse;
+        bool focused;
+        struct { int w; int h; } size;
+        int n; // zoom steps, or which clipboard to export to
+        bool reverse; // for CMD_SEARCH_NEXT
+        clipread_t *read;
+        // gtk let go of an offer, the one with this sequence number
+        struct { int clipboard; uint64_t seq; } drop;
+        TDrawStats draw; // for CMD_STATS, from the gtk thread's frame cache
+        double lines;
+        char *text; // owned by the command
+    };
+} cmd_t;
 
+/* With --parser-thread, reading and parsing run on a thread which owns the
+   Term.  The gtk thread sends it commands through a single-producer,
+   single-consumer queue, and it publishes TFrames back through a triple
+   buffer, so neither side ever waits on the other. */
+typedef struct {
+    pthread_t thread;
+    // eventfd, to wake the parser thread when commands are queued
+    int wake_fd;
+    cmd_t cmds[CMDQ_LEN];
+    size_t cmd_head; // written only by the gtk thread
+    size_t cmd_tail; // written only by the parser thread
+
+    TFrame *frames[3];
+    int back; // parser thread only
+    int front; // gtk thread only
+    int middle; // shared, with FRAME_FRESH when it is newer than front
+    bool have_frame; // gtk thread only
+    bool notify; // shared, a redraw is already scheduled
+
+    // the newest traced keypress each frame shows (see trace_t)
+    uint64_t frame_flow[3];
+
+    // parser thread state
+    bool quit;
+    int w;
+    int h;
+
+    // gtk thread state
+    TFrameCache *cache;
+    bool blink_hidden;
+    bool blinking;
+    int sent_w;
+    int sent_h;
+} parser_t;
+
+/* A paste in progress.  Large pastes are fed to the tty a chunk at a time as
+   it drains, so other writes can go out ahead of the rest of the paste. */
 typedef struct {
+    char *text;
+    size_t len;
+    size_t off;
+    bool bracketed;
+    // is a \e[200~ currently open?
+    bool open;
+} paste_t;
+
+/* don't queue more paste data than this for the tty at once; kept small,
+   since what is already queued still goes out when ctrl+c cancels a paste */
+#define PASTE_CHUNK 4096
+#define PASTE_HIGH_WATER 4096
+
+/* keypress to pty latency: from the key event to the writev() which sent
+   its bytes.  Keys which are sent together count once, from the oldest. */
+typedef struct {
+    gint64 since; // when the oldest unsent key was pressed, or 0
+    uint64_t mark; // writable bytes_added after the newest unsent key
+    uint64_t count;
+    gint64 total_us;
+    gint64 max_us;
+} latency_t;
+
+/* Everything about one window.  There is one per process, except with
+   --server, where each nastc request opens another. */
+typedef struct globals {
     // hooks pointer, must be the first element
     THooks hooks;
     Term *term;
     pid_t pid;
+    // the child is gone; its window closes now
+    bool reaped;
+    struct globals *next;
 
     char *font_name;
     int font_size;
 
     // rendering and io state
     bool want_focus;
+    bool focused;
+
+    // blink timer, only running while something on screen can blink
+    guint blink_src;
+    gint64 last_input;
+
+    // idle source for prerendering lines near the window
+    guint prerender_src;
+
+    // only with --parser-thread, otherwise NULL
+    parser_t *parser;
+
+    /* smooth scrolling: events only accumulate, and the frame clock applies
+       them, so there is one redraw per frame no matter the event rate */
+    guint scroll_tick;
+    double scroll_pending; // lines
+    double scroll_velocity; // lines per second
+    guint32 scroll_ms; // time of the last smooth scroll event
+    bool kinetic; // still coasting after the touchpad let go
+    gint64 kinetic_us; // time of the last kinetic step
+    double zoom_pending; // ctrl+scroll, in font size steps
+
+    /* pointer motion only keeps the newest position, which the frame clock
+       hands to the Term once per frame, however fast the mouse reports */
+    guint motion_tick;
+    bool motion_pending;
+    mouse_ev_t motion;
 
     int ttyfd;
+    /* writing to the tty failed with EIO or EPIPE: the child is gone, so
+       the queue was dropped and nothing more is written */
+    bool tty_hup;
     struct writable writable;
+    // the rest of a paste still waiting for the tty, or NULL
+    paste_t *paste;
+    latency_t keylat;
+    /* per-stage keypress latency (NAST_TRACE=file.json, or ctrl+shift+L
+       to show it live), NULL until something turns it on.  Each keypress
+       which sends bytes is a flow; the flow_* are the newest flow each
+       stage has got to, which covers all the older ones. */
+    trace_t *trace;
+    uint64_t flow_sent; // (whichever thread owns the Term)
+    uint64_t flow_written; // (ditto)
+    uint64_t flow_parsed; // (ditto, and read by the gtk thread)
+    uint64_t flow_drawn;
+    uint64_t flow_presented;
+    bool trace_shown;
+    guint trace_src;
+    GdkFrameClock *frame_clock;
+    gulong after_paint;
     gboolean write_pending;
     GtkWidget *window;
     GtkWidget *darea;
+    GIOChannel *rd_ttychan;
     GIOChannel *wr_ttychan;
+    guint rd_src;
+    guint wr_src;
     GtkClipboard *primary;
     GtkClipboard *clipboard;
+    /* lazy offers of the selection (see offer_clipboard()): do we own each
+       clipboard, and which offer is it?  offer_seq counts offers made by
+       the Term, which with --parser-thread is on the other thread. */
+    bool offering[2];
+    uint64_t offering_seq[2];
+    uint64_t offer_seq[2];
+    // the offer the Term took back last (see drop_clipboard())
+    uint64_t drop_seq[2];
+    // replacing our own offer, so gtk's clear callback isn't a drop
+    bool reoffering;
+
+    // the search box (ctrl+shift+F), which takes all keys while it is open
+    bool searching;
+    char search[256];
+    size_t search_len;
 
-    // pipe to close when it's time to exit
-    int ctrl_w;
     // did we kill things?
     bool killed;
 } globals_t;
 
-// sigchld needs to know the globals I guess?
-globals_t *G;
+// every open window
+static globals_t *windows;
+// keep running with no windows, and open more for nastc
+static bool server;
+static char sock_file[108];
+static bool parser_thread;
+
+/* sigchld passes each reaped child to the main loop through this pipe, for
+   event-loop-friendly signal handling; sigusr1 sends pid 0, for stats */
+static int ctrl_w;
+
+typedef struct {
+    pid_t pid;
+    int status;
+} reaped_t;
 
 // forward declarations
 static gboolean tty_io(GIOChannel *src, GIOCondition cond, gpointer user_data);
 void ttywrite(globals_t *g, const char *s, size_t n, int may_echo);
+int addflags(int fd, int flags);
+static void paste_break(globals_t *g);
+static void print_stats(globals_t *g, const TStats *ts);
 
 static void ttywrite_hook(THooks *thooks, const char *buf, size_t len){
     globals_t *g = (globals_t*)thooks;
+    // whatever the terminal sends must not land inside a bracketed paste
+    paste_break(g);
     ttywrite(g, buf, len, 0);
 }
 
@@ -88,16 +317,64 @@ void set_title(THooks *thooks, const char *title){
     // we will always just ignore this and leave ourselves called "nast"
 }
 
+// (the window may be gone by the time this runs; the clipboard won't be)
+typedef struct {
+    GtkClipboard *cb;
+    char *buf;
+    size_t len;
+} clipboard_req_t;
+
+static gboolean set_clipboard_cb(gpointer user_data){
+    clipboard_req_t *req = user_data;
+    gtk_clipboard_set_text(req->cb, req->buf, req->len);
+    free(req->buf);
+    free(req);
+    return G_SOURCE_REMOVE;
+}
+
 void set_clipboard(THooks *thooks, char *buf, size_t len, int clipboard){
     globals_t *g = (globals_t*)thooks;
-    gtk_clipboard_set_text(clipboard ? g->clipboard : g->primary, buf, len);
-    free(buf);
+    clipboard_req_t *req = xmalloc(sizeof(*req));
+    *req = (clipboard_req_t){
+        clipboard ? g->clipboard : g->primary, buf, len
+    };
+    if(g->parser){
+        // gtk calls belong on the gtk thread
+        g_idle_add(set_clipboard_cb, req);
+    }else{
+        set_clipboard_cb(req);
+    }
+}
+
+// the text of an offered selection, or NULL if the offer is gone
+static char *clipboard_text(Term *t, int clipboard, size_t *len){
+    TSelCursor c = {0};
+    size_t cap = 65536;
+    char *buf = xmalloc(cap);
+    *len = 0;
+    while(true){
+        ssize_t n = tclipboardread(t, clipboard, &c, buf + *len, cap - *len);
+        if(n < 0){
+            free(buf);
+            return NULL;
+        }
+        if(n == 0) return buf;
+        *len += n;
+        if(cap - *len < 4){
+            cap *= 2;
+            buf = xrealloc(buf, cap);
+        }
+    }
 }
 
 void ttywrite(globals_t *g, const char *s, size_t n, int may_echo){
-    if(!g->write_pending){
+    // (nobody is listening any more)
+    if(g->tty_hup) return;
+
+    // (the parser thread polls for writability itself)
+    if(!g->parser && !g->write_pending){
         g->write_pending = TRUE;
-        g_io_add_watch(g->wr_ttychan, G_IO_OUT, tty_io, g);
+        g->wr_src = g_io_add_watch(g->wr_ttychan, G_IO_OUT, tty_io, g);
     }
 
     if(may_echo && t_isset_echo(g->term)) {
@@ -107,28 +384,608 @@ void ttywrite(globals_t *g, const char *s, size_t n, int may_echo){
     if(!t_isset_crlf(g->term)){
         writable_add_bytes(&g->writable, s, n);
     }else{
-        // do an extra copy with the \r -> \r\n conversion
-        char buffer[16384];
-        size_t len = 0;
-        for(size_t i = 0; i < n; i++){
-            char c = s[i];
-            if(c == '\r'){
-                buffer[len++] = '\r';
-                buffer[len++] = '\n';
-            }else{
-                buffer[len++] = c;
+        writable_add_crlf(&g->writable, s, n);
+    }
+}
+
+// close the bracket around a pending paste; paste_pump reopens it
+static void paste_break(globals_t *g){
+    paste_t *p = g->paste;
+    if(!p || !p->open) return;
+    ttywrite(g, "\x1b[201~", 6, 0);
+    p->open = false;
+}
+
+// finish the pending paste, dropping whatever hasn't been queued yet
+static void paste_end(globals_t *g){
+    paste_break(g);
+    free(g->paste->text);
+    free(g->paste);
+    g->paste = NULL;
+}
+
+// top up the write queue from the pending paste
+static void paste_pump(globals_t *g){
+    paste_t *p = g->paste;
+    if(!p) return;
+    while(writable_len(&g->writable) < PASTE_HIGH_WATER){
+        if(p->off == p->len){
+            paste_end(g);
+            return;
+        }
+        if(p->bracketed && !p->open){
+            ttywrite(g, "\x1b[200~", 6, 0);
+            p->open = true;
+        }
+        size_t n = MIN(PASTE_CHUNK, p->len - p->off);
+        /* end on a utf8 boundary, since a key may break the bracket here
+           (unless a chunk of continuation bytes is all there is) */
+        size_t cut = n;
+        while(
+            cut && p->off + cut < p->len
+            && (p->text[p->off + cut] & 0xC0) == 0x80
+        ) cut--;
+        if(cut) n = cut;
+        ttywrite(g, p->text + p->off, n, 0);
+        p->off += n;
+    }
+}
+
+// takes ownership of text
+static void paste(globals_t *g, char *text){
+    size_t len = strlen(text);
+    paste_t *p = g->paste;
+    if(p){
+        // still busy with the last one; this one goes after it
+        size_t left = p->len - p->off;
+        char *buf = xmalloc(left + len);
+        memcpy(buf, p->text + p->off, left);
+        memcpy(buf + left, text, len);
+        free(text);
+        free(p->text);
+        p->text = buf;
+        p->len = left + len;
+        p->off = 0;
+    }else{
+        p = xmalloc(sizeof(*p));
+        *p = (paste_t){
+            .text = text,
+            .len = len,
+            .bracketed = t_isset_bracketpaste(g->term),
+        };
+        g->paste = p;
+    }
+    paste_pump(g);
+}
+
+// (the gtk thread may turn tracing on while the parser thread runs)
+static trace_t *trace_of(globals_t *g){
+    return __atomic_load_n(&g->trace, __ATOMIC_ACQUIRE);
+}
+
+/* Keys jump ahead of the rest of a pending paste (ttywrite_hook closes the
+   bracket first), and ctrl+c cancels it outright.  Call from whichever
+   thread owns the Term. */
+static bool keyev(globals_t *g, key_ev_t ev, gint64 us){
+    if(g->paste && ev.key == 'c' && ev.mods == CTRL_MASK) paste_end(g);
+    uint64_t before = g->writable.stats.bytes_added;
+    bool ret = tkeyev(g->term, ev);
+    if(g->writable.stats.bytes_added != before){
+        if(!g->keylat.since) g->keylat.since = us;
+        g->keylat.mark = g->writable.stats.bytes_added;
+        trace_t *tr = trace_of(g);
+        if(tr){
+            g->flow_sent++;
+            trace_mark(tr, TRACE_KEY, g->flow_sent, us);
+            trace_mark(tr, TRACE_KEYEV, g->flow_sent, trace_now());
+        }
+    }
+    return ret;
+}
+
+// stop writing to a tty whose child is gone
+static void tty_hangup(globals_t *g){
+    g->tty_hup = true;
+    writable_drop(&g->writable);
+    if(g->paste) paste_end(g);
+}
+
+// write what the tty will take, then top up any pending paste
+static void tty_flush(globals_t *g){
+    if(g->tty_hup) return;
+    ssize_t ret = writable_writev(&g->writable, g->ttyfd);
+    if(ret < 0 && (errno == EIO || errno == EPIPE)){
+        // only this window's child hung up; sigchld will close it
+        tty_hangup(g);
+        return;
+    }
+    if(ret < 0 && errno != EAGAIN && errno != EINTR){
+        die("couldn't write to tty: %s\n", strerror(errno));
+    }
+    latency_t *l = &g->keylat;
+    if(l->since && g->writable.stats.bytes_written >= l->mark){
+        gint64 us = g_get_monotonic_time() - l->since;
+        l->count++;
+        l->total_us += us;
+        l->max_us = MAX(l->max_us, us);
+        l->since = 0;
+        trace_t *tr = trace_of(g);
+        if(tr && g->flow_written != g->flow_sent){
+            g->flow_written = g->flow_sent;
+            trace_mark(tr, TRACE_WRITE, g->flow_written, trace_now());
+        }
+    }
+    paste_pump(g);
+}
+
+/* Reading the tty, after keys were written: the output is taken to be their
+   echo.  Returns the flow it answers, or 0. */
+static uint64_t trace_read_begin(globals_t *g){
+    trace_t *tr = trace_of(g);
+    if(!tr || g->flow_written == g->flow_parsed) return 0;
+    trace_mark(tr, TRACE_READ, g->flow_written, trace_now());
+    return g->flow_written;
+}
+
+static void trace_read_end(globals_t *g, uint64_t flow){
+    if(!flow) return;
+    trace_mark(g->trace, TRACE_PARSED, flow, trace_now());
+    __atomic_store_n(&g->flow_parsed, flow, __ATOMIC_RELEASE);
+}
+
+// returns true if the font changed
+static bool zoom_term(globals_t *g, int n){
+    int new_size = g->font_size + n;
+    // don't let font_size drop to zero
+    if(new_size <= 0) return false;
+    int ret = tsetfont(g->term, g->font_name, new_size);
+    if(ret < 0) return false;
+    // found new font successfully
+    g->font_size = new_size;
+    return true;
+}
+
+//////// parser thread
+
+// queue a command for the parser thread (gtk thread only)
+static void cmd_push(globals_t *g, cmd_t cmd){
+    parser_t *p = g->parser;
+    size_t head = p->cmd_head;
+    // the queue only fills if the parser thread is stuck; wait it out
+    while(head - __atomic_load_n(&p->cmd_tail, __ATOMIC_ACQUIRE) == CMDQ_LEN){
+        sched_yield();
+    }
+    p->cmds[head % CMDQ_LEN] = cmd;
+    __atomic_store_n(&p->cmd_head, head + 1, __ATOMIC_RELEASE);
+    uint64_t one = 1;
+    if(write(p->wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN){
+        die("write(eventfd): %s\n", strerror(errno));
+    }
+}
+
+// returns true if the Term changed
+static bool parser_run_cmds(globals_t *g){
+    parser_t *p = g->parser;
+    size_t head = __atomic_load_n(&p->cmd_head, __ATOMIC_ACQUIRE);
+    bool dirty = false;
+    for(size_t tail = p->cmd_tail; tail != head; tail++){
+        cmd_t *cmd = &p->cmds[tail % CMDQ_LEN];
+        switch(cmd->type){
+            case CMD_KEY: dirty |= keyev(g, cmd->key, cmd->us); break;
+            case CMD_MOUSE: dirty |= tmouseev(g->term, cmd->mouse); break;
+            case CMD_FOCUS: dirty |= tfocusev(g->term, cmd->focused); break;
+
+            case CMD_SIZE:
+                p->w = cmd->size.w;
+                p->h = cmd->size.h;
+                tsetsize(g->term, p->w, p->h);
+                dirty = true;
+                break;
+
+            case CMD_ZOOM:
+                if(!zoom_term(g, cmd->n)) break;
+                // the grid changed, so the terminal may need to resize
+                if(p->w) tsetsize(g->term, p->w, p->h);
+                dirty = true;
+                break;
+
+            case CMD_SCROLL:
+                dirty |= twindowscroll(g->term, cmd->lines);
+                break;
+
+            case CMD_PASTE:
+                paste(g, cmd->text);
+                break;
+
+            case CMD_EXPORT: texportselection(g->term, cmd->n); break;
+
+            case CMD_SEARCH:
+                tsearch(g->term, cmd->text, cmd->flags);
+                free(cmd->text);
+                dirty = true;
+                break;
+
+            case CMD_SEARCH_NEXT:
+                dirty |= tsearchnext(g->term, cmd->reverse) > 0;
+                break;
+
+            case CMD_SEARCH_END:
+                tsearchend(g->term);
+                dirty = true;
+                break;
+
+            case CMD_CLIPBOARD_READ:{
+                clipread_t *r = cmd->read;
+                char *text = clipboard_text(g->term, r->clipboard, &r->len);
+                pthread_mutex_lock(&r->lock);
+                r->text = text;
+                r->done = true;
+                pthread_cond_signal(&r->cond);
+                pthread_mutex_unlock(&r->lock);
+                break;
+            }
+
+            case CMD_CLIPBOARD_DROP:{
+                int i = cmd->drop.clipboard;
+                // (unless a newer offer is already on its way to gtk)
+                if(cmd->drop.seq == g->offer_seq[i]){
+                    tclipboarddrop(g->term, i);
+                }
+                break;
+            }
+
+            case CMD_STATS:{
+                TStats ts = tstats(g->term);
+                // the Term never draws in this mode
+                ts.draw = cmd->draw;
+                print_stats(g, &ts);
+                break;
+            }
+
+            case CMD_QUIT: p->quit = true; break;
+        }
+    }
+    __atomic_store_n(&p->cmd_tail, head, __ATOMIC_RELEASE);
+    return dirty;
+}
+
+static gboolean frame_ready_cb(gpointer user_data){
+    globals_t *g = user_data;
+    __atomic_store_n(&g->parser->notify, false, __ATOMIC_RELEASE);
+    gtk_widget_queue_draw(g->darea);
+    return G_SOURCE_REMOVE;
+}
+
+static void parser_publish(globals_t *g){
+    parser_t *p = g->parser;
+    tframe_capture(g->term, p->frames[p->back]);
+    p->frame_flow[p->back] = g->flow_parsed;
+    int old = __atomic_exchange_n(
+        &p->middle, p->back | FRAME_FRESH, __ATOMIC_ACQ_REL
+    );
+    p->back = old & ~FRAME_FRESH;
+    // wake the gtk thread, unless a wakeup is already on its way
+    if(!__atomic_exchange_n(&p->notify, true, __ATOMIC_ACQ_REL)){
+        g_idle_add(frame_ready_cb, g);
+    }
+}
+
+// take the newest published frame, if any (gtk thread only)
+static TFrame *parser_frame(parser_t *p){
+    if(__atomic_load_n(&p->middle, __ATOMIC_ACQUIRE) & FRAME_FRESH){
+        int old = __atomic_exchange_n(&p->middle, p->front, __ATOMIC_ACQ_REL);
+        p->front = old & ~FRAME_FRESH;
+        p->have_frame = true;
+    }
+    return p->have_frame ? p->frames[p->front] : NULL;
+}
+
+static void *parser_main(void *arg){
+    globals_t *g = arg;
+    parser_t *p = g->parser;
+    bool dirty = false;
+    bool hup = false;
+    gint64 last_publish = 0;
+
+    while(!p->quit){
+        short tty_events = POLLIN;
+        if(!g->tty_hup && writable_nonempty(&g->writable)){
+            tty_events |= POLLOUT;
+        }
+        struct pollfd pfds[2] = {
+            { .fd = p->wake_fd, .events = POLLIN },
+            { .fd = hup ? -1 : g->ttyfd, .events = tty_events },
+        };
+
+        // don't publish (or wait on publishing) until gtk has sized us
+        bool publish = dirty && p->w;
+        int timeout = -1;
+        if(publish){
+            gint64 since = (g_get_monotonic_time() - last_publish) / 1000;
+            timeout = since >= PUBLISH_MS ? 0 : (int)(PUBLISH_MS - since);
+        }
+
+        if(poll(pfds, 2, timeout) < 0){
+            if(errno == EINTR) continue;
+            die("poll: %s\n", strerror(errno));
+        }
+
+        if(pfds[0].revents & POLLIN){
+            uint64_t count;
+            if(read(p->wake_fd, &count, sizeof(count)) < 0 && errno != EAGAIN){
+                die("read(eventfd): %s\n", strerror(errno));
             }
-            // need to flush the buffer?
-            if(len + 2 >= sizeof(buffer)){
-                writable_add_bytes(&g->writable, buffer, len);
-                len = 0;
+            dirty |= parser_run_cmds(g);
+            // send keystrokes right away
+            if(!g->tty_hup) tty_flush(g);
+        }
+
+        short rev = pfds[1].revents;
+        if(rev & (POLLHUP | POLLERR | POLLNVAL)){
+            // the child is gone; sigchld takes care of quitting
+            hup = true;
+            tty_hangup(g);
+        }else{
+            if(rev & POLLIN){
+                uint64_t flow = trace_read_begin(g);
+                ttyread(g->term);
+                trace_read_end(g, flow);
+                dirty = true;
             }
+            if(rev & POLLOUT) tty_flush(g);
         }
-        // anything to flush at the end?
-        if(len > 0){
-            writable_add_bytes(&g->writable, buffer, len);
+
+        gint64 now = g_get_monotonic_time();
+        if(dirty && p->w && (now - last_publish) / 1000 >= PUBLISH_MS){
+            parser_publish(g);
+            last_publish = now;
+            dirty = false;
         }
     }
+    return NULL;
+}
+
+static void parser_start(globals_t *g){
+    parser_t *p = xmalloc(sizeof(*p));
+    *p = (parser_t){ .back = 0, .middle = 1, .front = 2 };
+    for(int i = 0; i < 3; i++) p->frames[i] = tframe_new();
+    p->cache = tframecache_new();
+    p->wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if(p->wake_fd < 0) die("eventfd: %s\n", strerror(errno));
+    g->parser = p;
+
+    if(addflags(g->ttyfd, O_NONBLOCK)) die("unable to configure tty\n");
+
+    int ret = pthread_create(&p->thread, NULL, parser_main, g);
+    if(ret) die("pthread_create: %s\n", strerror(ret));
+}
+
+static void parser_stop(globals_t *g){
+    parser_t *p = g->parser;
+    cmd_push(g, (cmd_t){ .type = CMD_QUIT });
+    pthread_join(p->thread, NULL);
+    // free anything left in the queue
+    for(size_t i = p->cmd_tail; i != p->cmd_head; i++){
+        cmd_t *cmd = &p->cmds[i % CMDQ_LEN];
+        if(cmd->type == CMD_PASTE || cmd->type == CMD_SEARCH) free(cmd->text);
+    }
+    for(int i = 0; i < 3; i++) tframe_free(p->frames[i]);
+    tframecache_free(p->cache);
+    close(p->wake_fd);
+    free(p);
+    g->parser = NULL;
+}
+
+/* These route an event to the Term directly, or to the parser thread when
+   there is one.  When queued, the return value is false; the parser thread
+   publishes a new frame if the event changed anything. */
+
+static bool term_keyev(globals_t *g, key_ev_t ev){
+    gint64 us = g_get_monotonic_time();
+    if(!g->parser){
+        bool ret = keyev(g, ev, us);
+        // don't make keystrokes wait for the write watch to come around
+        if(!g->tty_hup && writable_nonempty(&g->writable)) tty_flush(g);
+        return ret;
+    }
+    cmd_push(g, (cmd_t){ .type = CMD_KEY, .us = us, .key = ev });
+    return false;
+}
+
+static bool term_mouseev(globals_t *g, mouse_ev_t ev){
+    if(!g->parser) return tmouseev(g->term, ev);
+    cmd_push(g, (cmd_t){ .type = CMD_MOUSE, .mouse = ev });
+    return false;
+}
+
+static bool term_focusev(globals_t *g, bool focused){
+    if(!g->parser) return tfocusev(g->term, focused);
+    cmd_push(g, (cmd_t){ .type = CMD_FOCUS, .focused = focused });
+    return false;
+}
+
+// (queued scrolls report a move, since there's no way to know yet)
+static bool term_windowscroll(globals_t *g, double lines){
+    if(!g->parser) return twindowscroll(g->term, lines);
+    cmd_push(g, (cmd_t){ .type = CMD_SCROLL, .lines = lines });
+    return true;
+}
+
+static void term_exportselection(globals_t *g, int clipboard){
+    if(!g->parser){
+        texportselection(g->term, clipboard);
+        return;
+    }
+    cmd_push(g, (cmd_t){ .type = CMD_EXPORT, .n = clipboard });
+}
+
+// (queued searches report a change, since the match highlight likely moved)
+static bool term_search(globals_t *g, const char *pattern, int flags){
+    if(!g->parser){
+        tsearch(g->term, pattern, flags);
+        return true;
+    }
+    cmd_push(g, (cmd_t){
+        .type = CMD_SEARCH, .flags = flags, .text = xstrdup((char*)pattern)
+    });
+    return true;
+}
+
+static bool term_searchnext(globals_t *g, bool reverse){
+    if(!g->parser) return tsearchnext(g->term, reverse) > 0;
+    cmd_push(g, (cmd_t){ .type = CMD_SEARCH_NEXT, .reverse = reverse });
+    return false;
+}
+
+static bool term_searchend(globals_t *g){
+    if(!g->parser){
+        tsearchend(g->term);
+        return true;
+    }
+    cmd_push(g, (cmd_t){ .type = CMD_SEARCH_END });
+    return false;
+}
+
+//////// lazy clipboards
+
+/* A selection is offered to a clipboard without its text, which is only
+   made when another program pastes it.  Copying a huge selection costs
+   nothing until then, and then only what gtk asks for. */
+
+static void clipboard_get(
+    GtkClipboard *cb, GtkSelectionData *data, guint info, gpointer user_data
+){
+    (void)info;
+    globals_t *g = user_data;
+    int clipboard = cb == g->clipboard;
+    char *text;
+    size_t len;
+    if(!g->parser){
+        text = clipboard_text(g->term, clipboard, &len);
+    }else{
+        // (the parser thread only quits when we tell it to, so it answers)
+        clipread_t r = { .clipboard = clipboard };
+        pthread_mutex_init(&r.lock, NULL);
+        pthread_cond_init(&r.cond, NULL);
+        cmd_push(g, (cmd_t){ .type = CMD_CLIPBOARD_READ, .read = &r });
+        pthread_mutex_lock(&r.lock);
+        while(!r.done) pthread_cond_wait(&r.cond, &r.lock);
+        pthread_mutex_unlock(&r.lock);
+        pthread_mutex_destroy(&r.lock);
+        pthread_cond_destroy(&r.cond);
+        text = r.text;
+        len = r.len;
+    }
+    // a gone offer leaves the requestor with nothing, like an empty one
+    if(!text) return;
+    gtk_selection_data_set_text(data, text, (gint)len);
+    free(text);
+}
+
+// another program owns the clipboard now, or we replaced the offer
+static void clipboard_clear(GtkClipboard *cb, gpointer user_data){
+    globals_t *g = user_data;
+    if(g->reoffering) return;
+    int clipboard = cb == g->clipboard;
+    g->offering[clipboard] = false;
+    if(!g->parser){
+        tclipboarddrop(g->term, clipboard);
+        return;
+    }
+    cmd_push(g, (cmd_t){
+        .type = CMD_CLIPBOARD_DROP,
+        .drop = { clipboard, g->offering_seq[clipboard] },
+    });
+}
+
+static void clipboard_offer(globals_t *g, int clipboard){
+    GtkClipboard *cb = clipboard ? g->clipboard : g->primary;
+    GtkTargetList *list = gtk_target_list_new(NULL, 0);
+    gtk_target_list_add_text_targets(list, 0);
+    gint n;
+    GtkTargetEntry *targets = gtk_target_table_new_from_list(list, &n);
+    g->reoffering = true;
+    gtk_clipboard_set_with_data(
+        cb, targets, n, clipboard_get, clipboard_clear, g
+    );
+    g->reoffering = false;
+    gtk_target_table_free(targets, n);
+    gtk_target_list_unref(list);
+    g->offering[clipboard] = true;
+    g->offering_seq[clipboard] = __atomic_load_n(
+        &g->offer_seq[clipboard], __ATOMIC_ACQUIRE
+    );
+}
+
+static gboolean offer_primary_cb(gpointer user_data){
+    clipboard_offer(user_data, 0);
+    return G_SOURCE_REMOVE;
+}
+
+static gboolean offer_clipboard_cb(gpointer user_data){
+    clipboard_offer(user_data, 1);
+    return G_SOURCE_REMOVE;
+}
+
+static void offer_clipboard(THooks *thooks, int clipboard){
+    globals_t *g = (globals_t*)thooks;
+    __atomic_add_fetch(&g->offer_seq[clipboard], 1, __ATOMIC_RELEASE);
+    if(g->parser){
+        // gtk calls belong on the gtk thread
+        g_idle_add(clipboard ? offer_clipboard_cb : offer_primary_cb, g);
+    }else{
+        clipboard_offer(g, clipboard);
+    }
+}
+
+static void clipboard_let_go(globals_t *g, int clipboard){
+    uint64_t seq = __atomic_load_n(&g->drop_seq[clipboard], __ATOMIC_ACQUIRE);
+    // (unless a newer offer has taken its place)
+    if(g->offering[clipboard] && g->offering_seq[clipboard] == seq){
+        gtk_clipboard_clear(clipboard ? g->clipboard : g->primary);
+    }
+}
+
+static gboolean drop_primary_cb(gpointer user_data){
+    clipboard_let_go(user_data, 0);
+    return G_SOURCE_REMOVE;
+}
+
+static gboolean drop_clipboard_cb(gpointer user_data){
+    clipboard_let_go(user_data, 1);
+    return G_SOURCE_REMOVE;
+}
+
+// the Term took an offer back, so stop claiming to have a selection
+static void drop_clipboard(THooks *thooks, int clipboard){
+    globals_t *g = (globals_t*)thooks;
+    uint64_t seq = __atomic_load_n(&g->offer_seq[clipboard], __ATOMIC_ACQUIRE);
+    __atomic_store_n(&g->drop_seq[clipboard], seq, __ATOMIC_RELEASE);
+    if(g->parser){
+        // gtk calls belong on the gtk thread
+        g_idle_add(clipboard ? drop_clipboard_cb : drop_primary_cb, g);
+    }else{
+        clipboard_let_go(g, clipboard);
+    }
+}
+
+// the blink phase lives on the gtk thread when frames are detached
+static bool term_blinking(globals_t *g){
+    if(!g->parser) return tblinking(g->term);
+    return g->parser->blinking;
+}
+
+static bool term_blink(globals_t *g){
+    if(!g->parser) return tblink(g->term);
+    g->parser->blink_hidden = !g->parser->blink_hidden;
+    return g->parser->blinking;
+}
+
+static bool term_blinkreset(globals_t *g){
+    if(!g->parser) return tblinkreset(g->term);
+    bool was_hidden = g->parser->blink_hidden;
+    g->parser->blink_hidden = false;
+    return was_hidden;
 }
 
 // // return -1 on failure, 0 on success
@@ -179,6 +1036,196 @@ void ttywrite(globals_t *g, const char *s, size_t n, int may_echo){
 //     return 0;
 // }
 
+static gboolean blink_cb(gpointer user_data);
+
+// start or stop the blink timer, depending on if anything should be blinking
+static void blink_update(globals_t *g){
+    gint64 idle_ms = (g_get_monotonic_time() - g->last_input) / 1000;
+    bool want = g->focused && idle_ms < BLINK_IDLE_MS && term_blinking(g);
+    if(want && !g->blink_src){
+        g->blink_src = g_timeout_add(BLINK_MS, blink_cb, g);
+    }else if(!want && g->blink_src){
+        g_source_remove(g->blink_src);
+        g->blink_src = 0;
+        // never stop in the hidden phase
+        if(term_blinkreset(g)) gtk_widget_queue_draw(g->darea);
+    }
+}
+
+static gboolean blink_cb(gpointer user_data){
+    globals_t *g = user_data;
+    gint64 idle_ms = (g_get_monotonic_time() - g->last_input) / 1000;
+    if(idle_ms >= BLINK_IDLE_MS){
+        g->blink_src = 0;
+        if(term_blinkreset(g)) gtk_widget_queue_draw(g->darea);
+        return G_SOURCE_REMOVE;
+    }
+    if(term_blink(g)) gtk_widget_queue_draw(g->darea);
+    return G_SOURCE_CONTINUE;
+}
+
+// user input restarts the blink cycle in the visible phase
+static void blink_restart(globals_t *g){
+    g->last_input = g_get_monotonic_time();
+    if(g->blink_src){
+        g_source_remove(g->blink_src);
+        g->blink_src = 0;
+    }
+    if(term_blinkreset(g)) gtk_widget_queue_draw(g->darea);
+    blink_update(g);
+}
+
+static gboolean scroll_tick_cb(
+    GtkWidget *widget, GdkFrameClock *clock, gpointer user_data
+){
+    (void)widget;
+    globals_t *g = user_data;
+
+    if(g->kinetic){
+        gint64 now = gdk_frame_clock_get_frame_time(clock);
+        double dt = (now - g->kinetic_us) / 1e6;
+        g->kinetic_us = now;
+        g->scroll_pending += g->scroll_velocity * dt;
+        g->scroll_velocity *= exp(-dt / KINETIC_TAU);
+        if(fabs(g->scroll_velocity) < KINETIC_MIN) g->kinetic = false;
+    }
+
+    if(g->scroll_pending){
+        bool moved = term_windowscroll(g, g->scroll_pending);
+        g->scroll_pending = 0;
+        if(moved){
+            gtk_widget_queue_draw(g->darea);
+        }else if(g->kinetic){
+            // ran into one end of the scrollback
+            g->kinetic = false;
+        }
+    }
+
+    if(g->kinetic) return G_SOURCE_CONTINUE;
+    g->scroll_tick = 0;
+    return G_SOURCE_REMOVE;
+}
+
+static void scroll_schedule(globals_t *g){
+    if(g->scroll_tick) return;
+    g->scroll_tick = gtk_widget_add_tick_callback(
+        g->darea, scroll_tick_cb, g, NULL
+    );
+}
+
+// cancel any smooth or kinetic scrolling in progress
+static void scroll_stop(globals_t *g){
+    g->kinetic = false;
+    g->scroll_pending = 0;
+    g->scroll_velocity = 0;
+    if(g->scroll_tick){
+        gtk_widget_remove_tick_callback(g->darea, g->scroll_tick);
+        g->scroll_tick = 0;
+    }
+}
+
+static gboolean prerender_cb(gpointer user_data){
+    globals_t *g = user_data;
+    if(tprerender(g->term, PRERENDER_BATCH)) return G_SOURCE_CONTINUE;
+    g->prerender_src = 0;
+    return G_SOURCE_REMOVE;
+}
+
+// drawing a frame which shows flow; returns it if it wasn't drawn before
+static uint64_t trace_render_begin(globals_t *g, uint64_t flow){
+    if(!g->trace || flow == g->flow_drawn) return 0;
+    trace_mark(g->trace, TRACE_RENDER, flow, trace_now());
+    return flow;
+}
+
+static void trace_render_end(globals_t *g, uint64_t flow){
+    if(!flow) return;
+    trace_mark(g->trace, TRACE_RENDERED, flow, trace_now());
+    g->flow_drawn = flow;
+}
+
+// https://docs.gtk.org/gdk3/signal.FrameClock.after-paint.html
+static void on_after_paint(GdkFrameClock *clock, gpointer user_data){
+    (void)clock;
+    globals_t *g = user_data;
+    if(!g->trace || g->flow_presented == g->flow_drawn) return;
+    g->flow_presented = g->flow_drawn;
+    trace_mark(g->trace, TRACE_PRESENT, g->flow_presented, trace_now());
+}
+
+// the latency overlay: each stage's p50 and p99 since the key, and a histogram
+static void trace_draw(globals_t *g, cairo_t *cr, int w){
+    trace_hist_t hists[TRACE_NSTAGES];
+    trace_latency(g->trace, hists);
+    // buckets from 64us to 256ms, 6px each
+    int lo = 6, hi = 18;
+    double lh = 16, bw = 6, tw = 330;
+    double x0 = w - tw - (hi - lo) * bw - 16, y0 = 8;
+    cairo_save(cr);
+    cairo_set_source_rgba(cr, 0, 0, 0, 0.8);
+    cairo_rectangle(
+        cr, x0, y0, tw + (hi - lo) * bw + 8, lh * (TRACE_NSTAGES - 1) + 8
+    );
+    cairo_fill(cr);
+    cairo_select_font_face(
+        cr, "monospace", CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_NORMAL
+    );
+    cairo_set_font_size(cr, 12);
+    // (the key itself is where every latency starts)
+    for(int s = TRACE_KEYEV; s < TRACE_NSTAGES; s++){
+        trace_hist_t *h = &hists[s];
+        double y = y0 + 4 + lh * (s - 1);
+        char buf[128];
+        snprintf(
+            buf, sizeof(buf), "%-8s %5zu  p50 %7.2fms  p99 %7.2fms",
+            trace_stage_name(s), h->n, h->p50_us / 1e3, h->p99_us / 1e3
+        );
+        cairo_set_source_rgba(cr, 1, 1, 1, 0.9);
+        cairo_move_to(cr, x0 + 6, y + lh - 4);
+        cairo_show_text(cr, buf);
+
+        // (the first and last buckets take everything beyond them)
+        uint32_t counts[TRACE_BUCKETS] = {0};
+        uint32_t most = 1;
+        for(int b = 0; b < TRACE_BUCKETS; b++){
+            counts[MAX(lo, MIN(b, hi - 1))] += h->buckets[b];
+        }
+        for(int b = lo; b < hi; b++) most = MAX(most, counts[b]);
+        cairo_set_source_rgba(cr, 0.4, 0.8, 1, 0.9);
+        for(int b = lo; b < hi; b++){
+            double bh = (lh - 4) * counts[b] / most;
+            cairo_rectangle(
+                cr, x0 + tw + (b - lo) * bw, y + lh - 2 - bh, bw - 1, bh
+            );
+        }
+        cairo_fill(cr);
+    }
+    cairo_restore(cr);
+}
+
+static gboolean trace_tick_cb(gpointer user_data){
+    globals_t *g = user_data;
+    gtk_widget_queue_draw(g->darea);
+    return G_SOURCE_CONTINUE;
+}
+
+// show or hide the latency overlay, tracing from now on if we weren't
+static void trace_toggle(globals_t *g){
+    if(!g->trace){
+        trace_t *tr = trace_new(0);
+        if(!tr) die("trace_new: out of memory\n");
+        __atomic_store_n(&g->trace, tr, __ATOMIC_RELEASE);
+    }
+    g->trace_shown = !g->trace_shown;
+    if(g->trace_shown){
+        g->trace_src = g_timeout_add(TRACE_REFRESH_MS, trace_tick_cb, g);
+    }else{
+        g_source_remove(g->trace_src);
+        g->trace_src = 0;
+    }
+    gtk_widget_queue_draw(g->darea);
+}
+
 // developer.gnome.org/gtk3/3.24/GtkWidget.html#GtkWidget-draw
 static gboolean on_draw_event(GtkWidget *widget, cairo_t *cr,
         gpointer user_data){
@@ -187,9 +1234,39 @@ static gboolean on_draw_event(GtkWidget *widget, cairo_t *cr,
     int w = gtk_widget_get_allocated_width(widget);
     int h = gtk_widget_get_allocated_height(widget);
 
+    if(g->parser){
+        parser_t *p = g->parser;
+        // the parser thread resizes the Term, we just draw what it sends
+        if(w != p->sent_w || h != p->sent_h){
+            p->sent_w = w;
+            p->sent_h = h;
+            cmd_push(g, (cmd_t){ .type = CMD_SIZE, .size = { w, h } });
+        }
+        TFrame *f = parser_frame(p);
+        uint64_t flow = trace_render_begin(g, f ? p->frame_flow[p->front] : 0);
+        p->blinking = tframe_render(p->cache, f, cr, w, h, p->blink_hidden);
+        trace_render_end(g, flow);
+        if(g->trace_shown) trace_draw(g, cr, w);
+        blink_update(g);
+        return FALSE;
+    }
+
     double x1, y1, x2, y2;
     cairo_clip_extents(cr, &x1, &y1, &x2, &y2);
+    uint64_t flow = trace_render_begin(g, g->flow_parsed);
     trender(g->term, cr, w, h, x1, y1, x2, y2);
+    trace_render_end(g, flow);
+    if(g->trace_shown) trace_draw(g, cr, w);
+
+    // what we just drew decides if the blink timer should run
+    blink_update(g);
+
+    // warm up the lines around the window once there's nothing else to do
+    if(!g->prerender_src && tprerender(g->term, 0)){
+        g->prerender_src = g_idle_add_full(
+            G_PRIORITY_LOW, prerender_cb, g, NULL
+        );
+    }
 
     // allow other handlers to process the event
     return FALSE;
@@ -204,10 +1281,72 @@ static void paste_cb(
         // there's no text to paste
         return;
     }
-    bool bracketpaste = t_isset_bracketpaste(g->term);
-    if(bracketpaste) ttywrite(g, "\x1b[200~", 6, 0);
-    ttywrite(g, text, strlen(text), 0);
-    if(bracketpaste) ttywrite(g, "\x1b[201~", 6, 0);
+    if(g->parser){
+        cmd_push(g, (cmd_t){ .type = CMD_PASTE, .text = xstrdup((char*)text) });
+        return;
+    }
+    paste(g, xstrdup((char*)text));
+}
+
+// search for what is in the search box, from where the search started
+static void search_update(globals_t *g){
+    // smart case: only a pattern with capitals in it is case-sensitive
+    int flags = TSEARCH_BACKWARD | TSEARCH_ICASE;
+    for(const char *c = g->search; *c; c = g_utf8_next_char(c)){
+        if(g_unichar_isupper(g_utf8_get_char(c))) flags &= ~TSEARCH_ICASE;
+    }
+    char title[sizeof(g->search) + 16];
+    snprintf(title, sizeof(title), "nast: search: %s", g->search);
+    gtk_window_set_title(GTK_WINDOW(g->window), title);
+    if(term_search(g, g->search, flags)) gtk_widget_queue_draw(g->darea);
+}
+
+/* While the search box is open it takes every key: text edits the pattern,
+   enter (or up) goes to the next older match, shift+enter (or down) back to
+   a newer one, and escape closes it. */
+static void search_key(globals_t *g, GdkEventKey *event_key){
+    unsigned int state = event_key->state & (
+        GDK_CONTROL_MASK | GDK_SHIFT_MASK | GDK_MOD1_MASK | GDK_META_MASK
+    );
+    bool redraw = false;
+    switch(event_key->keyval){
+        case GDK_KEY_Escape:
+            g->searching = false;
+            gtk_window_set_title(GTK_WINDOW(g->window), "nast");
+            redraw = term_searchend(g);
+            break;
+
+        case GDK_KEY_BackSpace:
+            if(!g->search_len) break;
+            g->search_len = g_utf8_find_prev_char(
+                g->search, g->search + g->search_len
+            ) - g->search;
+            g->search[g->search_len] = '\0';
+            search_update(g);
+            return;
+
+        case GDK_KEY_Return:
+        case GDK_KEY_KP_Enter:
+            redraw = term_searchnext(g, state & GDK_SHIFT_MASK);
+            break;
+        case GDK_KEY_Up: redraw = term_searchnext(g, false); break;
+        case GDK_KEY_Down: redraw = term_searchnext(g, true); break;
+
+        default: {
+            gunichar c = gdk_keyval_to_unicode(event_key->keyval);
+            // only plain (or shifted) printable keys are typed
+            if(!c || g_unichar_iscntrl(c) || state & ~GDK_SHIFT_MASK) break;
+            char buf[6];
+            int n = g_unichar_to_utf8(c, buf);
+            if(g->search_len + n >= sizeof(g->search)) break;
+            memcpy(g->search + g->search_len, buf, n);
+            g->search_len += n;
+            g->search[g->search_len] = '\0';
+            search_update(g);
+            return;
+        }
+    }
+    if(redraw) gtk_widget_queue_draw(g->darea);
 }
 
 // developer.gnome.org/gtk3/3.24/GtkWidget.html#GtkWidget-key-press-event
@@ -222,6 +1361,15 @@ static gboolean on_key_event(
     // ignore releases
     if(event_key->type != GDK_KEY_PRESS) return TRUE;
 
+    if(g->searching){
+        search_key(g, event_key);
+        return FALSE;
+    }
+
+    blink_restart(g);
+    // typing returns the window to the bottom, don't fight it
+    scroll_stop(g);
+
     int key = -1;
     if(event_key->keyval < 128){
         // ascii keys are 1:1 with key
@@ -349,12 +1497,27 @@ static gboolean on_key_event(
        since there's no path by which an application could invoke this
        functionality */
     if(key == 'C' && mods == (CTRL_MASK | SHIFT_MASK)){
-        texportselection(g->term, 1);
+        term_exportselection(g, 1);
+        return FALSE;
+    }
+
+    // the latency overlay
+    if(key == 'L' && mods == (CTRL_MASK | SHIFT_MASK)){
+        trace_toggle(g);
+        return FALSE;
+    }
+
+    // open the search box
+    if(key == 'F' && mods == (CTRL_MASK | SHIFT_MASK)){
+        g->searching = true;
+        g->search_len = 0;
+        g->search[0] = '\0';
+        search_update(g);
         return FALSE;
     }
 
     key_ev_t ev = { key, mods };
-    bool redraw = tkeyev(g->term, ev);
+    bool redraw = term_keyev(g, ev);
     if(redraw) gtk_widget_queue_draw(g->darea);
     return FALSE;
 }
@@ -367,8 +1530,10 @@ static gboolean on_focus_in(
     (void)widget;
     (void)event;
     globals_t *g = user_data;
-    bool redraw = tfocusev(g->term, true);
+    g->focused = true;
+    bool redraw = term_focusev(g, true);
     if(redraw) gtk_widget_queue_draw(g->darea);
+    blink_restart(g);
     return FALSE;
 }
 
@@ -380,11 +1545,33 @@ static gboolean on_focus_out(
     (void)widget;
     (void)event;
     globals_t *g = user_data;
-    bool redraw = tfocusev(g->term, false);
+    g->focused = false;
+    bool redraw = term_focusev(g, false);
     if(redraw) gtk_widget_queue_draw(g->darea);
+    // stop blinking while unfocused
+    blink_update(g);
     return FALSE;
 }
 
+// apply the newest pointer motion, if there is any waiting
+static void motion_flush(globals_t *g){
+    if(!g->motion_pending) return;
+    g->motion_pending = false;
+    bool redraw = term_mouseev(g, g->motion);
+    if(redraw) gtk_widget_queue_draw(g->darea);
+}
+
+static gboolean motion_tick_cb(
+    GtkWidget *widget, GdkFrameClock *clock, gpointer user_data
+){
+    (void)widget;
+    (void)clock;
+    globals_t *g = user_data;
+    motion_flush(g);
+    g->motion_tick = 0;
+    return G_SOURCE_REMOVE;
+}
+
 // https://docs.gtk.org/gtk3/signal.Widget.button-press-event.html
 // https://docs.gtk.org/gdk3/struct.EventButton.html
 static gboolean on_button_event(
@@ -393,6 +1580,8 @@ static gboolean on_button_event(
     (void)widget;
     unsigned int modstate = event->state & GDK_MODIFIER_MASK;
     globals_t *g = user_data;
+    // a press or release happens where the pointer went before it
+    motion_flush(g);
     /* Discard doubleclick and tripleclick events, we'll just recalculate them.
        GTK's logic is weird anyway, since the second click of a doubleclick
        sends both a BUTTON_PRESS and a 2BUTTON_PRESS */
@@ -418,7 +1607,7 @@ static gboolean on_button_event(
         .y = (int)event->y,
         .pix_coords = true,
     };
-    bool redraw = tmouseev(g->term, ev);
+    bool redraw = term_mouseev(g, ev);
     if(redraw) gtk_widget_queue_draw(g->darea);
     return FALSE;
 }
@@ -441,11 +1630,67 @@ static gboolean on_motion_event(
         .y = (int)event->y,
         .pix_coords = true,
     };
-    bool redraw = tmouseev(g->term, ev);
-    if(redraw) gtk_widget_queue_draw(g->darea);
+    g->motion = ev;
+    g->motion_pending = true;
+    if(!g->motion_tick){
+        g->motion_tick = gtk_widget_add_tick_callback(
+            g->darea, motion_tick_cb, g, NULL
+        );
+    }
     return FALSE;
 }
 
+static void zoom(globals_t *g, int n){
+    if(g->parser){
+        cmd_push(g, (cmd_t){ .type = CMD_ZOOM, .n = n });
+        return;
+    }
+    if(zoom_term(g, n)) gtk_widget_queue_draw(g->darea);
+}
+
+/* touchpads (and wheels, with the smooth scroll mask) report fractional
+   deltas, where 1.0 is one wheel click */
+static void on_smooth_scroll(
+    globals_t *g, GdkEventScroll *event, unsigned int modstate
+){
+    double dx, dy;
+    if(!gdk_event_get_scroll_deltas((GdkEvent*)event, &dx, &dy)) return;
+
+    if(modstate == GDK_CONTROL_MASK){
+        // zoom in whole steps, carrying the remainder
+        g->zoom_pending -= dy;
+        int n = (int)g->zoom_pending;
+        g->zoom_pending -= n;
+        if(n) zoom(g, n);
+        return;
+    }
+
+    if(gdk_event_is_scroll_stop_event((GdkEvent*)event)){
+        // fingers lifted: coast with the last velocity, unless they paused
+        if(event->time - g->scroll_ms > 100) return;
+        if(fabs(g->scroll_velocity) < KINETIC_MIN) return;
+        g->kinetic = true;
+        g->kinetic_us = g_get_monotonic_time();
+        scroll_schedule(g);
+        return;
+    }
+
+    // gdk's dy is positive going down, but twindowscroll counts upwards
+    double lines = -dy;
+    g->kinetic = false;
+    // estimate velocity from recent events, forgetting it after a pause
+    guint32 dt_ms = event->time - g->scroll_ms;
+    g->scroll_ms = event->time;
+    if(dt_ms > 0 && dt_ms < 100){
+        double v = lines * 1000 / dt_ms;
+        g->scroll_velocity = 0.5 * g->scroll_velocity + 0.5 * v;
+    }else{
+        g->scroll_velocity = 0;
+    }
+    g->scroll_pending += lines;
+    scroll_schedule(g);
+}
+
 // https://docs.gtk.org/gtk3/signal.Widget.scroll-event.html
 // https://docs.gtk.org/gdk3/struct.EventScroll.html
 static gboolean on_scroll_event(
@@ -457,6 +1702,11 @@ static gboolean on_scroll_event(
     unsigned int modstate = event->state & (
         GDK_CONTROL_MASK | GDK_SHIFT_MASK | GDK_MOD1_MASK | GDK_META_MASK
     );
+    if(event->direction == GDK_SCROLL_SMOOTH){
+        on_smooth_scroll(g, event, modstate);
+        return FALSE;
+    }
+
     int n = 0;
     if(event->direction == GDK_SCROLL_UP){
         n = +1;
@@ -469,15 +1719,7 @@ static gboolean on_scroll_event(
 
     // intercept ctrl+scroll for zoom
     if(modstate == GDK_CONTROL_MASK){
-        // ctrl+scroll
-        int new_size = g->font_size + n;
-        // don't let font_size drop to zero
-        if(new_size == 0) return FALSE;
-        int ret = tsetfont(g->term, g->font_name, new_size);
-        if(ret < 0) return FALSE;
-        // found new font successfully
-        g->font_size = new_size;
-        gtk_widget_queue_draw(g->darea);
+        zoom(g, n);
         return FALSE;
     }
 
@@ -494,7 +1736,7 @@ static gboolean on_scroll_event(
         .y = (int)event->y,
         .pix_coords = true,
     };
-    bool redraw = tmouseev(g->term, ev);
+    bool redraw = term_mouseev(g, ev);
     if(redraw) gtk_widget_queue_draw(g->darea);
     return FALSE;
 }
@@ -502,7 +1744,12 @@ static gboolean on_scroll_event(
 // https://docs.gtk.org/gtk3/signal.Widget.realize.html
 // https://stackoverflow.com/a/35440192/4951379
 static void on_realize(GtkWidget* widget, gpointer user_data){
-    (void)user_data;
+    globals_t *g = user_data;
+    // frames are presented after they are painted, for latency tracing
+    g->frame_clock = gtk_widget_get_frame_clock(widget);
+    g->after_paint = g_signal_connect(
+        g->frame_clock, "after-paint", G_CALLBACK(on_after_paint), g
+    );
     // configure a text-type cursor
     GdkDisplay *display = gtk_widget_get_display(widget);
     GdkWindow *gdkwin = gtk_widget_get_window(widget);
@@ -512,96 +1759,129 @@ static void on_realize(GtkWidget* widget, gpointer user_data){
 }
 
 static gboolean tty_read(GIOChannel *src, globals_t *g){
-    gchar buf[16384];
-    GError *err = NULL;
-    gsize bytes_read = 0;
-    GIOStatus status = g_io_channel_read_chars(src, buf, sizeof(buf), &bytes_read, &err);
-    switch(status){
-        case G_IO_STATUS_ERROR: die("G_IO_STATUS_ERROR during read\n"); break;
-        case G_IO_STATUS_EOF: die("G_IO_STATUS_EOF during read\n"); break;
-        case G_IO_STATUS_AGAIN: die("G_IO_STATUS_AGAIN during read\n"); break;
-        case G_IO_STATUS_NORMAL: break;
-    }
-    // printf("tty_read: "); dumpstr(stdout, buf, bytes_read); printf("\n");
-    twrite(g->term, buf, bytes_read, 0);
-    // redraw
-    gtk_widget_queue_draw(g->darea);
+    (void)src;
+    // keystrokes go out before we take on more output
+    if(writable_nonempty(&g->writable)) tty_flush(g);
+
+    /* libnast reads straight into its own buffer and parses it in place;
+       keep going until the tty is drained or our slice is used up */
+    gint64 start = g_get_monotonic_time();
+    bool any = false;
+    uint64_t flow = trace_read_begin(g);
+    while(ttyread(g->term)){
+        any = true;
+        if(g_get_monotonic_time() - start >= READ_SLICE_US) break;
+    }
+    trace_read_end(g, flow);
+    if(any){
+        // redraw
+        gtk_widget_queue_draw(g->darea);
+    }
     // always be ready to read again
     return TRUE;
 }
 
 static gboolean tty_write(GIOChannel *src, globals_t *g){
-    size_t n;
-    const char *s;
-
-    // write until the buffer is full
-    while((s = writable_get_string(&g->writable, &n))){
-        // printf("writing %.*s\n", (int)n, s);
-
-        GError *err = NULL;
-        gsize n_written = 0;
-
-        GIOStatus status = g_io_channel_write_chars(src, s, n, &n_written, &err);
-        switch(status){
-            case G_IO_STATUS_ERROR:
-                die("G_IO_STATUS_ERROR during write\n");
-            case G_IO_STATUS_EOF:
-                die("G_IO_STATUS_EOF during write\n");
-            case G_IO_STATUS_AGAIN:
-                break;
-            case G_IO_STATUS_NORMAL:
-                break;
-        }
+    (void)src;
+    // one writev() for everything queued (up to IOV_MAX segments)
+    tty_flush(g);
 
-        if(n_written < n){
-            // return any leftover bytes
-            // there's more to write, but the buffer is full
-            writable_return_bytes(&g->writable, n - n_written);
-            return TRUE;
-        }
-
-    }
+    // if anything is left, the tty is full; wait until it has room again
+    if(writable_nonempty(&g->writable)) return TRUE;
 
     // we wrote everything we needed to
     g->write_pending = FALSE;
+    g->wr_src = 0;
     return FALSE;
 }
 
 static gboolean tty_io(GIOChannel *src, GIOCondition cond, gpointer user_data){
     globals_t *g = user_data;
-    if(g->killed) return FALSE;
+
+    /* after a hangup, read whatever is left, then stop watching; the window
+       closes once the child is reaped */
+    bool hup = (cond & (G_IO_HUP | G_IO_ERR)) && !(cond & G_IO_IN);
+    if(g->killed || hup){
+        if(hup) tty_hangup(g);
+        if(src == g->rd_ttychan){
+            g->rd_src = 0;
+        }else{
+            g->wr_src = 0;
+            g->write_pending = FALSE;
+        }
+        return FALSE;
+    }
+    if(cond & (G_IO_IN | G_IO_PRI)) return tty_read(src, g);
 
     switch(cond){
         case G_IO_OUT:
             return tty_write(src, g);
-        case G_IO_IN:
-        case G_IO_PRI:
-            return tty_read(src, g);
-            break;
-        case G_IO_ERR:
-            die("got G_IO_ERR from tty io callback\n");
-            break;
-        case G_IO_HUP:
-            die("got G_IO_HUP from tty io callback\n");
-            break;
         case G_IO_NVAL:
             die("got G_IO_NVAL from tty io callback\n");
             break;
+        default:
+            // (reading and hangups are handled above)
+            break;
     }
 
     // this event source should not be removed.
     return TRUE;
 }
 
+static void window_free(globals_t *g);
+
+// close a window whose child is gone, and quit after the last one
+static void window_close(globals_t *g){
+    for(globals_t **p = &windows; *p; p = &(*p)->next){
+        if(*p != g) continue;
+        *p = g->next;
+        break;
+    }
+    window_free(g);
+    if(!windows && !server) gtk_main_quit();
+}
+
+// print a window's counters, from whichever thread owns its Term
+static void dump_stats(globals_t *g){
+    if(g->parser){
+        TDrawStats draw = tframecache_stats(g->parser->cache);
+        cmd_push(g, (cmd_t){ .type = CMD_STATS, .draw = draw });
+        return;
+    }
+    TStats ts = tstats(g->term);
+    print_stats(g, &ts);
+}
+
 static gboolean ctrl_io(
     GIOChannel *src, GIOCondition cond, gpointer user_data
 ){
     (void)user_data;
 
-    // we only write to cause a quit
-    gtk_main_quit();
+    int fd = g_io_channel_unix_get_fd(src);
+    reaped_t r;
+    while(read(fd, &r, sizeof(r)) == sizeof(r)){
+        if(!r.pid){
+            for(globals_t *g = windows; g; g = g->next) dump_stats(g);
+            continue;
+        }
+        globals_t *g;
+        for(g = windows; g && g->pid != r.pid; g = g->next);
+        if(!g) continue;
+
+        if(!server){
+            if(WIFEXITED(r.status)){
+                fprintf(stderr, "shell exited %d\n", WEXITSTATUS(r.status));
+            }else if(WIFSIGNALED(r.status)){
+                fprintf(stderr,
+                    "shell terminated due to signal %d\n", WTERMSIG(r.status)
+                );
+            }
+        }
+        g->reaped = true;
+        window_close(g);
+    }
 
-    return FALSE;
+    return TRUE;
 }
 
 void prep_channel(GIOChannel *chan){
@@ -642,21 +1922,24 @@ void prep_channel(GIOChannel *chan){
 }
 
 void sigchld(int a){
-    int stat;
-    pid_t p;
-
-    if ((p = waitpid(-1, &stat, WNOHANG)) < 0)
-        fprintf(stderr, "wait() after SIGCHLD failed: %s\n", strerror(errno));
-
-    if (p != G->pid)
-        return;
-
-    if (WIFEXITED(stat))
-        fprintf(stderr, "shell exited %d\n", WEXITSTATUS(stat));
-    else if (WIFSIGNALED(stat))
-        fprintf(stderr, "shell terminated due to signal %d\n", WTERMSIG(stat));
+    (void)a;
+    int saved = errno;
+    reaped_t r;
+    // one SIGCHLD may stand for several children
+    while((r.pid = waitpid(-1, &r.status, WNOHANG)) > 0){
+        // (smaller than PIPE_BUF, so written whole or not at all)
+        if(write(ctrl_w, &r, sizeof(r)) < 0) break;
+    }
+    errno = saved;
+}
 
-    close(G->ctrl_w);
+void sigusr1(int a){
+    (void)a;
+    int saved = errno;
+    reaped_t r = { .pid = 0 };
+    ssize_t ret = write(ctrl_w, &r, sizeof(r));
+    (void)ret;
+    errno = saved;
 }
 
 int addflags(int fd, int flags){
@@ -679,17 +1962,102 @@ int addflags(int fd, int flags){
 
 static gboolean on_destroy(GtkWidget* self, gpointer user_data){
     globals_t *g = user_data;
+    g->window = NULL;
 
     // stop listening to
     g->killed = true;
-    int ret = kill(g->pid, SIGKILL);
-    if(ret) perror("kill");
+    // (the window closes once the child is reaped)
+    if(!g->reaped){
+        int ret = kill(g->pid, SIGKILL);
+        if(ret) perror("kill");
+    }
 
     return FALSE;
 }
 
-int main(int argc, char *argv[]){
-    globals_t g = {
+static void print_stats(globals_t *g, const TStats *ts){
+    latency_t *l = &g->keylat;
+    fprintf(stderr,
+        "stats for pid %d\n"
+        "tty reads: %llu bytes in %llu calls, buffer %zu bytes\n"
+        "tty writes: %llu bytes in %llu calls, %zu queued, at most %zu\n"
+        "keypress to pty: %llu keys, avg %.2fms, max %.2fms\n",
+        (int)g->pid,
+        (unsigned long long)ts->read_bytes,
+        (unsigned long long)ts->read_calls,
+        ts->read_cap,
+        (unsigned long long)g->writable.stats.bytes_written,
+        (unsigned long long)g->writable.stats.writes,
+        writable_len(&g->writable),
+        g->writable.stats.max_len,
+        (unsigned long long)l->count,
+        l->count ? l->total_us / 1000.0 / l->count : 0.0,
+        l->max_us / 1000.0
+    );
+    tstatsprint(ts, stderr);
+}
+
+static void window_free(globals_t *g){
+    // the Term's counters, but the frame cache did the drawing, if any
+    TDrawStats draw = {0};
+    bool cached = g->parser;
+    if(cached) draw = tframecache_stats(g->parser->cache);
+    if(g->parser) parser_stop(g);
+    /* nothing will be left to answer for our offers; a copy to the
+       clipboard stays, as text */
+    if(g->offering[1]){
+        size_t len;
+        char *text = clipboard_text(g->term, 1, &len);
+        if(text) gtk_clipboard_set_text(g->clipboard, text, len);
+        else gtk_clipboard_clear(g->clipboard);
+        free(text);
+    }
+    if(g->offering[0]) gtk_clipboard_clear(g->primary);
+    if(g->rd_src) g_source_remove(g->rd_src);
+    if(g->wr_src) g_source_remove(g->wr_src);
+    if(g->blink_src) g_source_remove(g->blink_src);
+    if(g->prerender_src) g_source_remove(g->prerender_src);
+    if(g->trace_src) g_source_remove(g->trace_src);
+    if(g->after_paint){
+        g_signal_handler_disconnect(g->frame_clock, g->after_paint);
+    }
+    // frame_ready_cb idles still queued by the parser thread
+    while(g_idle_remove_by_data(g));
+    // (this also removes any scroll or motion tick callback)
+    if(g->window) gtk_widget_destroy(g->window);
+    if(g->rd_ttychan) g_io_channel_unref(g->rd_ttychan);
+    if(g->wr_ttychan) g_io_channel_unref(g->wr_ttychan);
+    close(g->ttyfd);
+
+    if(getenv("NAST_STATS")){
+        TStats ts = tstats(g->term);
+        if(cached) ts.draw = draw;
+        print_stats(g, &ts);
+    }
+    const char *trace_file = getenv("NAST_TRACE");
+    if(g->trace && trace_file){
+        FILE *f = fopen(trace_file, "w");
+        if(!f || trace_json(g->trace, f)){
+            fprintf(
+                stderr, "couldn't write %s: %s\n", trace_file, strerror(errno)
+            );
+        }
+        if(f) fclose(f);
+    }
+    trace_free(g->trace);
+    tfree(g->term);
+    if(g->paste){
+        free(g->paste->text);
+        free(g->paste);
+    }
+    writable_free(&g->writable);
+    free(g);
+}
+
+// open a window running cmd (NULL for the user's shell)
+static globals_t *window_new(char **cmd){
+    globals_t *g = xmalloc(sizeof(*g));
+    *g = (globals_t){
         .hooks = {
             .ttywrite = ttywrite_hook,
             .ttyresize = ttyresize_hook,
@@ -698,88 +2066,237 @@ int main(int argc, char *argv[]){
             .sendbreak = sendbreak_hook,
             .set_title = set_title,
             .set_clipboard = set_clipboard,
+            .offer_clipboard = offer_clipboard,
+            .drop_clipboard = drop_clipboard,
         },
         .font_name = "monospace",
         .font_size = 20,
     };
-    G = &g;
-
-    gtk_init(&argc, &argv);
+    // trace keypress latency from the start, to write out at the end
+    if(getenv("NAST_TRACE") && !(g->trace = trace_new(0))){
+        die("trace_new: out of memory\n");
+    }
 
-    g.window = gtk_window_new(GTK_WINDOW_TOPLEVEL);
+    g->window = gtk_window_new(GTK_WINDOW_TOPLEVEL);
 
     // get both clipboards
-    g.primary = gtk_clipboard_get(gdk_atom_intern("PRIMARY", true));
-    g.clipboard = gtk_clipboard_get(gdk_atom_intern("CLIPBOARD", true));
+    g->primary = gtk_clipboard_get(gdk_atom_intern("PRIMARY", true));
+    g->clipboard = gtk_clipboard_get(gdk_atom_intern("CLIPBOARD", true));
 
-    g.darea = gtk_drawing_area_new();
-    gtk_container_add(GTK_CONTAINER(g.window), g.darea);
+    g->darea = gtk_drawing_area_new();
+    gtk_container_add(GTK_CONTAINER(g->window), g->darea);
 
     // GTK input handling: developer.gnome.org/gtk3/stable/chap-input-handling.html
-    g_signal_connect(G_OBJECT(g.darea), "draw", G_CALLBACK(on_draw_event), &g);
-    g_signal_connect(G_OBJECT(g.window), "destroy", G_CALLBACK(on_destroy), &g);
+    g_signal_connect(G_OBJECT(g->darea), "draw", G_CALLBACK(on_draw_event), g);
+    g_signal_connect(G_OBJECT(g->window), "destroy", G_CALLBACK(on_destroy), g);
 
     // // get keypresses from the drawing area (does not work)
-    // gtk_widget_add_events(GTK_WIDGET(g.darea), GDK_KEY_PRESS_MASK);
-    // gtk_widget_add_events(GTK_WIDGET(g.darea), GDK_KEY_RELEASE_MASK);
-    // g_signal_connect(G_OBJECT(g.darea), "key-press-event", G_CALLBACK(on_key_event), NULL);
-    // g_signal_connect(G_OBJECT(g.darea), "key-release-event", G_CALLBACK(on_key_event), NULL);
+    // gtk_widget_add_events(GTK_WIDGET(g->darea), GDK_KEY_PRESS_MASK);
+    // gtk_widget_add_events(GTK_WIDGET(g->darea), GDK_KEY_RELEASE_MASK);
+    // g_signal_connect(G_OBJECT(g->darea), "key-press-event", G_CALLBACK(on_key_event), NULL);
+    // g_signal_connect(G_OBJECT(g->darea), "key-release-event", G_CALLBACK(on_key_event), NULL);
 
     // get keypresses from the window (does work)
-    g_signal_connect(G_OBJECT(g.window), "key-press-event", G_CALLBACK(on_key_event), &g);
-    g_signal_connect(G_OBJECT(g.window), "key-release-event", G_CALLBACK(on_key_event), &g);
+    g_signal_connect(G_OBJECT(g->window), "key-press-event", G_CALLBACK(on_key_event), g);
+    g_signal_connect(G_OBJECT(g->window), "key-release-event", G_CALLBACK(on_key_event), g);
 
     // mouse buttons
-    // strangely, if I connect button press to the g.window I get duplicate events
-    gtk_widget_add_events(g.darea, GDK_BUTTON_PRESS_MASK);
-    gtk_widget_add_events(g.darea, GDK_BUTTON_RELEASE_MASK);
-    g_signal_connect(G_OBJECT(g.darea), "button-press-event", G_CALLBACK(on_button_event), &g);
-    g_signal_connect(G_OBJECT(g.darea), "button-release-event", G_CALLBACK(on_button_event), &g);
+    // strangely, if I connect button press to the g->window I get duplicate events
+    gtk_widget_add_events(g->darea, GDK_BUTTON_PRESS_MASK);
+    gtk_widget_add_events(g->darea, GDK_BUTTON_RELEASE_MASK);
+    g_signal_connect(G_OBJECT(g->darea), "button-press-event", G_CALLBACK(on_button_event), g);
+    g_signal_connect(G_OBJECT(g->darea), "button-release-event", G_CALLBACK(on_button_event), g);
 
     // mouse motion
-    gtk_widget_add_events(g.darea, GDK_POINTER_MOTION_MASK);
-    g_signal_connect(G_OBJECT(g.darea), "motion-notify-event", G_CALLBACK(on_motion_event), &g);
+    gtk_widget_add_events(g->darea, GDK_POINTER_MOTION_MASK);
+    g_signal_connect(G_OBJECT(g->darea), "motion-notify-event", G_CALLBACK(on_motion_event), g);
 
     // mouse scroll
-    gtk_widget_add_events(g.darea, GDK_SCROLL_MASK);
-    g_signal_connect(G_OBJECT(g.darea), "scroll-event", G_CALLBACK(on_scroll_event), &g);
+    gtk_widget_add_events(g->darea, GDK_SCROLL_MASK | GDK_SMOOTH_SCROLL_MASK);
+    g_signal_connect(G_OBJECT(g->darea), "scroll-event", G_CALLBACK(on_scroll_event), g);
 
     // get focus events from the window
-    g_signal_connect(G_OBJECT(g.window), "focus-in-event", G_CALLBACK(on_focus_in), &g);
-    g_signal_connect(G_OBJECT(g.window), "focus-out-event", G_CALLBACK(on_focus_out), &g);
+    g_signal_connect(G_OBJECT(g->window), "focus-in-event", G_CALLBACK(on_focus_in), g);
+    g_signal_connect(G_OBJECT(g->window), "focus-out-event", G_CALLBACK(on_focus_out), g);
 
-    gtk_window_set_position(GTK_WINDOW(g.window), GTK_WIN_POS_CENTER);
-    gtk_window_set_default_size(GTK_WINDOW(g.window), 400, 400);
-    gtk_window_set_title(GTK_WINDOW(g.window), "nast");
+    gtk_window_set_position(GTK_WINDOW(g->window), GTK_WIN_POS_CENTER);
+    gtk_window_set_default_size(GTK_WINDOW(g->window), 400, 400);
+    gtk_window_set_title(GTK_WINDOW(g->window), "nast");
 
     // configure a text-type cursor, when we are "realized"
-    g_signal_connect(G_OBJECT(g.window), "realize", G_CALLBACK(on_realize), &g);
+    g_signal_connect(G_OBJECT(g->window), "realize", G_CALLBACK(on_realize), g);
 
-    gtk_widget_show_all(g.window);
+    gtk_widget_show_all(g->window);
 
-    // create the terminal
+    /* create the terminal; libnast measures each font once per process, so
+       only the first window pays for that */
     char *delims = " `-=~!@#$%^&*()_+[]\\{}|;':\",./<>?";
-    tnew(&g.term, 80, 40, g.font_name, g.font_size, delims, (THooks*)&g);
+    tnew(&g->term, 80, 40, g->font_name, g->font_size, delims, (THooks*)g);
 
-    char **cmd = argc > 1 ? argv+1 : NULL;
-    g.ttyfd = ttynew(g.term, &g.pid, cmd);
-    // g.ttyfd = ttynew(g.term, &g.pid, NULL, NULL, NULL, NULL);
-    signal(SIGCHLD, sigchld);
+    g->ttyfd = ttynew(g->term, &g->pid, cmd);
+    // later children must not inherit this pty
+    if(fcntl(g->ttyfd, F_SETFD, FD_CLOEXEC) < 0){
+        die("fcntl: %s\n", strerror(errno));
+    }
 
-    // add the ttyfd to the main loop
-    GIOChannel *ttychan = g_io_channel_unix_new(g.ttyfd);
-    if(!ttychan) die("g_io_channel_unix_new()\n");
-    prep_channel(ttychan);
+    if(parser_thread){
+        // the parser thread does all the tty io itself
+        parser_start(g);
+    }else{
+        // add the ttyfd to the main loop
+        g->rd_ttychan = g_io_channel_unix_new(g->ttyfd);
+        if(!g->rd_ttychan) die("g_io_channel_unix_new()\n");
+        prep_channel(g->rd_ttychan);
+
+        // write channel must be a different channel to have independent watches
+        g->wr_ttychan = g_io_channel_unix_new(g->ttyfd);
+        if(!g->wr_ttychan) die("g_io_channel_unix_new()\n");
+        prep_channel(g->wr_ttychan);
+
+        // await bytes on the ttyfd, at a lower priority than input events
+        GIOCondition cond = G_IO_IN | G_IO_PRI | G_IO_ERR | G_IO_HUP | G_IO_NVAL;
+        g->rd_src = g_io_add_watch_full(
+            g->rd_ttychan, READ_PRIORITY, cond, tty_io, g, NULL
+        );
+    }
+
+    g->next = windows;
+    windows = g;
+    return g;
+}
+
+//////// server mode
+
+// a nastc request, read until the client shuts down its end
+typedef struct {
+    int fd;
+    char *buf;
+    size_t len;
+    size_t cap;
+} request_t;
+
+// requests are just a cwd and a command line
+#define REQUEST_MAX 65536
+
+// open the requested window; returns the status byte for the reply
+static unsigned char request_run(request_t *req){
+    // cwd\0arg\0arg\0...
+    if(!req->len || req->buf[req->len-1] != '\0') return 1;
+    size_t nstrs = 0;
+    for(size_t i = 0; i < req->len; i++) nstrs += req->buf[i] == '\0';
+    char **strs = xmalloc((nstrs + 1) * sizeof(*strs));
+    char *p = req->buf;
+    for(size_t i = 0; i < nstrs; i++){
+        strs[i] = p;
+        p += strlen(p) + 1;
+    }
+    strs[nstrs] = NULL;
+
+    // the child starts in the client's cwd
+    int here = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(chdir(strs[0])){
+        fprintf(stderr, "chdir(%s): %s\n", strs[0], strerror(errno));
+    }
+    window_new(nstrs > 1 ? strs + 1 : NULL);
+    if(here >= 0){
+        if(fchdir(here)) perror("fchdir");
+        close(here);
+    }
+
+    free(strs);
+    return 0;
+}
 
-    // write channel must be a different channel to have independent watches
-    g.wr_ttychan = g_io_channel_unix_new(g.ttyfd);
-    if(!g.wr_ttychan) die("g_io_channel_unix_new()\n");
-    prep_channel(g.wr_ttychan);
+static gboolean request_io(
+    GIOChannel *src, GIOCondition cond, gpointer user_data
+){
+    (void)cond;
+    request_t *req = user_data;
+    if(req->len == req->cap){
+        req->cap = req->cap ? req->cap * 2 : 4096;
+        req->buf = xrealloc(req->buf, req->cap);
+    }
+    ssize_t n = read(req->fd, req->buf + req->len, req->cap - req->len);
+    if(n < 0 && (errno == EAGAIN || errno == EINTR)) return TRUE;
+    if(n > 0){
+        req->len += (size_t)n;
+        if(req->len <= REQUEST_MAX) return TRUE;
+    }
 
-    // await bytes on the ttyfd
-    GIOCondition cond = G_IO_IN | G_IO_PRI | G_IO_ERR | G_IO_HUP | G_IO_NVAL;
-    guint rd_event_src_id = g_io_add_watch(ttychan, cond, tty_io, &g);
-    (void)rd_event_src_id;
+    // EOF: the request is complete; anything else, give up on it
+    if(n == 0){
+        unsigned char status = request_run(req);
+        // (a single byte on a fresh socket; it won't block)
+        if(write(req->fd, &status, 1) < 0) perror("write reply");
+    }
+    g_io_channel_unref(src);
+    close(req->fd);
+    free(req->buf);
+    free(req);
+    return FALSE;
+}
+
+static gboolean server_io(
+    GIOChannel *src, GIOCondition cond, gpointer user_data
+){
+    (void)cond;
+    (void)user_data;
+    int fd = accept(g_io_channel_unix_get_fd(src), NULL, NULL);
+    if(fd < 0){
+        if(errno != EAGAIN && errno != EINTR) perror("accept");
+        return TRUE;
+    }
+    // nobody else gets to run things as us
+    if(sock_peer_ok(fd)){
+        close(fd);
+        return TRUE;
+    }
+    // (children must not inherit it)
+    if(fcntl(fd, F_SETFD, FD_CLOEXEC) || addflags(fd, O_NONBLOCK)){
+        close(fd);
+        return TRUE;
+    }
+    request_t *req = xmalloc(sizeof(*req));
+    *req = (request_t){ .fd = fd };
+    GIOChannel *chan = g_io_channel_unix_new(fd);
+    if(!chan) die("g_io_channel_unix_new()\n");
+    prep_channel(chan);
+    g_io_add_watch(chan, G_IO_IN | G_IO_HUP | G_IO_ERR, request_io, req);
+    return TRUE;
+}
+
+static void server_start(void){
+    if(sock_path(sock_file, sizeof(sock_file), "nast")){
+        die("socket path: %s\n", strerror(errno));
+    }
+    int fd = sock_listen(sock_file);
+    if(fd < 0){
+        die("couldn't listen on %s: %s\n", sock_file, strerror(errno));
+    }
+    if(addflags(fd, O_NONBLOCK)) die("unable to configure socket\n");
+    GIOChannel *chan = g_io_channel_unix_new(fd);
+    if(!chan) die("g_io_channel_unix_new()\n");
+    prep_channel(chan);
+    g_io_add_watch(chan, G_IO_IN, server_io, NULL);
+    fprintf(stderr, "nast server listening on %s\n", sock_file);
+}
+
+int main(int argc, char *argv[]){
+    // leading options, then the command to run
+    for(; argc > 1 && strncmp(argv[1], "--", 2) == 0; argc--, argv++){
+        if(strcmp(argv[1], "--parser-thread") == 0){
+            parser_thread = true;
+        }else if(strcmp(argv[1], "--server") == 0){
+            server = true;
+        }else{
+            fprintf(stderr,
+                "usage: nast [--parser-thread] [--server | cmd [args...]]\n"
+            );
+            return 1;
+        }
+    }
+
+    gtk_init(&argc, &argv);
 
     // add a pipe-based control channel for event-loop-friendly signal handling
     int pipes[2];
@@ -789,25 +2306,43 @@ int main(int argc, char *argv[]){
         return 1;
     }
     int ctrl_r = pipes[0];
-    g.ctrl_w = pipes[1];
+    ctrl_w = pipes[1];
 
     // read end is nonblocking
-    ret = addflags(ctrl_r, O_CLOEXEC | O_NONBLOCK);
-    if(ret) return 1;
-    // write end doesn't atter
-    ret = addflags(g.ctrl_w, O_CLOEXEC);
+    ret = addflags(ctrl_r, O_NONBLOCK);
     if(ret) return 1;
+    // neither end may leak into a shell, or it could forge reaped records
+    // (O_CLOEXEC is a descriptor flag, which F_SETFL ignores)
+    if(fcntl(ctrl_r, F_SETFD, FD_CLOEXEC) < 0
+            || fcntl(ctrl_w, F_SETFD, FD_CLOEXEC) < 0){
+        perror("fcntl");
+        return 1;
+    }
 
     // add the control fd to the main loop
     GIOChannel *ctrl_chan = g_io_channel_unix_new(ctrl_r);
     if(!ctrl_chan) die("g_io_channel_unix_new()\n");
     prep_channel(ctrl_chan);
-    rd_event_src_id = g_io_add_watch(ctrl_chan, cond, ctrl_io, &g);
-    (void)rd_event_src_id;
+    g_io_add_watch(ctrl_chan, G_IO_IN, ctrl_io, NULL);
+    signal(SIGCHLD, sigchld);
+    signal(SIGUSR1, sigusr1);
+
+    if(server){
+        // windows come from nastc
+        server_start();
+    }else{
+        char **cmd = argc > 1 ? argv+1 : NULL;
+        window_new(cmd);
+    }
 
     gtk_main();
 
-    tfree(g.term);
+    while(windows){
+        globals_t *g = windows;
+        windows = g->next;
+        window_free(g);
+    }
+    if(server) unlink(sock_file);
 
     return 0;
 }
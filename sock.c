@@ -0,0 +1,181 @@
+// for struct ucred
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "sock.h"
+
+int sock_path(char *buf, size_t cap, const char *name){
+    const char *runtime = getenv("XDG_RUNTIME_DIR");
+    char dir[108];
+    int l;
+    if(runtime && *runtime){
+        l = snprintf(dir, sizeof(dir), "%s/nast", runtime);
+    }else{
+        l = snprintf(dir, sizeof(dir), "/tmp/nast-%u", (unsigned)getuid());
+    }
+    if(l < 0 || (size_t)l >= sizeof(dir)){
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    /* /tmp is shared, so anyone could have made the directory first; only
+       use it if it is really ours and nobody else can get in */
+    if(mkdir(dir, 0700) && errno != EEXIST) return -1;
+    struct stat st;
+    if(lstat(dir, &st)) return -1;
+    if(!S_ISDIR(st.st_mode) || st.st_uid != getuid()){
+        errno = EPERM;
+        return -1;
+    }
+    if(st.st_mode & 077){
+        errno = EACCES;
+        return -1;
+    }
+    l = snprintf(buf, cap, "%s/%s.sock", dir, name);
+    if(l < 0 || (size_t)l >= cap){
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    return 0;
+}
+
+int sock_peer_ok(int fd){
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+    if(getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len)) return -1;
+    if(cred.uid != getuid()){
+        errno = EACCES;
+        return -1;
+    }
+    return 0;
+}
+
+static int sock_addr(struct sockaddr_un *addr, const char *path){
+    *addr = (struct sockaddr_un){ .sun_family = AF_UNIX };
+    if(strlen(path) >= sizeof(addr->sun_path)){
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(addr->sun_path, path);
+    return 0;
+}
+
+int sock_connect(const char *path){
+    struct sockaddr_un addr;
+    if(sock_addr(&addr, path)) return -1;
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(fd < 0) return -1;
+    // (and only talk to a server of our own)
+    if(connect(fd, (struct sockaddr*)&addr, sizeof(addr)) || sock_peer_ok(fd)){
+        int err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+    return fd;
+}
+
+static int sock_bind(int fd, const char *path){
+    struct sockaddr_un addr;
+    if(sock_addr(&addr, path)) return -1;
+    if(bind(fd, (struct sockaddr*)&addr, sizeof(addr))) return -1;
+    /* (fchmod() on the fd wouldn't reach the path; the directory keeps
+       everyone else out in any case) */
+    return chmod(path, 0600);
+}
+
+int sock_listen(const char *path){
+    /* Servers starting together take turns on a lock beside the socket,
+       which the winner holds until it exits; otherwise one could unlink
+       the other's socket between its bind() and its listen(). */
+    char lock[116];
+    int l = snprintf(lock, sizeof(lock), "%s.lock", path);
+    if(l < 0 || (size_t)l >= sizeof(lock)){
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    int lockfd = open(lock, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if(lockfd < 0) return -1;
+    if(flock(lockfd, LOCK_EX | LOCK_NB)){
+        close(lockfd);
+        errno = errno == EWOULDBLOCK ? EADDRINUSE : errno;
+        return -1;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(fd < 0) goto fail;
+    if(sock_bind(fd, path)){
+        if(errno != EADDRINUSE) goto fail;
+        /* something is there already: a server which doesn't take the lock
+           keeps it, and only a socket nobody listens on is stale */
+        struct sockaddr_un addr;
+        sock_addr(&addr, path);
+        int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if(probe < 0) goto fail;
+        int ret = connect(probe, (struct sockaddr*)&addr, sizeof(addr));
+        int err = errno;
+        close(probe);
+        if(!ret){
+            errno = EADDRINUSE;
+            goto fail;
+        }
+        if(err != ECONNREFUSED){
+            errno = err;
+            goto fail;
+        }
+        unlink(path);
+        if(sock_bind(fd, path)) goto fail;
+    }
+    if(listen(fd, 64)) goto fail;
+    // (lockfd stays open, and locked, for as long as we run)
+    return fd;
+
+fail:
+    {
+        int err = errno;
+        if(fd >= 0) close(fd);
+        close(lockfd);
+        errno = err;
+    }
+    return -1;
+}
+
+int sock_write_all(int fd, const void *buf, size_t n){
+    const char *p = buf;
+    while(n){
+        ssize_t ret = write(fd, p, n);
+        if(ret < 0){
+            if(errno == EINTR) continue;
+            return -1;
+        }
+        p += ret;
+        n -= (size_t)ret;
+    }
+    return 0;
+}
+
+int sock_read_all(int fd, void *buf, size_t n){
+    char *p = buf;
+    while(n){
+        ssize_t ret = read(fd, p, n);
+        if(ret < 0){
+            if(errno == EINTR) continue;
+            return -1;
+        }
+        if(ret == 0){
+            errno = EPIPE;
+            return -1;
+        }
+        p += ret;
+        n -= (size_t)ret;
+    }
+    return 0;
+}
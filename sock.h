@@ -0,0 +1,25 @@
+// Unix socket helpers, shared by servers and their clients.
+//
+// char path[108];
+// if(sock_path(path, sizeof(path), "nast")) ...  // no room for the path
+// int fd = sock_listen(path);  // or sock_connect(path)
+//
+// All return -1 with errno set on failure, and the fds are CLOEXEC.
+
+#include <stddef.h>
+
+/* $XDG_RUNTIME_DIR/nast/<name>.sock, or /tmp/nast-<uid>/<name>.sock without
+   one; the directory is created if need be, and must be ours and 0700
+   (EPERM or EACCES otherwise) */
+int sock_path(char *buf, size_t cap, const char *name);
+/* bind and listen with the socket at 0600, replacing a stale socket at path
+   but failing with EADDRINUSE if a server is still answering there */
+int sock_listen(const char *path);
+// connect, failing with EACCES if the server isn't running as us
+int sock_connect(const char *path);
+// 0 if the process at the other end of fd runs as us, else -1 (EACCES)
+int sock_peer_ok(int fd);
+
+// write or read exactly n bytes, retrying on EINTR; read fails on early EOF
+int sock_write_all(int fd, const void *buf, size_t n);
+int sock_read_all(int fd, void *buf, size_t n);
@@ -0,0 +1,260 @@
+#include <locale.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "nast.c"
+#include "test_term.h"
+
+// what the hooks saw
+static char *clip[2];
+static size_t clip_len[2];
+static int sets;
+static int offers[2];
+static int drops[2];
+
+static void keep_clip(char *buf, size_t len, int clipboard){
+    free(clip[clipboard]);
+    clip[clipboard] = buf;
+    clip_len[clipboard] = len;
+    sets++;
+}
+static void offer_clipboard_hook(THooks *h, int clipboard){
+    (void)h;
+    offers[clipboard]++;
+}
+static void drop_clipboard_hook(THooks *h, int clipboard){
+    (void)h;
+    drops[clipboard]++;
+}
+
+// term() copies eagerly; these terms offer instead (see main())
+static THooks lazy;
+
+static Term *lazy_term(int cols, int rows){
+    Term *t;
+    tnew(&t, cols, rows, NULL, 0, " ", &lazy);
+    return t;
+}
+
+static void reset(void){
+    for(int i = 0; i < 2; i++){
+        free(clip[i]);
+        clip[i] = NULL;
+        clip_len[i] = 0;
+        offers[i] = 0;
+        drops[i] = 0;
+    }
+    sets = 0;
+}
+
+// read an offer out in chunks of at most n bytes; NULL if it is gone
+static char *read_all(Term *t, int clipboard, size_t n, size_t *len){
+    TSelCursor c = {0};
+    size_t cap = n;
+    char *buf = xmalloc(cap);
+    *len = 0;
+    ssize_t r;
+    while((r = tclipboardread(t, clipboard, &c, buf + *len, n)) > 0){
+        if((size_t)r > n) return NULL;
+        *len += r;
+        if(cap - *len < n){
+            cap = MAX(cap * 2, *len + n);
+            buf = xrealloc(buf, cap);
+        }
+    }
+    if(r < 0){
+        free(buf);
+        return NULL;
+    }
+    return buf;
+}
+
+// both Terms get the same text, wide characters and wrapped lines included
+static const char *text =
+    "first line\r\n"
+    "a line long enough that it wraps around the edge\r\n"
+    "\xe4\xb8\xad\xe6\x96\x87 and \xc3\xa9t\xc3\xa9   \r\n"
+    "last";
+
+int test_chunks(void){
+    reset();
+    Term *a = term(20, 8);
+    Term *b = lazy_term(20, 8);
+    feed(a, text);
+    feed(b, text);
+
+    tselect(a, 2, 0, 3, 6, 1);
+    tselect(b, 2, 0, 3, 6, 1);
+    texportselection(a, 0);
+    ASSERT(sets == 1 && clip[0]);
+
+    // an offer carries no text
+    texportselection(b, 0);
+    ASSERT(sets == 1 && offers[0] == 1);
+
+    // however it is read, it's the same text
+    for(size_t n = 4; n <= 64; n++){
+        size_t len;
+        char *buf = read_all(b, 0, n, &len);
+        ASSERT(buf);
+        ASSERT(len == clip_len[0] && memcmp(buf, clip[0], len) == 0);
+        free(buf);
+    }
+    // including the end of line, with line snapping
+    tselect(a, 0, 1, 0, 3, 3);
+    tselect(b, 0, 1, 0, 3, 3);
+    texportselection(a, 1);
+    texportselection(b, 1);
+    ASSERT(clip[1][clip_len[1] - 1] == '\n');
+    size_t len;
+    char *buf = read_all(b, 1, 5, &len);
+    ASSERT(buf);
+    ASSERT(len == clip_len[1] && memcmp(buf, clip[1], len) == 0);
+    free(buf);
+
+    // the newer selection was never offered to the primary
+    ASSERT(read_all(b, 0, 16, &len) == NULL);
+
+    tfree(a);
+    tfree(b);
+    return 0;
+}
+
+int test_break(void){
+    reset();
+    Term *t = lazy_term(20, 8);
+    feed(t, "one\r\ntwo\r\nthree\r\n");
+    size_t len;
+
+    // a primary offer just goes away with the selection
+    tselect(t, 0, 0, 2, 0, 1);
+    texportselection(t, 0);
+    feed(t, "\x1b[1;1Hxx");
+    ASSERT(read_all(t, 0, 16, &len) == NULL);
+    ASSERT(sets == 0 && drops[0] == 1);
+
+    // a clipboard offer is made into text as it breaks
+    tselect(t, 0, 1, 4, 2, 1);
+    texportselection(t, 1);
+    ASSERT(offers[1] == 1 && sets == 0);
+    char *buf = read_all(t, 1, 16, &len);
+    ASSERT(buf && len == 9 && memcmp(buf, "two\nthree", 9) == 0);
+    free(buf);
+    feed(t, "\x1b[2J");
+    ASSERT(read_all(t, 1, 16, &len) == NULL);
+    ASSERT(sets == 1 && clip_len[1] == 9 && drops[1] == 0);
+    ASSERT(memcmp(clip[1], "two\nthree", 9) == 0);
+    // only once
+    feed(t, "\x1b[2J");
+    ASSERT(sets == 1);
+
+    // a new selection breaks the old offer too
+    feed(t, "\x1b[Hfour\r\nfive");
+    tselect(t, 0, 0, 3, 0, 1);
+    texportselection(t, 1);
+    tselect(t, 0, 1, 3, 1, 1);
+    ASSERT(sets == 2 && clip_len[1] == 4 && memcmp(clip[1], "four", 4) == 0);
+    ASSERT(read_all(t, 1, 16, &len) == NULL);
+
+    // once someone else owns the clipboard, there's nothing to keep
+    texportselection(t, 1);
+    tclipboarddrop(t, 1);
+    ASSERT(read_all(t, 1, 16, &len) == NULL);
+    feed(t, "\x1b[2J");
+    ASSERT(sets == 2 && drops[1] == 0);
+
+    // output which leaves the selection alone leaves the offer alone
+    feed(t, "\x1b[Hsix\r\nseven\r\n");
+    tselect(t, 0, 0, 2, 0, 1);
+    texportselection(t, 1);
+    feed(t, "\x1b[3;1Height");
+    buf = read_all(t, 1, 16, &len);
+    ASSERT(buf && len == 3 && memcmp(buf, "six", 3) == 0);
+    free(buf);
+
+    tfree(t);
+    reset();
+    return 0;
+}
+
+//// bench: copying all of a long scrollback
+
+static double now(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int bench(size_t lines){
+    Term *t[2] = { term(80, 24), lazy_term(80, 24) };
+    char buf[65536];
+    for(int k = 0; k < 2; k++){
+        size_t len = 0;
+        for(size_t i = 0; i < lines; i++){
+            len += snprintf(
+                buf + len, sizeof(buf) - len,
+                "%zu \x1b[32mok\x1b[m GET /api/v1/items/%zu 200 %zums\r\n",
+                i, i * 7919 % 100000, i % 300
+            );
+            if(len > sizeof(buf) - 128){
+                ttyfeed(t[k], buf, len);
+                len = 0;
+            }
+        }
+        ttyfeed(t[k], buf, len);
+    }
+
+    // like the primary, offered each time the mouse lets go of a selection
+    int reps = 100;
+    size_t last = t[0]->main.len - 1;
+    double t0 = now();
+    for(int i = 0; i < reps; i++){
+        tselect(t[0], 0, 0, 0, last, 3);
+        texportselection(t[0], 0);
+    }
+    double t1 = now();
+    for(int i = 0; i < reps; i++){
+        tselect(t[1], 0, 0, 0, last, 3);
+        texportselection(t[1], 0);
+    }
+    double t2 = now();
+    // and when something does ask, it's read in the chunks gtk would use
+    size_t len;
+    char *text = read_all(t[1], 0, 65536, &len);
+    double t3 = now();
+    ASSERT(text && len == clip_len[0]);
+
+    printf(
+        "%zu lines (%.1f MB): eager copy %.3fms, lazy offer %.4fms, "
+        "reading it %.3fms\n",
+        t[0]->main.len, len / 1e6, (t1 - t0) * 1e3 / reps,
+        (t2 - t1) * 1e3 / reps, (t3 - t2) * 1e3
+    );
+    free(text);
+
+    tfree(t[0]);
+    tfree(t[1]);
+    reset();
+    return 0;
+}
+
+int main(int argc, char **argv){
+    clip_hook = keep_clip;
+    lazy = hooks;
+    lazy.offer_clipboard = offer_clipboard_hook;
+    lazy.drop_clipboard = drop_clipboard_hook;
+
+    if(argc > 1 && strcmp(argv[1], "bench") == 0){
+        return bench(argc > 2 ? strtoull(argv[2], NULL, 10) : 10000);
+    }
+
+    // for wide characters
+    setlocale(LC_CTYPE, "C.UTF-8");
+
+    int ret = 0;
+    ret |= test_chunks();
+    ret |= test_break();
+    printf("%s\n", ret ? "FAIL" : "PASS");
+    return ret;
+}
@@ -0,0 +1,372 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "delta.c"
+#include "test_term.h"
+
+// does the decoded grid show exactly what the Term does?
+static int same(TGrid *g, Term *t){
+    ASSERT(g->cols == tcols(t));
+    ASSERT(g->rows == trows(t));
+    for(int y = 0; y < g->rows; y++){
+        size_t n;
+        const Glyph *line = twindowline(t, y, &n);
+        for(int x = 0; x < g->cols; x++){
+            Glyph want = {0};
+            if((size_t)x < n) want = line[x];
+            ASSERT(glyph_eq(&g->cells[(size_t)y * g->cols + x], &want));
+        }
+    }
+    int x, y;
+    bool visible = tcursorpos(t, &x, &y);
+    ASSERT(g->cursor_visible == visible);
+    if(visible){
+        ASSERT(g->cursor_x == x);
+        ASSERT(g->cursor_y == y);
+    }
+    ASSERT(g->cursor_style == tcursorshape(t));
+    ASSERT(g->modes == tmodes(t));
+    return 0;
+}
+
+// encode a frame, apply it, and check the result; returns the frame size
+static size_t roundtrip(TDelta *d, TGrid *g, Term *t, int *failed){
+    size_t n;
+    const char *frame = tdelta_encode(d, t, &n);
+    if(tgrid_apply(g, frame, n) || same(g, t)) *failed = 1;
+    return n;
+}
+
+int test_roundtrip(void){
+    Term *t = term(40, 10);
+    TDelta *d = tdelta_new();
+    TGrid *g = tgrid_new();
+    int failed = 0;
+
+    // the first frame sizes the grid even when it's blank
+    ASSERT(roundtrip(d, g, t, &failed) > 0);
+    ASSERT(!failed);
+    ASSERT(g->resized);
+    // and nothing changed since
+    ASSERT(roundtrip(d, g, t, &failed) == 0);
+    ASSERT(!failed);
+
+    feed(t, "hello \x1b[1;31mred\x1b[m \x1b[38;2;1;2;3;48;5;200mrgb\x1b[m");
+    roundtrip(d, g, t, &failed);
+    ASSERT(!failed);
+    ASSERT(g->dirty[0] && !g->dirty[1]);
+    ASSERT(!g->resized);
+
+    // overwrite a few cells in the middle; wide characters too
+    feed(t, "\r\x1b[3Cxy\x1b[2;5H\xe4\xb8\xad\xe6\x96\x87");
+    roundtrip(d, g, t, &failed);
+    ASSERT(!failed);
+
+    // cursor moves and modes alone
+    feed(t, "\x1b[5;7H\x1b[?1h\x1b[?2004h\x1b[4 q");
+    roundtrip(d, g, t, &failed);
+    ASSERT(!failed);
+    ASSERT(g->modes & TMODE_APPCURSOR);
+    ASSERT(g->modes & TMODE_BRACKETPASTE);
+    feed(t, "\x1b[?25l");
+    roundtrip(d, g, t, &failed);
+    ASSERT(!failed);
+    ASSERT(!g->cursor_visible);
+    feed(t, "\x1b[?25h\x1b[?1l");
+    roundtrip(d, g, t, &failed);
+    ASSERT(!failed);
+
+    // the alt screen, and back
+    feed(t, "\x1b[?1049h\x1b[2Jalt screen");
+    roundtrip(d, g, t, &failed);
+    ASSERT(!failed);
+    ASSERT(g->modes & TMODE_ALTSCREEN);
+    feed(t, "\x1b[?1049l");
+    roundtrip(d, g, t, &failed);
+    ASSERT(!failed);
+
+    // resizes resend everything
+    tresize(t, 30, 6);
+    roundtrip(d, g, t, &failed);
+    ASSERT(!failed);
+    ASSERT(g->resized);
+    tresize(t, 50, 12);
+    roundtrip(d, g, t, &failed);
+    ASSERT(!failed);
+
+    // titles and bells
+    size_t n;
+    const char *frame = tdelta_title(d, "a title", &n);
+    ASSERT(tgrid_apply(g, frame, n) == 0);
+    ASSERT(g->title_changed && strcmp(g->title, "a title") == 0);
+    frame = tdelta_bell(d, &n);
+    ASSERT(tgrid_apply(g, frame, n) == 0);
+    ASSERT(g->bells == 1 && !g->title_changed);
+
+    // a fresh decoder after a reset
+    TGrid *g2 = tgrid_new();
+    tdelta_reset(d);
+    frame = tdelta_encode(d, t, &n);
+    ASSERT(tgrid_apply(g2, frame, n) == 0);
+    ASSERT(same(g2, t) == 0);
+
+    tgrid_free(g2);
+    tgrid_free(g);
+    tdelta_free(d);
+    tfree(t);
+    return 0;
+}
+
+// moved rows become scrolls, not repaints
+int test_scroll(void){
+    Term *t = term(60, 20);
+    TDelta *d = tdelta_new();
+    TGrid *g = tgrid_new();
+    int failed = 0;
+
+    char line[64];
+    for(int i = 0; i < 20; i++){
+        snprintf(line, sizeof(line), "%sline %d of the log", i ? "\r\n" : "", i);
+        feed(t, line);
+    }
+    roundtrip(d, g, t, &failed);
+    ASSERT(!failed);
+
+    // one new line: a scroll and a single row of text
+    feed(t, "\r\nline 20 of the log");
+    size_t n = roundtrip(d, g, t, &failed);
+    ASSERT(!failed);
+    ASSERT(g->nscrolls == 1);
+    ASSERT(g->scrolls[0].n == 1);
+    ASSERT(g->scrolls[0].top == 0 && g->scrolls[0].bot == 19);
+    ASSERT(n < 40);
+    int ndirty = 0;
+    for(int y = 0; y < g->rows; y++) ndirty += g->dirty[y];
+    ASSERT(ndirty == 1 && g->dirty[19]);
+
+    // several lines at once
+    feed(t, "\r\nline 21\r\nline 22\r\nline 23");
+    roundtrip(d, g, t, &failed);
+    ASSERT(!failed);
+    ASSERT(g->nscrolls == 1 && g->scrolls[0].n == 3);
+
+    // a region scrolling down under a status line, like a pager going back
+    feed(t, "\x1b[2;18r\x1b[2H\x1b[2L");
+    roundtrip(d, g, t, &failed);
+    ASSERT(!failed);
+    ASSERT(g->nscrolls == 1);
+    ASSERT(g->scrolls[0].n == -2);
+    ASSERT(g->scrolls[0].top == 1 && g->scrolls[0].bot == 17);
+
+    // and up
+    feed(t, "\x1b[18H\n\n\n\x1b[r");
+    roundtrip(d, g, t, &failed);
+    ASSERT(!failed);
+    ASSERT(g->nscrolls == 1 && g->scrolls[0].n == 3);
+
+    tgrid_free(g);
+    tdelta_free(d);
+    tfree(t);
+    return 0;
+}
+
+// many styles overflow the table, which resets and carries on
+int test_styles(void){
+    Term *t = term(80, 24);
+    TDelta *d = tdelta_new();
+    TGrid *g = tgrid_new();
+    int failed = 0;
+    char buf[64];
+    for(int i = 0; i < 3 * MAX_STYLES; i++){
+        snprintf(
+            buf, sizeof(buf), "\x1b[38;2;%d;%d;0mx", i & 0xff, (i >> 8) & 0xff
+        );
+        feed(t, buf);
+        if(i % 500 == 0){
+            roundtrip(d, g, t, &failed);
+            ASSERT(!failed);
+        }
+    }
+    roundtrip(d, g, t, &failed);
+    ASSERT(!failed);
+    ASSERT(g->nstyles <= MAX_STYLES);
+    tgrid_free(g);
+    tdelta_free(d);
+    tfree(t);
+    return 0;
+}
+
+// garbage is refused, not trusted
+int test_malformed(void){
+    TGrid *g = tgrid_new();
+    const char size[] = {OP_SIZE, 10, 2};
+    ASSERT(tgrid_apply(g, size, sizeof(size)) == 0);
+    // a span past the end of the row
+    const char span[] = {OP_STYLE, 0, 0, 0, 0, 0, 0, 0, OP_SPAN, 0, 8, 3, 0,
+                         'a', 'b', 'c'};
+    ASSERT(tgrid_apply(g, span, sizeof(span)) == -1);
+    // an undefined style
+    const char style[] = {OP_SPAN, 0, 0, 1, 5, 'a'};
+    ASSERT(tgrid_apply(g, style, sizeof(style)) == -1);
+    // truncated
+    const char trunc[] = {OP_SPAN, 0, 0, 3, 0, 'a'};
+    ASSERT(tgrid_apply(g, trunc, sizeof(trunc)) == -1);
+    const char run[] = {OP_RUN, 1, 0, 'a'};
+    ASSERT(tgrid_apply(g, run, sizeof(run)) == -1);
+    const char scroll[] = {OP_SCROLL, 0, 1, 4};
+    ASSERT(tgrid_apply(g, scroll, sizeof(scroll)) == -1);
+    const char op[] = {99};
+    ASSERT(tgrid_apply(g, op, sizeof(op)) == -1);
+    tgrid_free(g);
+    return 0;
+}
+
+//// bench: bytes per frame for typical workloads
+
+typedef struct {
+    const char *name;
+    size_t frames;
+    size_t bytes;
+} result_t;
+
+static void step(TDelta *d, TGrid *g, Term *t, const char *s, result_t *r){
+    feed(t, s);
+    size_t n;
+    const char *frame = tdelta_encode(d, t, &n);
+    if(tgrid_apply(g, frame, n)){
+        fprintf(stderr, "bad frame in %s\n", r->name);
+        exit(1);
+    }
+    r->frames++;
+    r->bytes += n;
+}
+
+static void report(result_t *r, int cols, int rows){
+    // a full repaint: every cell, with its attributes and colors
+    double full = (double)cols * rows * sizeof(Glyph);
+    double per = (double)r->bytes / (double)r->frames;
+    printf(
+        "%-22s %6zu frames: %8.1f bytes/frame (%5.2f%% of a %.0f byte repaint)\n",
+        r->name, r->frames, per, 100 * per / full, full
+    );
+}
+
+static void workload(const char *name, int which){
+    const int cols = 120, rows = 40;
+    Term *t = term(cols, rows);
+    TDelta *d = tdelta_new();
+    TGrid *g = tgrid_new();
+    result_t r = { .name = name };
+    char buf[512];
+    size_t n;
+    // fill the screen first, without counting it
+    for(int i = 0; i < rows; i++){
+        snprintf(buf, sizeof(buf), "\r\n%d some earlier output", i);
+        feed(t, buf);
+    }
+    const char *frame = tdelta_encode(d, t, &n);
+    tgrid_apply(g, frame, n);
+
+    switch(which){
+        case 0: // typing at a prompt, a frame per key
+            for(int i = 0; i < 2000; i++){
+                if(i % 60 == 0){
+                    step(d, g, t, "\r\n$ ", &r);
+                }else{
+                    buf[0] = 'a' + i % 26;
+                    buf[1] = '\0';
+                    step(d, g, t, buf, &r);
+                }
+            }
+            break;
+
+        case 1: // a log, a line per frame
+            for(int i = 0; i < 2000; i++){
+                snprintf(
+                    buf, sizeof(buf),
+                    "\r\n2026-10-18 12:00:%02d INFO request %d served in %dms",
+                    i % 60, i, i * 7 % 300
+                );
+                step(d, g, t, buf, &r);
+            }
+            break;
+
+        case 2: // fast output, many lines per frame
+            for(int i = 0; i < 500; i++){
+                buf[0] = '\0';
+                for(int j = 0; j < 8; j++){
+                    size_t len = strlen(buf);
+                    snprintf(
+                        buf + len, sizeof(buf) - len,
+                        "\r\nbuild/obj/%d/%d.o: compiling", i, j
+                    );
+                }
+                step(d, g, t, buf, &r);
+            }
+            break;
+
+        case 3: // a colorful full redraw, like htop
+            for(int i = 0; i < 200; i++){
+                char screen[16384];
+                size_t len = 0;
+                len += snprintf(screen + len, sizeof(screen) - len, "\x1b[H");
+                for(int y = 0; y < rows; y++){
+                    len += snprintf(
+                        screen + len, sizeof(screen) - len,
+                        "\x1b[%d;1H\x1b[3%dm%5d \x1b[42m%-40.*s\x1b[m %3d%%",
+                        y + 1, (y + i) % 8, 1000 + y, (i * y) % 40,
+                        "||||||||||||||||||||||||||||||||||||||||", (i * y) % 100
+                    );
+                }
+                step(d, g, t, screen, &r);
+            }
+            break;
+
+        case 4: // scrolling an editor's buffer under its status line
+            feed(t, "\x1b[?1049h\x1b[H\x1b[2J");
+            for(int y = 1; y < rows; y++){
+                snprintf(buf, sizeof(buf), "\x1b[%dH    int x%d = f(%d);", y, y, y);
+                feed(t, buf);
+            }
+            snprintf(buf, sizeof(buf), "\x1b[%dH\x1b[7m main.c \x1b[m", rows);
+            feed(t, buf);
+            frame = tdelta_encode(d, t, &n);
+            tgrid_apply(g, frame, n);
+            for(int i = 0; i < 1000; i++){
+                snprintf(
+                    buf, sizeof(buf),
+                    "\x1b[1;%dr\x1b[%dH\n\x1b[r\x1b[%dH    int y%d = g(%d);"
+                    "\x1b[%d;1H",
+                    rows - 1, rows - 1, rows - 1, i, i, rows - 1
+                );
+                step(d, g, t, buf, &r);
+            }
+            break;
+    }
+    report(&r, cols, rows);
+    tgrid_free(g);
+    tdelta_free(d);
+    tfree(t);
+}
+
+static int bench(void){
+    workload("typing", 0);
+    workload("log, a line a frame", 1);
+    workload("fast scroll", 2);
+    workload("colored full redraw", 3);
+    workload("editor region scroll", 4);
+    return 0;
+}
+
+int main(int argc, char **argv){
+    if(argc > 1 && strcmp(argv[1], "bench") == 0) return bench();
+
+    int ret = 0;
+    ret |= test_roundtrip();
+    ret |= test_scroll();
+    ret |= test_styles();
+    ret |= test_malformed();
+    printf("%s\n", ret ? "FAIL" : "PASS");
+    return ret;
+}
@@ -0,0 +1,218 @@
+#include <stdio.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+
+#include "loop.c"
+
+
+#define ASSERT(code) do{ \
+    if(!(code)){ \
+        fprintf(stderr, \
+            "failed assertion: %s (%s::%s:%d)\n", \
+            #code, __FILE__, __func__, __LINE__ \
+        ); \
+        return 1; \
+    } \
+} while(0)
+
+#define N 64
+
+typedef struct {
+    int damaged;
+    int exited;
+    int status;
+    char row0[32];
+} result_t;
+
+// the ascii text at the start of row y, without trailing blanks
+static void row_text(Term *t, int y, char *buf, size_t cap){
+    size_t n;
+    const Glyph *g = tline(t, y, &n);
+    size_t i;
+    for(i = 0; i + 1 < cap && i < n && g[i].u && g[i].u < 128; i++){
+        buf[i] = (char)g[i].u;
+    }
+    while(i && buf[i-1] == ' ') i--;
+    buf[i] = '\0';
+}
+
+static void damage_cb(lterm_t *lt, void *data){
+    result_t *r = data;
+    r->damaged++;
+    row_text(lterm_term(lt), 0, r->row0, sizeof(r->row0));
+}
+
+static void exited_cb(lterm_t *lt, int status, void *data){
+    (void)lt;
+    result_t *r = data;
+    r->exited++;
+    r->status = status;
+}
+
+static const lterm_cbs_t cbs = { .damage = damage_cb, .exited = exited_cb };
+
+// many short-lived children at once
+int test_spawn(loop_t *loop){
+    static result_t results[N];
+    memset(results, 0, sizeof(results));
+    for(int i = 0; i < N; i++){
+        char cmdstr[32];
+        snprintf(cmdstr, sizeof(cmdstr), "printf 'hello %d'", i);
+        char *cmd[] = {"/bin/sh", "-c", cmdstr, NULL};
+        ASSERT(loop_spawn(loop, 40, 5, cmd, &cbs, &results[i]));
+    }
+    ASSERT(loop_count(loop) == N);
+
+    while(loop_count(loop)) ASSERT(loop_run(loop, 5000) > 0);
+
+    for(int i = 0; i < N; i++){
+        char want[32];
+        snprintf(want, sizeof(want), "hello %d", i);
+        ASSERT(results[i].exited == 1);
+        ASSERT(WIFEXITED(results[i].status));
+        ASSERT(results[i].damaged >= 1);
+        ASSERT(strcmp(results[i].row0, want) == 0);
+    }
+
+    loop_free(loop);
+    return 0;
+}
+
+// writes reach the child, and its echo comes back
+int test_write(loop_t *loop){
+    result_t r = {0};
+    char *cmd[] = {"/bin/cat", NULL};
+    lterm_t *lt = loop_spawn(loop, 40, 5, cmd, &cbs, &r);
+    ASSERT(lt);
+
+    lterm_write(lt, "abc", 3);
+    while(strcmp(r.row0, "abc") != 0) ASSERT(loop_run(loop, 5000) > 0);
+
+    // ^D on an empty line ends cat
+    lterm_write(lt, "\r\x04", 2);
+    while(loop_count(loop)) ASSERT(loop_run(loop, 5000) > 0);
+    ASSERT(r.exited == 1);
+    ASSERT(WIFEXITED(r.status) && WEXITSTATUS(r.status) == 0);
+
+    loop_free(loop);
+    return 0;
+}
+
+static void watch_cb(int fd, uint32_t events, void *data){
+    (void)events;
+    char c;
+    if(read(fd, &c, 1) == 1) *(char*)data = c;
+}
+
+int test_watch(void){
+    loop_t *loop = loop_new();
+    int fds[2];
+    ASSERT(pipe(fds) == 0);
+    char got = 0;
+    lwatch_t *w = loop_watch(loop, fds[0], EPOLLIN, watch_cb, &got);
+    ASSERT(write(fds[1], "x", 1) == 1);
+    ASSERT(loop_run(loop, 5000) == 1);
+    ASSERT(got == 'x');
+    lwatch_free(w);
+    close(fds[0]);
+    close(fds[1]);
+    loop_free(loop);
+    return 0;
+}
+
+// the child side of bench(): write n bytes of text lines and exit
+static int bench_child(size_t n){
+    char line[4096];
+    for(size_t i = 0; i < sizeof(line); i++){
+        line[i] = i % 80 == 79 ? '\n' : 'a' + i % 26;
+    }
+    while(n){
+        size_t k = n < sizeof(line) ? n : sizeof(line);
+        ssize_t w = write(1, line, k);
+        if(w < 0) return 1;
+        n -= (size_t)w;
+    }
+    return 0;
+}
+
+static double now(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double cpu(void){
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6
+         + ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+}
+
+static void bench_exited(lterm_t *lt, int status, void *data){
+    (void)lt; (void)status; (void)data;
+}
+
+static const lterm_cbs_t bench_cbs = { .exited = bench_exited };
+
+/* many ptys streaming output at once, through each backend; the cpu time is
+   the loop's own (parsing included), not the children's */
+static int bench(loop_t *loop, const char *self, int nterms, size_t bytes){
+    char bytestr[32];
+    snprintf(bytestr, sizeof(bytestr), "%zu", bytes);
+    char *cmd[] = {(char*)self, "child", bytestr, NULL};
+
+    // children block on full ptys until the loop runs, so time only that
+    for(int i = 0; i < nterms; i++){
+        ASSERT(loop_spawn(loop, 80, 24, cmd, &bench_cbs, NULL));
+    }
+    double t0 = now(), c0 = cpu();
+    while(loop_count(loop)) ASSERT(loop_run(loop, 5000) >= 0);
+    double t1 = now(), c1 = cpu();
+
+    loop_stats_t st = loop_stats(loop);
+    double mb = st.bytes_read / 1e6;
+    printf(
+        "%-6s %d ptys: %7.1f MB in %5.2fs, %9.0f syscalls/s, "
+        "%6.2f cpu ms/MB, %5.1f KB/syscall\n",
+        loop_is_uring(loop) ? "uring" : "epoll", nterms, mb, t1 - t0,
+        st.syscalls / (t1 - t0), (c1 - c0) * 1e3 / mb,
+        st.bytes_read / 1e3 / (double)(st.syscalls ? st.syscalls : 1)
+    );
+    loop_free(loop);
+    return 0;
+}
+
+int main(int argc, char **argv){
+    if(argc > 2 && strcmp(argv[1], "child") == 0){
+        return bench_child(strtoull(argv[2], NULL, 10));
+    }
+
+    if(argc > 1 && strcmp(argv[1], "bench") == 0){
+        int nterms = argc > 2 ? atoi(argv[2]) : 1000;
+        size_t bytes = argc > 3 ? strtoull(argv[3], NULL, 10) : 1 << 20;
+        // a pty and a pidfd per child, and more for the ring
+        struct rlimit rl;
+        getrlimit(RLIMIT_NOFILE, &rl);
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+        char self[4096];
+        ssize_t len = readlink("/proc/self/exe", self, sizeof(self) - 1);
+        ASSERT(len > 0);
+        self[len] = '\0';
+        int ret = 0;
+        ret |= bench(loop_new(), self, nterms, bytes);
+        ret |= bench(loop_new_uring(), self, nterms, bytes);
+        return ret;
+    }
+
+    int ret = 0;
+    ret |= test_spawn(loop_new());
+    ret |= test_write(loop_new());
+    ret |= test_watch();
+    // the io_uring backend (or epoll again, if there's no io_uring here)
+    ret |= test_spawn(loop_new_uring());
+    ret |= test_write(loop_new_uring());
+    printf("%s\n", ret ? "FAIL" : "PASS");
+    return ret;
+}
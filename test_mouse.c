@@ -0,0 +1,110 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "nast.c"
+#include "test_term.h"
+
+static mouse_ev_t mouse(mouse_ev_e type, int x, int y){
+    return (mouse_ev_t){ .type = type, .x = x, .y = y, .ms = 1000 };
+}
+
+int test_drag(void){
+    Term *t = term(20, 4);
+    // a full scrollback, so each new line drops the oldest
+    for(int i = 0; i < RLINES_LIMIT; i++) feed(t, "\r\n");
+    feed(t, "one two three\r\nfour five six");
+    int y = t->main.len - 2;
+    ASSERT(tmouseev(t, mouse(MOUSE_EV_PRESS, 1, y)));
+    ASSERT(tmouseev(t, mouse(MOUSE_EV_MOTION, 5, y)));
+    uint64_t gen = t->sel_gen;
+    // moving within a cell does nothing at all
+    for(int i = 0; i < 10; i++){
+        ASSERT(!tmouseev(t, mouse(MOUSE_EV_MOTION, 5, y)));
+    }
+    ASSERT(t->sel_gen == gen);
+    ASSERT(tmouseev(t, mouse(MOUSE_EV_MOTION, 6, y + 1)));
+    ASSERT(t->sel_xe == 6 && t->sel_ye == (size_t)y + 1);
+
+    // output which breaks the selection makes the same cell count again
+    feed(t, "\x1b[3;3Hx");
+    ASSERT(!t->sel_type);
+    ASSERT(tmouseev(t, mouse(MOUSE_EV_MOTION, 6, y + 1)));
+    ASSERT(t->sel_type && t->sel_xe == 6);
+
+    // the same cell moves up as the oldest lines are dropped
+    feed(t, "\x1b[4;1H\r\n");
+    y--;
+    ASSERT(t->sel_ye == (size_t)y + 1 && t->drag_y == (size_t)y + 1);
+    ASSERT(!tmouseev(t, mouse(MOUSE_EV_MOTION, 6, y + 1)));
+    ASSERT(tmouseev(t, mouse(MOUSE_EV_MOTION, 6, y)));
+    ASSERT(!tmouseev(t, mouse(MOUSE_EV_RELEASE, 6, y)));
+
+    // a new press starts over
+    ASSERT(tmouseev(t, mouse(MOUSE_EV_PRESS, 2, y)));
+    ASSERT(tmouseev(t, mouse(MOUSE_EV_MOTION, 6, y)));
+
+    tfree(t);
+    return 0;
+}
+
+//// bench: dragging a selection
+
+static double now(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int bench(size_t lines){
+    Term *t = term(80, 24);
+    char buf[65536];
+    size_t len = 0;
+    for(size_t i = 0; i < lines; i++){
+        len += snprintf(
+            buf + len, sizeof(buf) - len,
+            "%zu \x1b[32mok\x1b[m GET /api/v1/items/%zu 200 %zums\r\n",
+            i, i * 7919 % 100000, i % 300
+        );
+        if(len > sizeof(buf) - 128){
+            ttyfeed(t, buf, len);
+            len = 0;
+        }
+    }
+    ttyfeed(t, buf, len);
+
+    /* a word selection down the window, with a mouse reporting many times
+       per cell, and then as if every report were a new cell */
+    size_t top = t->main.len - 24;
+    double ms[2];
+    for(int k = 0; k < 2; k++){
+        double t0 = now();
+        tmouseev(t, mouse(MOUSE_EV_PRESS, 3, top));
+        tmouseev(t, mouse(MOUSE_EV_PRESS, 3, top));
+        for(int i = 0; i < 24 * 80 * 16; i++){
+            if(k) t->drag_known = false;
+            tmouseev(t, mouse(MOUSE_EV_MOTION, i / 16 % 80, top + i / 1280));
+        }
+        tmouseev(t, mouse(MOUSE_EV_RELEASE, 0, top + 23));
+        ms[k] = (now() - t0) * 1e3;
+    }
+    printf(
+        "%zu lines, a %d event drag: %.2fms coalesced by cell, "
+        "%.2fms without\n",
+        t->main.len, 24 * 80 * 16, ms[0], ms[1]
+    );
+
+    tfree(t);
+    return 0;
+}
+
+int main(int argc, char **argv){
+    if(argc > 1 && strcmp(argv[1], "bench") == 0){
+        return bench(argc > 2 ? strtoull(argv[2], NULL, 10) : 10000);
+    }
+
+    int ret = 0;
+    ret |= test_drag();
+    printf("%s\n", ret ? "FAIL" : "PASS");
+    return ret;
+}
@@ -0,0 +1,488 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define main nastd_main
+#include "nastd.c"
+#undef main
+
+
+#define ASSERT(code) do{ \
+    if(!(code)){ \
+        fprintf(stderr, \
+            "failed assertion: %s (%s::%s:%d)\n", \
+            #code, __FILE__, __func__, __LINE__ \
+        ); \
+        return 1; \
+    } \
+} while(0)
+
+//// the client's input translation
+
+// translate some input, and gather up the messages it made
+static bool translate(inbuf_t *in, const char *s, size_t n){
+    attached_t a = {0};
+    bool more = translate_input(&a, s, n);
+    *in = (inbuf_t){0};
+    const char *p;
+    size_t len;
+    while((p = writable_get_string(&a.tx, &len))){
+        in->buf = xrealloc(in->buf, in->len + len);
+        memcpy(in->buf + in->len, p, len);
+        in->len += len;
+    }
+    in->cap = in->len;
+    writable_free(&a.tx);
+    return more;
+}
+
+static int next_key(inbuf_t *in, int key, unsigned int mods){
+    msg_hdr_t hdr;
+    bool bad = false;
+    const char *p = inbuf_next(in, &hdr, &bad);
+    ASSERT(p && hdr.type == C_KEY && hdr.len == sizeof(key_ev_t));
+    key_ev_t ev;
+    memcpy(&ev, p, sizeof(ev));
+    ASSERT(ev.key == key && ev.mods == mods);
+    return 0;
+}
+
+static int next_text(inbuf_t *in, const char *text){
+    msg_hdr_t hdr;
+    bool bad = false;
+    const char *p = inbuf_next(in, &hdr, &bad);
+    ASSERT(p && hdr.type == C_TEXT);
+    ASSERT(hdr.len == strlen(text) && memcmp(p, text, hdr.len) == 0);
+    return 0;
+}
+
+// input which is exactly one key
+static int is_key(const char *s, int key, unsigned int mods){
+    inbuf_t in;
+    ASSERT(translate(&in, s, strlen(s)));
+    ASSERT(next_key(&in, key, mods) == 0);
+    ASSERT(in.off == in.len);
+    free(in.buf);
+    return 0;
+}
+
+// input which goes through as text
+static int is_text(const char *s){
+    inbuf_t in;
+    ASSERT(translate(&in, s, strlen(s)));
+    ASSERT(next_text(&in, s) == 0);
+    ASSERT(in.off == in.len);
+    free(in.buf);
+    return 0;
+}
+
+int test_translate(void){
+    // CSI, with and without xterm's modifier parameter
+    ASSERT(is_key("\x1b[A", NAST_KEY_UP, 0) == 0);
+    ASSERT(is_key("\x1b[1;5A", NAST_KEY_UP, CTRL_MASK) == 0);
+    ASSERT(is_key("\x1b[1;2D", NAST_KEY_LEFT, SHIFT_MASK) == 0);
+    ASSERT(is_key("\x1b[3;4~", NAST_KEY_DELETE, SHIFT_MASK | ALT_MASK) == 0);
+    ASSERT(is_key("\x1b[15;6~", NAST_KEY_F5, SHIFT_MASK | CTRL_MASK) == 0);
+    ASSERT(is_key("\x1b[5;9~", NAST_KEY_PGUP, META_MASK) == 0);
+    ASSERT(is_key("\x1b[Z", NAST_KEY_TAB, SHIFT_MASK) == 0);
+    // SS3, and older xterms' modified SS3
+    ASSERT(is_key("\x1bOH", NAST_KEY_HOME, 0) == 0);
+    ASSERT(is_key("\x1bOP", NAST_KEY_F1, 0) == 0);
+    ASSERT(is_key("\x1bO5Q", NAST_KEY_F2, CTRL_MASK) == 0);
+    ASSERT(is_key("\x1b[1;3S", NAST_KEY_F4, ALT_MASK) == 0);
+    // what isn't a key passes through untouched
+    ASSERT(is_text("\x1b[200~") == 0);
+    ASSERT(is_text("\x1b[1;5X") == 0);
+
+    // escape prefixes alt
+    ASSERT(is_key("\x1bx", 'x', ALT_MASK) == 0);
+    ASSERT(is_key("\x1b\r", NAST_KEY_ENTER, ALT_MASK) == 0);
+    ASSERT(is_key("\x1b\x7f", NAST_KEY_BKSP, ALT_MASK) == 0);
+    ASSERT(is_key("\x1b\x01", 'a', ALT_MASK | CTRL_MASK) == 0);
+    ASSERT(is_key("\x1b\x1b", NAST_KEY_ESC, ALT_MASK) == 0);
+    // unless it's alone
+    ASSERT(is_key("\x1b", NAST_KEY_ESC, 0) == 0);
+    // and non-ascii text goes through without it
+    ASSERT(is_text("\xc3\xa9") == 0);
+    inbuf_t in;
+    ASSERT(translate(&in, "\x1b\xc3\xa9x", 4));
+    ASSERT(next_text(&in, "\xc3\xa9") == 0);
+    ASSERT(next_key(&in, 'x', 0) == 0);
+    ASSERT(in.off == in.len);
+    free(in.buf);
+
+    // control characters
+    ASSERT(is_key("\x01", 'a', CTRL_MASK) == 0);
+    ASSERT(is_key("\x1a", 'z', CTRL_MASK) == 0);
+    ASSERT(translate(&in, "\0", 1));
+    ASSERT(next_key(&in, ' ', CTRL_MASK) == 0);
+    free(in.buf);
+    ASSERT(is_key("\x1c", '\\', CTRL_MASK) == 0);
+    ASSERT(is_key("\t", NAST_KEY_TAB, 0) == 0);
+
+    // a sequence cut off by the end of a read goes as text
+    ASSERT(is_text("\x1b[") == 0);
+    ASSERT(is_text("\x1b[1;5") == 0);
+    ASSERT(is_text("\x1bO") == 0);
+    ASSERT(translate(&in, "ab\x1b[1;", 6));
+    ASSERT(next_key(&in, 'a', 0) == 0);
+    ASSERT(next_key(&in, 'b', 0) == 0);
+    ASSERT(next_text(&in, "\x1b[1;") == 0);
+    ASSERT(in.off == in.len);
+    free(in.buf);
+
+    // ctrl+] detaches, and nothing after it is sent
+    ASSERT(!translate(&in, "ab\x1d" "cd", 5));
+    ASSERT(next_key(&in, 'a', 0) == 0);
+    ASSERT(next_key(&in, 'b', 0) == 0);
+    ASSERT(in.off == in.len);
+    free(in.buf);
+    ASSERT(!translate(&in, "\x1d", 1));
+    ASSERT(in.len == 0);
+    free(in.buf);
+    return 0;
+}
+
+//// message framing
+
+static void put_hdr(struct writable *w, uint32_t type, uint32_t len){
+    msg_hdr_t hdr = { type, len };
+    put(w, &hdr, sizeof(hdr));
+}
+
+// hand over n bytes of w, through a pipe, in pieces of at most step bytes
+static int pass(int fds[2], inbuf_t *in, struct writable *w, size_t n,
+        size_t step){
+    while(n){
+        const char *s;
+        size_t got;
+        ASSERT((s = writable_get_string(w, &got)));
+        size_t len = MIN(got, MIN(n, step));
+        ASSERT(write(fds[1], s, len) == (ssize_t)len);
+        if(got > len) writable_return_bytes(w, got - len);
+        ASSERT(inbuf_read(in, fds[0]) == (ssize_t)len);
+        n -= len;
+    }
+    return 0;
+}
+
+int test_inbuf(void){
+    int fds[2];
+    ASSERT(pipe(fds) == 0);
+    inbuf_t in = {0};
+    struct writable w = {0};
+    msg_hdr_t hdr;
+    bool bad = false;
+
+    // a message is only there once all of it is
+    put_msg(&w, C_TEXT, "hello", 5);
+    put_msg(&w, C_LIST, NULL, 0);
+    put_msg(&w, C_TEXT, "world", 5);
+    ASSERT(pass(fds, &in, &w, 4, 64) == 0);
+    ASSERT(!inbuf_next(&in, &hdr, &bad));
+    ASSERT(pass(fds, &in, &w, sizeof(hdr) - 4 + 3, 64) == 0);
+    ASSERT(!inbuf_next(&in, &hdr, &bad));
+    ASSERT(pass(fds, &in, &w, 2 + sizeof(hdr) - 1, 64) == 0);
+    const char *p = inbuf_next(&in, &hdr, &bad);
+    ASSERT(p && hdr.type == C_TEXT && hdr.len == 5);
+    ASSERT(memcmp(p, "hello", 5) == 0);
+    ASSERT(!inbuf_next(&in, &hdr, &bad));
+    ASSERT(pass(fds, &in, &w, writable_len(&w), 1) == 0);
+    p = inbuf_next(&in, &hdr, &bad);
+    ASSERT(p && hdr.type == C_LIST && hdr.len == 0);
+    p = inbuf_next(&in, &hdr, &bad);
+    ASSERT(p && hdr.type == C_TEXT && memcmp(p, "world", 5) == 0);
+    ASSERT(!inbuf_next(&in, &hdr, &bad));
+    ASSERT(!bad);
+
+    // one bigger than the buffer, arriving in pieces
+    size_t big = 100000;
+    char *text = xmalloc(big);
+    for(size_t i = 0; i < big; i++) text[i] = 'a' + i % 26;
+    put_msg(&w, C_TEXT, text, big);
+    ASSERT(pass(fds, &in, &w, writable_len(&w), 4096) == 0);
+    p = inbuf_next(&in, &hdr, &bad);
+    ASSERT(p && hdr.len == big && memcmp(p, text, big) == 0);
+    free(text);
+    // consumed messages are dropped on the next read
+    ASSERT(in.off == in.len);
+    put_msg(&w, C_LIST, NULL, 0);
+    ASSERT(pass(fds, &in, &w, writable_len(&w), 64) == 0);
+    ASSERT(in.off == 0 && in.len == sizeof(hdr));
+    ASSERT(inbuf_next(&in, &hdr, &bad) && hdr.type == C_LIST);
+
+    // MSG_MAX is allowed (if not yet here), and any more is a broken peer
+    put_hdr(&w, C_TEXT, MSG_MAX);
+    ASSERT(pass(fds, &in, &w, writable_len(&w), 64) == 0);
+    ASSERT(!inbuf_next(&in, &hdr, &bad));
+    ASSERT(!bad);
+    in.len = in.off = 0;
+    put_hdr(&w, C_TEXT, MSG_MAX + 1);
+    ASSERT(pass(fds, &in, &w, writable_len(&w), 64) == 0);
+    ASSERT(!inbuf_next(&in, &hdr, &bad));
+    ASSERT(bad);
+
+    free(in.buf);
+    writable_free(&w);
+    close(fds[0]);
+    close(fds[1]);
+    return 0;
+}
+
+//// the server, in-process, over socketpairs
+
+// a connection to the server
+typedef struct {
+    int fd;
+    inbuf_t in;
+} conn_t;
+
+static int conn_open(conn_t *c){
+    int sv[2];
+    ASSERT(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) == 0);
+    ASSERT(fcntl(sv[0], F_SETFL, O_NONBLOCK) == 0);
+    ASSERT(fcntl(sv[1], F_SETFL, O_NONBLOCK) == 0);
+    client_add(sv[0]);
+    *c = (conn_t){ .fd = sv[1] };
+    return 0;
+}
+
+static void conn_close(conn_t *c){
+    close(c->fd);
+    free(c->in.buf);
+}
+
+static void conn_send(conn_t *c, uint32_t type, struct writable *req){
+    struct writable w = {0};
+    put_hdr(&w, type, (uint32_t)writable_len(req));
+    const char *s;
+    size_t n;
+    while((s = writable_get_string(req, &n))) put(&w, s, n);
+    while(writable_nonempty(&w)) writable_writev(&w, c->fd);
+    writable_free(&w);
+}
+
+// run the server until the next message arrives; NULL after 5s of nothing
+static const char *conn_recv(conn_t *c, msg_hdr_t *hdr){
+    bool bad = false;
+    for(int i = 0; i < 500; i++){
+        const char *p = inbuf_next(&c->in, hdr, &bad);
+        if(p || bad) return p;
+        loop_run(loop, 10);
+        inbuf_read(&c->in, c->fd);
+    }
+    return NULL;
+}
+
+static void new_req(struct writable *req, int cols, int rows, uint16_t flags){
+    put_u16(req, (uint16_t)cols);
+    put_u16(req, (uint16_t)rows);
+    put_u16(req, flags);
+}
+
+static void put_str(struct writable *w, const char *s){
+    put(w, s, strlen(s) + 1);
+}
+
+// the ascii text at the start of a session's row y, without trailing blanks
+static void row_text(session_t *s, int y, char *buf, size_t cap){
+    size_t n;
+    const Glyph *g = twindowline(lterm_term(s->lt), y, &n);
+    size_t i;
+    for(i = 0; i + 1 < cap && i < n && g[i].u && g[i].u < 128; i++){
+        buf[i] = (char)g[i].u;
+    }
+    while(i && buf[i-1] == ' ') i--;
+    buf[i] = '\0';
+}
+
+static int wait_row(session_t *s, int y, const char *want){
+    char got[256];
+    for(int i = 0; i < 500; i++){
+        row_text(s, y, got, sizeof(got));
+        if(strcmp(got, want) == 0) return 0;
+        loop_run(loop, 10);
+    }
+    fprintf(stderr, "row %d: got \"%s\", wanted \"%s\"\n", y, got, want);
+    return 1;
+}
+
+// a request the server refuses
+static int refused(struct writable *req){
+    conn_t c;
+    ASSERT(conn_open(&c) == 0);
+    conn_send(&c, C_NEW, req);
+    writable_free(req);
+    msg_hdr_t hdr;
+    const char *p = conn_recv(&c, &hdr);
+    ASSERT(p && hdr.type == S_ERROR);
+    ASSERT(hdr.len == 11 && memcmp(p, "bad request", 11) == 0);
+    conn_close(&c);
+    return 0;
+}
+
+int test_new(void){
+    uint32_t ids = next_id;
+
+    // the size and flags, then cwd and each argument, all \0-terminated
+    struct writable req = {0};
+    put_u16(&req, 80);
+    ASSERT(refused(&req) == 0);
+    new_req(&req, 80, 24, 0);
+    ASSERT(refused(&req) == 0);
+    new_req(&req, 80, 24, 0);
+    put(&req, "/", 1);
+    ASSERT(refused(&req) == 0);
+    new_req(&req, 0, 24, 0);
+    put_str(&req, "/");
+    ASSERT(refused(&req) == 0);
+    new_req(&req, 80, 0, 0);
+    put_str(&req, "/");
+    ASSERT(refused(&req) == 0);
+    ASSERT(!sessions && next_id == ids);
+
+    // the command runs in the cwd, with each argument as it was sent
+    char dir[] = "/tmp/test_nastd-XXXXXX";
+    ASSERT(mkdtemp(dir));
+    char here[PATH_MAX];
+    ASSERT(getcwd(here, sizeof(here)));
+    conn_t c;
+    ASSERT(conn_open(&c) == 0);
+    new_req(&req, 40, 5, 0);
+    put_str(&req, dir);
+    put_str(&req, "/bin/sh");
+    put_str(&req, "-c");
+    put_str(&req, "pwd; printf '<%s>' \"$@\"; exec cat");
+    put_str(&req, "sh");
+    put_str(&req, "a b");
+    put_str(&req, "");
+    put_str(&req, "c");
+    conn_send(&c, C_NEW, &req);
+    writable_free(&req);
+    msg_hdr_t hdr;
+    const char *p = conn_recv(&c, &hdr);
+    ASSERT(p && hdr.type == S_ATTACHED && hdr.len == 10);
+    uint32_t id;
+    memcpy(&id, p, 4);
+    session_t *s = sessions;
+    ASSERT(s && s->id == id && id == ids);
+    ASSERT(strcmp(
+        s->name, "/bin/sh -c pwd; printf '<%s>' \"$@\"; exec cat sh a b  c"
+    ) == 0);
+    ASSERT(wait_row(s, 0, dir) == 0);
+    ASSERT(wait_row(s, 1, "<a b><><c>") == 0);
+    // (and the server stays where it was)
+    char now_in[PATH_MAX];
+    ASSERT(getcwd(now_in, sizeof(now_in)) && strcmp(now_in, here) == 0);
+    // the first frame follows
+    p = conn_recv(&c, &hdr);
+    ASSERT(p && hdr.type == S_FRAME);
+
+    // with no command it's the user's shell
+    conn_t c2;
+    ASSERT(conn_open(&c2) == 0);
+    new_req(&req, 40, 5, 0);
+    put_str(&req, dir);
+    conn_send(&c2, C_NEW, &req);
+    writable_free(&req);
+    p = conn_recv(&c2, &hdr);
+    ASSERT(p && hdr.type == S_ATTACHED);
+    ASSERT(sessions != s && strcmp(sessions->name, "(shell)") == 0);
+    lterm_write(sessions->lt, "shell\r", 6);
+    ASSERT(wait_row(sessions, 1, "shell") == 0);
+
+    // a client which goes away leaves its session running
+    conn_close(&c);
+    conn_close(&c2);
+    for(int i = 0; i < 10; i++) loop_run(loop, 10);
+    ASSERT(sessions && sessions->next == s);
+    ASSERT(rmdir(dir) == 0);
+    return 0;
+}
+
+//// bench: attaching to a session with a long scrollback
+
+static double now(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int bench(size_t lines){
+    // all of the scrollback is kept
+    conn_t c;
+    ASSERT(conn_open(&c) == 0);
+    struct writable req = {0};
+    new_req(&req, 120, 40, NEW_SPILL);
+    put_str(&req, "/");
+    put_str(&req, "/bin/sh");
+    put_str(&req, "-c");
+    char cmd[64];
+    snprintf(cmd, sizeof(cmd), "seq %zu; exec cat", lines);
+    put_str(&req, cmd);
+    conn_send(&c, C_NEW, &req);
+    writable_free(&req);
+    msg_hdr_t hdr;
+    ASSERT(conn_recv(&c, &hdr) && hdr.type == S_ATTACHED);
+    session_t *s = sessions;
+    Term *t = lterm_term(s->lt);
+    double t0 = now();
+    while(tscrollback(t) < lines) ASSERT(loop_run(loop, 5000) > 0);
+    double fed = now() - t0;
+    conn_close(&c);
+
+    // attach, then get and draw the first frame
+    int reps = 100;
+    ASSERT(conn_open(&c) == 0);
+    attached_t a = { .fg = defaultfg, .bg = defaultbg, .grid = tgrid_new() };
+    t0 = now();
+    for(int i = 0; i < reps; i++){
+        put_u32(&req, s->id);
+        put_u16(&req, 120);
+        put_u16(&req, 40);
+        conn_send(&c, C_ATTACH, &req);
+        const char *p;
+        bool framed = false;
+        while(!framed && (p = conn_recv(&c, &hdr))){
+            reader_t r = { p, hdr.len, true };
+            ASSERT(handle_server_msg(&a, hdr.type, &r) == 0);
+            framed = hdr.type == S_FRAME;
+        }
+        ASSERT(framed);
+        writable_drop(&a.scr);
+    }
+    double attached = now() - t0;
+
+    printf(
+        "%zu lines (%zu kept, fed in %.2fs): attach and first frame %.3fms\n",
+        lines, tscrollback(t), fed, attached * 1e3 / reps
+    );
+    writable_free(&req);
+    writable_free(&a.scr);
+    tgrid_free(a.grid);
+    conn_close(&c);
+    return 0;
+}
+
+int main(int argc, char **argv){
+    // a vanished client must not kill the server
+    signal(SIGPIPE, SIG_IGN);
+    loop = loop_new();
+
+    int ret = 0;
+    if(argc > 1 && strcmp(argv[1], "bench") == 0){
+        ret = bench(argc > 2 ? strtoull(argv[2], NULL, 10) : 100000);
+        loop_free(loop);
+        return ret;
+    }
+
+    // the user's shell, as far as the server can tell
+    setenv("SHELL", "/bin/cat", 1);
+
+    ret |= test_translate();
+    ret |= test_inbuf();
+    ret |= test_new();
+    loop_free(loop);
+    printf("%s\n", ret ? "FAIL" : "PASS");
+    return ret;
+}
@@ -0,0 +1,59 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "pool.c"
+
+
+#define ASSERT(code) do{ \
+    if(!(code)){ \
+        fprintf(stderr, \
+            "failed assertion: %s (%s::%s:%d)\n", \
+            #code, __FILE__, __func__, __LINE__ \
+        ); \
+        return 1; \
+    } \
+} while(0)
+
+#define N 1000
+
+typedef struct {
+    size_t count[N];
+    int workers[N];
+} job_t;
+
+static void count_fn(void *arg, size_t i, int worker){
+    job_t *job = arg;
+    job->count[i]++;
+    job->workers[i] = worker;
+}
+
+int test_pool(int nthreads){
+    pool_t *pool = pool_new(nthreads);
+    ASSERT(pool);
+    ASSERT(pool_size(pool) == nthreads);
+
+    static job_t job;
+    memset(&job, 0, sizeof(job));
+    // many small jobs back-to-back, to shake out any handoff races
+    for(size_t r = 0; r < 100; r++){
+        pool_run(pool, N, count_fn, &job);
+        // a job might be shorter than the pool
+        pool_run(pool, r % 4, count_fn, &job);
+    }
+    for(size_t i = 0; i < N; i++){
+        size_t extra = i < 3 ? 75 - 25 * i : 0;
+        ASSERT(job.count[i] == 100 + extra);
+        ASSERT(job.workers[i] >= 0 && job.workers[i] < nthreads);
+    }
+
+    pool_free(pool);
+    return 0;
+}
+
+int main(){
+    int ret = 0;
+    ret |= test_pool(1);
+    ret |= test_pool(4);
+    printf("%s\n", ret ? "FAIL" : "PASS");
+    return ret;
+}
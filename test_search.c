@@ -0,0 +1,499 @@
+#include <locale.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "nast.c"
+#include "test_term.h"
+
+// "line <i>" for lines [first, first + n)
+static void feed_lines(Term *t, size_t first, size_t n){
+    char buf[65536];
+    size_t len = 0;
+    for(size_t i = first; i < first + n; i++){
+        len += snprintf(buf + len, sizeof(buf) - len, "line %zu\r\n", i);
+        if(len > sizeof(buf) - 64){
+            ttyfeed(t, buf, len);
+            len = 0;
+        }
+    }
+    ttyfeed(t, buf, len);
+}
+
+static int match_is(TMatch m, size_t yb, int xb, size_t ye, int xe){
+    ASSERT(m.yb == yb && m.xb == xb && m.ye == ye && m.xe == xe);
+    return 0;
+}
+
+// the text of a match which fits on one row
+static int match_text(Term *t, TMatch m, const char *want){
+    ASSERT(m.yb == m.ye);
+    RLine *rline = get_rline(t->scr, m.yb);
+    size_t len = strlen(want);
+    ASSERT((size_t)(m.xe - m.xb + 1) == len);
+    for(size_t i = 0; i < len; i++){
+        ASSERT(rline->glyphs[m.xb + i].u == (Rune)want[i]);
+    }
+    return 0;
+}
+
+static int line_is(Term *t, size_t y, const char *want){
+    RLine *rline = get_rline(t->scr, y);
+    size_t len = strlen(want);
+    for(size_t x = 0; x < rline->n_glyphs; x++){
+        ASSERT(rline->glyphs[x].u == (x < len ? (Rune)want[x] : ' '));
+    }
+    return 0;
+}
+
+int test_scan(void){
+    // the vector scans agree with a plain loop, at every alignment
+    Rune u[67];
+    for(size_t i = 0; i < LEN(u); i++) u[i] = 'a' + i % 3;
+    u[40] = 'x';
+    u[66] = 'x';
+    for(size_t i = 0; i <= LEN(u); i++){
+        size_t want = i <= 40 ? 40 : i <= 66 ? 66 : SIZE_MAX;
+        ASSERT(scan_rune(u, i, LEN(u), 'x') == want);
+        want = i > 66 ? 66 : i > 40 ? 40 : SIZE_MAX;
+        ASSERT(scan_rune_back(u, i, 'x') == want);
+    }
+    ASSERT(scan_rune(u, 0, 40, 'x') == SIZE_MAX);
+    ASSERT(scan_rune(u, 0, LEN(u), 'c') == 2);
+    ASSERT(scan_rune_back(u, LEN(u), 'c') == 65);
+    return 0;
+}
+
+int test_find(void){
+    Term *t = term(10, 4);
+    // row 0-1: one line wrapped over two rows
+    feed(t, "hello world foo\r\n");
+    // row 2: wide characters, and mixed case
+    feed(t, "\xe4\xb8\xad\xe6\x96\x87" "abc Ab");
+    size_t n = tscrollback(t);
+    ASSERT(n == 4);
+    TMatch m;
+
+    // across the wrap
+    ASSERT(tfind(t, "world foo", 0, 0, -1, &m) == 1);
+    ASSERT(match_is(m, 0, 6, 1, 4) == 0);
+    // around wide characters, which take in their second cell
+    ASSERT(tfind(t, "\xe4\xb8\xad\xe6\x96\x87", 0, 0, -1, &m) == 1);
+    ASSERT(match_is(m, 2, 0, 2, 3) == 0);
+    ASSERT(tfind(t, "\xe6\x96\x87" "a", 0, 0, -1, &m) == 1);
+    ASSERT(match_is(m, 2, 2, 2, 4) == 0);
+
+    // forwards and backwards from a position
+    ASSERT(tfind(t, "o", 0, 0, -1, &m) == 1);
+    ASSERT(match_is(m, 0, 4, 0, 4) == 0);
+    ASSERT(tfind(t, "o", 0, 0, 4, &m) == 1);
+    ASSERT(match_is(m, 0, 7, 0, 7) == 0);
+    ASSERT(tfind(t, "o", TSEARCH_BACKWARD, n - 1, 10, &m) == 1);
+    ASSERT(match_is(m, 1, 4, 1, 4) == 0);
+    ASSERT(tfind(t, "o", TSEARCH_BACKWARD, 1, 3, &m) == 1);
+    ASSERT(match_is(m, 0, 7, 0, 7) == 0);
+    ASSERT(tfind(t, "o", TSEARCH_BACKWARD, 0, 4, &m) == 0);
+    ASSERT(tfind(t, "nothing", 0, 0, -1, &m) == 0);
+    // nothing past the end of a line matches, not even its blanks
+    ASSERT(tfind(t, "foo  ", 0, 0, -1, &m) == 0);
+
+    // case
+    ASSERT(tfind(t, "c ab", 0, 0, -1, &m) == 0);
+    ASSERT(tfind(t, "c ab", TSEARCH_ICASE, 0, -1, &m) == 1);
+    ASSERT(match_is(m, 2, 6, 2, 9) == 0);
+
+    // regexes
+    ASSERT(tfind(t, "wor+ld f", TSEARCH_REGEX, 0, -1, &m) == 1);
+    ASSERT(match_is(m, 0, 6, 1, 2) == 0);
+    ASSERT(tfind(t, "^abc", TSEARCH_REGEX, 0, -1, &m) == 0);
+    ASSERT(tfind(t, "^h", TSEARCH_REGEX, 0, 0, &m) == 0);
+    ASSERT(tfind(t, "[a-c]+", TSEARCH_REGEX, 2, 4, &m) == 1);
+    ASSERT(match_is(m, 2, 5, 2, 6) == 0);
+    ASSERT(tfind(t, "o+", TSEARCH_REGEX | TSEARCH_BACKWARD, n - 1, 10, &m));
+    ASSERT(match_is(m, 1, 3, 1, 4) == 0);
+    ASSERT(tfind(t, "C A", TSEARCH_REGEX | TSEARCH_ICASE, 0, -1, &m) == 1);
+    ASSERT(match_is(m, 2, 6, 2, 8) == 0);
+    // an empty match is no match
+    ASSERT(tfind(t, "z*", TSEARCH_REGEX, 0, -1, &m) == 0);
+    ASSERT(tfind(t, "(", TSEARCH_REGEX, 0, -1, &m) == -1);
+    tfree(t);
+    return 0;
+}
+
+int test_incremental(void){
+    Term *t = term(20, 5);
+    feed_lines(t, 0, 1000);
+    size_t n = tscrollback(t);
+    TMatch m = {0}, want;
+
+    // typing narrows the search the same as starting over would
+    const char *typed[] = {"l", "li", "line 5", "line 50", "line 500", "line 5"};
+    for(size_t i = 0; i < LEN(typed); i++){
+        int found = tsearch(t, typed[i], TSEARCH_BACKWARD);
+        ASSERT(tfind(t, typed[i], TSEARCH_BACKWARD, n - 1, 20, &want) == found);
+        ASSERT(tsearchmatch(t, &m) == found);
+        if(found) ASSERT(match_is(m, want.yb, want.xb, want.ye, want.xe) == 0);
+    }
+    // (the last of them is found)
+    ASSERT(tsearchmatch(t, &m));
+    ASSERT(match_text(t, m, "line 5") == 0);
+    ASSERT(m.yb == 599);
+
+    // the window follows the match
+    ASSERT(tsearch(t, "line 500", TSEARCH_BACKWARD) == 1);
+    ASSERT(tsearchmatch(t, &m) && m.yb == 500);
+    ASSERT(window2abs(t, 0) <= 500 && 500 < window2abs(t, 5));
+
+    // next and previous
+    ASSERT(tsearch(t, "line 12", TSEARCH_BACKWARD) == 1);
+    ASSERT(tsearchmatch(t, &m) && m.yb == 129);
+    ASSERT(tsearchnext(t, false) == 1);
+    ASSERT(tsearchmatch(t, &m) && m.yb == 128);
+    ASSERT(tsearchnext(t, true) == 1);
+    ASSERT(tsearchmatch(t, &m) && m.yb == 129);
+    for(int i = 0; i < 10; i++) ASSERT(tsearchnext(t, false) == 1);
+    ASSERT(tsearchmatch(t, &m) && m.yb == 12);
+    // the last one stays
+    ASSERT(tsearchnext(t, false) == 0);
+    ASSERT(tsearchmatch(t, &m) && m.yb == 12);
+
+    // no match, and a bad regex
+    ASSERT(tsearch(t, "line 12x", TSEARCH_BACKWARD) == 0);
+    ASSERT(!tsearchmatch(t, &m));
+    ASSERT(tsearch(t, "line (", TSEARCH_BACKWARD | TSEARCH_REGEX) == -1);
+    ASSERT(tsearch(t, "line 9+", TSEARCH_BACKWARD | TSEARCH_REGEX) == 1);
+    ASSERT(tsearchmatch(t, &m) && match_text(t, m, "line 999") == 0);
+
+    // the highlight is just the match
+    int first, last;
+    ASSERT(t_get_match_span(t, m.yb, &first, &last));
+    ASSERT(first == 0 && last == 7);
+    ASSERT(!t_get_match_span(t, m.yb + 1, &first, &last));
+    tsearchend(t);
+    ASSERT(!tsearchmatch(t, &m));
+    ASSERT(!t_get_match_span(t, 999, &first, &last));
+    tfree(t);
+    return 0;
+}
+
+int test_moving(void){
+    // lines dropping off the top of a full ring carry the match with them
+    Term *t = term(20, 5);
+    feed_lines(t, 0, 12000);
+    TMatch m;
+    ASSERT(tsearch(t, "0000", TSEARCH_BACKWARD) == 1);
+    feed_lines(t, 12000, 100);
+    ASSERT(tsearchmatch(t, &m) && line_is(t, m.yb, "line 10000") == 0);
+    /* and it's gone once its line is, and so is where the search started,
+       so it starts over from the window, which is at the top now */
+    feed_lines(t, 12100, 10000);
+    ASSERT(!tsearchmatch(t, &m));
+    ASSERT(tsearchnext(t, false) == 0);
+    ASSERT(tsearchnext(t, true) == 1);
+    ASSERT(tsearchmatch(t, &m) && line_is(t, m.yb, "line 20000") == 0);
+
+    // a reset forgets it
+    feed(t, "\x1b" "c");
+    ASSERT(!tsearchmatch(t, &m));
+    ASSERT(tsearchnext(t, false) == 0);
+    tsearchend(t);
+
+    // spilled lines are searched like any others
+    ASSERT(tspill(t, NULL) == 0);
+    feed(t, "\x1b[H");
+    feed_lines(t, 0, 30000);
+    twindowmv(t, -(int)tscrollback(t));
+    ASSERT(tspilled(t) > 10000);
+    ASSERT(tsearch(t, "line 42", TSEARCH_BACKWARD) == 1);
+    for(int i = 0; i < 13; i++) ASSERT(tsearchnext(t, false) == 1);
+    ASSERT(tsearchmatch(t, &m) && line_is(t, m.yb, "line 4286") == 0);
+    ASSERT(m.yb < tspilled(t));
+    tfree(t);
+    return 0;
+}
+
+// tfindall() finds just what stepping through with tfind() does
+static int findall_steps(Term *t, const char *pattern, int flags, size_t *n){
+    TMatches ms;
+    ASSERT(tfindall(t, pattern, flags, &ms) == 0);
+    TMatch m;
+    size_t y = 0;
+    int x = -1;
+    *n = 0;
+    while(tfind(t, pattern, flags, y, x, &m) == 1){
+        ASSERT(*n < ms.n);
+        ASSERT(match_is(ms.m[*n], m.yb, m.xb, m.ye, m.xe) == 0);
+        (*n)++;
+        y = m.yb;
+        x = m.xb;
+    }
+    ASSERT(*n == ms.n);
+    tmatchesfree(&ms);
+    return 0;
+}
+
+int test_findall(void){
+    // enough rows for the pool, with lines wrapped over the chunk boundaries
+    Term *t = term(20, 5);
+    ASSERT(tspill(t, NULL) == 0);
+    // several workers, however many cpus there are
+    t->rpool.pool = pool_new(4);
+    ASSERT(t->rpool.pool);
+    t->rpool.pctx = calloc(pool_size(t->rpool.pool), sizeof(*t->rpool.pctx));
+    for(size_t i = 0; i < 16000; i++){
+        char buf[64];
+        const char *fmt = i % 4 ? "line %zu\r\n" : "line %zu wraps over the edge\r\n";
+        snprintf(buf, sizeof(buf), fmt, i);
+        feed(t, buf);
+    }
+    ASSERT(tscrollback(t) > FINDALL_PARALLEL_MIN && tspilled(t) > 0);
+    size_t straddled = 0;
+    for(size_t y = FINDALL_CHUNK; y < tscrollback(t); y += FINDALL_CHUNK){
+        uint64_t id = get_rline(t->scr, y)->line_id;
+        straddled += id && get_rline(t->scr, y - 1)->line_id == id;
+    }
+    ASSERT(straddled > 0);
+
+    size_t n;
+    ASSERT(findall_steps(t, "7", 0, &n) == 0 && n > 5000);
+    ASSERT(findall_steps(t, "er the e", 0, &n) == 0 && n == 4000);
+    ASSERT(findall_steps(t, "THE EDGE", TSEARCH_ICASE, &n) == 0 && n == 4000);
+    ASSERT(findall_steps(t, "e [0-9]+ w", TSEARCH_REGEX, &n) == 0 && n == 4000);
+    ASSERT(findall_steps(t, "99$", TSEARCH_REGEX, &n) == 0 && n == 160);
+    ASSERT(findall_steps(t, "nothing", 0, &n) == 0 && n == 0);
+    TMatches ms;
+    ASSERT(tfindall(t, "(", TSEARCH_REGEX, &ms) == -1 && ms.n == 0);
+
+    // restored lines are searched while still packed, and left that way
+    char path[64];
+    ASSERT(test_tmpfile(path, "test_search") == 0);
+    int fd = open(path, O_WRONLY | O_TRUNC | O_CLOEXEC);
+    ASSERT(fd >= 0 && tsnapshot(t, fd) == 0);
+    close(fd);
+    Term *r = term(20, 5);
+    ASSERT(trestore(r, path) == 0);
+    unlink(path);
+    TMatches a, b;
+    ASSERT(tfindall(t, "wraps", 0, &a) == 0 && tfindall(r, "wraps", 0, &b) == 0);
+    ASSERT(a.n == b.n);
+    for(size_t i = 0; i < a.n; i++){
+        TMatch m = b.m[i];
+        ASSERT(match_is(a.m[i], m.yb, m.xb, m.ye, m.xe) == 0);
+    }
+    ASSERT(r->main.rlines[rlines_idx(&r->main, 0)]->packed);
+    tmatchesfree(&a);
+    tmatchesfree(&b);
+    tfree(r);
+    tfree(t);
+
+    // a list keeps up with lines dropping off the top
+    t = term(20, 5);
+    feed_lines(t, 0, 12000);
+    ASSERT(tfindall(t, "line 5", 0, &ms) == 0);
+    size_t before = ms.n;
+    feed_lines(t, 12000, 3500);
+    ASSERT(tmatchesupdate(t, &ms));
+    ASSERT(ms.n > 0 && ms.n < before);
+    for(size_t i = 0; i < ms.n; i++){
+        ASSERT(match_text(t, ms.m[i], "line 5") == 0);
+    }
+    // and the oldest can be made the current match
+    ASSERT(!tsearchgoto(t, &ms.m[0]));
+    ASSERT(tsearch(t, "line 5", TSEARCH_BACKWARD) == 1);
+    TMatch m;
+    ASSERT(tsearchgoto(t, &ms.m[0]) && tsearchmatch(t, &m));
+    ASSERT(match_is(m, ms.m[0].yb, ms.m[0].xb, ms.m[0].ye, ms.m[0].xe) == 0);
+    ASSERT(tsearchnext(t, true) == 1 && tsearchmatch(t, &m));
+    ASSERT(match_is(m, ms.m[1].yb, ms.m[1].xb, ms.m[1].ye, ms.m[1].xe) == 0);
+    // but not with a clear, which leaves nothing for them to mean
+    feed(t, "\x1b[3J");
+    ASSERT(!tmatchesupdate(t, &ms) && ms.n == 0);
+    tfree(t);
+    return 0;
+}
+
+static int matches_eq(TMatches *a, TMatches *b){
+    ASSERT(a->n == b->n);
+    for(size_t i = 0; i < a->n; i++){
+        TMatch m = b->m[i];
+        ASSERT(match_is(a->m[i], m.yb, m.xb, m.ye, m.xe) == 0);
+    }
+    return 0;
+}
+
+// a list finds what was added after it was made, as if made again
+int test_update(void){
+    Term *t = term(20, 5);
+    feed_lines(t, 0, 100);
+    TMatches ms, fresh;
+    ASSERT(tfindall(t, "line 1", 0, &ms) == 0);
+    feed_lines(t, 100, 2000);
+    ASSERT(tmatchesupdate(t, &ms) && ms.scanned == tscrollback(t));
+    ASSERT(tfindall(t, "line 1", 0, &fresh) == 0);
+    ASSERT(ms.n > 1000 && matches_eq(&ms, &fresh) == 0);
+    tmatchesfree(&fresh);
+
+    // the window is searched again, since it can change under the list
+    feed(t, "\x1b[1;1Hline 1\x1b[3;1H\x1b[2K");
+    ASSERT(tmatchesupdate(t, &ms));
+    ASSERT(tfindall(t, "line 1", 0, &fresh) == 0);
+    ASSERT(matches_eq(&ms, &fresh) == 0);
+    tmatchesfree(&fresh);
+    tmatchesfree(&ms);
+    tfree(t);
+
+    // tfindallstart() gets there a slice at a time
+    t = term(20, 5);
+    ASSERT(tspill(t, NULL) == 0);
+    feed_lines(t, 0, 50000);
+    ASSERT(tfindallstart(t, "line 4", 0, &ms) == 0);
+    ASSERT(ms.n == 0 && ms.scanned == 0);
+    int steps = 0;
+    while(ms.scanned < tscrollback(t)){
+        ASSERT(tmatchesupdate(t, &ms));
+        steps++;
+    }
+    ASSERT(steps > 1);
+    ASSERT(tfindall(t, "line 4", 0, &fresh) == 0);
+    ASSERT(matches_eq(&ms, &fresh) == 0);
+    tmatchesfree(&fresh);
+    tmatchesfree(&ms);
+    ASSERT(tfindallstart(t, "(", TSEARCH_REGEX, &ms) == -1);
+    tfree(t);
+    return 0;
+}
+
+//// bench: searching a big scrollback
+
+static double now(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int bench(size_t lines){
+    Term *t = term(120, 40);
+    tspill(t, NULL);
+    char buf[65536];
+    size_t len = 0;
+    for(size_t i = 0; i < lines; i++){
+        len += snprintf(
+            buf + len, sizeof(buf) - len,
+            "%zu \x1b[32mok\x1b[m GET /api/v1/items/%zu 200 %zums "
+            "user-agent=curl/8.5.0 trace=%016zx\r\n",
+            i, i * 7919 % 100000, i % 300, (size_t)(i * 0x9e3779b97f4a7c15ULL)
+        );
+        if(len > sizeof(buf) - 256){
+            ttyfeed(t, buf, len);
+            len = 0;
+        }
+    }
+    ttyfeed(t, buf, len);
+    size_t n = tscrollback(t);
+    TMatch m;
+
+    // scanning for one rune, with and without vectors
+    Rune *u = xmalloc(1 << 20 << 2);
+    for(size_t i = 0; i < 1 << 20; i++) u[i] = 'a' + i % 26;
+    double t0 = now();
+    size_t hits = 0;
+    volatile Rune z = 'Z';
+    for(int k = 0; k < 100; k++) hits += scan_rune(u, 0, 1 << 20, z) != 0;
+    double simd = now() - t0;
+    t0 = now();
+    for(int k = 0; k < 100; k++){
+        size_t i = 0;
+        Rune c = z;
+        while(i < 1 << 20 && u[i] != c) i++;
+        hits += i;
+    }
+    double plain = now() - t0;
+    free(u);
+
+    // a whole scrollback with nothing to find, either way
+    const char *patterns[] = {"no such thing", "GET /api/v2", "Z+z"};
+    int flags[] = {0, TSEARCH_ICASE, TSEARCH_REGEX};
+    double times[3];
+    for(int i = 0; i < 3; i++){
+        t0 = now();
+        tfind(t, patterns[i], flags[i] | TSEARCH_BACKWARD, n - 1, 120, &m);
+        times[i] = now() - t0;
+    }
+
+    // typing a search for an old line, one key at a time
+    const char *target = "items/77777 ";
+    char typed[64] = {0};
+    t0 = now();
+    for(size_t i = 0; target[i]; i++){
+        typed[i] = target[i];
+        tsearch(t, typed, TSEARCH_BACKWARD);
+    }
+    double typing = now() - t0;
+    t0 = now();
+    for(size_t i = 0; target[i]; i++){
+        memcpy(typed, target, i + 1);
+        typed[i + 1] = '\0';
+        tfind(t, typed, TSEARCH_BACKWARD, n - 1, 120, &m);
+    }
+    double restarting = now() - t0;
+
+    // counting every match, on one thread and then on the pool
+    const char *common = "GET /api";
+    TMatches ms;
+    t->rpool.failed = true;
+    t0 = now();
+    tfindall(t, common, 0, &ms);
+    double serial = now() - t0;
+    size_t counted = ms.n;
+    tmatchesfree(&ms);
+    t->rpool.failed = false;
+    t0 = now();
+    tfindall(t, common, 0, &ms);
+    double parallel = now() - t0;
+    ASSERT(ms.n == counted);
+    tmatchesfree(&ms);
+    t0 = now();
+    tfindall(t, "items/7+ ", TSEARCH_REGEX, &ms);
+    double regex = now() - t0;
+    size_t nregex = ms.n;
+    tmatchesfree(&ms);
+    int workers = t->rpool.pool ? pool_size(t->rpool.pool) : 1;
+
+    printf(
+        "rune scan: %.2f GB/s with vectors, %.2f GB/s without (%zu)\n"
+        "%zu lines: literal %.0fms, case-insensitive %.0fms, regex %.0fms\n"
+        "typing \"%s\": %.1fms incrementally, %.1fms starting over each key\n",
+        4.0 * 100 * (1 << 20) / simd / 1e9,
+        4.0 * 100 * (1 << 20) / plain / 1e9, hits & 1,
+        n, times[0] * 1e3, times[1] * 1e3, times[2] * 1e3,
+        target, typing * 1e3, restarting * 1e3
+    );
+    printf(
+        "finding all %zu \"%s\": %.0fms on one thread, %.0fms on a pool of %d; "
+        "%zu regex matches in %.0fms\n",
+        counted, common, serial * 1e3, parallel * 1e3, workers,
+        nregex, regex * 1e3
+    );
+    tfree(t);
+    return 0;
+}
+
+int main(int argc, char **argv){
+    if(argc > 1 && strcmp(argv[1], "bench") == 0){
+        if(argc > 2) return bench(strtoull(argv[2], NULL, 10));
+        return bench(100000) || bench(1000000);
+    }
+
+    // for wide characters
+    setlocale(LC_CTYPE, "C.UTF-8");
+
+    int ret = 0;
+    ret |= test_scan();
+    ret |= test_find();
+    ret |= test_incremental();
+    ret |= test_moving();
+    ret |= test_findall();
+    ret |= test_update();
+    printf("%s\n", ret ? "FAIL" : "PASS");
+    return ret;
+}
@@ -0,0 +1,268 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "nast.c"
+#include "test_term.h"
+
+// (made by main())
+static char path[64];
+
+static int save(Term *t, const char *p){
+    int fd = open(p, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    ASSERT(fd >= 0);
+    ASSERT(tsnapshot(t, fd) == 0);
+    close(fd);
+    return 0;
+}
+
+static int cursor_eq(TCursor *a, TCursor *b){
+    ASSERT(a->x == b->x && a->y == b->y && a->state == b->state);
+    ASSERT(a->attr.u == b->attr.u && snap_style_eq(a->attr, b->attr));
+    return 0;
+}
+
+static int screen_eq(Screen *a, Screen *b){
+    ASSERT(a->len == b->len);
+    ASSERT(a->cap == b->cap);
+    ASSERT(a->line_id == b->line_id);
+    ASSERT(a->new_line_id_on_write == b->new_line_id_on_write);
+    ASSERT(a->window_off == b->window_off);
+    for(size_t i = 0; i < a->len; i++){
+        RLine *x = get_rline(a, i);
+        RLine *y = get_rline(b, i);
+        ASSERT(x->n_glyphs == y->n_glyphs);
+        ASSERT(x->line_id == y->line_id);
+        ASSERT(x->maxwritten == y->maxwritten);
+        for(size_t j = 0; j < x->n_glyphs; j++){
+            ASSERT(x->glyphs[j].u == y->glyphs[j].u);
+            ASSERT(snap_style_eq(x->glyphs[j], y->glyphs[j]));
+        }
+    }
+    return 0;
+}
+
+// everything a snapshot is meant to carry
+static int term_eq(Term *a, Term *b){
+    ASSERT(a->row == b->row && a->col == b->col);
+    ASSERT(a->mode == b->mode);
+    ASSERT(a->appkeypad == b->appkeypad && a->appcursor == b->appcursor);
+    ASSERT(a->modify_other == b->modify_other);
+    ASSERT(a->mouse == b->mouse && a->want_focus == b->want_focus);
+    ASSERT(a->cursor_style == b->cursor_style);
+    ASSERT(a->top == b->top && a->bot == b->bot);
+    ASSERT(a->charset == b->charset && a->icharset == b->icharset);
+    ASSERT(memcmp(a->trantbl, b->trantbl, sizeof(a->trantbl)) == 0);
+    for(int x = 0; x < a->col; x++) ASSERT(!a->tabs[x] == !b->tabs[x]);
+    ASSERT((a->scr == &a->alt) == (b->scr == &b->alt));
+    ASSERT(cursor_eq(&a->c, &b->c) == 0);
+    ASSERT(cursor_eq(&a->saved[0], &b->saved[0]) == 0);
+    ASSERT(cursor_eq(&a->saved[1], &b->saved[1]) == 0);
+    ASSERT(screen_eq(&a->main, &b->main) == 0);
+    ASSERT(screen_eq(&a->alt, &b->alt) == 0);
+    return 0;
+}
+
+int test_roundtrip(void){
+    Term *a = term(40, 8);
+    // scrollback, with colors, wide characters, and long wrapped lines
+    for(int i = 0; i < 100; i++){
+        char buf[128];
+        snprintf(
+            buf, sizeof(buf),
+            "\x1b[3%dm%d \x1b[1;48;2;%d;2;3mbold\x1b[m \xe4\xb8\xad %s\r\n",
+            i % 8, i, i, i % 10 ? "" : "a line which wraps around the edge"
+        );
+        feed(a, buf);
+    }
+    // a saved cursor, tabs, line drawing, and modes
+    feed(a, "\x1b[3;5H\x1b" "7\x1b[1;1H");
+    feed(a, "\x1b[3g\x1b[1;4H\x1bH\x1b[1;11H\x1bH");
+    feed(a, "\x1b(0lqk\x1b(B\x1b[?1h\x1b=\x1b[?2004h\x1b[?1000h\x1b[5 q");
+    feed(a, "\x1b[2;6r");
+    // the alt screen, with its own saved cursor
+    feed(a, "\x1b[?1049h\x1b[2;2Halt \x1b[7mscreen\x1b[m\x1b[4;4H\x1b" "7\x1b[6;1H");
+
+    ASSERT(save(a, path) == 0);
+    Term *b = term(10, 3);
+    ASSERT(trestore(b, path) == 0);
+    ASSERT(term_eq(a, b) == 0);
+
+    // and they carry on alike
+    const char *more = "\tx\x1b" "8y\x1b[?1049l\x1b" "8z\x1b[rmore\r\nlines\r\n";
+    feed(a, more);
+    feed(b, more);
+    ASSERT(term_eq(a, b) == 0);
+
+    // a restored Term's lines are written out again without unpacking
+    Term *c = term(10, 3);
+    ASSERT(trestore(c, path) == 0);
+    char path2[64];
+    ASSERT(test_tmpfile(path2, "test_snapshot2") == 0);
+    ASSERT(save(c, path2) == 0);
+    // (nor does dropping what's rendered, as a zoom does)
+    tunrender(c);
+    size_t packed = 0;
+    for(size_t i = 0; i < c->main.len; i++){
+        packed += c->main.rlines[rlines_idx(&c->main, i)]->packed != NULL;
+    }
+    ASSERT(packed == c->main.len);
+    FILE *f1 = fopen(path, "r"), *f2 = fopen(path2, "r");
+    ASSERT(f1 && f2);
+    int c1, c2;
+    do {
+        c1 = fgetc(f1);
+        c2 = fgetc(f2);
+        ASSERT(c1 == c2);
+    } while(c1 != EOF);
+    fclose(f1);
+    fclose(f2);
+
+    // resizing reflows restored lines like any others
+    tresize(c, 25, 6);
+    tresize(a, 10, 3);
+    tresize(a, 25, 6);
+    tresize(b, 10, 3);
+    tresize(b, 25, 6);
+    ASSERT(screen_eq(&a->main, &b->main) == 0);
+
+    tfree(a);
+    tfree(b);
+    tfree(c);
+    unlink(path2);
+    return 0;
+}
+
+// a bad snapshot is refused, and the Term is left as it was
+int test_corrupt(void){
+    Term *a = term(20, 4);
+    feed(a, "hello\r\nworld");
+    ASSERT(save(a, path) == 0);
+
+    FILE *f = fopen(path, "r");
+    ASSERT(f);
+    char buf[4096];
+    size_t len = fread(buf, 1, sizeof(buf), f);
+    fclose(f);
+
+    Term *b = term(30, 5);
+    feed(b, "untouched");
+    char bad[64];
+    ASSERT(test_tmpfile(bad, "test_snapshot_bad") == 0);
+    for(size_t cut = 0; cut < len; cut++){
+        f = fopen(bad, "w");
+        fwrite(buf, 1, cut, f);
+        fclose(f);
+        errno = 0;
+        ASSERT(trestore(b, bad) == -1 && errno == EINVAL);
+    }
+    // an unknown version
+    buf[strlen(SNAP_MAGIC)] = SNAP_VERSION + 1;
+    f = fopen(bad, "w");
+    fwrite(buf, 1, len, f);
+    fclose(f);
+    ASSERT(trestore(b, bad) == -1 && errno == EINVAL);
+
+    // room for far more lines than are there, which would be a huge malloc
+    size_t cap = (size_t)1 << 24;
+    a->main.rlines = xrealloc(a->main.rlines, (cap + 1) * sizeof(RLine*));
+    memset(
+        a->main.rlines + a->main.cap + 1, 0,
+        (cap - a->main.cap) * sizeof(RLine*)
+    );
+    a->main.cap = cap;
+    ASSERT(save(a, bad) == 0);
+    ASSERT(trestore(b, bad) == -1 && errno == EINVAL);
+
+    ASSERT(tcols(b) == 30 && trows(b) == 5);
+    size_t n;
+    const Glyph *g = tline(b, 0, &n);
+    ASSERT(g[0].u == 'u' && g[8].u == 'd');
+    ASSERT(trestore(b, "/nonexistent/snapshot") == -1 && errno == ENOENT);
+
+    tfree(a);
+    tfree(b);
+    unlink(bad);
+    return 0;
+}
+
+//// bench: a huge scrollback
+
+static double now(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int bench(size_t lines){
+    Term *t = term(80, 24);
+    // more scrollback than a Term normally keeps; nothing has wrapped yet
+    t->main.rlines = xrealloc(t->main.rlines, (lines + 1) * sizeof(RLine*));
+    memset(
+        t->main.rlines + t->main.cap + 1, 0,
+        (lines - t->main.cap) * sizeof(RLine*)
+    );
+    t->main.cap = lines;
+
+    double t0 = now();
+    char buf[65536];
+    size_t len = 0;
+    for(size_t i = 0; i < lines; i++){
+        len += snprintf(
+            buf + len, sizeof(buf) - len,
+            "%zu \x1b[32mok\x1b[m GET /api/v1/items/%zu 200 %zums\r\n",
+            i, i * 7919 % 100000, i % 300
+        );
+        if(len > sizeof(buf) - 128){
+            ttyfeed(t, buf, len);
+            len = 0;
+        }
+    }
+    ttyfeed(t, buf, len);
+    double t1 = now();
+
+    ASSERT(save(t, path) == 0);
+    double t2 = now();
+    struct stat st;
+    stat(path, &st);
+
+    Term *r = term(80, 24);
+    ASSERT(trestore(r, path) == 0);
+    double t3 = now();
+    // what a renderer would touch first
+    for(int y = 0; y < 24; y++){
+        size_t n;
+        twindowline(r, y, &n);
+    }
+    double t4 = now();
+    for(size_t i = 0; i < r->main.len; i++) get_rline(&r->main, i);
+    double t5 = now();
+
+    printf(
+        "%zu lines: fed in %.2fs, snapshot %.2fs (%.1f MB, %.1f bytes/line)\n"
+        "restore %.3fs, first window %.3fms, unpacking everything %.2fs\n",
+        r->main.len, t1 - t0, t2 - t1, st.st_size / 1e6,
+        (double)st.st_size / r->main.len, t3 - t2, (t4 - t3) * 1e3, t5 - t4
+    );
+    tfree(t);
+    tfree(r);
+    unlink(path);
+    return 0;
+}
+
+int main(int argc, char **argv){
+    if(test_tmpfile(path, "test_snapshot")){
+        perror("mkstemp");
+        return 1;
+    }
+    if(argc > 1 && strcmp(argv[1], "bench") == 0){
+        return bench(argc > 2 ? strtoull(argv[2], NULL, 10) : 1000000);
+    }
+
+    int ret = 0;
+    ret |= test_roundtrip();
+    ret |= test_corrupt();
+    unlink(path);
+    printf("%s\n", ret ? "FAIL" : "PASS");
+    return ret;
+}
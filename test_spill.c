@@ -0,0 +1,289 @@
+#include <dirent.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "nast.c"
+#include "test_term.h"
+
+// what was last copied
+static char *clip;
+static size_t clip_len;
+
+static void keep_clip(char *buf, size_t len, int clipboard){
+    (void)clipboard;
+    free(clip);
+    clip = buf;
+    clip_len = len;
+}
+
+// "line <i>" for lines [0, n)
+static void feed_lines(Term *t, size_t first, size_t n){
+    char buf[65536];
+    size_t len = 0;
+    for(size_t i = first; i < first + n; i++){
+        len += snprintf(buf + len, sizeof(buf) - len, "line %zu\r\n", i);
+        if(len > sizeof(buf) - 64){
+            ttyfeed(t, buf, len);
+            len = 0;
+        }
+    }
+    ttyfeed(t, buf, len);
+}
+
+// does a line read as expected, padded out with spaces?
+static int text_is(const Glyph *g, size_t n, const char *want){
+    size_t len = strlen(want);
+    for(size_t x = 0; x < n; x++){
+        ASSERT(g[x].u == (x < len ? (Rune)want[x] : ' '));
+    }
+    return 0;
+}
+
+static int line_is(Term *t, size_t y_abs, const char *want){
+    RLine *rline = get_rline(&t->main, y_abs);
+    return text_is(rline->glyphs, rline->n_glyphs, want);
+}
+
+static int lines_are(Term *t, size_t n){
+    char want[64];
+    for(size_t i = 0; i < n; i++){
+        snprintf(want, sizeof(want), "line %zu", i);
+        if(line_is(t, i, want)) return 1;
+    }
+    return 0;
+}
+
+static size_t count_fds(void){
+    DIR *d = opendir("/proc/self/fd");
+    if(!d) return 0;
+    size_t n = 0;
+    while(readdir(d)) n++;
+    closedir(d);
+    return n;
+}
+
+#define NLINES 30000
+
+int test_spill(void){
+    size_t fds = count_fds();
+    Term *t = term(20, 5);
+    ASSERT(tspill(t, NULL) == 0);
+    ASSERT(count_fds() == fds + 1);
+    feed_lines(t, 0, NLINES);
+
+    // nothing was dropped, and the ring is full
+    ASSERT(t->main.len == NLINES + 1);
+    ASSERT(tspilled(t) == NLINES + 1 - t->main.cap);
+    ASSERT(lines_are(t, NLINES) == 0);
+    // reading everything again comes back through the cache's evictions
+    ASSERT(lines_are(t, NLINES) == 0);
+
+    // the window scrolls all the way back
+    ASSERT(twindowmv(t, NLINES));
+    ASSERT(t->main.window_off == t->main.len - 5);
+    size_t n;
+    const Glyph *g = twindowline(t, 0, &n);
+    ASSERT(text_is(g, n, "line 0") == 0);
+    g = twindowline(t, 4, &n);
+    ASSERT(text_is(g, n, "line 4") == 0);
+    twindowmv(t, -NLINES);
+
+    // unrendering (as a zoom does) reads no spilled lines back
+    uint64_t clock = t->main.spill->clock;
+    tunrender(t);
+    ASSERT(t->main.spill->clock == clock);
+
+    // a selection across the edge of the ring
+    size_t edge = tspilled(t);
+    tselect(t, 0, edge - 2, 0, edge + 1, 3);
+    texportselection(t, 0);
+    char want[128];
+    snprintf(
+        want, sizeof(want), "line %zu\nline %zu\nline %zu\nline %zu\n",
+        edge - 2, edge - 1, edge, edge + 1
+    );
+    ASSERT(clip_len == strlen(want) && memcmp(clip, want, clip_len) == 0);
+
+    // new output line groups never reach into spilled lines
+    mod_line_group(t, edge - 1, -1);
+    ASSERT(get_rline(&t->main, edge - 1)->line_id != 0);
+
+    tfree(t);
+    ASSERT(count_fds() == fds);
+    return 0;
+}
+
+int test_resize(void){
+    Term *t = term(20, 5);
+    ASSERT(tspill(t, NULL) == 0);
+    feed(t, "a spilled line which wraps\r\n");
+    feed_lines(t, 1, NLINES);
+
+    // spilled lines are cut off to a narrower width, not reflowed
+    tresize(t, 10, 5);
+    ASSERT(line_is(t, 0, "a spilled") == 0);
+    ASSERT(line_is(t, 1, " wraps") == 0);
+    ASSERT(line_is(t, 2, "line 1") == 0);
+    // while the ring's lines still are
+    ASSERT(line_is(t, t->main.len - 2, "line 30000") == 0);
+
+    // and come back padded out to a wider one
+    tresize(t, 30, 5);
+    ASSERT(line_is(t, 0, "a spilled line which") == 0);
+    ASSERT(line_is(t, 1, " wraps") == 0);
+    ASSERT(line_is(t, 2, "line 1") == 0);
+    ASSERT(get_rline(&t->main, 2)->n_glyphs == 30);
+
+    // output after a resize spills at the new width
+    size_t len = t->main.len;
+    feed_lines(t, 0, 1000);
+    ASSERT(t->main.len == len + 1000);
+    tfree(t);
+    return 0;
+}
+
+int test_clear(void){
+    Term *t = term(20, 5);
+    ASSERT(tspill(t, NULL) == 0);
+    feed_lines(t, 0, NLINES);
+    ASSERT(twindowmv(t, NLINES));
+
+    // clearing the scrollback clears the spilled lines too
+    feed(t, "\x1b[3J");
+    ASSERT(tspilled(t) == 0 && t->main.len == 5);
+    ASSERT(t->main.window_off == 0);
+
+    // and it keeps spilling afterwards
+    feed(t, "\x1b[H");
+    feed_lines(t, 0, NLINES);
+    ASSERT(tspilled(t) > 0);
+    ASSERT(lines_are(t, NLINES) == 0);
+
+    // so does a reset
+    feed(t, "\x1b" "c");
+    ASSERT(tspilled(t) == 0 && t->main.len == t->main.cap);
+    // (the first few lines fill the window, which is at the top now)
+    feed_lines(t, 0, NLINES);
+    ASSERT(tspilled(t) == NLINES - 4);
+
+    ASSERT(tspill(t, "/nonexistent") == 0); // already spilling
+    Term *u = term(20, 5);
+    errno = 0;
+    ASSERT(tspill(u, "/nonexistent") == -1 && errno == ENOENT);
+    tfree(u);
+    tfree(t);
+    return 0;
+}
+
+int test_snapshot(void){
+    char path[64];
+    ASSERT(test_tmpfile(path, "test_spill") == 0);
+    Term *t = term(20, 5);
+    ASSERT(tspill(t, NULL) == 0);
+    feed_lines(t, 0, NLINES);
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    ASSERT(fd >= 0);
+    ASSERT(tsnapshot(t, fd) == 0);
+    close(fd);
+
+    // spilled lines are restored along with the ring's
+    Term *r = term(20, 5);
+    ASSERT(tspill(r, NULL) == 0);
+    feed_lines(r, 0, NLINES);
+    ASSERT(trestore(r, path) == 0);
+    ASSERT(tspilled(r) == 0 && r->main.len == t->main.len);
+    ASSERT(lines_are(r, NLINES) == 0);
+    // and it spills again from there
+    feed_lines(r, NLINES, 10);
+    ASSERT(tspilled(r) == 10);
+    ASSERT(lines_are(r, NLINES + 10) == 0);
+
+    tfree(t);
+    tfree(r);
+    unlink(path);
+    return 0;
+}
+
+//// bench: a long-running log
+
+static double now(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double run(Term *t, size_t lines){
+    double t0 = now();
+    char buf[65536];
+    size_t len = 0;
+    for(size_t i = 0; i < lines; i++){
+        len += snprintf(
+            buf + len, sizeof(buf) - len,
+            "%zu \x1b[32mok\x1b[m GET /api/v1/items/%zu 200 %zums\r\n",
+            i, i * 7919 % 100000, i % 300
+        );
+        if(len > sizeof(buf) - 128){
+            ttyfeed(t, buf, len);
+            len = 0;
+        }
+    }
+    ttyfeed(t, buf, len);
+    return now() - t0;
+}
+
+static int bench(size_t lines){
+    Term *plain = term(80, 24);
+    double fed_plain = run(plain, lines);
+    tfree(plain);
+
+    Term *t = term(80, 24);
+    ASSERT(tspill(t, NULL) == 0);
+    double fed = run(t, lines);
+    struct spill *sp = t->main.spill;
+    size_t bytes = 0;
+    for(size_t i = 0; i < sp->nblocks; i++) bytes += sp->blocks[i].len;
+
+    // jump around the scrollback, reading a window each time
+    size_t jumps = 10000;
+    uint64_t seed = 1;
+    double t0 = now();
+    for(size_t i = 0; i < jumps; i++){
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        size_t top = (seed >> 33) % (t->main.len - 24);
+        for(size_t y = 0; y < 24; y++) get_rline(&t->main, top + y);
+    }
+    double jumped = now() - t0;
+
+    // what a zoom pays before redrawing
+    t0 = now();
+    tunrender(t);
+    double unrendered = now() - t0;
+
+    printf(
+        "%zu lines: fed in %.2fs (%.2fs without spilling), %zu spilled\n"
+        "spill file %.1f MB (%.1f bytes/line), random window %.1fus\n"
+        "unrender %.2fms\n",
+        lines, fed, fed_plain, tspilled(t), bytes / 1e6,
+        (double)bytes / sp->flushed, jumped / jumps * 1e6, unrendered * 1e3
+    );
+    tfree(t);
+    return 0;
+}
+
+int main(int argc, char **argv){
+    if(argc > 1 && strcmp(argv[1], "bench") == 0){
+        return bench(argc > 2 ? strtoull(argv[2], NULL, 10) : 1000000);
+    }
+
+    clip_hook = keep_clip;
+    int ret = 0;
+    ret |= test_spill();
+    ret |= test_resize();
+    ret |= test_clear();
+    ret |= test_snapshot();
+    free(clip);
+    printf("%s\n", ret ? "FAIL" : "PASS");
+    return ret;
+}
@@ -0,0 +1,136 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "nast.c"
+#include "test_term.h"
+
+int test_parse(void){
+    Term *t = term(20, 5);
+    const char *s =
+        "ab\x1b[1mc\x1b[0m"
+        "\x1b]0;title\a"
+        "\x1b]777;notify\a"
+        "\x1bP+q544e\x1b\\";
+    feed(t, s);
+    TStats ts = tstats(t);
+    ASSERT(ts.read_calls == 1 && ts.read_bytes == strlen(s));
+    ASSERT(ts.parsed_bytes == strlen(s));
+    ASSERT(ts.printed == 3);
+    ASSERT(ts.csi['m' - 0x40] == 2 && ts.csi['H' - 0x40] == 0);
+    ASSERT(ts.osc[0] == 1 && ts.osc[TSTATS_OSC] == 1);
+    ASSERT(ts.dcs == 1);
+
+    // the escapes which started those were controls, and so are these
+    uint64_t controls = ts.controls;
+    feed(t, "\r\n\a");
+    ts = tstats(t);
+    ASSERT(ts.controls == controls + 3);
+    ASSERT(ts.printed == 3);
+
+    // an incomplete utf8 sequence waits for the rest before it's parsed
+    feed(t, "\xe2\x82");
+    ASSERT(tstats(t).parsed_bytes == strlen(s) + 3);
+    feed(t, "\xac");
+    ts = tstats(t);
+    ASSERT(ts.parsed_bytes == strlen(s) + 6 && ts.printed == 4);
+    tfree(t);
+    return 0;
+}
+
+int test_screen(void){
+    Term *t = term(10, 5);
+    TStats before = tstats(t);
+    for(int i = 0; i < 20; i++) feed(t, "x\r\n");
+    TStats ts = tstats(t);
+    // the first four newlines only moved the cursor
+    ASSERT(ts.lines_scrolled == 16);
+    ASSERT(ts.rlines_new - before.rlines_new == 16);
+    ASSERT(ts.rlines_dropped == 0);
+
+    // a scroll region scrolls in place
+    feed(t, "\x1b[2;4r\x1b[2S\x1b[T\x1b[r");
+    ts = tstats(t);
+    ASSERT(ts.lines_scrolled == 19);
+    ASSERT(ts.rlines_new - before.rlines_new == 16);
+
+    // clearing the history frees it
+    feed(t, "\x1b[3J");
+    ASSERT(tstats(t).rlines_dropped == 16);
+
+    tresize(t, 7, 5);
+    tresize(t, 12, 6);
+    ts = tstats(t);
+    ASSERT(ts.reflows == 2);
+    tfree(t);
+    return 0;
+}
+
+int test_print(void){
+    Term *t = term(20, 5);
+    feed(t, "hi\x1b[1m\x1b[31m\x1b]2;x\a");
+    TStats ts = tstats(t);
+    char *buf;
+    size_t len;
+    FILE *f = open_memstream(&buf, &len);
+    tstatsprint(&ts, f);
+    fclose(f);
+    ASSERT(strstr(buf, "parsed_bytes 17\n"));
+    ASSERT(strstr(buf, "printed 2\n"));
+    ASSERT(strstr(buf, "csi_m 2\n"));
+    ASSERT(strstr(buf, "osc_2 1\n"));
+    ASSERT(strstr(buf, "read_bytes_per_call 17.0\n"));
+    // zeros are left out
+    ASSERT(!strstr(buf, "dcs"));
+    ASSERT(!strstr(buf, "csi_H"));
+    free(buf);
+    tfree(t);
+    return 0;
+}
+
+//// bench: parsing, which is where the counters are hottest
+
+static double now(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int bench(size_t mb){
+    // colored text, a few escapes per line, like ls or a compiler
+    char line[256];
+    int n = snprintf(line, sizeof(line),
+        "\x1b[1;32mok\x1b[0m  src/some/file_%s.c  \x1b[33m%d\x1b[0m warnings"
+        "  and then some plain text to round it out\r\n",
+        "name", 12
+    );
+    size_t total = mb << 20;
+    char *buf = xmalloc(total);
+    for(size_t i = 0; i < total; i++) buf[i] = line[i % (size_t)n];
+
+    Term *t = term(120, 40);
+    double t0 = now();
+    for(size_t off = 0; off < total; off += 65536){
+        ttyfeed(t, buf + off, MIN((size_t)65536, total - off));
+    }
+    double t1 = now();
+    TStats ts = tstats(t);
+    printf("%zuMB in %.3fs, %.1fMB/s\n", mb, t1 - t0, mb / (t1 - t0));
+    tstatsprint(&ts, stdout);
+    tfree(t);
+    free(buf);
+    return 0;
+}
+
+int main(int argc, char **argv){
+    if(argc > 1 && strcmp(argv[1], "bench") == 0){
+        return bench(argc > 2 ? strtoull(argv[2], NULL, 10) : 64);
+    }
+
+    int ret = 0;
+    ret |= test_parse();
+    ret |= test_screen();
+    ret |= test_print();
+    printf("%s\n", ret ? "FAIL" : "PASS");
+    return ret;
+}
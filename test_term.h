@@ -0,0 +1,74 @@
+// The scaffolding shared by the tests (and bench.c) which drive a Term
+// directly: include it after nast.c, or something which includes it.
+//
+// The hooks do nothing, except that set_clipboard hands its buffer to
+// clip_hook when a test sets one (and frees it otherwise).
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define ASSERT(code) do{ \
+    if(!(code)){ \
+        fprintf(stderr, \
+            "failed assertion: %s (%s::%s:%d)\n", \
+            #code, __FILE__, __func__, __LINE__ \
+        ); \
+        return 1; \
+    } \
+} while(0)
+
+static void (*clip_hook)(char *buf, size_t len, int clipboard);
+
+static void ttywrite_hook(THooks *h, const char *buf, size_t len){
+    (void)h; (void)buf; (void)len;
+}
+static void ttyresize_hook(THooks *h, int row, int col){
+    (void)h; (void)row; (void)col;
+}
+static void ttyhangup_hook(THooks *h){ (void)h; }
+static void bell_hook(THooks *h){ (void)h; }
+static void sendbreak_hook(THooks *h){ (void)h; }
+static void set_title_hook(THooks *h, const char *title){
+    (void)h; (void)title;
+}
+static void set_clipboard_hook(THooks *h, char *buf, size_t len, int clip){
+    (void)h;
+    if(clip_hook){
+        clip_hook(buf, len, clip);
+    }else{
+        free(buf);
+    }
+}
+
+static THooks hooks = {
+    .ttywrite = ttywrite_hook,
+    .ttyresize = ttyresize_hook,
+    .ttyhangup = ttyhangup_hook,
+    .bell = bell_hook,
+    .sendbreak = sendbreak_hook,
+    .set_title = set_title_hook,
+    .set_clipboard = set_clipboard_hook,
+};
+
+static inline Term *term(int cols, int rows){
+    Term *t;
+    tnew(&t, cols, rows, NULL, 0, " ", &hooks);
+    return t;
+}
+
+static inline void feed(Term *t, const char *s){
+    ttyfeed(t, s, strlen(s));
+}
+
+/* make an empty file for a test to write, as /tmp/<name>-XXXXXX, so that
+   nothing else can have put a file (or a symlink) there first; returns 0 or
+   -1, and the test unlinks it when it is done */
+static inline int test_tmpfile(char path[64], const char *name){
+    snprintf(path, 64, "/tmp/%s-XXXXXX", name);
+    int fd = mkstemp(path);
+    if(fd < 0) return -1;
+    close(fd);
+    return 0;
+}
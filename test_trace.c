@@ -0,0 +1,190 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "trace.c"
+
+
+#define ASSERT(code) do{ \
+    if(!(code)){ \
+        fprintf(stderr, \
+            "failed assertion: %s (%s::%s:%d)\n", \
+            #code, __FILE__, __func__, __LINE__ \
+        ); \
+        return 1; \
+    } \
+} while(0)
+
+int test_ring(void){
+    trace_t *tr = trace_new(10);
+    ASSERT(tr && tr->mask == 15);
+    size_t n;
+    trace_ev_t *evs = trace_snapshot(tr, &n);
+    ASSERT(evs && n == 0);
+    free(evs);
+
+    for(uint64_t i = 0; i < 40; i++) trace_mark(tr, i % 8, i, 100 + i);
+    evs = trace_snapshot(tr, &n);
+    // only the newest ones are left, oldest first
+    ASSERT(n == 16);
+    for(size_t i = 0; i < n; i++){
+        ASSERT(evs[i].flow == 24 + i && evs[i].us == 124 + (int64_t)i);
+        ASSERT(evs[i].stage == (24 + i) % 8);
+    }
+    free(evs);
+    trace_free(tr);
+    return 0;
+}
+
+// each key, then each stage 100us after the one before it
+static void keypress(trace_t *tr, uint64_t flow, int64_t us){
+    for(int s = 0; s < TRACE_NSTAGES; s++){
+        trace_mark(tr, s, flow, us + 100 * s);
+    }
+}
+
+int test_latency(void){
+    trace_t *tr = trace_new(0);
+    trace_hist_t h[TRACE_NSTAGES];
+    trace_latency(tr, h);
+    for(int s = 0; s < TRACE_NSTAGES; s++) ASSERT(h[s].n == 0);
+
+    for(uint64_t i = 1; i <= 99; i++) keypress(tr, i, i * 100000);
+    // one slow key
+    trace_mark(tr, TRACE_KEY, 100, 100 * 100000);
+    trace_mark(tr, TRACE_KEYEV, 100, 100 * 100000 + 50000);
+
+    trace_latency(tr, h);
+    ASSERT(h[TRACE_KEY].n == 100 && h[TRACE_KEY].max_us == 0);
+    ASSERT(h[TRACE_KEYEV].n == 100);
+    ASSERT(h[TRACE_KEYEV].p50_us == 100 && h[TRACE_KEYEV].p99_us == 100);
+    ASSERT(h[TRACE_KEYEV].max_us == 50000);
+    // (the slow key never got further)
+    ASSERT(h[TRACE_PRESENT].n == 99 && h[TRACE_PRESENT].p99_us == 700);
+    ASSERT(h[TRACE_PRESENT].buckets[9] == 99);
+    ASSERT(h[TRACE_KEYEV].buckets[6] == 99 && h[TRACE_KEYEV].buckets[15] == 1);
+
+    // one write or frame can carry several keys, and marks the newest
+    trace_free(tr);
+    tr = trace_new(0);
+    trace_mark(tr, TRACE_KEY, 1, 1000);
+    trace_mark(tr, TRACE_KEY, 2, 1500);
+    trace_mark(tr, TRACE_KEY, 3, 1700);
+    trace_mark(tr, TRACE_WRITE, 2, 2000);
+    trace_mark(tr, TRACE_WRITE, 3, 2100);
+    trace_mark(tr, TRACE_PRESENT, 3, 9000);
+    trace_latency(tr, h);
+    ASSERT(h[TRACE_WRITE].n == 3);
+    ASSERT(h[TRACE_WRITE].p50_us == 500 && h[TRACE_WRITE].max_us == 1000);
+    ASSERT(h[TRACE_PRESENT].n == 3 && h[TRACE_PRESENT].max_us == 8000);
+    // stages which never ran have nothing
+    ASSERT(h[TRACE_READ].n == 0);
+    trace_free(tr);
+    return 0;
+}
+
+int test_json(void){
+    trace_t *tr = trace_new(0);
+    keypress(tr, 1, 1000);
+    keypress(tr, 2, 5000);
+    trace_mark(tr, TRACE_KEY, 3, 9000);
+    char *buf;
+    size_t len;
+    FILE *f = open_memstream(&buf, &len);
+    ASSERT(trace_json(tr, f) == 0);
+    fclose(f);
+    ASSERT(strncmp(buf, "{\"traceEvents\":[", 16) == 0);
+    ASSERT(strcmp(buf + len - 4, "\n]}\n") == 0);
+    // a span for each key which made it to the screen
+    size_t spans = 0, slices = 0, keys = 0;
+    for(char *p = buf; (p = strstr(p, "\"key to pixels\"")); p++) spans++;
+    for(char *p = buf; (p = strstr(p, "\"ph\":\"B\"")); p++) slices++;
+    for(char *p = buf; (p = strstr(p, "\"name\":\"key\"")); p++) keys++;
+    ASSERT(spans == 4 && slices == 2 && keys == 3);
+    ASSERT(strstr(buf, "\"ph\":\"e\",\"id\":2,\"ts\":5700,"));
+    free(buf);
+    trace_free(tr);
+    return 0;
+}
+
+//// many writers at once, while someone reads
+
+#define WRITERS 4
+#define MARKS 200000
+
+static void *writer(void *arg){
+    trace_t *tr = arg;
+    for(uint64_t i = 0; i < MARKS; i++){
+        // every field says the same thing, so a torn event shows
+        trace_mark(tr, i % TRACE_NSTAGES, i, i * 3);
+    }
+    return NULL;
+}
+
+int test_threads(void){
+    trace_t *tr = trace_new(1024);
+    pthread_t threads[WRITERS];
+    for(int i = 0; i < WRITERS; i++){
+        pthread_create(&threads[i], NULL, writer, tr);
+    }
+    for(int r = 0; r < 200; r++){
+        size_t n;
+        trace_ev_t *evs = trace_snapshot(tr, &n);
+        for(size_t i = 0; i < n; i++){
+            ASSERT(evs[i].us == (int64_t)evs[i].flow * 3);
+            ASSERT(evs[i].stage == evs[i].flow % TRACE_NSTAGES);
+        }
+        free(evs);
+    }
+    for(int i = 0; i < WRITERS; i++) pthread_join(threads[i], NULL);
+    ASSERT(tr->head == WRITERS * MARKS);
+    size_t n;
+    trace_ev_t *evs = trace_snapshot(tr, &n);
+    ASSERT(n == 1024);
+    free(evs);
+    trace_free(tr);
+    return 0;
+}
+
+//// bench: the cost of a mark
+
+static void *bench_writer(void *arg){
+    trace_t *tr = arg;
+    for(uint64_t i = 0; i < 10000000; i++) trace_mark(tr, TRACE_KEY, i, 0);
+    return NULL;
+}
+
+static int bench(int nthreads){
+    trace_t *tr = trace_new(0);
+    int64_t t0 = trace_now();
+    pthread_t threads[64];
+    for(int i = 0; i < nthreads; i++){
+        pthread_create(&threads[i], NULL, bench_writer, tr);
+    }
+    for(int i = 0; i < nthreads; i++) pthread_join(threads[i], NULL);
+    int64_t t1 = trace_now();
+    for(int i = 0; i < 1000000; i++) trace_now();
+    int64_t t2 = trace_now();
+    printf(
+        "%d threads: %.1fns per mark, %.1fns per trace_now()\n",
+        nthreads, (t1 - t0) * 1e3 / (10000000.0 * nthreads),
+        (t2 - t1) * 1e3 / 1000000
+    );
+    trace_free(tr);
+    return 0;
+}
+
+int main(int argc, char **argv){
+    if(argc > 1 && strcmp(argv[1], "bench") == 0){
+        int n = argc > 2 ? atoi(argv[2]) : 1;
+        return bench(n < 1 ? 1 : n > 64 ? 64 : n);
+    }
+
+    int ret = 0;
+    ret |= test_ring();
+    ret |= test_latency();
+    ret |= test_json();
+    ret |= test_threads();
+    printf("%s\n", ret ? "FAIL" : "PASS");
+    return ret;
+}
@@ -1,6 +1,10 @@
 // steal access to static functions
 #include "writable.c"
 
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
 #define ASSERT(expr, ...) \
     do { \
         if(!(expr)){ \
@@ -46,38 +50,38 @@ int test_writable(){
         ASSERT(c == chars[i], "wrong char at index %zu\n", i);
     }
 
-    // test heap overflow
+    // test chain overflow
 
     ASSERT(writable_ring_len(&w) == 0, "wrong ring length after ring test");
     ASSERT(writable_nonempty(&w) == false, "nonempty after ring test");
 
-    writable_add_heap(&w, "a", 1);
-    writable_add_heap(&w, "bb", 2);
-    writable_add_heap(&w, "ccc", 3);
+    writable_add_chain(&w, "a", 1);
+    writable_add_chain(&w, "bb", 2);
+    writable_add_chain(&w, "ccc", 3);
 
-    // make sure we get the first heap string
-    string = writable_get_string(&w, &len);
-    ASSERT(len == 1, "wrong string len after add heap");
-    ASSERT(strncmp("a", string, len) == 0, "wrong string after add heap");
+    ASSERT(w.head == w.tail, "small adds should share a chunk");
+    ASSERT(writable_len(&w) == 6, "wrong length after add chain");
 
-    // now get the second heap string
+    // small adds coalesce into one string
     string = writable_get_string(&w, &len);
-    ASSERT(len == 2, "wrong string len after add heap");
-    ASSERT(strncmp("bb", string, len) == 0, "wrong string after add heap");
+    ASSERT(len == 6, "wrong string len after add chain");
+    ASSERT(strncmp("abbccc", string, len) == 0, "wrong string after add chain");
 
-    // put half of it back
-    writable_return_bytes(&w, 1);
+    // put most of it back
+    writable_return_bytes(&w, 5);
 
-    ASSERT(writable_ring_len(&w) == 0, "wrong ring length after add heap");
-    ASSERT(writable_nonempty(&w) == true, "empty after add heap");
+    ASSERT(writable_ring_len(&w) == 0, "wrong ring length after add chain");
+    ASSERT(writable_nonempty(&w) == true, "empty after add chain");
+    ASSERT(writable_len(&w) == 5, "wrong length after return bytes");
 
-    for(size_t i = 2; i < sizeof(chars) / sizeof(*chars); i++){
+    for(size_t i = 1; i < sizeof(chars) / sizeof(*chars); i++){
         char c = writable_get_char(&w);
         ASSERT(c == chars[i], "wrong char at index %zu\n", i);
     }
 
-    ASSERT(writable_ring_len(&w) == 0, "wrong ring length after heap test");
-    ASSERT(writable_nonempty(&w) == false, "nonempty after heap test");
+    ASSERT(writable_ring_len(&w) == 0, "wrong ring length after chain test");
+    ASSERT(writable_nonempty(&w) == false, "nonempty after chain test");
+    ASSERT(w.npool == 1, "drained chunk was not pooled");
 
     // test again with the full writable_add_bytes() api
 
@@ -115,13 +119,225 @@ int test_writable(){
     ASSERT(writable_ring_len(&w) == 0, "wrong ring length after full test");
     ASSERT(writable_nonempty(&w) == false, "nonempty after full test");
 
+    writable_free(&w);
+
+    return 0;
+}
+
+// read everything available from a nonblocking fd
+static size_t drain(int fd, char *buf, size_t cap){
+    size_t len = 0;
+    ssize_t ret;
+    while(len < cap && (ret = read(fd, buf + len, cap - len)) > 0){
+        len += (size_t)ret;
+    }
+    return len;
+}
+
+int test_writev(){
+    struct writable w = {0};
+
+    int fds[2];
+    ASSERT(pipe(fds) == 0, "pipe failed\n");
+    ASSERT(fcntl(fds[0], F_SETFL, O_NONBLOCK) == 0, "fcntl failed\n");
+    ASSERT(fcntl(fds[1], F_SETFL, O_NONBLOCK) == 0, "fcntl failed\n");
+
+    // more than the ring, spanning a few chunks
+    size_t total = 16383 + 3 * WRITABLE_CHUNK + 100;
+    char *in = malloc(total);
+    char *out = malloc(total);
+    ASSERT(in && out, "malloc failed\n");
+    for(size_t i = 0; i < total; i++) in[i] = (char)(i * 7 + i / 251);
+
+    // add in uneven pieces
+    for(size_t i = 0; i < total; i += 1000){
+        size_t n = total - i < 1000 ? total - i : 1000;
+        writable_add_bytes(&w, &in[i], n);
+    }
+    ASSERT(writable_len(&w) == total, "wrong length after adds\n");
+    ASSERT(w.stats.chunk_allocs == 4, "wrong chunk allocs\n");
+    ASSERT(w.stats.max_len == total, "wrong max_len\n");
+
+    size_t got = 0;
+    while(writable_nonempty(&w)){
+        ssize_t ret = writable_writev(&w, fds[1]);
+        ASSERT(ret >= 0 || errno == EAGAIN, "writev failed\n");
+        got += drain(fds[0], &out[got], total - got);
+    }
+    got += drain(fds[0], &out[got], total - got);
+    ASSERT(got == total, "wrong byte count through pipe: %zu\n", got);
+    ASSERT(memcmp(in, out, total) == 0, "wrong bytes through pipe\n");
+    ASSERT(w.stats.bytes_written == total, "wrong bytes_written\n");
+    ASSERT(w.npool == 4, "chunks were not pooled\n");
+
+    // the second time around, the chunks come from the pool
+    writable_add_bytes(&w, in, total);
+    ASSERT(w.stats.chunk_allocs == 4, "pooled chunks were not reused\n");
+
+    writable_free(&w);
+    close(fds[0]);
+    close(fds[1]);
+    free(in);
+    free(out);
     return 0;
 }
 
+int test_crlf(){
+    struct writable w = {0};
+
+    // crosses from the ring into the chain, with \r's at the edges
+    size_t n = 3 * WRITABLE_CHUNK;
+    char *in = malloc(n);
+    char *want = malloc(2 * n);
+    char *got = malloc(2 * n);
+    ASSERT(in && want && got, "malloc failed\n");
+    size_t wantlen = 0;
+    for(size_t i = 0; i < n; i++){
+        in[i] = (i == 0 || i == n - 1 || i % 97 == 3) ? '\r' : 'a' + i % 26;
+        want[wantlen++] = in[i];
+        if(in[i] == '\r') want[wantlen++] = '\n';
+    }
+
+    writable_add_crlf(&w, "", 0);
+    ASSERT(!writable_nonempty(&w), "nonempty after empty add\n");
+
+    writable_add_crlf(&w, in, n);
+    ASSERT(writable_len(&w) == wantlen, "wrong length after crlf add\n");
+    size_t len = 0;
+    const char *string;
+    size_t slen;
+    while((string = writable_get_string(&w, &slen))){
+        memcpy(&got[len], string, slen);
+        len += slen;
+    }
+    ASSERT(len == wantlen, "wrong crlf output length\n");
+    ASSERT(memcmp(got, want, len) == 0, "wrong crlf output\n");
 
-int main(void){
+    writable_free(&w);
+    free(in);
+    free(want);
+    free(got);
+    return 0;
+}
+
+int test_drop(){
+    struct writable w = {0};
+
+    // fill the ring and start a chain, then throw it all away
+    char *buf = malloc(2 * sizeof(w.ring));
+    ASSERT(buf, "malloc failed\n");
+    memset(buf, 'x', 2 * sizeof(w.ring));
+    writable_add_bytes(&w, buf, 2 * sizeof(w.ring));
+    ASSERT(w.head, "no chain\n");
+    writable_drop(&w);
+    ASSERT(!writable_nonempty(&w), "nonempty after drop\n");
+    ASSERT(writable_len(&w) == 0, "nonzero length after drop\n");
+    ASSERT(w.npool > 0, "chunks not pooled after drop\n");
+
+    // and it is still good to use
+    writable_add_bytes(&w, "abc", 3);
+    size_t slen;
+    const char *string = writable_get_string(&w, &slen);
+    ASSERT(string && slen == 3 && !memcmp(string, "abc", 3), "bad reuse\n");
+
+    writable_free(&w);
+    free(buf);
+    return 0;
+}
+
+static double now(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* throughput benchmark: queue a large paste in terminal-sized pieces, then
+   flush it to /dev/null both ways */
+int bench(void){
+    int fd = open("/dev/null", O_WRONLY);
+    ASSERT(fd >= 0, "open(/dev/null) failed\n");
+
+    size_t total = (size_t)256 << 20;
+    size_t piece = 4096;
+    char buf[4096];
+    memset(buf, 'x', sizeof(buf));
+
+    struct writable w = {0};
+    size_t syscalls = 0;
+    double t0 = now();
+    for(size_t i = 0; i < total; i += piece){
+        writable_add_bytes(&w, buf, piece);
+        // flush in bursts, like a tty which drains periodically
+        if(writable_len(&w) < (size_t)1 << 20) continue;
+        const char *s;
+        size_t n;
+        while((s = writable_get_string(&w, &n))){
+            ASSERT(write(fd, s, n) == (ssize_t)n, "write failed\n");
+            syscalls++;
+        }
+    }
+    double t1 = now();
+    printf(
+        "get_string+write: %7.1f MB/s, %zu syscalls, %llu allocs\n",
+        total / (t1 - t0) / 1e6,
+        syscalls,
+        (unsigned long long)w.stats.chunk_allocs
+    );
+    writable_free(&w);
+
+    w = (struct writable){0};
+    t0 = now();
+    for(size_t i = 0; i < total; i += piece){
+        writable_add_bytes(&w, buf, piece);
+        if(writable_len(&w) < (size_t)1 << 20) continue;
+        while(writable_nonempty(&w)){
+            ASSERT(writable_writev(&w, fd) > 0, "writev failed\n");
+        }
+    }
+    t1 = now();
+    printf(
+        "writev:           %7.1f MB/s, %llu syscalls, %llu allocs, "
+        "%.1f segments/syscall\n",
+        total / (t1 - t0) / 1e6,
+        (unsigned long long)w.stats.writes,
+        (unsigned long long)w.stats.chunk_allocs,
+        (double)w.stats.segments / w.stats.writes
+    );
+    writable_free(&w);
+
+    // crlf translation, with a \r at the end of every 80 byte "line"
+    for(size_t i = 79; i < sizeof(buf); i += 80) buf[i] = '\r';
+    w = (struct writable){0};
+    t0 = now();
+    for(size_t i = 0; i < total; i += piece){
+        writable_add_crlf(&w, buf, piece);
+        if(writable_len(&w) < (size_t)1 << 20) continue;
+        while(writable_nonempty(&w)){
+            ASSERT(writable_writev(&w, fd) > 0, "writev failed\n");
+        }
+    }
+    t1 = now();
+    printf(
+        "crlf+writev:      %7.1f MB/s\n",
+        total / (t1 - t0) / 1e6
+    );
+    writable_free(&w);
+
+    close(fd);
+    return 0;
+}
+
+
+int main(int argc, char **argv){
+    if(argc > 1 && strcmp(argv[1], "bench") == 0){
+        PROP( bench() );
+        return 0;
+    }
 
     PROP( test_writable() );
+    PROP( test_writev() );
+    PROP( test_crlf() );
+    PROP( test_drop() );
 
     printf("PASS\n");
     return 0;
@@ -0,0 +1,248 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+#define TRACE_DEFAULT 16384
+
+typedef struct {
+    uint64_t seq; // i + 1 once event i is complete, 0 while it is written
+    int64_t us;
+    uint64_t flow;
+    uint32_t stage;
+    uint32_t tid;
+} trace_ev_t;
+
+struct trace {
+    trace_ev_t *evs;
+    size_t mask;
+    uint64_t head; // events ever marked, claimed atomically
+};
+
+static const char *stage_names[TRACE_NSTAGES] = {
+    [TRACE_KEY] = "key",
+    [TRACE_KEYEV] = "keyev",
+    [TRACE_WRITE] = "write",
+    [TRACE_READ] = "read",
+    [TRACE_PARSED] = "parsed",
+    [TRACE_RENDER] = "render",
+    [TRACE_RENDERED] = "rendered",
+    [TRACE_PRESENT] = "present",
+};
+
+const char *trace_stage_name(trace_stage_e stage){
+    return stage < TRACE_NSTAGES ? stage_names[stage] : "?";
+}
+
+trace_t *trace_new(size_t n){
+    if(!n) n = TRACE_DEFAULT;
+    size_t cap = 1;
+    while(cap < n) cap *= 2;
+    trace_t *tr = malloc(sizeof(*tr));
+    if(!tr) return NULL;
+    tr->evs = calloc(cap, sizeof(*tr->evs));
+    if(!tr->evs){
+        free(tr);
+        return NULL;
+    }
+    tr->mask = cap - 1;
+    tr->head = 0;
+    return tr;
+}
+
+void trace_free(trace_t *tr){
+    if(!tr) return;
+    free(tr->evs);
+    free(tr);
+}
+
+int64_t trace_now(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static uint32_t trace_tid(void){
+    static __thread uint32_t tid;
+    if(!tid) tid = (uint32_t)syscall(SYS_gettid);
+    return tid;
+}
+
+void trace_mark(trace_t *tr, trace_stage_e stage, uint64_t flow, int64_t us){
+    uint64_t i = __atomic_fetch_add(&tr->head, 1, __ATOMIC_RELAXED);
+    trace_ev_t *ev = &tr->evs[i & tr->mask];
+    /* a seqlock per slot: readers skip it until seq says it is whole (the
+       fields are atomic too, only so that racing on them is defined) */
+    __atomic_store_n(&ev->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&ev->us, us, __ATOMIC_RELAXED);
+    __atomic_store_n(&ev->flow, flow, __ATOMIC_RELAXED);
+    __atomic_store_n(&ev->stage, (uint32_t)stage, __ATOMIC_RELAXED);
+    __atomic_store_n(&ev->tid, trace_tid(), __ATOMIC_RELAXED);
+    __atomic_store_n(&ev->seq, i + 1, __ATOMIC_RELEASE);
+}
+
+// copy out every whole event in the ring, oldest first
+static trace_ev_t *trace_snapshot(trace_t *tr, size_t *n){
+    uint64_t head = __atomic_load_n(&tr->head, __ATOMIC_ACQUIRE);
+    uint64_t cap = tr->mask + 1;
+    uint64_t start = head > cap ? head - cap : 0;
+    trace_ev_t *out = malloc((head - start + 1) * sizeof(*out));
+    if(!out) return NULL;
+    *n = 0;
+    for(uint64_t i = start; i < head; i++){
+        trace_ev_t *ev = &tr->evs[i & tr->mask];
+        uint64_t seq = __atomic_load_n(&ev->seq, __ATOMIC_ACQUIRE);
+        if(seq != i + 1) continue;
+        trace_ev_t copy = {
+            .seq = seq,
+            .us = __atomic_load_n(&ev->us, __ATOMIC_RELAXED),
+            .flow = __atomic_load_n(&ev->flow, __ATOMIC_RELAXED),
+            .stage = __atomic_load_n(&ev->stage, __ATOMIC_RELAXED),
+            .tid = __atomic_load_n(&ev->tid, __ATOMIC_RELAXED),
+        };
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if(__atomic_load_n(&ev->seq, __ATOMIC_RELAXED) != seq) continue;
+        out[(*n)++] = copy;
+    }
+    return out;
+}
+
+static int cmp_flow(const void *a, const void *b){
+    const trace_ev_t *x = a, *y = b;
+    if(x->stage != y->stage) return x->stage < y->stage ? -1 : 1;
+    if(x->flow != y->flow) return x->flow < y->flow ? -1 : 1;
+    if(x->us != y->us) return x->us < y->us ? -1 : 1;
+    return 0;
+}
+
+static int cmp_i64(const void *a, const void *b){
+    int64_t x = *(const int64_t*)a, y = *(const int64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+/* For each TRACE_KEY in evs (sorted by cmp_flow), when each stage reached
+   it: a stage marks the newest flow it got to, which covers every older
+   flow it hadn't marked yet.  lat[s * nkeys + k] is -1 if stage s never
+   got to key k. */
+static int64_t *trace_join(trace_ev_t *evs, size_t n, size_t *nkeys){
+    size_t first[TRACE_NSTAGES + 1] = {0};
+    for(size_t i = 0, s = 0; s <= TRACE_NSTAGES; s++){
+        while(i < n && evs[i].stage < s) i++;
+        first[s] = i;
+    }
+    *nkeys = first[TRACE_KEY + 1] - first[TRACE_KEY];
+    int64_t *lat = malloc((*nkeys * TRACE_NSTAGES + 1) * sizeof(*lat));
+    if(!lat) return NULL;
+    for(int s = 0; s < TRACE_NSTAGES; s++){
+        // walk the keys and this stage's events together, both by flow
+        size_t j = first[s];
+        for(size_t k = 0; k < *nkeys; k++){
+            trace_ev_t *key = &evs[first[TRACE_KEY] + k];
+            while(j < first[s + 1] && evs[j].flow < key->flow) j++;
+            // (never count a stage as answering a key it came before)
+            while(j < first[s + 1] && evs[j].us < key->us) j++;
+            if(j == first[s + 1]){
+                lat[s * *nkeys + k] = -1;
+                continue;
+            }
+            lat[s * *nkeys + k] = evs[j].us - key->us;
+        }
+    }
+    return lat;
+}
+
+void trace_latency(trace_t *tr, trace_hist_t hists[TRACE_NSTAGES]){
+    memset(hists, 0, TRACE_NSTAGES * sizeof(*hists));
+    size_t n, nkeys;
+    trace_ev_t *evs = trace_snapshot(tr, &n);
+    if(!evs) return;
+    qsort(evs, n, sizeof(*evs), cmp_flow);
+    int64_t *lat = trace_join(evs, n, &nkeys);
+    free(evs);
+    if(!lat) return;
+
+    int64_t *v = malloc((nkeys + 1) * sizeof(*v));
+    for(int s = 0; v && s < TRACE_NSTAGES; s++){
+        trace_hist_t *h = &hists[s];
+        for(size_t k = 0; k < nkeys; k++){
+            int64_t us = lat[s * nkeys + k];
+            if(us < 0) continue;
+            v[h->n++] = us;
+            int b = us > 0 ? 63 - __builtin_clzll((uint64_t)us) : 0;
+            if(b >= TRACE_BUCKETS) b = TRACE_BUCKETS - 1;
+            h->buckets[b]++;
+        }
+        if(!h->n) continue;
+        qsort(v, h->n, sizeof(*v), cmp_i64);
+        h->p50_us = v[(h->n - 1) * 50 / 100];
+        h->p99_us = v[(h->n - 1) * 99 / 100];
+        h->max_us = v[h->n - 1];
+    }
+    free(v);
+    free(lat);
+}
+
+static int cmp_time(const void *a, const void *b){
+    const trace_ev_t *x = a, *y = b;
+    return x->us < y->us ? -1 : x->us > y->us;
+}
+
+int trace_json(trace_t *tr, FILE *f){
+    size_t n, nkeys;
+    trace_ev_t *evs = trace_snapshot(tr, &n);
+    if(!evs) return -1;
+    int pid = getpid();
+    fprintf(f, "{\"traceEvents\":[\n");
+    const char *sep = "";
+
+    // each keypress, as one span from the key to the pixels
+    qsort(evs, n, sizeof(*evs), cmp_flow);
+    int64_t *lat = trace_join(evs, n, &nkeys);
+    for(size_t k = 0; lat && k < nkeys; k++){
+        trace_ev_t *key = &evs[k];
+        int64_t end = lat[TRACE_PRESENT * nkeys + k];
+        if(end < 0) continue;
+        fprintf(f,
+            "%s{\"name\":\"key to pixels\",\"cat\":\"latency\",\"ph\":\"b\","
+            "\"id\":%llu,\"ts\":%lld,\"pid\":%d,\"tid\":%u}",
+            sep, (unsigned long long)key->flow, (long long)key->us, pid,
+            key->tid
+        );
+        sep = ",\n";
+        fprintf(f,
+            "%s{\"name\":\"key to pixels\",\"cat\":\"latency\",\"ph\":\"e\","
+            "\"id\":%llu,\"ts\":%lld,\"pid\":%d,\"tid\":%u}",
+            sep, (unsigned long long)key->flow, (long long)(key->us + end),
+            pid, key->tid
+        );
+    }
+    free(lat);
+
+    // and every event where it happened, with drawing as a slice
+    qsort(evs, n, sizeof(*evs), cmp_time);
+    for(size_t i = 0; i < n; i++){
+        trace_ev_t *ev = &evs[i];
+        const char *ph = "\"i\",\"s\":\"t\"";
+        if(ev->stage == TRACE_RENDER) ph = "\"B\"";
+        if(ev->stage == TRACE_RENDERED) ph = "\"E\"";
+        fprintf(f,
+            "%s{\"name\":\"%s\",\"cat\":\"input\",\"ph\":%s,\"ts\":%lld,"
+            "\"pid\":%d,\"tid\":%u,\"args\":{\"flow\":%llu}}",
+            sep, ev->stage == TRACE_RENDERED ? "render" :
+                trace_stage_name(ev->stage),
+            ph, (long long)ev->us, pid, ev->tid,
+            (unsigned long long)ev->flow
+        );
+        sep = ",\n";
+    }
+    fprintf(f, "\n]}\n");
+    free(evs);
+    return ferror(f) ? -1 : 0;
+}
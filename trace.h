@@ -0,0 +1,65 @@
+// A lock-free ring of timestamped events, for tracing input latency.
+//
+// trace_t *tr = trace_new(0);
+// uint64_t flow = ...;  // which keypress an event belongs to
+// trace_mark(tr, TRACE_KEY, flow, trace_now());
+// ...
+// trace_json(tr, f);  // chrome://tracing, or ui.perfetto.dev
+// trace_free(tr);
+//
+// Any thread may mark events; marking is a clock read, an atomic increment
+// and a few stores, and never waits.  Once the ring is full the oldest events
+// are overwritten.  Readers copy the ring out and skip any slot which was
+// being written while they looked.
+//
+// Each keypress is a flow, numbered from 1, and each stage on its way to the
+// screen marks the flow it got to.  trace_latency() joins the stages of each
+// flow still in the ring back to its TRACE_KEY, for percentiles.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// in the order a keypress reaches them
+typedef enum {
+    TRACE_KEY = 0, // the key event arrived (its own timestamp)
+    TRACE_KEYEV, // tkeyev() turned it into bytes for the tty
+    TRACE_WRITE, // the bytes were written to the tty
+    TRACE_READ, // the tty had output after that; reading starts
+    TRACE_PARSED, // and it was parsed into the Term
+    TRACE_RENDER, // drawing started on a frame with that output
+    TRACE_RENDERED, // and finished
+    TRACE_PRESENT, // the frame was painted
+    TRACE_NSTAGES,
+} trace_stage_e;
+
+const char *trace_stage_name(trace_stage_e stage);
+
+typedef struct trace trace_t;
+
+// n events (rounded up to a power of two), or a default for 0
+trace_t *trace_new(size_t n);
+void trace_free(trace_t *tr);
+
+// monotonic microseconds, the clock all events use
+int64_t trace_now(void);
+
+void trace_mark(trace_t *tr, trace_stage_e stage, uint64_t flow, int64_t us);
+
+// write every event in the ring as chrome trace json; returns 0 or -1
+int trace_json(trace_t *tr, FILE *f);
+
+#define TRACE_BUCKETS 32
+
+// latencies from TRACE_KEY to one stage, over the flows in the ring
+typedef struct {
+    size_t n;
+    int64_t p50_us;
+    int64_t p99_us;
+    int64_t max_us;
+    // bucket i counts latencies in [2^i, 2^(i+1)) us; bucket 0 also has 0
+    uint32_t buckets[TRACE_BUCKETS];
+} trace_hist_t;
+
+void trace_latency(trace_t *tr, trace_hist_t hists[TRACE_NSTAGES]);
@@ -0,0 +1,195 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "uring.h"
+
+static int sys_setup(unsigned entries, struct io_uring_params *p){
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_enter(int fd, unsigned to_submit, unsigned min_complete){
+    return (int)syscall(
+        __NR_io_uring_enter, fd, to_submit, min_complete, 0, NULL, 0
+    );
+}
+
+static int sys_register(int fd, unsigned op, void *arg, unsigned nargs){
+    return (int)syscall(__NR_io_uring_register, fd, op, arg, nargs);
+}
+
+static bool probe_op(int fd, int op){
+    size_t len = sizeof(struct io_uring_probe)
+               + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = calloc(1, len);
+    if(!probe) return false;
+    bool ok = false;
+    if(sys_register(fd, IORING_REGISTER_PROBE, probe, 256) == 0){
+        ok = op <= probe->last_op
+          && (probe->ops[op].flags & IO_URING_OP_SUPPORTED);
+    }
+    free(probe);
+    return ok;
+}
+
+int uring_init(uring_t *u, unsigned entries, unsigned nbufs, size_t buf_size){
+    *u = (uring_t){ .fd = -1 };
+
+    struct io_uring_params p = {0};
+    u->fd = sys_setup(entries, &p);
+    if(u->fd < 0) return -1;
+    if(!(p.features & IORING_FEAT_SINGLE_MMAP)){
+        // (linux 5.4) not worth supporting the older layout
+        errno = ENOSYS;
+        goto fail;
+    }
+
+    u->sq_map_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    size_t cq_len = p.cq_off.cqes
+                  + p.cq_entries * sizeof(struct io_uring_cqe);
+    if(cq_len > u->sq_map_len) u->sq_map_len = cq_len;
+    u->sq_map = mmap(
+        NULL, u->sq_map_len, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING
+    );
+    if(u->sq_map == MAP_FAILED){
+        u->sq_map = NULL;
+        goto fail;
+    }
+    // with a single mmap, the cq ring is the same mapping
+    u->cq_map = u->sq_map;
+
+    u->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    u->sqes = mmap(
+        NULL, u->sqes_len, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES
+    );
+    if(u->sqes == MAP_FAILED){
+        u->sqes = NULL;
+        goto fail;
+    }
+
+    char *sq = u->sq_map;
+    u->sq_head = (unsigned*)(sq + p.sq_off.head);
+    u->sq_tail = (unsigned*)(sq + p.sq_off.tail);
+    u->sq_mask = *(unsigned*)(sq + p.sq_off.ring_mask);
+    u->sq_array = (unsigned*)(sq + p.sq_off.array);
+    u->sq_entries = p.sq_entries;
+
+    char *cq = u->cq_map;
+    u->cq_head = (unsigned*)(cq + p.cq_off.head);
+    u->cq_tail = (unsigned*)(cq + p.cq_off.tail);
+    u->cq_mask = *(unsigned*)(cq + p.cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+
+    // the provided buffer ring, and the buffers themselves
+    u->nbufs = nbufs;
+    u->buf_size = buf_size;
+    u->br_len = nbufs * sizeof(struct io_uring_buf);
+    u->br = mmap(
+        NULL, u->br_len, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0
+    );
+    if(u->br == MAP_FAILED){
+        u->br = NULL;
+        goto fail;
+    }
+    u->bufs = malloc(nbufs * buf_size);
+    if(!u->bufs) goto fail;
+
+    struct io_uring_buf_reg reg = {
+        .ring_addr = (uint64_t)(uintptr_t)u->br,
+        .ring_entries = nbufs,
+        .bgid = URING_BGID,
+    };
+    if(sys_register(u->fd, IORING_REGISTER_PBUF_RING, &reg, 1)) goto fail;
+    for(unsigned i = 0; i < nbufs; i++) uring_buf_return(u, i);
+
+    u->read_multishot = probe_op(u->fd, URING_OP_READ_MULTISHOT);
+
+    return 0;
+
+fail:
+    {
+        int err = errno;
+        uring_exit(u);
+        errno = err;
+    }
+    return -1;
+}
+
+void uring_exit(uring_t *u){
+    if(u->sqes) munmap(u->sqes, u->sqes_len);
+    if(u->sq_map) munmap(u->sq_map, u->sq_map_len);
+    if(u->br) munmap(u->br, u->br_len);
+    free(u->bufs);
+    if(u->fd >= 0) close(u->fd);
+    *u = (uring_t){ .fd = -1 };
+}
+
+static unsigned sq_pending(uring_t *u){
+    return *u->sq_tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+}
+
+struct io_uring_sqe *uring_sqe(uring_t *u){
+    if(sq_pending(u) + u->sq_queued == u->sq_entries){
+        // full; the kernel consumes sqes as soon as they are submitted
+        uring_submit(u);
+        if(sq_pending(u) == u->sq_entries) return NULL;
+    }
+    unsigned idx = (*u->sq_tail + u->sq_queued) & u->sq_mask;
+    struct io_uring_sqe *sqe = &u->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    u->sq_array[idx] = idx;
+    u->sq_queued++;
+    return sqe;
+}
+
+int uring_submit(uring_t *u){
+    if(u->sq_queued){
+        __atomic_store_n(
+            u->sq_tail, *u->sq_tail + u->sq_queued, __ATOMIC_RELEASE
+        );
+        u->sq_queued = 0;
+    }
+    unsigned n;
+    while((n = sq_pending(u))){
+        u->enters++;
+        int ret = sys_enter(u->fd, n, 0);
+        if(ret < 0){
+            if(errno == EINTR) continue;
+            // the cq is backed up; the rest go out next time
+            if(errno == EAGAIN || errno == EBUSY) return 0;
+            return -1;
+        }
+        if(!ret) return 0;
+    }
+    return 0;
+}
+
+struct io_uring_cqe *uring_peek(uring_t *u){
+    unsigned head = *u->cq_head;
+    if(head == __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE)) return NULL;
+    return &u->cqes[head & u->cq_mask];
+}
+
+void uring_seen(uring_t *u){
+    __atomic_store_n(u->cq_head, *u->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+char *uring_buf(uring_t *u, unsigned bid){
+    return u->bufs + (size_t)bid * u->buf_size;
+}
+
+void uring_buf_return(uring_t *u, unsigned bid){
+    unsigned short tail = u->br->tail;
+    struct io_uring_buf *buf = &u->br->bufs[tail & (u->nbufs - 1)];
+    buf->addr = (uint64_t)(uintptr_t)uring_buf(u, bid);
+    buf->len = (uint32_t)u->buf_size;
+    buf->bid = (uint16_t)bid;
+    unsigned short next = tail + 1;
+    __atomic_store_n(&u->br->tail, next, __ATOMIC_RELEASE);
+}
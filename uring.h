@@ -0,0 +1,75 @@
+// A minimal io_uring wrapper over the raw syscalls, so there is no liburing
+// dependency.  Just enough for loop.c: one ring, and one group of provided
+// buffers for reads to land in.
+//
+// uring_t u;
+// if(uring_init(&u, 4096, 256, 16384)) ...  // unavailable; use epoll
+// struct io_uring_sqe *sqe = uring_sqe(&u);  // fill it in
+// uring_submit(&u);
+// for(struct io_uring_cqe *cqe; (cqe = uring_peek(&u)); uring_seen(&u)) ...
+// uring_exit(&u);
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <linux/io_uring.h>
+
+// newer than some installed headers (linux 6.7)
+#define URING_OP_READ_MULTISHOT 49
+
+// the buffer group for uring_t's provided buffers
+#define URING_BGID 0
+
+typedef struct {
+    int fd;
+
+    // submission queue
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned sq_mask;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned sq_entries;
+    unsigned sq_queued; // filled in, but not yet submitted
+
+    // completion queue
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe *cqes;
+
+    void *sq_map;
+    size_t sq_map_len;
+    void *cq_map;
+    size_t cq_map_len;
+    size_t sqes_len;
+
+    // provided buffers, for IOSQE_BUFFER_SELECT reads
+    struct io_uring_buf_ring *br;
+    size_t br_len;
+    unsigned nbufs;
+    size_t buf_size;
+    char *bufs;
+
+    bool read_multishot; // does the kernel have URING_OP_READ_MULTISHOT?
+    uint64_t enters; // io_uring_enter() syscalls
+} uring_t;
+
+/* nbufs must be a power of two; returns 0, or -1 with errno set if io_uring
+   (with provided buffer rings, linux 5.19) isn't available */
+int uring_init(uring_t *u, unsigned entries, unsigned nbufs, size_t buf_size);
+void uring_exit(uring_t *u);
+
+/* a zeroed sqe; submits to make room if the queue is full, and returns NULL
+   only if the kernel won't take any more until completions are reaped */
+struct io_uring_sqe *uring_sqe(uring_t *u);
+// submit everything queued; returns 0, or -1 with errno set
+int uring_submit(uring_t *u);
+
+// NULL when there are no completions
+struct io_uring_cqe *uring_peek(uring_t *u);
+void uring_seen(uring_t *u);
+
+// the provided buffer a read completed into, and handing it back afterwards
+char *uring_buf(uring_t *u, unsigned bid);
+void uring_buf_return(uring_t *u, unsigned bid);
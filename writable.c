@@ -1,20 +1,51 @@
+#include <errno.h>
+#include <limits.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <sys/uio.h>
 
 #include "writable.h"
 
-static void writable_add_link(struct writable *w, struct writable_heap *link){
-    if(w->list == NULL){
-        w->list = link;
-        link->next = link;
-        link->prev = link;
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+static struct writable_chunk *chunk_get(struct writable *w){
+    struct writable_chunk *chunk = w->pool;
+    if(chunk){
+        w->pool = chunk->next;
+        w->npool--;
     }else{
-        link->next = w->list;
-        link->prev = w->list->prev;
-        link->next->prev = link;
-        link->prev->next = link;
+        chunk = malloc(sizeof(*chunk));
+        if(!chunk){
+            fprintf(stderr, "malloc failed\n");
+            exit(1);
+        }
+        w->stats.chunk_allocs++;
     }
+    chunk->next = NULL;
+    chunk->start = 0;
+    chunk->end = 0;
+    return chunk;
+}
+
+static void chunk_put(struct writable *w, struct writable_chunk *chunk){
+    if(w->npool >= WRITABLE_POOL_MAX){
+        free(chunk);
+        return;
+    }
+    chunk->next = w->pool;
+    w->pool = chunk;
+    w->npool++;
+}
+
+// drop the head chunk, which must be fully written
+static void chain_pop(struct writable *w){
+    struct writable_chunk *chunk = w->head;
+    w->head = chunk->next;
+    if(!w->head) w->tail = NULL;
+    chunk_put(w, chunk);
 }
 
 // add to the ring buffer (must already fit in ring buffer)
@@ -32,19 +63,27 @@ static void writable_add_ring(struct writable *w, const char *s, size_t n){
     w->end = (w->end + n) % sizeof(w->ring);
 }
 
-// add to the writable heap linked list, any length is allowed
-static void writable_add_heap(struct writable *w, const char *s, size_t n){
-    struct writable_heap *link = malloc(sizeof(*link) + n);
-    if(!link){
-        fprintf(stderr, "malloc failed\n");
-        exit(1);
+// add to the chain, filling the tail chunk before starting new ones
+static void writable_add_chain(struct writable *w, const char *s, size_t n){
+    w->chained += n;
+    while(n){
+        struct writable_chunk *tail = w->tail;
+        if(!tail || tail->end == WRITABLE_CHUNK){
+            tail = chunk_get(w);
+            if(w->tail){
+                w->tail->next = tail;
+            }else{
+                w->head = tail;
+            }
+            w->tail = tail;
+        }
+        size_t space = WRITABLE_CHUNK - tail->end;
+        size_t cp = n < space ? n : space;
+        memcpy(&tail->data[tail->end], s, cp);
+        tail->end += cp;
+        s += cp;
+        n -= cp;
     }
-    link->written = 0;
-    link->len = n;
-    link->next = link;
-    link->prev = link;
-    memcpy(link->data, s, n);
-    writable_add_link(w, link);
 }
 
 // get the length of the ring buffer (just the ring, not the whole thing)
@@ -54,20 +93,9 @@ static inline size_t writable_ring_len(struct writable *w){
 
 // all bytes are returnable until the next call; this is for "the next call"
 static void drop_returnable(struct writable *w){
-    if(w->returnable == RETURNABLE_HEAP){
-        struct writable_heap *link = w->list;
-        // are we done with this link?
-        if(link->written == link->len){
-            // was this the last link?
-            if(link->next == link){
-                w->list = NULL;
-            }else{
-                w->list = link->next;
-                link->next->prev = link->prev;
-                link->prev->next = link->next;
-            }
-            free(link);
-        }
+    if(w->returnable == RETURNABLE_CHAIN){
+        // are we done with this chunk?
+        if(w->head->start == w->head->end) chain_pop(w);
     }
 
     w->returnable = RETURNABLE_NONE;
@@ -77,24 +105,47 @@ static void drop_returnable(struct writable *w){
 void writable_add_bytes(struct writable *w, const char *s, size_t n){
     drop_returnable(w);
 
-    // if there is already a heap, we just pile onto it
-    if(w->list != NULL){
-        writable_add_heap(w, s, n);
+    w->stats.bytes_added += n;
+
+    // if there is already a chain, we just pile onto it
+    if(w->head != NULL){
+        writable_add_chain(w, s, n);
     }else{
         // see how much of the buffer fits in the ring
         size_t ringable = sizeof(w->ring) - writable_ring_len(w) - 1;
         if(!ringable){
             // none of it fits
-            writable_add_heap(w, s, n);
+            writable_add_chain(w, s, n);
         }else if(n > ringable){
             // some of it fits
             writable_add_ring(w, s, ringable);
-            writable_add_heap(w, &s[ringable], n - ringable);
+            writable_add_chain(w, &s[ringable], n - ringable);
         }else{
             // all of it fits
             writable_add_ring(w, s, n);
         }
     }
+
+    size_t len = writable_ring_len(w) + w->chained;
+    if(len > w->stats.max_len) w->stats.max_len = len;
+}
+
+/* like writable_add_bytes, but each \r becomes \r\n; the stretches between
+   \r's are found with memchr() (vectorized in any decent libc) and added
+   as-is, so there is no per-byte loop and no intermediate copy */
+void writable_add_crlf(struct writable *w, const char *s, size_t n){
+    const char *end = s + n;
+    while(s < end){
+        const char *cr = memchr(s, '\r', (size_t)(end - s));
+        if(!cr){
+            writable_add_bytes(w, s, (size_t)(end - s));
+            return;
+        }
+        // include the \r itself, then splice in the \n
+        writable_add_bytes(w, s, (size_t)(cr - s) + 1);
+        writable_add_bytes(w, "\n", 1);
+        s = cr + 1;
+    }
 }
 
 // get a byte to write, there must be a writable character
@@ -107,9 +158,10 @@ char writable_get_char(struct writable *w){
         w->start = (w->start + 1) % sizeof(w->ring);
         w->returnable = RETURNABLE_RING;
     }else{
-        struct writable_heap *link = w->list;
-        out = link->data[link->written++];
-        w->returnable = RETURNABLE_HEAP;
+        struct writable_chunk *chunk = w->head;
+        out = chunk->data[chunk->start++];
+        w->chained--;
+        w->returnable = RETURNABLE_CHAIN;
     }
     return out;
 }
@@ -117,7 +169,13 @@ char writable_get_char(struct writable *w){
 bool writable_nonempty(struct writable *w){
     drop_returnable(w);
 
-    return w->list || writable_ring_len(w);
+    return w->head || writable_ring_len(w);
+}
+
+size_t writable_len(struct writable *w){
+    drop_returnable(w);
+
+    return writable_ring_len(w) + w->chained;
 }
 
 const char *writable_get_string(struct writable *w, size_t *n){
@@ -137,13 +195,14 @@ const char *writable_get_string(struct writable *w, size_t *n){
         }
         w->start = (w->start + len) % sizeof(w->ring);
         w->returnable = RETURNABLE_RING;
-    }else if(w->list){
-        struct writable_heap *link = w->list;
-        out = &link->data[link->written];
-        len = link->len - link->written;
+    }else if(w->head){
+        struct writable_chunk *chunk = w->head;
+        out = &chunk->data[chunk->start];
+        len = chunk->end - chunk->start;
         // that's all there is
-        link->written = link->len;
-        w->returnable = RETURNABLE_HEAP;
+        chunk->start = chunk->end;
+        w->chained -= len;
+        w->returnable = RETURNABLE_CHAIN;
     }
 
     *n = len;
@@ -158,10 +217,100 @@ void writable_return_bytes(struct writable *w, size_t unneeded){
         case RETURNABLE_RING:
             w->start = (w->start - unneeded) % sizeof(w->ring);
             break;
-        case RETURNABLE_HEAP:
-            w->list->written -= unneeded;
+        case RETURNABLE_CHAIN:
+            w->head->start -= unneeded;
+            w->chained += unneeded;
             break;
     }
 
     w->returnable = RETURNABLE_NONE;
 }
+
+// mark n bytes as written, from the front
+static void writable_consume(struct writable *w, size_t n){
+    size_t ring_len = writable_ring_len(w);
+    size_t from_ring = n < ring_len ? n : ring_len;
+    w->start = (w->start + from_ring) % sizeof(w->ring);
+    n -= from_ring;
+
+    w->chained -= n;
+    while(n){
+        struct writable_chunk *chunk = w->head;
+        size_t avail = chunk->end - chunk->start;
+        size_t used = n < avail ? n : avail;
+        chunk->start += used;
+        n -= used;
+        if(chunk->start == chunk->end) chain_pop(w);
+    }
+}
+
+int writable_iov(struct writable *w, struct iovec *iov, int max){
+    drop_returnable(w);
+
+    int niov = 0;
+    if(writable_ring_len(w) && niov < max){
+        if(w->start > w->end){
+            // the ring wraps, so it takes two segments
+            iov[niov++] = (struct iovec){
+                &w->ring[w->start], sizeof(w->ring) - w->start
+            };
+            if(w->end && niov < max){
+                iov[niov++] = (struct iovec){ w->ring, w->end };
+            }
+        }else{
+            iov[niov++] = (struct iovec){
+                &w->ring[w->start], w->end - w->start
+            };
+        }
+    }
+    struct writable_chunk *chunk = w->head;
+    for(; chunk && niov < max; chunk = chunk->next){
+        iov[niov++] = (struct iovec){
+            &chunk->data[chunk->start], chunk->end - chunk->start
+        };
+    }
+    return niov;
+}
+
+void writable_wrote(struct writable *w, size_t n, int niov){
+    w->stats.writes++;
+    w->stats.segments += niov;
+    w->stats.bytes_written += n;
+    writable_consume(w, n);
+}
+
+ssize_t writable_writev(struct writable *w, int fd){
+    struct iovec iov[IOV_MAX];
+    int niov = writable_iov(w, iov, IOV_MAX);
+    if(!niov) return 0;
+
+    ssize_t ret = writev(fd, iov, niov);
+    if(ret < 0) return ret;
+
+    writable_wrote(w, (size_t)ret, niov);
+    return ret;
+}
+
+void writable_drop(struct writable *w){
+    w->returnable = RETURNABLE_NONE;
+    w->start = 0;
+    w->end = 0;
+    while(w->head) chain_pop(w);
+    w->chained = 0;
+}
+
+void writable_free(struct writable *w){
+    while(w->head){
+        struct writable_chunk *chunk = w->head;
+        w->head = chunk->next;
+        free(chunk);
+    }
+    w->tail = NULL;
+    w->chained = 0;
+    while(w->pool){
+        struct writable_chunk *chunk = w->pool;
+        w->pool = chunk->next;
+        free(chunk);
+    }
+    w->npool = 0;
+}
@@ -1,35 +1,64 @@
 #include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
 
-struct writable_heap;
+// bytes of data in each chunk of the overflow chain
+#define WRITABLE_CHUNK 16384
+// how many drained chunks to keep around for reuse (1 MiB)
+#define WRITABLE_POOL_MAX 64
 
-struct writable_heap {
-    struct writable_heap *next;
-    struct writable_heap *prev;
-    // how much is there to write?
-    size_t len;
-    // how much has already been written?
-    size_t written;
-    char data[0];
+struct writable_chunk;
+
+struct writable_chunk {
+    struct writable_chunk *next;
+    // data[start:end] is what remains to be written
+    size_t start;
+    size_t end;
+    char data[WRITABLE_CHUNK];
+};
+
+struct writable_stats {
+    uint64_t bytes_added;
+    uint64_t bytes_written; // only counts writable_writev()
+    uint64_t writes;        // writev() syscalls
+    uint64_t segments;      // iovecs passed to writev()
+    uint64_t chunk_allocs;  // chunks which had to be malloc'd
+    size_t max_len;         // the most bytes ever waiting at once
 };
 
 struct writable {
     char ring[16384];
     size_t start;
     size_t end;
-    // list points to first link in list (or NULL)
-    struct writable_heap *list;
+    /* once the ring is full, bytes go into a chain of chunks, oldest first
+       (head is NULL when the chain is empty) */
+    struct writable_chunk *head;
+    struct writable_chunk *tail;
+    // bytes in the chain
+    size_t chained;
+    // drained chunks, ready for reuse
+    struct writable_chunk *pool;
+    size_t npool;
+    struct writable_stats stats;
     enum {
         RETURNABLE_NONE,
         RETURNABLE_RING,
-        RETURNABLE_HEAP,
+        RETURNABLE_CHAIN,
     } returnable;
 };
 
 // add some bytes to what's writable, and sort out where they need to go
 void writable_add_bytes(struct writable *w, const char *s, size_t n);
 
+// the same, but translating \r to \r\n
+void writable_add_crlf(struct writable *w, const char *s, size_t n);
+
 bool writable_nonempty(struct writable *w);
 
+// how many bytes are waiting to be written
+size_t writable_len(struct writable *w);
+
 // get a byte to write, there must be a writable character
 char writable_get_char(struct writable *w);
 
@@ -40,3 +69,19 @@ const char *writable_get_string(struct writable *w, size_t *n);
 // after writable_get_char(), ensure that unneeded == 1
 // after writable_get_string(), ensure that 0 < unneeded <= n
 void writable_return_bytes(struct writable *w, size_t unneeded);
+
+/* write as much as possible to fd with a single writev() of up to IOV_MAX
+   segments; returns what writev() returned (0 if there was nothing to do) */
+ssize_t writable_writev(struct writable *w, int fd);
+
+/* for doing the writev() some other way (like io_uring): fill in up to max
+   segments of what is queued, and after writing, report how it went.  The
+   segments stay valid until writable_wrote(), even if more is added. */
+int writable_iov(struct writable *w, struct iovec *iov, int max);
+void writable_wrote(struct writable *w, size_t n, int niov);
+
+// forget everything queued (for when fd is gone), keeping the pool
+void writable_drop(struct writable *w);
+
+// free the chain and the pool
+void writable_free(struct writable *w);